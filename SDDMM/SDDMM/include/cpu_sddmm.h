@@ -0,0 +1,47 @@
+#ifndef CPU_SDDMM_H
+#define CPU_SDDMM_H
+#include <assert.h>
+#include <cstdint>
+
+// CPU reference of the quantized SDDMM on the aligned (begin, end) row offsets.
+// Offsets into the dense operands and the output are computed in 64-bit.
+template <typename IndexType>
+double Host_sddmm_integers(const int *lhs_matrix, const int *rhs_matrix, int *ref_C, int64_t M_GLOBAL, int64_t K_GLOBAL, int64_t N_GLOBAL, int preA, int preB, int vec_length, const IndexType *row_offsets, const IndexType *col_indices, int64_t m_vec, int alignment){
+
+    int maskA = (1 << preA) - 1; //0b0000000011111111 for 8 bits
+    int maskB = (1 << preB) - 1; //0b0000000011111111 for 8 bits
+    int a_tiles = 32 / preA;
+    int b_tiles = 32 / preB;
+
+    double flops = 0;
+    // Loop over all the rows
+    for (int64_t i = 0; i < m_vec; i++){
+        // Loop over all the nonzero columns of the column
+        for (int64_t j = row_offsets[i*2]; j < row_offsets[i*2+1]; j++){
+            // Loop over all the values in the vector
+            for (int v = 0; v < vec_length; v++){
+                int accumulator = 0;
+                int64_t idx_m = i * vec_length + v;
+                int64_t idx_n = col_indices[j];
+  
+	        assert(a_tiles == b_tiles);
+                for (int64_t l=0; l<K_GLOBAL; l+=a_tiles){
+		    int a_tile = lhs_matrix[idx_m*K_GLOBAL/a_tiles + l/a_tiles];
+		    int b_tile = rhs_matrix[idx_n*K_GLOBAL/b_tiles + l/b_tiles];
+                    for(int at=0; at < a_tiles; at++){
+	            	int shift = at*preA;
+                        int a_val = ((maskA << shift) & a_tile) >> shift;
+                        int b_val = ((maskB << shift) & b_tile) >> shift;
+			accumulator += (a_val*b_val); 
+                        flops += 2.0;
+	            }
+                }
+                // Write the output
+                ref_C[(j/alignment)*alignment*vec_length + alignment*v + j%alignment] = accumulator;
+            }
+        }
+    }
+    return flops;
+}
+
+#endif
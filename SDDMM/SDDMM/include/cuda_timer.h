@@ -0,0 +1,113 @@
+#ifndef CUDA_TIMER_H
+#define CUDA_TIMER_H
+#include <cuda_runtime.h>
+#include <vector>
+#include "timer.h"
+
+// Pre-allocated pairs of cuda events. All pairs of a batch are recorded
+// back to back and read after a single synchronization, so no event is
+// created or destroyed inside the timing loop.
+class CudaEventPool{
+public:
+    explicit CudaEventPool(int capacity): used_(0){
+        Grow(capacity);
+    }
+    ~CudaEventPool(){
+        for(size_t i = 0; i < start_.size(); i++){
+            cudaEventDestroy(start_[i]);
+            cudaEventDestroy(end_[i]);
+        }
+    }
+
+    // Start a new batch
+    void Reset(){ used_ = 0; }
+
+    void Start(cudaStream_t stream = 0){
+        if(used_ == static_cast<int>(start_.size())) Grow(start_.size() * 2);
+        cudaEventRecord(start_[used_], stream);
+    }
+    void Stop(cudaStream_t stream = 0){
+        cudaEventRecord(end_[used_], stream);
+        used_++;
+    }
+
+    // Wait for the batch and append the elapsed time of every pair in ms
+    void Collect(std::vector<double> &samples){
+        if(used_ == 0) return;
+        cudaEventSynchronize(end_[used_ - 1]);
+        for(int i = 0; i < used_; i++){
+            float ms = 0;
+            cudaEventElapsedTime(&ms, start_[i], end_[i]);
+            samples.push_back(ms);
+        }
+        used_ = 0;
+    }
+
+private:
+    void Grow(size_t capacity){
+        while(start_.size() < capacity){
+            cudaEvent_t start, end;
+            cudaEventCreate(&start);
+            cudaEventCreate(&end);
+            start_.push_back(start);
+            end_.push_back(end);
+        }
+    }
+
+    std::vector<cudaEvent_t> start_;
+    std::vector<cudaEvent_t> end_;
+    int used_;
+
+    CudaEventPool(const CudaEventPool &);
+    CudaEventPool &operator=(const CudaEventPool &);
+};
+
+// Evicts the L2 cache by writing a buffer twice its size
+class L2Flusher{
+public:
+    L2Flusher(): buffer_(NULL), bytes_(0){
+        int device = 0;
+        cudaDeviceProp prop;
+        cudaGetDevice(&device);
+        cudaGetDeviceProperties(&prop, device);
+        bytes_ = static_cast<size_t>(prop.l2CacheSize) * 2;
+        if(bytes_ > 0) cudaMalloc(&buffer_, bytes_);
+    }
+    ~L2Flusher(){
+        if(buffer_ != NULL) cudaFree(buffer_);
+    }
+    void Flush(cudaStream_t stream = 0){
+        if(buffer_ != NULL) cudaMemsetAsync(buffer_, 0, bytes_, stream);
+    }
+
+private:
+    void *buffer_;
+    size_t bytes_;
+
+    L2Flusher(const L2Flusher &);
+    L2Flusher &operator=(const L2Flusher &);
+};
+
+// Time a kernel launch. Samples are in ms; with flush_cache set the L2 is
+// flushed outside the timed region before every iteration.
+template <typename Launch>
+TimingStats TimeDevice(const TimingOptions &options, Launch launch, std::vector<double> &samples,
+                       cudaStream_t stream = 0){
+    for(int i = 0; i < options.warmup; i++) launch();
+    CudaEventPool pool(options.min_iters > 0 ? options.min_iters : 1);
+    L2Flusher *flusher = options.flush_cache ? new L2Flusher() : NULL;
+    TimingStats stats = RunTimed(options, [&](int iters, std::vector<double> &out){
+        pool.Reset();
+        for(int i = 0; i < iters; i++){
+            if(flusher != NULL) flusher->Flush(stream);
+            pool.Start(stream);
+            launch();
+            pool.Stop(stream);
+        }
+        pool.Collect(out);
+    }, samples);
+    delete flusher;
+    return stats;
+}
+
+#endif
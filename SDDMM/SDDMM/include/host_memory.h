@@ -0,0 +1,114 @@
+#ifndef HOST_MEMORY_H
+#define HOST_MEMORY_H
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+// Accounting of the large host buffers of the benchmark drivers. Buffers are
+// allocated through HostArray, which reports its size to HostMemory; the
+// driver names its stages with HostMemory::SetStage and prints the peak of
+// the whole run and of every stage at the end.
+
+class HostMemory{
+public:
+    static HostMemory &Get(){
+        static HostMemory memory;
+        return memory;
+    }
+
+    void Add(int64_t bytes){
+        const int64_t current = current_ += bytes;
+        UpdateMax(peak_, current);
+        UpdateMax(stage_peak_, current);
+    }
+    void Remove(int64_t bytes){ current_ -= bytes; }
+
+    int64_t current() const { return current_; }
+    int64_t peak() const { return peak_; }
+
+    // Close the current stage and open the next one
+    void SetStage(const char *name){
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(stage_ != NULL) stages_.push_back(std::make_pair(std::string(stage_), static_cast<int64_t>(stage_peak_)));
+        stage_ = name;
+        stage_peak_ = static_cast<int64_t>(current_);
+    }
+
+    void Print(FILE *out){
+        SetStage(NULL);
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        fprintf(out, "host memory peak %.2f MB tracked, %.2f MB resident\n", peak_ / 1048576.0,
+                usage.ru_maxrss / 1024.0);
+        for(size_t i = 0; i < stages_.size(); i++)
+            fprintf(out, "  %-20s %10.2f MB\n", stages_[i].first.c_str(), stages_[i].second / 1048576.0);
+        stages_.clear();
+    }
+
+private:
+    HostMemory(): current_(0), peak_(0), stage_peak_(0), stage_(NULL) {}
+
+    static void UpdateMax(std::atomic<int64_t> &target, int64_t value){
+        int64_t seen = target;
+        while(value > seen && !target.compare_exchange_weak(seen, value)) {}
+    }
+
+    std::atomic<int64_t> current_;
+    std::atomic<int64_t> peak_;
+    std::atomic<int64_t> stage_peak_;
+    const char *stage_;
+    std::vector<std::pair<std::string, int64_t> > stages_;
+    std::mutex mutex_;
+};
+
+// Owning array of trivially copyable T, counted by HostMemory. reset() frees
+// the buffer early, as soon as the driver has consumed it.
+template <typename T>
+class HostArray{
+public:
+    HostArray(): data_(NULL), size_(0) {}
+    explicit HostArray(int64_t size, bool zero = false): data_(NULL), size_(0){
+        allocate(size, zero);
+    }
+    ~HostArray(){ reset(); }
+
+    void allocate(int64_t size, bool zero = false){
+        reset();
+        const size_t bytes = static_cast<size_t>(size) * sizeof(T);
+        data_ = static_cast<T *>(zero ? calloc(size > 0 ? size : 1, sizeof(T)) : malloc(bytes > 0 ? bytes : 1));
+        if(data_ == NULL){
+            fprintf(stderr, "Host allocation of %zu bytes failed (%.2f MB in use)\n", bytes,
+                    HostMemory::Get().current() / 1048576.0);
+            abort();
+        }
+        size_ = size;
+        HostMemory::Get().Add(bytes);
+    }
+
+    void reset(){
+        if(data_ == NULL) return;
+        free(data_);
+        HostMemory::Get().Remove(static_cast<int64_t>(size_) * sizeof(T));
+        data_ = NULL;
+        size_ = 0;
+    }
+
+    T *get() const { return data_; }
+    int64_t size() const { return size_; }
+    T &operator[](int64_t i) const { return data_[i]; }
+
+private:
+    T *data_;
+    int64_t size_;
+
+    HostArray(const HostArray &);
+    HostArray &operator=(const HostArray &);
+};
+
+#endif
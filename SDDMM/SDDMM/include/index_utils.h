@@ -0,0 +1,56 @@
+#ifndef INDEX_UTILS_H
+#define INDEX_UTILS_H
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <stdio.h>
+
+// Size arithmetic for the host path. All element counts and byte sizes are
+// computed in int64_t; any intermediate that does not fit aborts with the
+// name of the quantity instead of silently wrapping around.
+
+inline void IndexOverflow(const char *what){
+    fprintf(stderr, "Index overflow: %s does not fit the index type\n", what);
+    abort();
+}
+
+inline int64_t CheckedMul(int64_t a, int64_t b, const char *what){
+    int64_t result;
+    if (__builtin_mul_overflow(a, b, &result)) IndexOverflow(what);
+    return result;
+}
+
+inline int64_t CheckedAdd(int64_t a, int64_t b, const char *what){
+    int64_t result;
+    if (__builtin_add_overflow(a, b, &result)) IndexOverflow(what);
+    return result;
+}
+
+// Number of storage words of WordType needed for count items of bits each
+inline int64_t CheckedPackedWords(int64_t count, int bits, int word_bytes, const char *what){
+    int64_t total_bits = CheckedMul(count, bits, what);
+    int64_t word_bits = static_cast<int64_t>(word_bytes) * 8;
+    return (total_bits + word_bits - 1) / word_bits;
+}
+
+// Number of bytes needed for count items of bits each
+inline size_t CheckedPackedBytes(int64_t count, int bits, const char *what){
+    return static_cast<size_t>(CheckedPackedWords(count, bits, 1, what));
+}
+
+// Narrow a 64-bit size to the given index type (e.g. the int offsets used by
+// the device kernels), aborting if it does not fit.
+template <typename IndexType>
+inline IndexType CheckedCast(int64_t value, const char *what){
+    if (value > static_cast<int64_t>(std::numeric_limits<IndexType>::max()) ||
+        value < static_cast<int64_t>(std::numeric_limits<IndexType>::min()))
+        IndexOverflow(what);
+    return static_cast<IndexType>(value);
+}
+
+// Returns true if value can be used as a 32-bit offset by the device kernels
+inline bool FitsDeviceIndex(int64_t value){
+    return value <= static_cast<int64_t>(std::numeric_limits<int>::max());
+}
+
+#endif
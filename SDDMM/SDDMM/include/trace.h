@@ -0,0 +1,148 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdio.h>
+
+// Scoped tracing of the host pipeline stages, written as Chrome trace JSON
+// (chrome://tracing or ui.perfetto.dev). Tracing is off unless the
+// MAGICUBE_TRACE environment variable names the output file; a span then
+// costs a single branch. Span names must be string literals or otherwise
+// outlive the process.
+//
+//   TRACE_SCOPE("pack values");         // until the end of the scope
+//
+//   TraceSpan stage("read matrix");     // a sequence of stages
+//   ...
+//   stage.Next("align rows");
+
+struct TraceEvent{
+    const char *name;
+    double begin_us;
+    double duration_us;
+};
+
+// Events are buffered per thread and written when the process exits
+class Tracer{
+public:
+    static Tracer &Get(){
+        static Tracer tracer;
+        return tracer;
+    }
+
+    bool enabled() const { return enabled_; }
+
+    double NowUs() const {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start_).count();
+    }
+
+    void Record(const char *name, double begin_us, double end_us){
+        ThreadBuffer &buffer = LocalBuffer();
+        TraceEvent event = {name, begin_us, end_us - begin_us};
+        buffer.events.push_back(event);
+    }
+
+    ~Tracer(){ Write(); }
+
+private:
+    struct ThreadBuffer{
+        int tid;
+        std::vector<TraceEvent> events;
+    };
+
+    Tracer(): start_(std::chrono::steady_clock::now()), next_tid_(0){
+        const char *path = getenv("MAGICUBE_TRACE");
+        enabled_ = (path != NULL && path[0] != '\0');
+        if(enabled_) path_ = path;
+    }
+
+    // The buffers are owned by the tracer so they outlive their threads
+    ThreadBuffer &LocalBuffer(){
+        static thread_local ThreadBuffer *local = NULL;
+        if(local == NULL){
+            std::lock_guard<std::mutex> lock(mutex_);
+            buffers_.push_back(std::unique_ptr<ThreadBuffer>(new ThreadBuffer()));
+            local = buffers_.back().get();
+            local->tid = next_tid_++;
+        }
+        return *local;
+    }
+
+    void Write(){
+        if(!enabled_) return;
+        FILE *out = fopen(path_.c_str(), "w");
+        if(out == NULL){
+            fprintf(stderr, "Failed to open trace %s\n", path_.c_str());
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+        bool first = true;
+        for(size_t b = 0; b < buffers_.size(); b++){
+            const ThreadBuffer &buffer = *buffers_[b];
+            for(size_t i = 0; i < buffer.events.size(); i++){
+                const TraceEvent &event = buffer.events[i];
+                fprintf(out, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                        first ? "" : ",\n", event.name, buffer.tid, event.begin_us, event.duration_us);
+                first = false;
+            }
+        }
+        fprintf(out, "\n]}\n");
+        fclose(out);
+    }
+
+    bool enabled_;
+    std::string path_;
+    std::chrono::steady_clock::time_point start_;
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<ThreadBuffer> > buffers_;
+    int next_tid_;
+
+    Tracer(const Tracer &);
+    Tracer &operator=(const Tracer &);
+};
+
+class TraceSpan{
+public:
+    explicit TraceSpan(const char *name): name_(NULL), begin_us_(0){
+        if(Tracer::Get().enabled()) Begin(name);
+    }
+    ~TraceSpan(){ End(); }
+
+    // End this span and start the next stage
+    void Next(const char *name){
+        if(!Tracer::Get().enabled()) return;
+        End();
+        Begin(name);
+    }
+
+    void End(){
+        if(name_ == NULL) return;
+        Tracer::Get().Record(name_, begin_us_, Tracer::Get().NowUs());
+        name_ = NULL;
+    }
+
+private:
+    void Begin(const char *name){
+        name_ = name;
+        begin_us_ = Tracer::Get().NowUs();
+    }
+
+    const char *name_;
+    double begin_us_;
+
+    TraceSpan(const TraceSpan &);
+    TraceSpan &operator=(const TraceSpan &);
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(name)
+
+#endif
@@ -4,6 +4,12 @@
 #include <algorithm>
 #include <stdio.h>
 #include "include/bm_test_utils.h"
+#include "include/index_utils.h"
+#include "include/cpu_sddmm.h"
+#include "include/cuda_timer.h"
+#include "include/trace.h"
+#include "include/verifier.h"
+#include "include/host_memory.h"
 #include "include/cuda_sddmm.cuh"
 #include "include/wmma_sddmm.cuh"
 #include "include/cublas_gemm.cuh"
@@ -14,56 +20,14 @@
 #include <cusparse.h>
 #include <iostream>
 
-int power2n(int n){
-    int exp=1;
-    for(int i=0; i < n; i++)
-        exp *= 2;
-    return exp;
-}
-
-double Host_sddmm_integers(int *lhs_matrix, int *rhs_matrix, int *ref_C, int M_GLOBAL, int K_GLOBAL, int N_GLOBAL, int preA, int preB, int vec_length, int *row_offsets, int *col_indices, int m_vec, int alignment){
-
-    int maskA = (int)(power2n(preA)-1); //0b0000000011111111 for 8 bits
-    int maskB = (int)(power2n(preB)-1); //0b0000000011111111 for 8 bits
-    int a_tiles = 32 / preA;
-    int b_tiles = 32 / preB;
-
-    double flops = 0;
-    // Loop over all the rows
-    for (int i = 0; i < m_vec; i++){
-        // Loop over all the nonzero columns of the column
-        for (int j = row_offsets[i*2]; j < row_offsets[i*2+1]; j++){
-            // Loop over all the values in the vector
-            for (int v = 0; v < vec_length; v++){
-                int accumulator = 0;
-                int idx_m = i * vec_length + v;
-                int idx_n = col_indices[j];
-  
-	        assert(a_tiles == b_tiles);
-                for (int l=0; l<K_GLOBAL; l+=a_tiles){
-		    int a_tile = lhs_matrix[idx_m*K_GLOBAL/a_tiles + l/a_tiles];
-		    int b_tile = rhs_matrix[idx_n*K_GLOBAL/b_tiles + l/b_tiles];
-                    for(int at=0; at < a_tiles; at++){
-	            	int shift = at*preA;
-                        int a_val = ((maskA << shift) & a_tile) >> shift;
-                        int b_val = ((maskB << shift) & b_tile) >> shift;
-			accumulator += (a_val*b_val); 
-                        flops += 2.0;
-	            }
-                }
-                // Write the output
-                ref_C[(j/alignment)*alignment*vec_length + alignment*v + j%alignment] = accumulator;
-            }
-        }
-    }
-    return flops;
-}
-
 // For benchmarking, as a set of sparse matrices are provided
 // The Dim M, N, and number of nonzeros are determined by the benchmark
 void BmFN(std::string benchmark, int dimK, int vec_length, bool sorted, bool func, int sparse, int preA, int preB){
     // The SDDMM is D_MxN = A_MxK * B_KxN o C_MxN
 
+    // Pipeline stages are traced with MAGICUBE_TRACE=trace.json, see include/trace.h
+    TraceSpan stage("read matrix");
+
     // Open the benchmark file
     std::ifstream infile(benchmark, std::ifstream::in);
     std::string line;
@@ -71,50 +35,67 @@ void BmFN(std::string benchmark, int dimK, int vec_length, bool sorted, bool fun
     // get the Size of the benchmark
     std::getline(infile, line, ',');
     const int m_vec = std::stoi(line);
-    const int m = m_vec * vec_length;
+    // All sizes are kept in 64-bit on the host, see include/index_utils.h
+    const int m = CheckedCast<int>(CheckedMul(m_vec, vec_length, "m"), "m");
     std::getline(infile, line, ',');
     const int n = std::stoi(line);
     std::getline(infile, line, '\n');
     const int nonzeros_vec = std::stoi(line);
-    const int nonzeros = nonzeros_vec * vec_length;
+    const int64_t nonzeros = CheckedMul(nonzeros_vec, vec_length, "nonzeros");
     const int k = dimK;
 
     int alignment = 8;
 
-    printf("PreA: %d, PreB: %d, vec_len: %d, M: %d, M_vec: %d, N: %d, nnz: %d, K: %d\n", preA, preB, vec_length, m, m_vec, n, nonzeros, k);
+    printf("PreA: %d, PreB: %d, vec_len: %d, M: %d, M_vec: %d, N: %d, nnz: %lld, K: %d\n", preA, preB, vec_length, m, m_vec, n, (long long)nonzeros, k);
 
     std::default_random_engine generator;
 
     if (sparse){
         // Host
+        // Host buffers are counted by include/host_memory.h and released as
+        // soon as the next stage has consumed them
+        HostMemory::Get().SetStage("read matrix");
         // Step 1: fetch the sparse matrix from benchmark file
-        int *row_offsets = new int[m_vec + 1];
+        HostArray<int> row_offsets(m_vec + 1);
         for (int i = 0; i < m_vec + 1; i ++){
             if (i == m_vec) std::getline(infile, line, '\n');
             else std::getline(infile, line, ' ');
             row_offsets[i] = std::stoi(line);
         }
 
-        int *col_indices = new int[nonzeros_vec];
+        HostArray<int> col_indices(nonzeros_vec);
         for (int i = 0; i < nonzeros_vec; i ++){
             std::getline(infile, line, ' ');
             col_indices[i] = std::stoi(line);
         }
 
-        int *aligned_row_offsets = new int[m_vec*2];
-	int aligned_num_item = 0;
-	aligned_row_offsets[0] = aligned_num_item;
+        stage.Next("pack indices");
+        HostMemory::Get().SetStage("pack indices");
+        HostArray<int> aligned_row_offsets(m_vec*2);
+	int64_t aligned_num_item_64 = 0;
+	aligned_row_offsets[0] = 0;
 	for(int i = 1; i < m_vec + 1; i++){
 	    int num_item = row_offsets[i] - row_offsets[i-1];
             //ceiling
-	    aligned_num_item += (num_item + alignment - 1) / alignment * alignment;
+	    aligned_num_item_64 += (num_item + alignment - 1) / alignment * alignment;
 	    if(i != m_vec)
-	        aligned_row_offsets[i*2] = aligned_num_item;
+	        aligned_row_offsets[i*2] = CheckedCast<int>(aligned_num_item_64, "aligned_num_item");
 	    aligned_row_offsets[i*2-1] = aligned_row_offsets[i*2-2] + num_item;
 	}
+	const int aligned_num_item = CheckedCast<int>(aligned_num_item_64, "aligned_num_item");
+
+        // The kernels index the dense operands and the output with 32-bit offsets
+        const int64_t output_size = CheckedMul(aligned_num_item, vec_length, "output values");
+        const int64_t lhs_words = CheckedPackedWords(CheckedMul(m, k, "m * k"), preA, sizeof(int), "lhs matrix");
+        const int64_t rhs_words = CheckedPackedWords(CheckedMul(n, k, "n * k"), preB, sizeof(int), "rhs matrix");
+        if(!FitsDeviceIndex(output_size) || !FitsDeviceIndex(CheckedMul(lhs_words, sizeof(int), "lhs matrix")) ||
+           !FitsDeviceIndex(CheckedMul(rhs_words, sizeof(int), "rhs matrix"))){
+            printf("Problem size exceeds the 32-bit index range of the device kernels!\n");
+            return;
+        }
 
 	std::cout << " nonzero_vec: " << nonzeros_vec << " aligned_ nonzero_vec: " << aligned_num_item  << "\n" ;
-        int *aligned_col_indices = new int[aligned_num_item];
+        HostArray<int> aligned_col_indices(aligned_num_item);
 	for(int i = 0; i < aligned_num_item; i++){
 	    aligned_col_indices[i] = -1;
 	}
@@ -125,123 +106,92 @@ void BmFN(std::string benchmark, int dimK, int vec_length, bool sorted, bool fun
 	    for(int j = offset_begin; j < offset_end; j++)
 	        aligned_col_indices[aligned_row_offsets[(i-1)*2] + j - offset_begin] = col_indices[j];
 	}
+        col_indices.reset();
 
-	int *lhs_matrix;
-	int *rhs_matrix;
-        lhs_matrix = new int[m*k/(32/preA)];
-        rhs_matrix = new int[n*k/(32/preB)];
-
-        MakeDenseMatrix<int>(m, k/(32/preA), lhs_matrix, generator);
-        MakeDenseMatrix<int>(n, k/(32/preB), rhs_matrix, generator);
+        stage.Next("generate operands");
+        HostMemory::Get().SetStage("generate operands");
+        HostArray<int> lhs_matrix(lhs_words);
+        HostArray<int> rhs_matrix(rhs_words);
 
-        // Step 3: generate the output matrix
-        int *h_output_values = new int[aligned_num_item*vec_length];
-        int *output_values = new int[aligned_num_item*vec_length];
-	for(int i = 0; i < aligned_num_item*vec_length; i++){
-	    h_output_values[i] = 0;
-	    output_values[i] = 0;
-	}
-
-        double flops = 0.0;
-        if (func){
-            // Step 4: Do the SDDMM on host
-            flops = Host_sddmm_integers(lhs_matrix, rhs_matrix, h_output_values, m, k, n, preA, preB, vec_length, aligned_row_offsets, aligned_col_indices, m_vec, alignment);
-	}
+        MakeDenseMatrix<int>(m, k/(32/preA), lhs_matrix.get(), generator);
+        MakeDenseMatrix<int>(n, k/(32/preB), rhs_matrix.get(), generator);
 
         // Device
         int *d_row_offsets, *d_col_indices, *d_row_indices;
         int *d_lhs_matrix, *d_rhs_matrix;
         int *d_output_values;
 
+        stage.Next("device alloc");
         checkCuda(cudaMalloc(&d_row_offsets, (m_vec*2)*sizeof(int)));
         checkCuda(cudaMalloc(&d_col_indices, aligned_num_item*sizeof(int)));
-        checkCuda(cudaMalloc(&d_lhs_matrix, m*k*preA/8));
-        checkCuda(cudaMalloc(&d_rhs_matrix, n*k*preB/8));
-        checkCuda(cudaMalloc(&d_output_values, aligned_num_item*vec_length*sizeof(int)));
+        checkCuda(cudaMalloc(&d_lhs_matrix, lhs_words*sizeof(int)));
+        checkCuda(cudaMalloc(&d_rhs_matrix, rhs_words*sizeof(int)));
+        checkCuda(cudaMalloc(&d_output_values, output_size*sizeof(int)));
         checkCuda(cudaMalloc(&d_row_indices, m_vec * sizeof(int)));
 
-        checkCuda(cudaMemcpy(d_row_offsets, aligned_row_offsets, (m_vec*2)*sizeof(int), cudaMemcpyHostToDevice));
-        checkCuda(cudaMemcpy(d_col_indices, aligned_col_indices, aligned_num_item*sizeof(int), cudaMemcpyHostToDevice));
-        checkCuda(cudaMemcpy(d_lhs_matrix, lhs_matrix, m*k*preA/8, cudaMemcpyHostToDevice));
-        checkCuda(cudaMemcpy(d_rhs_matrix, rhs_matrix, n*k*preB/8, cudaMemcpyHostToDevice));
-        checkCuda(cudaMemcpy(d_output_values, output_values, aligned_num_item*vec_length*sizeof(int), cudaMemcpyHostToDevice));
+        // The output is zeroed on the device, no host staging copy is needed
+        stage.Next("copy to device");
+        HostMemory::Get().SetStage("copy to device");
+        checkCuda(cudaMemcpy(d_row_offsets, aligned_row_offsets.get(), (m_vec*2)*sizeof(int), cudaMemcpyHostToDevice));
+        checkCuda(cudaMemcpy(d_col_indices, aligned_col_indices.get(), aligned_num_item*sizeof(int), cudaMemcpyHostToDevice));
+        checkCuda(cudaMemcpy(d_lhs_matrix, lhs_matrix.get(), lhs_words*sizeof(int), cudaMemcpyHostToDevice));
+        checkCuda(cudaMemcpy(d_rhs_matrix, rhs_matrix.get(), rhs_words*sizeof(int), cudaMemcpyHostToDevice));
+        checkCuda(cudaMemset(d_output_values, 0, output_size*sizeof(int)));
+
+        stage.Next("row swizzle");
+        HostMemory::Get().SetStage("row swizzle");
+        {
+            HostArray<int> row_indices(m_vec);
+            if (sorted) {
+                //printf("Sort CSR based on row length\n");
+                SortedRowSwizzle(m_vec, row_offsets.get(), row_indices.get());
+            }
+            else{
+                //printf("Process the rows in order\n");
+                IdentityRowSwizzle(m_vec, row_indices.get());
+            }
 
-        int *row_indices = new int[m_vec];
-        if (sorted) {
-            //printf("Sort CSR based on row length\n");
-            SortedRowSwizzle(m_vec, row_offsets, row_indices);
-        }
-        else{
-            //printf("Process the rows in order\n");
-            IdentityRowSwizzle(m_vec, row_indices);
+            checkCuda(cudaMemcpy(d_row_indices, row_indices.get(), m_vec * sizeof(int), cudaMemcpyHostToDevice));
         }
+        row_offsets.reset();
 
-        checkCuda(cudaMemcpy(d_row_indices, row_indices, m_vec * sizeof(int), cudaMemcpyHostToDevice));
+        // The reference reuses the host copies of the operands, which are
+        // released as soon as it is done
+        stage.Next("reference sddmm");
+        HostMemory::Get().SetStage("reference sddmm");
+        HostArray<int> h_output_values;
+        double flops = 0.0;
+        if (func){
+            // Step 4: Do the SDDMM on host
+            h_output_values.allocate(output_size, true);
+            flops = Host_sddmm_integers<int>(lhs_matrix.get(), rhs_matrix.get(), h_output_values.get(), m, k, n, preA, preB, vec_length, aligned_row_offsets.get(), aligned_col_indices.get(), m_vec, alignment);
+	}
+        lhs_matrix.reset();
+        rhs_matrix.reset();
+        aligned_row_offsets.reset();
+        aligned_col_indices.reset();
 
+        stage.Next("kernel loop");
+        HostMemory::Get().SetStage("kernel loop");
         cudaProfilerStart();
         int NUM_PROFILES = 512;
-        float sddmm_ms_avg = 0.0f;
-        // TODO: Launch kernel
+        std::vector<double> sddmm_samples;
+        TimingStats sddmm_stats = ComputeTimingStats(sddmm_samples);
         if (preA == 4 && preB == 4){
             printf("Using WMMA \n");
-            for(int iter=0; iter<32; ++iter){
-                sddmm::wmmaSddmm_4b(m_vec, k, n, d_row_indices, d_row_offsets, d_col_indices, d_lhs_matrix, d_rhs_matrix, d_output_values, vec_length);
-            }
-            for(int iter=0; iter<NUM_PROFILES; ++iter){
-                float sddmm_ms = 0.0f;
-                cudaEvent_t sddmm_start;
-                cudaEvent_t sddmm_end;
-                cudaEventCreate(&sddmm_start);
-                cudaEventCreate(&sddmm_end);
-                cudaEventRecord(sddmm_start);
+            sddmm_stats = TimeDevice(FixedTimingOptions(32, NUM_PROFILES), [&](){
                 sddmm::wmmaSddmm_4b(m_vec, k, n, d_row_indices, d_row_offsets, d_col_indices, d_lhs_matrix, d_rhs_matrix, d_output_values, vec_length);
-                cudaEventRecord(sddmm_end);
-                cudaEventSynchronize(sddmm_end);
-                cudaEventElapsedTime(&sddmm_ms, sddmm_start, sddmm_end);
-                cudaEventDestroy(sddmm_start);
-                cudaEventDestroy(sddmm_end);
-                sddmm_ms_avg += sddmm_ms;
-            }
+            }, sddmm_samples);
         }
 	else if (preA == 8 && preB == 8){
-            for(int iter=0; iter<32; ++iter){
-                sddmm::wmmaSddmm_8b(m_vec, k, n, d_row_indices, d_row_offsets, d_col_indices, d_lhs_matrix, d_rhs_matrix, d_output_values, vec_length);
-            }
-            for(int iter=0; iter<NUM_PROFILES; ++iter){
-                float sddmm_ms = 0.0f;
-                cudaEvent_t sddmm_start;
-                cudaEvent_t sddmm_end;
-                cudaEventCreate(&sddmm_start);
-                cudaEventCreate(&sddmm_end);
-                cudaEventRecord(sddmm_start);
+            sddmm_stats = TimeDevice(FixedTimingOptions(32, NUM_PROFILES), [&](){
                 sddmm::wmmaSddmm_8b(m_vec, k, n, d_row_indices, d_row_offsets, d_col_indices, d_lhs_matrix, d_rhs_matrix, d_output_values, vec_length);
-                cudaEventRecord(sddmm_end);
-                cudaEventSynchronize(sddmm_end);
-                cudaEventElapsedTime(&sddmm_ms, sddmm_start, sddmm_end);
-                cudaEventDestroy(sddmm_start);
-                cudaEventDestroy(sddmm_end);
-                sddmm_ms_avg += sddmm_ms;
-            }
+            }, sddmm_samples);
         }
 	else if (preA == 16 && preB == 16){
-            for(int iter=0; iter<32; ++iter){
+            sddmm_stats = TimeDevice(FixedTimingOptions(32, NUM_PROFILES), [&](){
                 sddmm::wmmaSddmm_16b(m_vec, k, n, d_row_indices, d_row_offsets, d_col_indices, d_lhs_matrix, d_rhs_matrix, d_output_values, vec_length);
-            }
-            for(int iter=0; iter<NUM_PROFILES; ++iter){
-                float sddmm_ms = 0.0f;
-                cudaEvent_t sddmm_start;
-                cudaEvent_t sddmm_end;
-                cudaEventCreate(&sddmm_start);
-                cudaEventCreate(&sddmm_end);
-                cudaEventRecord(sddmm_start);
-                sddmm::wmmaSddmm_16b(m_vec, k, n, d_row_indices, d_row_offsets, d_col_indices, d_lhs_matrix, d_rhs_matrix, d_output_values, vec_length);
-                cudaEventRecord(sddmm_end);
-                cudaEventSynchronize(sddmm_end);
-                cudaEventElapsedTime(&sddmm_ms, sddmm_start, sddmm_end);
-                cudaEventDestroy(sddmm_start);
-                cudaEventDestroy(sddmm_end);
-                sddmm_ms_avg += sddmm_ms;
-            }
+            }, sddmm_samples);
         }
         else{
             printf("unsupported kernel\n");
@@ -249,52 +199,47 @@ void BmFN(std::string benchmark, int dimK, int vec_length, bool sorted, bool fun
         }
 
 	flops = flops/1000.0/1000.0/1000.0;
-        std::cout << "Magicube SDDMM runtime " << sddmm_ms_avg/(float)NUM_PROFILES << " ms" << "\n";
-        sddmm_ms_avg = sddmm_ms_avg/(float)NUM_PROFILES/1000.0;
+        std::cout << "Magicube SDDMM runtime " << sddmm_stats.mean << " ms" << "\n";
+        PrintTimingStats("Magicube SDDMM", sddmm_stats);
         if (func){
-            std::cout << "SDDMM TOPS: " << flops/1000.0 << "  performance TOP/s: " << flops/sddmm_ms_avg/1000.0 << "\n";
+            std::cout << "SDDMM TOPS: " << flops/1000.0 << "  performance TOP/s: " << flops/(sddmm_stats.mean/1000.0)/1000.0 << "\n";
 	}
 
         cudaProfilerStop();
 
         if (func){
             // Copy the result back to host
-            int *output_value_cuda = new int[aligned_num_item*vec_length];
-            checkCuda(cudaMemcpy(output_value_cuda, d_output_values, aligned_num_item*vec_length*sizeof(int), cudaMemcpyDeviceToHost)); 
+            stage.Next("copy to host");
+            HostMemory::Get().SetStage("copy to host");
+            HostArray<int> output_value_cuda(output_size);
+            checkCuda(cudaMemcpy(output_value_cuda.get(), d_output_values, output_size*sizeof(int), cudaMemcpyDeviceToHost)); 
             
             // Verify the result
-            int errors = 0;
-            for (int j=0; j < aligned_num_item*vec_length; j++){
-                if ((output_value_cuda[j] - h_output_values[j]) != 0){
-		    //if(j<256)
-                    //    printf("item %d, expect %d, got %d\n", j, h_output_values[j], output_value_cuda[j]);
-                    errors ++;
-                }
-            }
-            if (errors > 0) {
-                printf("SDDMM does not agree with SEQUENTIAL! Total %d, %d errors!\n", aligned_num_item*vec_length, errors);
+            stage.Next("verify");
+            HostMemory::Get().SetStage("verify");
+            // One row per nonzero vector, stored alignment vectors at a
+            // time lane by lane; a thread block computes 64 of them
+            VerifyOptions verify_options = SddmmVerifyOptions(aligned_num_item, vec_length, alignment, 64);
+            VerifyReport report = VerifyExact(output_value_cuda.get(), h_output_values.get(), output_size, verify_options);
+            if (!report.Passed()) {
+                printf("SDDMM does not agree with SEQUENTIAL! Total %lld, %lld errors!\n", (long long)output_size, (long long)report.errors);
+                PrintVerifyReport(stdout, "SDDMM", report);
             }else {
                 printf("SDDMM results verification: PASS\n");
             }
-            delete output_value_cuda;
         }
 
         // Free the memory
+        stage.Next("free");
         cudaFree(d_row_offsets);
         cudaFree(d_col_indices);
         cudaFree(d_row_indices);
         cudaFree(d_lhs_matrix);
         cudaFree(d_rhs_matrix);
         cudaFree(d_output_values);
-        delete row_offsets;
-        delete col_indices;
-        delete aligned_row_offsets;
-        delete aligned_col_indices;
-        delete lhs_matrix;
-        delete rhs_matrix;
-        delete output_values;
-        delete h_output_values;
-        delete row_indices;
+
+        h_output_values.reset();
+        HostMemory::Get().Print(stdout);
     }
 }
 
@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "include/smtx_io.h"
+#include "include/autotuner.h"
+
+int main(int argc, char **argv){
+    if (argc < 8 || strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0){
+        printf("This script selects the vec_length of the Magicube SpMM for a matrix. Tile_N and\n");
+        printf("Warps are fixed per precision by the dispatchers and not tuned. The winner is stored\n");
+        printf("in a tuning database keyed by the matrix features and the executor and reused for\n");
+        printf("matrices of a similar shape; magicube_bench --tuning-db runs the GPU SpMM with the\n");
+        printf("records of the model executor.\n");
+        printf("\n");
+        printf("usage: ./autotune [bm] [n] [v] [preA] [preB] [db] [executor] [force]\n");
+        printf("arguments\n");
+        printf("bm       :   path to the sparse matrix benchmark.\n");
+        printf("n        :   the length of dimension n.\n");
+        printf("v        :   the vector length the benchmark is stored with, can be {2, 4, 8}. \n");
+        printf("preA     :   lhs precision, can be {4, 8, 12, 16}. \n");
+        printf("preB     :   rhs precision, can be {4, 8, 16}. \n");
+        printf("db       :   path to the tuning database, created if missing.\n");
+        printf("executor :   executor = model, candidates are scored by the cost model of the GPU kernels;\n");
+        printf("             executor = cpu, candidates are timed on the CPU backend (CPU only).\n");
+        printf("force    :   force = 1, tune again even if the database has a record.\n");
+        return argc < 8 ? 1 : 0;
+    }
+
+    std::string benchmark(argv[1]);
+    int64_t n = atoll(argv[2]);
+    int vec_length = atoi(argv[3]);
+    int preA = atoi(argv[4]);
+    int preB = atoi(argv[5]);
+    std::string db_path(argv[6]);
+    std::string executor_name(argv[7]);
+    bool force = argc > 8 && atoi(argv[8]) != 0;
+    if(!SpmmPrecisionSupported(preA, preB) || (vec_length != 2 && vec_length != 4 && vec_length != 8)){
+        fprintf(stderr, "Unsupported configuration preA %d, preB %d, vec_length %d\n", preA, preB, vec_length);
+        return 1;
+    }
+
+    SmtxMatrix matrix;
+    if(!ReadSmtx(benchmark, matrix)) return 1;
+
+    SpmmFeatures features = ComputeSpmmFeatures(matrix.m_vec, matrix.k, matrix.row_offsets.data(), n,
+                                                vec_length, preA, preB);
+    std::map<std::string, TuningRecord> db = LoadTuningDb(db_path);
+
+    SpmmExecutor executor;
+    if(executor_name == "model")
+        executor = CostModelExecutor(matrix.m_vec, matrix.row_offsets.data(), vec_length, n, preA, preB,
+                                     DefaultMachineModel());
+    else if(executor_name == "cpu")
+        executor = CpuExecutor(matrix.m_vec, matrix.k, matrix.row_offsets.data(), matrix.col_indices.data(),
+                               vec_length, n, 5);
+    else{
+        fprintf(stderr, "Unknown executor: %s\n", executor_name.c_str());
+        return 1;
+    }
+
+    const std::string key = TuningKey(features, executor_name);
+    std::map<std::string, TuningRecord>::const_iterator cached = db.find(key);
+    if(cached != db.end() && !force){
+        const TuningRecord &r = cached->second;
+        printf("cached %s: vec_length %d score %.4f (%s)\n", key.c_str(), r.candidate.vec_length, r.score,
+               r.source.c_str());
+        return 0;
+    }
+
+    TuningRecord best = TuneSpmmVecLength(SpmmVecLengthCandidates(preA, preB, vec_length, n), executor, executor_name,
+                                          true);
+    db[key] = best;
+    if(!SaveTuningDb(db_path, db)) return 1;
+    printf("tuned %s: vec_length %d score %.4f (%s)\n", key.c_str(), best.candidate.vec_length, best.score,
+           best.source.c_str());
+    return 0;
+}
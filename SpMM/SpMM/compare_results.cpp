@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/results_store.h"
+
+// Compare two revisions of the results store written by magicube_bench
+// --store. Every configuration measured in both revisions is checked with
+// Welch's t-test. With hundreds of configurations some would pass a plain
+// alpha by chance, so the p-values are adjusted for the number of tests
+// (Holm by default, Benjamini-Hochberg with --correction bh) and a change is
+// reported when its adjusted p-value is below --alpha and it is larger than
+// --threshold. Exits with 1 if any configuration regressed.
+//
+//   ./compare_results results.tsv 1e80557 550f4c8 --alpha 0.01 --threshold 0.02
+
+struct PooledResult{
+    int64_t count;
+    double mean;
+    double m2;                          // sum of squared deviations
+};
+
+// Runs of the same configuration and revision are pooled into one sample
+static void Pool(PooledResult &pooled, const StoredResult &result){
+    const double m2 = result.stddev_ms * result.stddev_ms * std::max<int64_t>(result.count - 1, 0);
+    if(pooled.count == 0){
+        pooled.count = result.count;
+        pooled.mean = result.mean_ms;
+        pooled.m2 = m2;
+        return;
+    }
+    const int64_t count = pooled.count + result.count;
+    const double delta = result.mean_ms - pooled.mean;
+    pooled.m2 += m2 + delta * delta * pooled.count * result.count / count;
+    pooled.mean += delta * result.count / count;
+    pooled.count = count;
+}
+
+static double Stddev(const PooledResult &pooled){
+    return pooled.count > 1 ? std::sqrt(pooled.m2 / (pooled.count - 1)) : 0;
+}
+
+struct Change{
+    std::string key;
+    double ratio;
+    double p_value;
+    double adjusted_p;
+};
+
+// Adjust the p-values of all changes for multiple testing. Holm's step-down
+// keeps the family-wise error rate at alpha; Benjamini-Hochberg's step-up
+// keeps the false discovery rate at alpha and flags more changes.
+static void AdjustPValues(std::vector<Change> &changes, const std::string &correction){
+    const size_t m = changes.size();
+    std::vector<size_t> order(m);
+    for(size_t i = 0; i < m; i++) order[i] = i;
+    std::sort(order.begin(), order.end(), [&](size_t x, size_t y){ return changes[x].p_value < changes[y].p_value; });
+    if(correction == "holm"){
+        double running = 0;
+        for(size_t i = 0; i < m; i++){
+            running = std::max(running, std::min(1.0, (m - i) * changes[order[i]].p_value));
+            changes[order[i]].adjusted_p = running;
+        }
+    }
+    else if(correction == "bh"){
+        double running = 1;
+        for(size_t i = m; i-- > 0;){
+            running = std::min(running, std::min(1.0, static_cast<double>(m) / (i + 1) * changes[order[i]].p_value));
+            changes[order[i]].adjusted_p = running;
+        }
+    }
+    else{
+        for(size_t i = 0; i < m; i++) changes[i].adjusted_p = changes[i].p_value;
+    }
+}
+
+struct GroupSummary{
+    int points;
+    double log_ratio_sum;
+    int regressions;
+    int improvements;
+};
+
+static void PrintUsage(){
+    printf("./compare_results [store] [base revision] [new revision] [--name value]...\n");
+    printf("--alpha      :   significance level of the adjusted p-values. Default 0.01.\n");
+    printf("--correction :   multiple testing correction, holm, bh (Benjamini-Hochberg) or none. Default holm.\n");
+    printf("--threshold  :   smallest relative change reported. Default 0.02.\n");
+    printf("--top        :   number of regressions and improvements listed. Default 20.\n");
+}
+
+int main(int argc, char **argv){
+    if(argc < 4 || strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0){
+        PrintUsage();
+        return argc < 4 ? 2 : 0;
+    }
+    const std::string store(argv[1]), base(argv[2]), head(argv[3]);
+    double alpha = 0.01, threshold = 0.02;
+    std::string correction = "holm";
+    int top = 20;
+    for(int i = 4; i + 1 < argc; i += 2){
+        if(strcmp(argv[i], "--alpha") == 0) alpha = atof(argv[i+1]);
+        else if(strcmp(argv[i], "--threshold") == 0) threshold = atof(argv[i+1]);
+        else if(strcmp(argv[i], "--correction") == 0) correction = argv[i+1];
+        else if(strcmp(argv[i], "--top") == 0) top = atoi(argv[i+1]);
+        else{
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return 2;
+        }
+    }
+
+    if(correction != "holm" && correction != "bh" && correction != "none"){
+        fprintf(stderr, "Unknown correction: %s\n", correction.c_str());
+        return 2;
+    }
+
+    std::vector<StoredResult> results;
+    if(!LoadResults(store, results)) return 2;
+    std::map<std::string, PooledResult> base_results, head_results;
+    std::map<std::string, std::string> groups;
+    for(size_t i = 0; i < results.size(); i++){
+        const StoredResult &result = results[i];
+        std::map<std::string, PooledResult> *target = NULL;
+        if(result.revision == base) target = &base_results;
+        else if(result.revision == head) target = &head_results;
+        if(target == NULL) continue;
+        PooledResult empty = {0, 0, 0};
+        Pool(target->insert(std::make_pair(result.Key(), empty)).first->second, result);
+        std::ostringstream group;
+        group << result.op << " a" << result.preA << "b" << result.preB;
+        groups[result.Key()] = group.str();
+    }
+
+    std::vector<Change> changes;
+    for(std::map<std::string, PooledResult>::const_iterator it = head_results.begin(); it != head_results.end(); ++it){
+        std::map<std::string, PooledResult>::const_iterator old = base_results.find(it->first);
+        if(old == base_results.end() || old->second.mean <= 0) continue;
+        const PooledResult &a = old->second, &b = it->second;
+        const WelchTest test = WelchTTest(a.mean, Stddev(a), a.count, b.mean, Stddev(b), b.count);
+        Change change;
+        change.key = it->first;
+        change.ratio = b.mean / a.mean;
+        change.p_value = test.p_value;
+        changes.push_back(change);
+    }
+    AdjustPValues(changes, correction);
+
+    std::map<std::string, GroupSummary> summaries;
+    std::vector<Change> regressions, improvements;
+    const int compared = static_cast<int>(changes.size());
+    for(size_t i = 0; i < changes.size(); i++){
+        const Change &change = changes[i];
+        GroupSummary empty = {0, 0, 0, 0};
+        GroupSummary &summary = summaries.insert(std::make_pair(groups[change.key], empty)).first->second;
+        summary.points++;
+        summary.log_ratio_sum += std::log(change.ratio);
+        if(change.adjusted_p < alpha && change.ratio > 1 + threshold){
+            summary.regressions++;
+            regressions.push_back(change);
+        }
+        else if(change.adjusted_p < alpha && change.ratio < 1 - threshold){
+            summary.improvements++;
+            improvements.push_back(change);
+        }
+    }
+    if(compared == 0){
+        fprintf(stderr, "No configuration measured in both %s and %s\n", base.c_str(), head.c_str());
+        return 2;
+    }
+
+    printf("%s -> %s: %d configurations, alpha %.3g (%s), threshold %.1f%%\n", base.c_str(), head.c_str(), compared, alpha,
+           correction.c_str(), threshold * 100);
+    printf("%-16s %8s %12s %12s %12s\n", "kernel", "points", "geomean", "regressed", "improved");
+    for(std::map<std::string, GroupSummary>::const_iterator it = summaries.begin(); it != summaries.end(); ++it)
+        printf("%-16s %8d %11.3fx %12d %12d\n", it->first.c_str(), it->second.points,
+               std::exp(it->second.log_ratio_sum / it->second.points), it->second.regressions, it->second.improvements);
+
+    // Largest changes first; the key columns are op preA preB n v kernel_config matrix
+    std::sort(regressions.begin(), regressions.end(), [](const Change &x, const Change &y){ return x.ratio > y.ratio; });
+    std::sort(improvements.begin(), improvements.end(), [](const Change &x, const Change &y){ return x.ratio < y.ratio; });
+    if(!regressions.empty())
+        printf("\nregressions (new/base runtime, p-value, adjusted p-value, op preA preB n v kernel_config matrix)\n");
+    for(int i = 0; i < static_cast<int>(regressions.size()) && i < top; i++)
+        printf("  %.3fx  p=%.2e  adj=%.2e  %s\n", regressions[i].ratio, regressions[i].p_value, regressions[i].adjusted_p,
+               regressions[i].key.c_str());
+    if(!improvements.empty())
+        printf("\nimprovements (new/base runtime, p-value, adjusted p-value, op preA preB n v kernel_config matrix)\n");
+    for(int i = 0; i < static_cast<int>(improvements.size()) && i < top; i++)
+        printf("  %.3fx  p=%.2e  adj=%.2e  %s\n", improvements[i].ratio, improvements[i].p_value, improvements[i].adjusted_p,
+               improvements[i].key.c_str());
+    return regressions.empty() ? 0 : 1;
+}
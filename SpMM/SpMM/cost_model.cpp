@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "include/smtx_io.h"
+#include "include/cost_model.h"
+
+// Override one field of the machine model from a key=value argument
+bool SetMachineField(MachineModel &machine, const char *arg){
+    const char *eq = strchr(arg, '=');
+    if(eq == NULL) return false;
+    std::string key(arg, eq - arg);
+    double value = atof(eq + 1);
+    if(key == "sm_count") machine.sm_count = static_cast<int>(value);
+    else if(key == "clock_ghz") machine.clock_ghz = value;
+    else if(key == "dram_gbs") machine.dram_gbs = value;
+    else if(key == "l2_gbs") machine.l2_gbs = value;
+    else if(key == "mma_per_sm_cycle") machine.mma_per_sm_cycle = value;
+    else if(key == "dp4a_per_sm_cycle") machine.dp4a_per_sm_cycle = value;
+    else if(key == "rhs_l2_hit_rate") machine.rhs_l2_hit_rate = value;
+    else if(key == "launch_us") machine.launch_us = value;
+    else return false;
+    return true;
+}
+
+int main(int argc, char **argv){
+    if (argc < 6 || strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0){
+        printf("This script predicts the cost of the Magicube SpMM without running it.\n");
+        printf("It prints the bytes loaded, the mma issued and a roofline estimate as JSON.\n");
+        printf("\n");
+        printf("usage: ./cost_model [bm] [n] [v] [preA] [preB] [key=value ...]\n");
+        printf("arguments\n");
+        printf("bm      :   path to the sparse matrix benchmark.\n");
+        printf("n       :   the length of dimension n.\n");
+        printf("v       :   the vector length of the column vector sparsity, can be {2, 4, 8}. \n");
+        printf("preA    :   lhs precision, can be {4, 8, 12, 16}. \n");
+        printf("preB    :   rhs precision, can be {4, 8, 16}. \n");
+        printf("key     :   machine model overrides: sm_count, clock_ghz, dram_gbs, l2_gbs,\n");
+        printf("            mma_per_sm_cycle, dp4a_per_sm_cycle, rhs_l2_hit_rate, launch_us\n");
+        return argc < 6 ? 1 : 0;
+    }
+
+    std::string benchmark(argv[1]);
+    int64_t n = atoll(argv[2]);
+    int vec_length = atoi(argv[3]);
+    int preA = atoi(argv[4]);
+    int preB = atoi(argv[5]);
+    if(!SpmmPrecisionSupported(preA, preB) || (vec_length != 2 && vec_length != 4 && vec_length != 8)){
+        fprintf(stderr, "Unsupported configuration preA %d, preB %d, vec_length %d\n", preA, preB, vec_length);
+        return 1;
+    }
+
+    MachineModel machine = DefaultMachineModel();
+    for(int i = 6; i < argc; i++){
+        if(!SetMachineField(machine, argv[i])){
+            fprintf(stderr, "Unknown machine model field: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    SmtxMatrix matrix;
+    if(!ReadSmtx(benchmark, matrix)) return 1;
+
+    SpmmCost cost = EstimateDispatchedSpmmCost<int>(matrix.m_vec, matrix.row_offsets.data(), n, vec_length, preA, preB,
+                                                    machine);
+    WriteSpmmCostJson(stdout, cost, machine);
+    return 0;
+}
@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/bench_options.h"
+#include "include/matrix_features.h"
+
+// Feature extractor for the benchmark datasets. Computes the features of
+// include/matrix_features.h for every matrix of the given lists and stores
+// them in a binary catalog keyed by the matrix path of the list.
+//
+//   ./features --list eval_matrices/s50.txt,eval_matrices/s70.txt --catalog features.bin --jobs 8
+//   ./features --catalog features.bin --show rn50/magnitude_pruning/0.5/initial_conv.smtx
+//
+// Matrices already in the catalog are skipped unless --force 1 is given.
+
+static void PrintUsage(){
+    printf("./features [--name value]...\n");
+    printf("--list         :   matrix list files (eval_matrices/s*.txt), comma separated.\n");
+    printf("--dataset-dir  :   prefix of the matrix paths. Default $dataset_dir.\n");
+    printf("--catalog      :   catalog file. Default features.bin.\n");
+    printf("--jobs         :   matrices processed in parallel. Default 1.\n");
+    printf("--force        :   1 to recompute matrices already in the catalog. Default 0.\n");
+    printf("--show         :   print the features of one matrix, or 'all'.\n");
+}
+
+// Column indices outside [0, k) would index past the per-column tables
+static bool CheckSmtx(const std::string &path, const SmtxMatrix &matrix){
+    if(matrix.row_offsets[0] != 0 || matrix.row_offsets[matrix.m_vec] != matrix.nonzeros_vec){
+        fprintf(stderr, "%s: row offsets do not match nnz\n", path.c_str());
+        return false;
+    }
+    for(int64_t i = 0; i < matrix.nonzeros_vec; i++){
+        if(matrix.col_indices[i] < 0 || matrix.col_indices[i] >= matrix.k){
+            fprintf(stderr, "%s: column index %d out of range\n", path.c_str(), matrix.col_indices[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv){
+    if(argc == 2 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0)){
+        PrintUsage();
+        return 0;
+    }
+    std::vector<std::string> matrices;
+    std::string dataset_dir, catalog_path = "features.bin", show;
+    int jobs = 1;
+    bool force = false;
+    const char *env_dir = getenv("dataset_dir");
+    if(env_dir != NULL) dataset_dir = env_dir;
+    for(int i = 1; i < argc; i++){
+        std::string arg(argv[i]);
+        if(arg.compare(0, 2, "--") != 0 || i + 1 >= argc){
+            fprintf(stderr, "Expected --name value, got %s\n", arg.c_str());
+            PrintUsage();
+            return 1;
+        }
+        const std::string name = arg.substr(2);
+        const std::string value(argv[++i]);
+        bool ok = true;
+        if(name == "list"){
+            std::vector<std::string> lists;
+            SplitList(value, lists);
+            for(size_t l = 0; ok && l < lists.size(); l++) ok = LoadMatrixList(lists[l], matrices);
+        }
+        else if(name == "dataset-dir") dataset_dir = value;
+        else if(name == "catalog") catalog_path = value;
+        else if(name == "jobs") ok = ParseInt(value, jobs) && jobs > 0;
+        else if(name == "force") force = (value == "1" || value == "true");
+        else if(name == "show") show = value;
+        else{
+            fprintf(stderr, "Unknown option: %s\n", name.c_str());
+            return 1;
+        }
+        if(!ok){
+            fprintf(stderr, "Invalid value for %s: %s\n", name.c_str(), value.c_str());
+            return 1;
+        }
+    }
+
+    FeatureCatalog catalog;
+    if(!LoadFeatureCatalog(catalog_path, catalog)) return 1;
+
+    if(!show.empty()){
+        for(size_t i = 0; i < catalog.names.size(); i++)
+            if(show == "all" || show == catalog.names[i]) PrintMatrixFeatures(stdout, catalog.names[i], catalog.records[i]);
+        return (show == "all" || catalog.Find(show) != NULL) ? 0 : 1;
+    }
+
+    std::sort(matrices.begin(), matrices.end());
+    matrices.erase(std::unique(matrices.begin(), matrices.end()), matrices.end());
+    std::vector<std::string> pending;
+    for(size_t i = 0; i < matrices.size(); i++)
+        if(force || catalog.Find(matrices[i]) == NULL) pending.push_back(matrices[i]);
+    printf("%zu matrices, %zu in the catalog, %zu to process\n", matrices.size(), matrices.size() - pending.size(),
+           pending.size());
+
+    std::atomic<size_t> next(0);
+    std::atomic<int> failed(0);
+    std::mutex catalog_mutex;
+    std::vector<std::thread> workers;
+    for(int w = 0; w < jobs; w++){
+        workers.push_back(std::thread([&](){
+            while(true){
+                const size_t i = next++;
+                if(i >= pending.size()) break;
+                const std::string path = dataset_dir.empty() ? pending[i] : dataset_dir + "/" + pending[i];
+                SmtxMatrix matrix;
+                if(!ReadSmtx(path, matrix) || !CheckSmtx(path, matrix)){
+                    failed++;
+                    continue;
+                }
+                MatrixFeatures features = ComputeMatrixFeatures(matrix.m_vec, matrix.k, matrix.row_offsets.data(),
+                                                                matrix.col_indices.data());
+                std::lock_guard<std::mutex> lock(catalog_mutex);
+                catalog.Put(pending[i], features);
+            }
+        }));
+    }
+    for(size_t w = 0; w < workers.size(); w++) workers[w].join();
+
+    if(!SaveFeatureCatalog(catalog_path, catalog)) return 1;
+    printf("%zu matrices in %s, %d failed\n", catalog.names.size(), catalog_path.c_str(), (int)failed);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,235 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Size-class arena for the workspaces of the packer and the benchmark
+// drivers. A released block goes back to the free list of its size class
+// instead of the system, so repeated calls with the same shapes allocate
+// nothing once the arena is warm. Reserve() warms it up front from the
+// buffer sizes of a plan (see SpmmPlan in spmm_packer.h).
+//
+// The free lists hold at most cache_limit bytes (unlimited by default);
+// blocks released past the limit go straight back to the backend. A driver
+// that moves between unrelated shapes calls Trim() in between, and an
+// allocation the backend refuses trims the free lists and retries once
+// before giving up.
+//
+// The memory comes from a pages backend: HostPages below maps anonymous
+// memory, backs large blocks with transparent huge pages and pre-faults
+// reserved blocks so that first-touch page faults happen at reservation
+// time. The device backend is in cuda_arena.h.
+
+// Size classes: four per power of two above 4 KB (at most 25% waste), exact
+// multiples of 4 KB below.
+inline size_t ArenaSizeClass(size_t bytes){
+    const size_t page = 4096;
+    if(bytes <= 4 * page) return std::max<size_t>(page, (bytes + page - 1) / page * page);
+    size_t power = 4 * page;
+    while(power * 2 < bytes) power *= 2;
+    const size_t step = power / 4;
+    return (bytes + step - 1) / step * step;
+}
+
+struct ArenaStats{
+    int64_t allocations;                // Allocate() calls
+    int64_t cache_hits;                 // served from a free list
+    int64_t mapped_bytes;               // obtained from the backend
+    int64_t cached_bytes;               // on the free lists
+    int64_t in_use_bytes;
+    int64_t peak_in_use_bytes;
+};
+
+struct HostPages{
+    static const size_t kHugePage = 2 << 20;
+
+    static void *Map(size_t bytes){
+        void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(p == MAP_FAILED) return NULL;
+#ifdef MADV_HUGEPAGE
+        if(bytes >= kHugePage) madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+        return p;
+    }
+    static void Unmap(void *p, size_t bytes){ munmap(p, bytes); }
+
+    // Touch every page so the faults are taken now rather than on first use
+    static void Prefault(void *p, size_t bytes){
+        const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        volatile char *c = static_cast<volatile char *>(p);
+        for(size_t i = 0; i < bytes; i += page) c[i] = 0;
+    }
+    static void Zero(void *p, size_t bytes){ memset(p, 0, bytes); }
+    static const char *Name(){ return "host"; }
+};
+
+template <typename Pages>
+class SizeClassArena{
+public:
+    typedef Pages PagesType;
+
+    SizeClassArena(): cache_limit_(std::numeric_limits<int64_t>::max()){ memset(&stats_, 0, sizeof(stats_)); }
+    ~SizeClassArena(){ Trim(); }
+
+    void SetCacheLimit(int64_t bytes){
+        std::lock_guard<std::mutex> lock(mutex_);
+        cache_limit_ = bytes;
+        TrimTo(cache_limit_);
+    }
+
+    void *Allocate(size_t bytes){
+        const size_t size = ArenaSizeClass(bytes);
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.allocations++;
+        void *p = NULL;
+        std::vector<void *> &free_list = free_[size];
+        if(!free_list.empty()){
+            p = free_list.back();
+            free_list.pop_back();
+            stats_.cache_hits++;
+            stats_.cached_bytes -= size;
+        }
+        else{
+            p = Pages::Map(size);
+            if(p == NULL && stats_.cached_bytes > 0){
+                // The free lists may hold what the backend is missing
+                TrimTo(0);
+                p = Pages::Map(size);
+            }
+            if(p == NULL){
+                fprintf(stderr, "%s arena: failed to map %zu bytes (%.2f MB mapped)\n", Pages::Name(), size,
+                        stats_.mapped_bytes / 1048576.0);
+                abort();
+            }
+            stats_.mapped_bytes += size;
+        }
+        sizes_[p] = size;
+        stats_.in_use_bytes += size;
+        stats_.peak_in_use_bytes = std::max(stats_.peak_in_use_bytes, stats_.in_use_bytes);
+        return p;
+    }
+
+    void Release(void *p){
+        if(p == NULL) return;
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::map<void *, size_t>::iterator it = sizes_.find(p);
+        if(it == sizes_.end()){
+            fprintf(stderr, "%s arena: release of a block it does not own\n", Pages::Name());
+            abort();
+        }
+        stats_.in_use_bytes -= it->second;
+        if(stats_.cached_bytes + static_cast<int64_t>(it->second) > cache_limit_){
+            Pages::Unmap(p, it->second);
+            stats_.mapped_bytes -= it->second;
+        }
+        else{
+            free_[it->second].push_back(p);
+            stats_.cached_bytes += it->second;
+        }
+        sizes_.erase(it);
+    }
+
+    // Make sure one free block exists for each of the given sizes, mapping
+    // and pre-faulting the missing ones. Sizes may repeat.
+    void Reserve(const std::vector<size_t> &bytes){
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::map<size_t, size_t> wanted;
+        for(size_t i = 0; i < bytes.size(); i++) wanted[ArenaSizeClass(bytes[i])]++;
+        for(std::map<size_t, size_t>::const_iterator it = wanted.begin(); it != wanted.end(); ++it){
+            std::vector<void *> &free_list = free_[it->first];
+            while(free_list.size() < it->second && stats_.cached_bytes + static_cast<int64_t>(it->first) <= cache_limit_){
+                void *p = Pages::Map(it->first);
+                if(p == NULL) return;
+                Pages::Prefault(p, it->first);
+                stats_.mapped_bytes += it->first;
+                stats_.cached_bytes += it->first;
+                free_list.push_back(p);
+            }
+        }
+    }
+
+    // Return every free block to the backend
+    void Trim(){
+        std::lock_guard<std::mutex> lock(mutex_);
+        TrimTo(0);
+    }
+
+    ArenaStats stats(){
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+    void PrintStats(FILE *out){
+        const ArenaStats s = stats();
+        fprintf(out, "%s arena: %lld allocations, %lld from cache, %.2f MB mapped, %.2f MB cached, %.2f MB peak in use\n",
+                Pages::Name(), (long long)s.allocations, (long long)s.cache_hits, s.mapped_bytes / 1048576.0,
+                s.cached_bytes / 1048576.0, s.peak_in_use_bytes / 1048576.0);
+    }
+
+private:
+    std::mutex mutex_;
+    std::map<size_t, std::vector<void *> > free_;
+    std::map<void *, size_t> sizes_;
+    ArenaStats stats_;
+    int64_t cache_limit_;
+
+    // Unmap free blocks, largest first, until at most bytes are cached.
+    // Called with the mutex held.
+    void TrimTo(int64_t bytes){
+        for(std::map<size_t, std::vector<void *> >::reverse_iterator it = free_.rbegin();
+            it != free_.rend() && stats_.cached_bytes > bytes; ++it){
+            while(!it->second.empty() && stats_.cached_bytes > bytes){
+                Pages::Unmap(it->second.back(), it->first);
+                it->second.pop_back();
+                stats_.mapped_bytes -= it->first;
+                stats_.cached_bytes -= it->first;
+            }
+        }
+    }
+
+    SizeClassArena(const SizeClassArena &);
+    SizeClassArena &operator=(const SizeClassArena &);
+};
+
+typedef SizeClassArena<HostPages> HostArena;
+
+// Process-wide host arena
+inline HostArena &GlobalHostArena(){
+    static HostArena arena;
+    return arena;
+}
+
+// Array of T borrowed from an arena for the lifetime of the object. The
+// contents are not initialized unless zero is set.
+template <typename T, typename Arena>
+class ArenaBuffer{
+public:
+    ArenaBuffer(Arena &arena, int64_t size, bool zero = false): arena_(arena), size_(size){
+        data_ = static_cast<T *>(arena_.Allocate(std::max<size_t>(static_cast<size_t>(size) * sizeof(T), 1)));
+        if(zero) Arena::PagesType::Zero(data_, static_cast<size_t>(size) * sizeof(T));
+    }
+    ~ArenaBuffer(){ arena_.Release(data_); }
+
+    T *data() const { return data_; }
+    int64_t size() const { return size_; }
+    T &operator[](int64_t i) const { return data_[i]; }
+
+private:
+    Arena &arena_;
+    T *data_;
+    int64_t size_;
+
+    ArenaBuffer(const ArenaBuffer &);
+    ArenaBuffer &operator=(const ArenaBuffer &);
+};
+
+#endif
@@ -0,0 +1,256 @@
+#ifndef AUTOTUNER_H
+#define AUTOTUNER_H
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include "cost_model.h"
+#include "skinny_spmm.h"
+#include "timer.h"
+
+// Selection of the vec_length an SpMM runs with.
+//
+// The Tile_N and Warps of the wmmaSpmm kernels are template arguments fixed
+// per precision pair (one instantiation per dispatcher in src/wmma_spmm.cu),
+// so they are not tuned: the only free choice is the vec_length the matrix
+// is re-blocked to. A candidate is such a vec_length together with the
+// configuration SelectWmmaSpmm launches for it, which is recorded for
+// reference. Candidates come from SpmmVecLengthCandidates, they are scored
+// by an executor (lower is better) and the winner is stored in a tuning
+// database keyed by bucketed matrix features and the executor, so similar
+// matrices reuse it. Only the cost model executor describes the GPU
+// kernels; magicube_bench --tuning-db applies its stored vec_length.
+
+struct SpmmCandidate{
+    SpmmKernelConfig config;
+    int vec_length;
+};
+
+// Every vec_length the matrix can be re-blocked to, each with the
+// configuration its dispatcher launches for n columns (SpmmDispatchedConfig).
+// A matrix stored with vec_length v can be split into vectors of v/2 and v/4.
+inline std::vector<SpmmCandidate> SpmmVecLengthCandidates(int preA, int preB, int native_vec_length, int64_t n){
+    std::vector<SpmmCandidate> candidates;
+    for(int vec_length = 2; vec_length <= native_vec_length; vec_length *= 2){
+        if(native_vec_length % vec_length != 0) continue;
+        SpmmCandidate candidate;
+        candidate.config = SpmmDispatchedConfig(preA, preB, n);
+        candidate.vec_length = vec_length;
+        candidates.push_back(candidate);
+    }
+    return candidates;
+}
+
+// Row offsets of the matrix after splitting every vector into factor
+// shorter vectors: each vector row becomes factor rows with the same columns
+inline std::vector<int> SplitVectorRows(int64_t m_vec, const int *row_offsets, int factor){
+    std::vector<int> split_offsets(1, 0);
+    for(int64_t i = 0; i < m_vec; i++)
+        for(int f = 0; f < factor; f++)
+            split_offsets.push_back(split_offsets.back() + row_offsets[i+1] - row_offsets[i]);
+    return split_offsets;
+}
+
+// Column indices of the split matrix, see SplitVectorRows
+inline std::vector<int> SplitVectorColumns(int64_t m_vec, const int *row_offsets, const int *col_indices, int factor){
+    std::vector<int> split_columns;
+    for(int64_t i = 0; i < m_vec; i++)
+        for(int f = 0; f < factor; f++)
+            split_columns.insert(split_columns.end(), col_indices + row_offsets[i], col_indices + row_offsets[i+1]);
+    return split_columns;
+}
+
+// Matrix features that key the tuning database. Sizes and the density are
+// bucketed on a log2 scale and the row length imbalance linearly, so that
+// the record of one matrix applies to matrices of a similar shape.
+struct SpmmFeatures{
+    int64_t rows;
+    int64_t k;
+    int64_t n;
+    int preA;
+    int preB;
+    int vec_length;
+    double density;
+    // Coefficient of variation of the nonzeros per vector row
+    double row_cv;
+};
+
+inline SpmmFeatures ComputeSpmmFeatures(int64_t m_vec, int64_t k, const int *row_offsets, int64_t n,
+                                        int vec_length, int preA, int preB){
+    SpmmFeatures features;
+    features.rows = m_vec * vec_length;
+    features.k = k;
+    features.n = n;
+    features.preA = preA;
+    features.preB = preB;
+    features.vec_length = vec_length;
+    const double nonzeros_vec = row_offsets[m_vec] - row_offsets[0];
+    features.density = nonzeros_vec / (static_cast<double>(m_vec) * k);
+    const double mean = nonzeros_vec / m_vec;
+    double var = 0;
+    for(int64_t i = 0; i < m_vec; i++){
+        const double d = (row_offsets[i+1] - row_offsets[i]) - mean;
+        var += d * d;
+    }
+    features.row_cv = mean > 0 ? std::sqrt(var / m_vec) / mean : 0;
+    return features;
+}
+
+inline int Log2Bucket(double x){
+    return x > 0 ? static_cast<int>(std::floor(std::log2(x))) : -64;
+}
+
+// Scores of different executors are in different units, so the executor is
+// part of the key
+inline std::string TuningKey(const SpmmFeatures &features, const std::string &executor){
+    std::ostringstream key;
+    key << executor << "_a" << features.preA << "b" << features.preB << "v" << features.vec_length
+        << "_m" << Log2Bucket(features.rows) << "_k" << Log2Bucket(features.k)
+        << "_n" << Log2Bucket(features.n) << "_d" << Log2Bucket(features.density)
+        << "_cv" << std::min(static_cast<int>(features.row_cv * 4), 8);
+    return key.str();
+}
+
+struct TuningRecord{
+    SpmmCandidate candidate;
+    // Score of the winner, in the unit of the executor that produced it
+    double score;
+    std::string source;
+};
+
+// The tuning database is a text file with one record per line:
+// key tile_m tile_k tile_n warps vec_length score source
+inline std::map<std::string, TuningRecord> LoadTuningDb(const std::string &path){
+    std::map<std::string, TuningRecord> db;
+    std::ifstream infile(path, std::ifstream::in);
+    std::string line;
+    while(std::getline(infile, line)){
+        if(line.empty() || line[0] == '#') continue;
+        std::istringstream fields(line);
+        std::string key;
+        TuningRecord record;
+        if(fields >> key >> record.candidate.config.tile_m >> record.candidate.config.tile_k >> record.candidate.config.tile_n
+                  >> record.candidate.config.warps >> record.candidate.vec_length >> record.score >> record.source)
+            db[key] = record;
+        else
+            fprintf(stderr, "%s: skipping malformed record: %s\n", path.c_str(), line.c_str());
+    }
+    return db;
+}
+
+// The record executor stored for matrices like features, NULL if there is
+// none. A record applies only to the backend its executor describes: "model"
+// to the GPU kernels, "cpu" to the CPU backend.
+inline const TuningRecord *FindTuningRecord(const std::map<std::string, TuningRecord> &db, const SpmmFeatures &features,
+                                            const std::string &executor){
+    std::map<std::string, TuningRecord>::const_iterator it = db.find(TuningKey(features, executor));
+    return it != db.end() ? &it->second : NULL;
+}
+
+inline bool SaveTuningDb(const std::string &path, const std::map<std::string, TuningRecord> &db){
+    // Write to a temporary file first so an interrupted run keeps the old database
+    const std::string tmp_path = path + ".tmp";
+    FILE *out = fopen(tmp_path.c_str(), "w");
+    if(out == NULL){
+        fprintf(stderr, "Failed to write %s\n", tmp_path.c_str());
+        return false;
+    }
+    fprintf(out, "# key tile_m tile_k tile_n warps vec_length score source\n");
+    for(std::map<std::string, TuningRecord>::const_iterator it = db.begin(); it != db.end(); ++it){
+        const TuningRecord &r = it->second;
+        fprintf(out, "%s %d %d %d %d %d %.6g %s\n", it->first.c_str(), r.candidate.config.tile_m, r.candidate.config.tile_k,
+                r.candidate.config.tile_n, r.candidate.config.warps, r.candidate.vec_length,
+                r.score, r.source.c_str());
+    }
+    fclose(out);
+    return rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+// Scores a candidate, lower is better
+typedef std::function<double(const SpmmCandidate &)> SpmmExecutor;
+
+// Executor that scores with the predicted runtime (us) of the kernel
+// SelectWmmaSpmm launches, mma or skinny dp4a, at the candidate's vec_length
+inline SpmmExecutor CostModelExecutor(int64_t m_vec, const int *row_offsets, int native_vec_length, int64_t n,
+                                      int preA, int preB, const MachineModel &machine){
+    std::vector<int> offsets(row_offsets, row_offsets + m_vec + 1);
+    return [=](const SpmmCandidate &candidate) -> double {
+        const int factor = native_vec_length / candidate.vec_length;
+        std::vector<int> split = SplitVectorRows(m_vec, offsets.data(), factor);
+        return EstimateDispatchedSpmmCost<int>(m_vec * factor, split.data(), n, candidate.vec_length, preA, preB,
+                                               machine).predicted_us;
+    };
+}
+
+// Vector-sparse SpMM on the CPU, walking the output in column tiles of tile_n
+// like the thread blocks of the kernel: out = A * rhs with int8 operands.
+inline void TiledSpmmCpu(int64_t m_vec, int vec_length, const int *row_offsets, const int *col_indices,
+                         const int8_t *values, const int8_t *rhs, int64_t n, int tile_n, int32_t *out){
+    std::fill(out, out + m_vec * vec_length * n, 0);
+    for(int64_t i = 0; i < m_vec; i++){
+        for(int64_t c0 = 0; c0 < n; c0 += tile_n){
+            const int64_t c1 = std::min<int64_t>(c0 + tile_n, n);
+            for(int64_t j = row_offsets[i]; j < row_offsets[i+1]; j++){
+                const int8_t *rhs_row = rhs + static_cast<int64_t>(col_indices[j]) * n;
+                for(int v = 0; v < vec_length; v++){
+                    const int32_t a = values[j * vec_length + v];
+                    int32_t *out_row = out + (i * vec_length + v) * n;
+                    for(int64_t c = c0; c < c1; c++)
+                        out_row[c] += a * rhs_row[c];
+                }
+            }
+        }
+    }
+}
+
+// Executor that measures TiledSpmmCpu with the candidate's vec_length. The
+// timing says how the CPU backend likes the re-blocking and nothing about
+// the GPU kernels, so its records are kept apart (see FindTuningRecord).
+// Returns the median of repeats runs in ms.
+inline SpmmExecutor CpuExecutor(int64_t m_vec, int64_t k, const int *row_offsets, const int *col_indices,
+                                int native_vec_length, int64_t n, int repeats){
+    std::vector<int> offsets(row_offsets, row_offsets + m_vec + 1);
+    std::vector<int> columns(col_indices, col_indices + row_offsets[m_vec]);
+    return [=](const SpmmCandidate &candidate) -> double {
+        const int factor = native_vec_length / candidate.vec_length;
+        const int64_t split_m_vec = m_vec * factor;
+        std::vector<int> split = SplitVectorRows(m_vec, offsets.data(), factor);
+        std::vector<int> split_columns = SplitVectorColumns(m_vec, offsets.data(), columns.data(), factor);
+        std::vector<int8_t> values(split_columns.size() * candidate.vec_length, 1);
+        std::vector<int8_t> rhs(k * n, 1);
+        std::vector<int32_t> out(split_m_vec * candidate.vec_length * n);
+
+        std::vector<double> times;
+        return TimeHost<SteadyClock>(FixedTimingOptions(1, repeats), [&](){
+            TiledSpmmCpu(split_m_vec, candidate.vec_length, split.data(), split_columns.data(), values.data(),
+                         rhs.data(), n, candidate.config.tile_n, out.data());
+        }, times).median;
+    };
+}
+
+// Score every candidate and return the best one
+inline TuningRecord TuneSpmmVecLength(const std::vector<SpmmCandidate> &candidates, const SpmmExecutor &executor,
+                             const std::string &source, bool verbose){
+    TuningRecord best;
+    best.score = -1;
+    best.source = source;
+    for(size_t c = 0; c < candidates.size(); c++){
+        const double score = executor(candidates[c]);
+        if(verbose)
+            printf("vec_length %d (tile_n %d warps %d): %.4f\n", candidates[c].vec_length,
+                   candidates[c].config.tile_n, candidates[c].config.warps, score);
+        if(best.score < 0 || score < best.score){
+            best.candidate = candidates[c];
+            best.score = score;
+        }
+    }
+    return best;
+}
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef BENCH_OPTIONS_H
+#define BENCH_OPTIONS_H
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdio.h>
+
+// Named options of the unified benchmark driver. Every option can be given
+// on the command line as --name value or in a config file as name = value,
+// one per line ('#' starts a comment). Options that take a list accept comma
+// separated values and can be repeated; the driver runs the cross product of
+// ops, matrices, n and vec_length.
+
+struct BenchOptions{
+    std::vector<std::string> ops;       // spmm, spmm_t, hybrid, sddmm, cublas, cusparse
+    std::vector<std::string> matrices;
+    std::string dataset_dir;            // prefix of relative matrix paths
+    std::vector<int> n;                 // dense dimension: N of SpMM, K of SDDMM
+    std::vector<int> vec_length;
+    int preA;
+    int preB;
+    bool sorted;
+    bool verify;
+    int warmup;
+    int iters;
+    // Adaptive timing: repeat up to max_iters until the 95% CI is within
+    // target_ci of the mean. 0 runs exactly iters iterations.
+    double target_ci;
+    int max_iters;
+    bool flush;                         // flush L2 before every iteration
+    std::string format;                 // json or csv
+    std::string output;                 // empty for stdout
+    std::string store;                  // results store to append to, see results_store.h
+    std::string revision;               // empty for the checked out git revision
+    std::string tuning_db;              // autotune database applied to spmm, see autotuner.h
+};
+
+inline BenchOptions DefaultBenchOptions(){
+    BenchOptions options;
+    options.preA = 8;
+    options.preB = 8;
+    options.sorted = true;
+    options.verify = false;
+    options.warmup = 16;
+    options.iters = 512;
+    options.target_ci = 0;
+    options.max_iters = 8192;
+    options.flush = false;
+    options.format = "json";
+    return options;
+}
+
+inline void SplitList(const std::string &value, std::vector<std::string> &out){
+    std::stringstream stream(value);
+    std::string item;
+    while(std::getline(stream, item, ','))
+        if(!item.empty()) out.push_back(item);
+}
+
+inline bool ParseInt(const std::string &value, int &out){
+    char *end = NULL;
+    long parsed = strtol(value.c_str(), &end, 10);
+    if(value.empty() || *end != '\0') return false;
+    out = static_cast<int>(parsed);
+    return true;
+}
+
+inline bool ParseIntList(const std::string &value, std::vector<int> &out){
+    std::vector<std::string> items;
+    SplitList(value, items);
+    for(size_t i = 0; i < items.size(); i++){
+        int parsed;
+        if(!ParseInt(items[i], parsed)) return false;
+        out.push_back(parsed);
+    }
+    return !items.empty();
+}
+
+// Read one path per line from a matrix list file
+inline bool LoadMatrixList(const std::string &path, std::vector<std::string> &matrices){
+    std::ifstream infile(path, std::ifstream::in);
+    if(!infile.is_open()) return false;
+    std::string line;
+    while(std::getline(infile, line)){
+        if(line.empty() || line[0] == '#') continue;
+        matrices.push_back(line);
+    }
+    return true;
+}
+
+inline bool LoadBenchConfig(const std::string &path, BenchOptions &options);
+
+// Apply one name/value pair. Returns false with a message on stderr if the
+// option is unknown or the value is malformed.
+inline bool SetBenchOption(BenchOptions &options, const std::string &name, const std::string &value){
+    bool ok = true;
+    if(name == "op") SplitList(value, options.ops);
+    else if(name == "matrix") SplitList(value, options.matrices);
+    else if(name == "matrix-list") ok = LoadMatrixList(value, options.matrices);
+    else if(name == "dataset-dir") options.dataset_dir = value;
+    else if(name == "n") ok = ParseIntList(value, options.n);
+    else if(name == "v") ok = ParseIntList(value, options.vec_length);
+    else if(name == "preA") ok = ParseInt(value, options.preA);
+    else if(name == "preB") ok = ParseInt(value, options.preB);
+    else if(name == "sort") options.sorted = (value == "1" || value == "true");
+    else if(name == "verify") options.verify = (value == "1" || value == "true");
+    else if(name == "warmup") ok = ParseInt(value, options.warmup);
+    else if(name == "iters") ok = ParseInt(value, options.iters);
+    else if(name == "max-iters") ok = ParseInt(value, options.max_iters);
+    else if(name == "target-ci"){
+        options.target_ci = atof(value.c_str());
+        ok = options.target_ci >= 0;
+    }
+    else if(name == "flush") options.flush = (value == "1" || value == "true");
+    else if(name == "format"){
+        options.format = value;
+        ok = (value == "json" || value == "csv");
+    }
+    else if(name == "output") options.output = value;
+    else if(name == "store") options.store = value;
+    else if(name == "revision") options.revision = value;
+    else if(name == "tuning-db") options.tuning_db = value;
+    else if(name == "config") ok = LoadBenchConfig(value, options);
+    else{
+        fprintf(stderr, "Unknown option: %s\n", name.c_str());
+        return false;
+    }
+    if(!ok) fprintf(stderr, "Invalid value for %s: %s\n", name.c_str(), value.c_str());
+    return ok;
+}
+
+inline std::string TrimSpaces(const std::string &s){
+    size_t begin = s.find_first_not_of(" \t\r");
+    if(begin == std::string::npos) return "";
+    size_t end = s.find_last_not_of(" \t\r");
+    return s.substr(begin, end - begin + 1);
+}
+
+inline bool LoadBenchConfig(const std::string &path, BenchOptions &options){
+    std::ifstream infile(path, std::ifstream::in);
+    if(!infile.is_open()){
+        fprintf(stderr, "Failed to open config %s\n", path.c_str());
+        return false;
+    }
+    std::string line;
+    while(std::getline(infile, line)){
+        line = TrimSpaces(line.substr(0, line.find('#')));
+        if(line.empty()) continue;
+        size_t eq = line.find('=');
+        if(eq == std::string::npos){
+            fprintf(stderr, "%s: expected name = value: %s\n", path.c_str(), line.c_str());
+            return false;
+        }
+        if(!SetBenchOption(options, TrimSpaces(line.substr(0, eq)), TrimSpaces(line.substr(eq + 1))))
+            return false;
+    }
+    return true;
+}
+
+inline bool ParseBenchOptions(int argc, char **argv, BenchOptions &options){
+    for(int i = 1; i < argc; i++){
+        std::string arg(argv[i]);
+        if(arg.compare(0, 2, "--") != 0 || i + 1 >= argc){
+            fprintf(stderr, "Expected --name value, got %s\n", arg.c_str());
+            return false;
+        }
+        if(!SetBenchOption(options, arg.substr(2), argv[++i])) return false;
+    }
+    if(options.ops.empty()) options.ops.push_back("spmm");
+    if(options.n.empty()) options.n.push_back(256);
+    if(options.vec_length.empty()) options.vec_length.push_back(8);
+    if(options.matrices.empty()){
+        fprintf(stderr, "No matrix given, use --matrix or --matrix-list\n");
+        return false;
+    }
+    return true;
+}
+
+inline std::string MatrixPath(const BenchOptions &options, const std::string &matrix){
+    if(options.dataset_dir.empty() || matrix.empty() || matrix[0] == '/') return matrix;
+    return options.dataset_dir + "/" + matrix;
+}
+
+#endif
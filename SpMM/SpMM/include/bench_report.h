@@ -0,0 +1,128 @@
+#ifndef BENCH_REPORT_H
+#define BENCH_REPORT_H
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include "timer.h"
+
+// One measured configuration of the unified benchmark driver, written as a
+// JSON array of objects or as CSV rows with a header.
+
+struct BenchRecord{
+    std::string op;
+    std::string matrix;
+    int64_t m;
+    int64_t k;
+    int64_t n;
+    int vec_length;
+    int preA;
+    int preB;
+    // Launch configuration of the kernel (tiles, warps, row order), part of
+    // the results store key
+    std::string kernel_config;
+    int64_t nonzeros_vec;
+    // Vectors after padding the rows to the kernel alignment
+    int64_t aligned_nonzeros_vec;
+    // Useful flops and the bytes the kernel moves
+    double flops;
+    double bytes;
+    std::vector<double> times_ms;
+    // "pass", "fail" or "skipped"
+    std::string verified;
+    int64_t errors;
+    std::string status;
+
+    double PaddingRatio() const {
+        return nonzeros_vec > 0 ? static_cast<double>(aligned_nonzeros_vec) / nonzeros_vec : 1.0;
+    }
+    TimingStats Stats() const { return ComputeTimingStats(times_ms); }
+    // Throughput at the median runtime
+    double Gflops(const TimingStats &stats) const {
+        return stats.median > 0 ? flops / stats.median / 1e6 : 0;
+    }
+    double Gbs(const TimingStats &stats) const {
+        return stats.median > 0 ? bytes / stats.median / 1e6 : 0;
+    }
+};
+
+inline BenchRecord MakeBenchRecord(const std::string &op, const std::string &matrix, int vec_length, int preA, int preB){
+    BenchRecord record;
+    record.op = op;
+    record.matrix = matrix;
+    record.m = record.k = record.n = 0;
+    record.vec_length = vec_length;
+    record.preA = preA;
+    record.preB = preB;
+    record.kernel_config = "default";
+    record.nonzeros_vec = record.aligned_nonzeros_vec = 0;
+    record.flops = record.bytes = 0;
+    record.verified = "skipped";
+    record.errors = 0;
+    record.status = "ok";
+    return record;
+}
+
+// Escape the characters JSON does not allow in a string
+inline std::string JsonEscape(const std::string &s){
+    std::string escaped;
+    for(size_t i = 0; i < s.size(); i++){
+        const unsigned char c = static_cast<unsigned char>(s[i]);
+        if(c < 0x20){
+            // Control characters are not allowed raw in JSON strings
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", c);
+            escaped += code;
+            continue;
+        }
+        if(c == '"' || c == '\\') escaped += '\\';
+        escaped += s[i];
+    }
+    return escaped;
+}
+
+inline void WriteBenchJson(FILE *out, const std::vector<BenchRecord> &records){
+    fprintf(out, "[\n");
+    for(size_t r = 0; r < records.size(); r++){
+        const BenchRecord &rec = records[r];
+        const TimingStats stats = rec.Stats();
+        fprintf(out, "  {\"op\": \"%s\", \"matrix\": \"%s\", \"status\": \"%s\", \"kernel_config\": \"%s\",\n",
+                rec.op.c_str(), JsonEscape(rec.matrix).c_str(), JsonEscape(rec.status).c_str(),
+                JsonEscape(rec.kernel_config).c_str());
+        fprintf(out, "   \"m\": %lld, \"k\": %lld, \"n\": %lld, \"vec_length\": %d, \"preA\": %d, \"preB\": %d,\n",
+                (long long)rec.m, (long long)rec.k, (long long)rec.n, rec.vec_length, rec.preA, rec.preB);
+        fprintf(out, "   \"nonzeros_vec\": %lld, \"aligned_nonzeros_vec\": %lld, \"padding_ratio\": %.4f,\n",
+                (long long)rec.nonzeros_vec, (long long)rec.aligned_nonzeros_vec, rec.PaddingRatio());
+        fprintf(out, "   \"mean_ms\": %.6f, \"median_ms\": %.6f, \"p95_ms\": %.6f, \"p99_ms\": %.6f, \"min_ms\": %.6f,\n",
+                stats.mean, stats.median, stats.p95, stats.p99, stats.min);
+        fprintf(out, "   \"stddev_ms\": %.6f, \"ci95_ms\": %.6f, \"gflops\": %.3f, \"gbs\": %.3f,\n",
+                stats.stddev, stats.ci95, rec.Gflops(stats), rec.Gbs(stats));
+        fprintf(out, "   \"verified\": \"%s\", \"errors\": %lld,\n", rec.verified.c_str(), (long long)rec.errors);
+        fprintf(out, "   \"times_ms\": [");
+        for(size_t i = 0; i < rec.times_ms.size(); i++)
+            fprintf(out, "%s%.6f", i ? ", " : "", rec.times_ms[i]);
+        fprintf(out, "]}%s\n", r + 1 < records.size() ? "," : "");
+    }
+    fprintf(out, "]\n");
+}
+
+// The per-iteration times go into the last column, separated by ';'
+inline void WriteBenchCsv(FILE *out, const std::vector<BenchRecord> &records){
+    fprintf(out, "op,matrix,status,kernel_config,m,k,n,vec_length,preA,preB,nonzeros_vec,aligned_nonzeros_vec,padding_ratio,"
+                 "mean_ms,median_ms,p95_ms,p99_ms,min_ms,stddev_ms,ci95_ms,gflops,gbs,verified,errors,times_ms\n");
+    for(size_t r = 0; r < records.size(); r++){
+        const BenchRecord &rec = records[r];
+        const TimingStats stats = rec.Stats();
+        fprintf(out, "%s,\"%s\",\"%s\",%s,%lld,%lld,%lld,%d,%d,%d,%lld,%lld,%.4f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.3f,%.3f,%s,%lld,",
+                rec.op.c_str(), rec.matrix.c_str(), rec.status.c_str(), rec.kernel_config.c_str(), (long long)rec.m, (long long)rec.k,
+                (long long)rec.n, rec.vec_length, rec.preA, rec.preB, (long long)rec.nonzeros_vec,
+                (long long)rec.aligned_nonzeros_vec, rec.PaddingRatio(), stats.mean, stats.median, stats.p95, stats.p99,
+                stats.min, stats.stddev, stats.ci95, rec.Gflops(stats), rec.Gbs(stats), rec.verified.c_str(), (long long)rec.errors);
+        for(size_t i = 0; i < rec.times_ms.size(); i++)
+            fprintf(out, "%s%.6f", i ? ";" : "", rec.times_ms[i]);
+        fprintf(out, "\n");
+    }
+}
+
+#endif
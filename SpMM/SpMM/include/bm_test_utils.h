@@ -7,6 +7,7 @@
 #include "cuda_fp16.h"
 #include <assert.h>
 #include <cublas_v2.h>
+#include <cusparse.h>
 
 inline
 cudaError_t checkCuda(cudaError_t result){
@@ -42,6 +43,15 @@ cublasStatus_t checkCublas(cublasStatus_t result){
     return result;
 }
 
+inline
+cusparseStatus_t checkCusparse(cusparseStatus_t result){
+    if (result != CUSPARSE_STATUS_SUCCESS) {
+        fprintf(stderr, "cuSPARSE Error: %s\n", cusparseGetErrorString(result));
+        assert(result == CUSPARSE_STATUS_SUCCESS);
+    }
+    return result;
+}
+
 
 // Helper function that generates random column indices for Blocked ELL format
 void GenerateUniformBlockedELLIndex(int num_block_col, 
@@ -128,11 +138,11 @@ void MakeSparseMatrixRandomUniform(int rows, int columns, int nonzeros,
 
 
 template <typename ValueType>
-void MakeDenseMatrix(int rows, int columns, ValueType *matrix,
+void MakeDenseMatrix(int64_t rows, int64_t columns, ValueType *matrix,
                      std::default_random_engine generator)
 {
     std::uniform_real_distribution<float> distribution(0.0, 1.0);
-    for(int64_t i = 0; i < static_cast<int64_t>(rows) * columns; ++i){
+    for(int64_t i = 0; i < rows * columns; ++i){
 	if(typeid(matrix[i]) == typeid(int)){
             float temp = 2147483647.0*distribution(generator);
             //matrix[i] = ValueType(temp);
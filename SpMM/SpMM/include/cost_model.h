@@ -0,0 +1,277 @@
+#ifndef COST_MODEL_H
+#define COST_MODEL_H
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <stdio.h>
+#include "spmm_packer.h"
+#include "skinny_spmm.h"
+
+// Analytic cost model of the wmmaSpmm kernels. For a vector-sparse matrix, N,
+// vec_length and (preA, preB) it counts what the kernel launched by the
+// dispatchers in src/wmma_spmm.cu loads and issues, and predicts the runtime
+// under a simple roofline machine model. The skinny kernels of
+// skinny_spmm.h issue dp4a instead of mma and have their own estimate.
+
+// Template arguments of a wmmaSpmm_*_template instantiation
+struct SpmmKernelConfig{
+    int tile_m;
+    int tile_k;
+    int tile_n;
+    int warps;
+};
+
+// Short name of a configuration for reports and the results store, e.g.
+// "1x16x128w4" (tile_m x tile_k x tile_n, warps)
+inline std::string SpmmKernelConfigName(const SpmmKernelConfig &config){
+    char name[64];
+    snprintf(name, sizeof(name), "%dx%dx%dw%d", config.tile_m, config.tile_k, config.tile_n, config.warps);
+    return name;
+}
+
+// Precision pairs that have a dispatcher
+inline bool SpmmPrecisionSupported(int preA, int preB){
+    if(preB == 4) return preA == 4 || preA == 8 || preA == 12 || preA == 16;
+    if(preB == 8) return preA == 8 || preA == 12 || preA == 16;
+    return preA == 16 && preB == 16;
+}
+
+// The configuration hard-coded in the dispatcher of (preA, preB)
+inline SpmmKernelConfig DefaultSpmmKernelConfig(int preA, int preB){
+    SpmmKernelConfig config;
+    config.tile_m = 1;
+    config.tile_k = MmaKDim(preA, preB);
+    if(config.tile_k == 32){
+        config.tile_n = 128;
+        config.warps = 2;
+    }
+    else{
+        config.tile_n = (preB == 16) ? 64 : 128;
+        config.warps = 4;
+    }
+    return config;
+}
+
+// The configuration SelectWmmaSpmm(preA, preB, n) launches: the skinny
+// kernels run Warps = 4 vector rows per block over n rounded up to their
+// column template, the others the one configuration of their dispatcher
+inline SpmmKernelConfig SpmmDispatchedConfig(int preA, int preB, int64_t n){
+    SpmmKernelConfig config = DefaultSpmmKernelConfig(preA, preB);
+    if(UseSkinnySpmm(preA, preB, n)){
+        config.tile_m = 4;
+        config.warps = 4;
+        config.tile_n = 1;
+        while(config.tile_n < n) config.tile_n *= 2;
+    }
+    return config;
+}
+
+// Throughput figures of the target GPU. The defaults describe an A100.
+struct MachineModel{
+    int sm_count;
+    double clock_ghz;
+    double dram_gbs;
+    double l2_gbs;
+    // m8n8k16 (8-bit) or m8n8k32 (4-bit) mma issued per SM per cycle. The
+    // legacy m8n8 shapes do not reach the m16n8 peak of one per cycle.
+    double mma_per_sm_cycle;
+    // dp4a issued per SM per cycle (thread instructions)
+    double dp4a_per_sm_cycle;
+    // Fraction of the rhs loads served by L2
+    double rhs_l2_hit_rate;
+    double launch_us;
+};
+
+inline MachineModel DefaultMachineModel(){
+    MachineModel machine;
+    machine.sm_count = 108;
+    machine.clock_ghz = 1.41;
+    machine.dram_gbs = 1555.0;
+    machine.l2_gbs = 4800.0;
+    machine.mma_per_sm_cycle = 0.5;
+    machine.dp4a_per_sm_cycle = 64.0;
+    machine.rhs_l2_hit_rate = 0.8;
+    machine.launch_us = 3.0;
+    return machine;
+}
+
+struct SpmmCost{
+    int preA;
+    int preB;
+    int vec_length;
+    int64_t n;
+    int mma_k_dim;
+    SpmmKernelConfig config;
+    int64_t grid_m;
+    int64_t grid_n;
+    // Vectors before and after the mma_k_dim padding of aligned_row_offsets
+    int64_t nonzeros_vec;
+    int64_t aligned_nonzeros_vec;
+    // Bytes loaded by all thread blocks
+    int64_t index_bytes;
+    int64_t value_bytes;
+    int64_t rhs_bytes;
+    int64_t output_bytes;
+    // "mma", or "dp4a" for the skinny kernels
+    const char *engine;
+    // Operand planes of the decomposition and mma (or dp4a) instructions
+    // issued
+    int planes_a;
+    int planes_b;
+    int64_t mma_count;
+    // Multiply-adds of the real nonzeros and of all issued mma
+    double useful_macs;
+    double issued_macs;
+    // Model outputs
+    double dram_bytes;
+    double l2_bytes;
+    double mma_us;
+    double dram_us;
+    double l2_us;
+    double predicted_us;
+    const char *bound;
+};
+
+// Bits of storage per lhs value: 12-bit values are stored as 16-bit words
+inline int SpmmValueBits(int preA){
+    return preA == 12 ? 16 : preA;
+}
+
+// Same rounding as AlignRowOffsets
+template <typename IndexType>
+int64_t AlignedNonzerosVec(int64_t m_vec, const IndexType *row_offsets, int mma_k_dim){
+    int64_t aligned = 0;
+    for(int64_t i = 0; i < m_vec; i++){
+        int64_t num_item = row_offsets[i+1] - row_offsets[i];
+        aligned += (num_item + mma_k_dim - 1) / mma_k_dim * mma_k_dim;
+    }
+    return aligned;
+}
+
+// Roofline of a cost whose bytes and compute_us are filled in: the sparse
+// operand and the output stream from DRAM, the rhs mostly hits in L2
+inline void FinishSpmmRoofline(SpmmCost &cost, double compute_us, const MachineModel &machine){
+    const double sparse_bytes = static_cast<double>(cost.index_bytes + cost.value_bytes);
+    cost.dram_bytes = sparse_bytes + cost.output_bytes + cost.rhs_bytes * (1.0 - machine.rhs_l2_hit_rate);
+    cost.l2_bytes = sparse_bytes + cost.output_bytes + static_cast<double>(cost.rhs_bytes);
+    cost.mma_us = compute_us;
+    cost.dram_us = cost.dram_bytes / (machine.dram_gbs * 1e3);
+    cost.l2_us = cost.l2_bytes / (machine.l2_gbs * 1e3);
+    cost.predicted_us = machine.launch_us + std::max(cost.mma_us, std::max(cost.dram_us, cost.l2_us));
+    if(cost.mma_us >= cost.dram_us && cost.mma_us >= cost.l2_us) cost.bound = "compute";
+    else if(cost.dram_us >= cost.l2_us) cost.bound = "dram";
+    else cost.bound = "l2";
+}
+
+template <typename IndexType>
+SpmmCost EstimateSpmmCost(int64_t m_vec, const IndexType *row_offsets, int64_t n, int vec_length,
+                          int preA, int preB, const SpmmKernelConfig &config, const MachineModel &machine){
+    SpmmCost cost;
+    cost.preA = preA;
+    cost.preB = preB;
+    cost.vec_length = vec_length;
+    cost.n = n;
+    cost.mma_k_dim = MmaKDim(preA, preB);
+    cost.config = config;
+    cost.grid_m = (m_vec + config.tile_m - 1) / config.tile_m;
+    cost.grid_n = (n + config.tile_n - 1) / config.tile_n;
+    cost.nonzeros_vec = row_offsets[m_vec] - row_offsets[0];
+    cost.aligned_nonzeros_vec = AlignedNonzerosVec(m_vec, row_offsets, cost.mma_k_dim);
+    cost.engine = "mma";
+
+    // Every column tile of a vector row reloads its indices and values, and
+    // the rhs rows of all its vectors, padding included
+    const int64_t padded_n = cost.grid_n * config.tile_n;
+    cost.index_bytes = cost.grid_n * cost.aligned_nonzeros_vec * static_cast<int64_t>(sizeof(int));
+    cost.value_bytes = cost.grid_n * cost.aligned_nonzeros_vec * vec_length * SpmmValueBits(preA) / 8;
+    cost.rhs_bytes = cost.aligned_nonzeros_vec * padded_n * preB / 8;
+    cost.output_bytes = m_vec * vec_length * n * static_cast<int64_t>(sizeof(int));
+
+    // The operands are split into planes of the mma input width. The lhs
+    // planes of a vector are stacked along the 8 rows of the mma, so 12b and
+    // 16b operands issue ceil(planes_a * vec_length / 8) times the MMAs.
+    const int plane_bits = (cost.mma_k_dim == 32) ? 4 : 8;
+    cost.planes_a = (preA + plane_bits - 1) / plane_bits;
+    cost.planes_b = (preB + plane_bits - 1) / plane_bits;
+    const int64_t mma_per_step = (config.tile_n / 8) * ((cost.planes_a * vec_length + 7) / 8) * cost.planes_b;
+    cost.mma_count = cost.grid_n * (cost.aligned_nonzeros_vec / cost.mma_k_dim) * mma_per_step;
+    cost.useful_macs = static_cast<double>(cost.nonzeros_vec) * vec_length * n;
+    cost.issued_macs = static_cast<double>(cost.mma_count) * 8 * 8 * cost.mma_k_dim;
+
+    FinishSpmmRoofline(cost, cost.mma_count / (machine.sm_count * machine.mma_per_sm_cycle * machine.clock_ghz * 1e3), machine);
+    return cost;
+}
+
+// The skinny kernels (n <= kSkinnyMaxN): one warp per vector row reads the
+// row's indices and skinny-packed values once, every lane gathers the rhs
+// word of its column for each nonzero, and a packed lhs word costs one dp4a
+// per vector lane and nibble plane for each of the tile_n columns.
+template <typename IndexType>
+SpmmCost EstimateSkinnySpmmCost(int64_t m_vec, const IndexType *row_offsets, int64_t n, int vec_length,
+                                int preA, int preB, const MachineModel &machine){
+    SpmmCost cost;
+    cost.preA = preA;
+    cost.preB = preB;
+    cost.vec_length = vec_length;
+    cost.n = n;
+    cost.mma_k_dim = MmaKDim(preA, preB);
+    cost.config = SpmmDispatchedConfig(preA, preB, n);
+    cost.grid_m = (m_vec + cost.config.warps - 1) / cost.config.warps;
+    cost.grid_n = 1;
+    cost.nonzeros_vec = row_offsets[m_vec] - row_offsets[0];
+    cost.aligned_nonzeros_vec = AlignedNonzerosVec(m_vec, row_offsets, cost.mma_k_dim);
+    cost.engine = "dp4a";
+
+    const int items_a = 32 / preA;
+    const int64_t words = cost.aligned_nonzeros_vec / items_a;
+    cost.index_bytes = cost.aligned_nonzeros_vec * static_cast<int64_t>(sizeof(int));
+    cost.value_bytes = SkinnyValueWords(cost.aligned_nonzeros_vec, vec_length, preA) * static_cast<int64_t>(sizeof(int));
+    cost.rhs_bytes = cost.aligned_nonzeros_vec * SkinnyRowWords(n, preB) * static_cast<int64_t>(sizeof(int));
+    cost.output_bytes = m_vec * vec_length * n * static_cast<int64_t>(sizeof(int));
+
+    cost.planes_a = items_a / 4;
+    cost.planes_b = 1;
+    cost.mma_count = words * vec_length * cost.planes_a * cost.config.tile_n;
+    cost.useful_macs = static_cast<double>(cost.nonzeros_vec) * vec_length * n;
+    cost.issued_macs = static_cast<double>(cost.mma_count) * 4;
+
+    FinishSpmmRoofline(cost, cost.mma_count / (machine.sm_count * machine.dp4a_per_sm_cycle * machine.clock_ghz * 1e3), machine);
+    return cost;
+}
+
+// Cost of the kernel SelectWmmaSpmm(preA, preB, n) launches
+template <typename IndexType>
+SpmmCost EstimateDispatchedSpmmCost(int64_t m_vec, const IndexType *row_offsets, int64_t n, int vec_length,
+                                    int preA, int preB, const MachineModel &machine){
+    if(UseSkinnySpmm(preA, preB, n))
+        return EstimateSkinnySpmmCost<IndexType>(m_vec, row_offsets, n, vec_length, preA, preB, machine);
+    return EstimateSpmmCost<IndexType>(m_vec, row_offsets, n, vec_length, preA, preB,
+                                       DefaultSpmmKernelConfig(preA, preB), machine);
+}
+
+inline void WriteSpmmCostJson(FILE *out, const SpmmCost &cost, const MachineModel &machine){
+    fprintf(out, "{\n");
+    fprintf(out, "  \"preA\": %d, \"preB\": %d, \"vec_length\": %d, \"n\": %lld, \"mma_k_dim\": %d,\n",
+            cost.preA, cost.preB, cost.vec_length, (long long)cost.n, cost.mma_k_dim);
+    fprintf(out, "  \"config\": {\"tile_m\": %d, \"tile_k\": %d, \"tile_n\": %d, \"warps\": %d},\n",
+            cost.config.tile_m, cost.config.tile_k, cost.config.tile_n, cost.config.warps);
+    fprintf(out, "  \"grid\": [%lld, %lld],\n", (long long)cost.grid_m, (long long)cost.grid_n);
+    fprintf(out, "  \"nonzeros_vec\": %lld, \"aligned_nonzeros_vec\": %lld,\n",
+            (long long)cost.nonzeros_vec, (long long)cost.aligned_nonzeros_vec);
+    fprintf(out, "  \"bytes\": {\"indices\": %lld, \"values\": %lld, \"rhs\": %lld, \"output\": %lld},\n",
+            (long long)cost.index_bytes, (long long)cost.value_bytes, (long long)cost.rhs_bytes, (long long)cost.output_bytes);
+    fprintf(out, "  \"mma\": {\"engine\": \"%s\", \"planes_a\": %d, \"planes_b\": %d, \"count\": %lld, \"useful_macs\": %.0f, \"issued_macs\": %.0f},\n",
+            cost.engine, cost.planes_a, cost.planes_b, (long long)cost.mma_count, cost.useful_macs, cost.issued_macs);
+    fprintf(out, "  \"machine\": {\"sm_count\": %d, \"clock_ghz\": %g, \"dram_gbs\": %g, \"l2_gbs\": %g, "
+                 "\"mma_per_sm_cycle\": %g, \"dp4a_per_sm_cycle\": %g, \"rhs_l2_hit_rate\": %g, \"launch_us\": %g},\n",
+            machine.sm_count, machine.clock_ghz, machine.dram_gbs, machine.l2_gbs,
+            machine.mma_per_sm_cycle, machine.dp4a_per_sm_cycle, machine.rhs_l2_hit_rate, machine.launch_us);
+    fprintf(out, "  \"roofline\": {\"dram_bytes\": %.0f, \"l2_bytes\": %.0f, \"intensity\": %.4f, "
+                 "\"mma_us\": %.3f, \"dram_us\": %.3f, \"l2_us\": %.3f, \"bound\": \"%s\"},\n",
+            cost.dram_bytes, cost.l2_bytes, cost.useful_macs * 2 / cost.dram_bytes,
+            cost.mma_us, cost.dram_us, cost.l2_us, cost.bound);
+    fprintf(out, "  \"predicted_us\": %.3f\n", cost.predicted_us);
+    fprintf(out, "}\n");
+}
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef CPU_SPMM_H
+#define CPU_SPMM_H
+#include <cstdint>
+
+inline int power2n(int n){
+    int exp=1;
+    for(int i=0; i < n; i++)
+        exp *= 2;
+    return exp;
+}
+
+// CPU reference of the quantized SpMM on the unpacked vector-sparse CSR.
+// A holds scaleA words of TypeA per nonzero vector, B holds 32/preB values per
+// int. IndexType is the type of row_offsets/col_indices; output positions are
+// computed in 64-bit so M_GLOBAL * N_GLOBAL may exceed 2^31.
+// vector type size larger than long long
+template <typename TypeA, typename IndexType>
+double compute_ref_integers(const TypeA *A, const int *B, int *ref_C, int64_t M_GLOBAL, int64_t K_GLOBAL, int64_t N_GLOBAL, int preA, int preA_cut, int preB, int vec_length, const IndexType *row_offsets, const IndexType *col_indices, int64_t m_vec, int scaleA) {
+    TypeA maskA = (TypeA)(power2n(preA)-1); //0b0000000011111111 for 8 bits
+    int maskB = power2n(preB)-1; //0b0000000011111111 for 8 bits
+    TypeA maskA_cut = (TypeA)(power2n(preA_cut)-1); //0b0000111111111111 for 12 bits
+
+    // Initialize the output matrix with 0
+    for(int64_t i=0; i < M_GLOBAL * N_GLOBAL; i++){
+        ref_C[i] = 0;
+    }
+
+    double flops = 0;
+    int b_tile = 32/preB;
+    // Rows start on a new int; the last one may be partly used (skinny N)
+    int64_t b_row_words = (N_GLOBAL + b_tile - 1)/b_tile;
+    // traverse all the vector rows
+    for(int64_t i=0; i < m_vec; i++){
+        // traverse all the nonzero columns in this row
+        for(int64_t j=row_offsets[i]; j < row_offsets[i+1]; j++){
+            int64_t col_idx = col_indices[j];
+            // traverse all the elements in the vector
+            for(int tt=0; tt<scaleA; tt++){
+                TypeA A_vec_tile = A[j * scaleA + tt];
+                for(int av=0; av < vec_length/scaleA; av++){
+                    int64_t row_idx = i*vec_length + av + tt*vec_length/scaleA;
+                    int shift_a = av*preA;
+                    int a_val = (int)((((maskA << shift_a) & A_vec_tile) >> shift_a) & maskA_cut);
+                    int *ref_C_row = ref_C + row_idx*N_GLOBAL;
+                    for(int64_t n=0; n < b_row_words; n++){
+                        int B_tile = B[col_idx * b_row_words + n];
+                        for(int bv=0; bv < b_tile && n*b_tile + bv < N_GLOBAL; bv++){
+                            int shift_b = bv*preB;
+                            int b_val = ((maskB << shift_b) & B_tile) >> shift_b;
+                            ref_C_row[n*b_tile + bv] += a_val*b_val;
+                        }
+                    }
+                    flops += 2.0 * N_GLOBAL;
+                }
+            }
+        }
+    }
+    return flops;
+}
+
+#endif
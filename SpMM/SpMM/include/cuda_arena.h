@@ -0,0 +1,39 @@
+#ifndef CUDA_ARENA_H
+#define CUDA_ARENA_H
+#include <cuda_runtime.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "arena.h"
+
+// Device backend of the size-class arena: cudaMalloc'd blocks are kept on
+// the free lists between calls instead of going through cudaMalloc/cudaFree
+// for every configuration.
+struct DevicePages{
+    static void *Map(size_t bytes){
+        void *p = NULL;
+        if(cudaMalloc(&p, bytes) != cudaSuccess) return NULL;
+        return p;
+    }
+    static void Unmap(void *p, size_t){ cudaFree(p); }
+    static void Prefault(void *, size_t){}
+    static void Zero(void *p, size_t bytes){
+        const cudaError_t result = cudaMemset(p, 0, bytes);
+        if(result != cudaSuccess){
+            fprintf(stderr, "device arena: cudaMemset of %zu bytes failed: %s\n", bytes, cudaGetErrorString(result));
+            abort();
+        }
+    }
+    static const char *Name(){ return "device"; }
+};
+
+typedef SizeClassArena<DevicePages> DeviceArena;
+
+// Process-wide arena of the current device. It is never destroyed: a static
+// destructor would run cudaFree after the CUDA runtime has shut down, so
+// drivers call Trim() before they return from main.
+inline DeviceArena &GlobalDeviceArena(){
+    static DeviceArena *arena = new DeviceArena();
+    return *arena;
+}
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef EPILOGUE_H
+#define EPILOGUE_H
+#include <cstdint>
+#include <math.h>
+#include <stdio.h>
+
+#ifdef __CUDACC__
+#define EPILOGUE_HOST_DEVICE __host__ __device__
+#else
+#define EPILOGUE_HOST_DEVICE
+#endif
+
+// Epilogue fused into the output tiles of the integer wmmaSpmm kernels, and
+// its CPU counterpart. Every int32 accumulator goes through
+//
+//   acc += bias[row]                          bias in accumulator units
+//   x = activation(acc)                       none, ReLU or GELU
+//   out = x                                   out_bits == 32
+//   out = clamp(trunc(x / scale * out_scale)) out_bits == 8 or 4
+//
+// scale is the quantization scale of the accumulator (the product of the
+// operand scales, the dequantizing kernels divide by it) and out_scale the
+// one of the next layer's operand. GELU is computed on acc / scale; with an
+// int32 output its result is multiplied back by scale.
+//
+// Requantized values are clamped to [0, 2^out_bits - 1], the operand range of
+// the u8 / u4 mma kernels, and packed 32 / out_bits per int with column c of
+// a row at bits (c % items) * out_bits of int c / items: the dimM x dimN
+// output is the row-major packed rhs a wmmaSpmm kernel of preB = out_bits
+// takes as the next layer's operand.
+
+enum EpilogueActivation{
+    kEpilogueNone = 0,
+    kEpilogueRelu = 1,
+    kEpilogueGelu = 2
+};
+
+struct SpmmEpilogue{
+    // dimM int32 biases, NULL for none; device memory for the kernels and
+    // host memory for ApplyEpilogueRef
+    const int *bias;
+    int activation;
+    float scale;
+    float out_scale;
+    // 32 (int32 output), 8 or 4 (packed)
+    int out_bits;
+};
+
+inline SpmmEpilogue IdentityEpilogue(){
+    SpmmEpilogue epilogue;
+    epilogue.bias = NULL;
+    epilogue.activation = kEpilogueNone;
+    epilogue.scale = 1.0f;
+    epilogue.out_scale = 1.0f;
+    epilogue.out_bits = 32;
+    return epilogue;
+}
+
+inline bool EpilogueSupported(const SpmmEpilogue &epilogue){
+    if (epilogue.out_bits != 32 && epilogue.out_bits != 8 && epilogue.out_bits != 4) return false;
+    if (epilogue.activation < kEpilogueNone || epilogue.activation > kEpilogueGelu) return false;
+    return epilogue.scale > 0.0f && epilogue.out_scale > 0.0f;
+}
+
+// Output ints of a row of cols columns
+inline int64_t EpilogueRowWords(int64_t cols, int out_bits){
+    return cols * out_bits / 32;
+}
+
+EPILOGUE_HOST_DEVICE inline float EpilogueGelu(float x){
+    return 0.5f * x * (1.0f + tanhf(0.7978845608f * (x + 0.044715f * x * x * x)));
+}
+
+// One accumulator through the epilogue, bias already loaded
+EPILOGUE_HOST_DEVICE inline int EpilogueValue(const SpmmEpilogue &epilogue, int acc, int bias){
+    acc += bias;
+    if (epilogue.out_bits == 32){
+        if (epilogue.activation == kEpilogueRelu) return acc > 0 ? acc : 0;
+        if (epilogue.activation == kEpilogueGelu) return (int)(EpilogueGelu(acc / epilogue.scale) * epilogue.scale);
+        return acc;
+    }
+    float x = acc / epilogue.scale;
+    if (epilogue.activation == kEpilogueRelu) x = x > 0.0f ? x : 0.0f;
+    else if (epilogue.activation == kEpilogueGelu) x = EpilogueGelu(x);
+    const float qmax = (float)((1 << epilogue.out_bits) - 1);
+    float q = x * epilogue.out_scale;
+    q = q < 0.0f ? 0.0f : (q > qmax ? qmax : q);
+    return (int)q;
+}
+
+// Packs 32 / out_bits epilogue outputs into one int
+EPILOGUE_HOST_DEVICE inline int EpiloguePack(const int *values, int out_bits){
+    const int items = 32 / out_bits;
+    unsigned int packed = 0;
+    for (int i = 0; i < items; i++)
+        packed |= (unsigned int)values[i] << (i * out_bits);
+    return (int)packed;
+}
+
+// CPU epilogue over the int32 reference output of compute_ref_integers.
+// output holds rows x EpilogueRowWords(cols, out_bits) ints.
+inline void ApplyEpilogueRef(const int *acc, int64_t rows, int64_t cols, const SpmmEpilogue &epilogue, int *output){
+    const int items = 32 / epilogue.out_bits;
+    const int64_t row_words = EpilogueRowWords(cols, epilogue.out_bits);
+    int values[8];
+    for (int64_t r = 0; r < rows; r++){
+        const int bias = epilogue.bias != NULL ? epilogue.bias[r] : 0;
+        for (int64_t w = 0; w < row_words; w++){
+            for (int i = 0; i < items; i++)
+                values[i] = EpilogueValue(epilogue, acc[r * cols + w * items + i], bias);
+            output[r * row_words + w] = items == 1 ? values[0] : EpiloguePack(values, epilogue.out_bits);
+        }
+    }
+}
+
+// Unpacks an epilogue output back to rows x cols ints
+inline void EpilogueUnpack(const int *output, int64_t rows, int64_t cols, int out_bits, int *values){
+    const int items = 32 / out_bits;
+    const unsigned int mask = out_bits == 32 ? 0xffffffffu : (1u << out_bits) - 1;
+    for (int64_t i = 0; i < rows * cols; i++){
+        const unsigned int word = (unsigned int)output[i / items];
+        values[i] = (int)((word >> ((i % items) * out_bits)) & mask);
+    }
+}
+
+#endif
@@ -0,0 +1,222 @@
+#ifndef HYBRID_FORMAT_H
+#define HYBRID_FORMAT_H
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "index_utils.h"
+
+// Hybrid vector-sparse format with a per-panel vec_length.
+//
+// The matrix is cut into row panels of kHybridPanelRows rows. Each panel is
+// stored as kHybridPanelRows / v vector rows of length v, where v is chosen per
+// panel from {2, 4, 8}. All panels that share a v form one group, which is a
+// plain vector-sparse CSR and can be packed and launched like a regular
+// matrix with vec_length = v. Vector row r of a group writes output rows
+// starting at VectorRowOutputRow(group, r).
+
+static const int kHybridPanelRows = 8;
+static const int kHybridVecLengths[3] = {2, 4, 8};
+
+template <typename ValueType, typename IndexType>
+struct HybridGroup{
+    int vec_length;
+    // Panels stored in this group, in increasing order
+    std::vector<IndexType> panel_ids;
+    // Vector-sparse CSR over the vector rows of this group
+    std::vector<IndexType> row_offsets;
+    std::vector<IndexType> col_indices;
+    // vec_length values per nonzero vector, value v of the vector belongs to
+    // the v-th row of the vector row. Missing entries are explicit zeros.
+    std::vector<ValueType> values;
+
+    IndexType NumVectorRows() const {
+        return static_cast<IndexType>(row_offsets.size() - 1);
+    }
+};
+
+template <typename ValueType, typename IndexType>
+struct HybridMatrix{
+    IndexType rows;
+    IndexType cols;
+    // vec_length chosen for every panel
+    std::vector<int> panel_vec_length;
+    // One group per entry of kHybridVecLengths
+    HybridGroup<ValueType, IndexType> groups[3];
+};
+
+// First output row written by vector row r of a group
+template <typename ValueType, typename IndexType>
+int64_t VectorRowOutputRow(const HybridGroup<ValueType, IndexType> &group, int64_t r){
+    const int vectors_per_panel = kHybridPanelRows / group.vec_length;
+    return static_cast<int64_t>(group.panel_ids[r / vectors_per_panel]) * kHybridPanelRows +
+           (r % vectors_per_panel) * group.vec_length;
+}
+
+// Storage estimate of one panel stored with a given vec_length
+struct PanelCost{
+    int vec_length;
+    // Number of stored vectors after padding each vector row to mma_k_dim
+    int64_t stored_vectors;
+    // Stored value slots that hold a padding zero
+    int64_t stored_zeros;
+    // Bytes of values and column indices
+    int64_t bytes;
+};
+
+// Estimate the storage of the panel starting at row panel_begin when stored
+// with vec_length. Rows past the end of the matrix count as empty.
+template <typename IndexType>
+PanelCost EstimatePanelCost(IndexType rows, const IndexType *row_offsets, const IndexType *col_indices,
+                            int64_t panel_begin, int vec_length, int mma_k_dim, int value_bits,
+                            std::vector<IndexType> &scratch){
+    PanelCost cost;
+    cost.vec_length = vec_length;
+    cost.stored_vectors = 0;
+    cost.stored_zeros = 0;
+    int64_t real_nnz = 0;
+    for(int64_t vr = panel_begin; vr < panel_begin + kHybridPanelRows; vr += vec_length){
+        // The columns of a vector row are the union of the columns of its rows
+        scratch.clear();
+        for(int64_t r = vr; r < std::min<int64_t>(vr + vec_length, rows); r++){
+            scratch.insert(scratch.end(), col_indices + row_offsets[r], col_indices + row_offsets[r+1]);
+            real_nnz += row_offsets[r+1] - row_offsets[r];
+        }
+        std::sort(scratch.begin(), scratch.end());
+        int64_t num_vectors = std::unique(scratch.begin(), scratch.end()) - scratch.begin();
+        // Same mma_k_dim padding as AlignRowOffsets
+        cost.stored_vectors += (num_vectors + mma_k_dim - 1) / mma_k_dim * mma_k_dim;
+    }
+    cost.stored_zeros = cost.stored_vectors * vec_length - real_nnz;
+    cost.bytes = (cost.stored_vectors * vec_length * value_bits + 7) / 8 + cost.stored_vectors * static_cast<int64_t>(sizeof(int));
+    return cost;
+}
+
+// Choose the vec_length of every panel. Counting stored zeros alone would
+// always pick the shortest vector, so the panels are compared by their total
+// footprint: the padding zeros plus the column indices, which shrink as
+// vectors get longer. Ties go to the longer vector, which issues fewer MMAs.
+template <typename IndexType>
+std::vector<int> SelectPanelVecLengths(IndexType rows, const IndexType *row_offsets, const IndexType *col_indices,
+                                       int mma_k_dim, int value_bits){
+    const int64_t num_panels = (static_cast<int64_t>(rows) + kHybridPanelRows - 1) / kHybridPanelRows;
+    std::vector<int> panel_vec_length(num_panels);
+    std::vector<IndexType> scratch;
+    for(int64_t p = 0; p < num_panels; p++){
+        PanelCost best = EstimatePanelCost<IndexType>(rows, row_offsets, col_indices, p * kHybridPanelRows,
+                                                      kHybridVecLengths[2], mma_k_dim, value_bits, scratch);
+        for(int c = 1; c >= 0; c--){
+            PanelCost cost = EstimatePanelCost<IndexType>(rows, row_offsets, col_indices, p * kHybridPanelRows,
+                                                          kHybridVecLengths[c], mma_k_dim, value_bits, scratch);
+            if(cost.bytes < best.bytes) best = cost;
+        }
+        panel_vec_length[p] = best.vec_length;
+    }
+    return panel_vec_length;
+}
+
+// Convert a plain CSR matrix to the hybrid format. When panel_vec_length is
+// empty the vec_length of every panel is chosen by SelectPanelVecLengths.
+// Column indices within a row must be sorted.
+template <typename ValueType, typename IndexType>
+void CsrToHybrid(IndexType rows, IndexType cols, const IndexType *row_offsets, const IndexType *col_indices,
+                 const ValueType *values, int mma_k_dim, int value_bits,
+                 HybridMatrix<ValueType, IndexType> &hybrid,
+                 std::vector<int> panel_vec_length = std::vector<int>()){
+    if(panel_vec_length.empty())
+        panel_vec_length = SelectPanelVecLengths<IndexType>(rows, row_offsets, col_indices, mma_k_dim, value_bits);
+    hybrid.rows = rows;
+    hybrid.cols = cols;
+    hybrid.panel_vec_length = panel_vec_length;
+
+    for(int g = 0; g < 3; g++){
+        HybridGroup<ValueType, IndexType> &group = hybrid.groups[g];
+        group.vec_length = kHybridVecLengths[g];
+        group.panel_ids.clear();
+        group.row_offsets.assign(1, 0);
+        group.col_indices.clear();
+        group.values.clear();
+    }
+
+    std::vector<IndexType> cursor(kHybridPanelRows);
+    for(int64_t p = 0; p < static_cast<int64_t>(panel_vec_length.size()); p++){
+        const int vec_length = panel_vec_length[p];
+        HybridGroup<ValueType, IndexType> &group = hybrid.groups[vec_length == 2 ? 0 : (vec_length == 4 ? 1 : 2)];
+        group.panel_ids.push_back(CheckedCast<IndexType>(p, "panel id"));
+
+        for(int64_t vr = p * kHybridPanelRows; vr < (p + 1) * kHybridPanelRows; vr += vec_length){
+            // Merge the sorted column lists of the rows of this vector row
+            const int64_t row_end = std::min<int64_t>(vr + vec_length, rows);
+            for(int64_t r = vr; r < row_end; r++) cursor[r - vr] = row_offsets[r];
+            while(true){
+                int64_t col = -1;
+                for(int64_t r = vr; r < row_end; r++){
+                    if(cursor[r - vr] < row_offsets[r+1] && (col < 0 || col_indices[cursor[r - vr]] < col))
+                        col = col_indices[cursor[r - vr]];
+                }
+                if(col < 0) break;
+                group.col_indices.push_back(static_cast<IndexType>(col));
+                for(int v = 0; v < vec_length; v++){
+                    const int64_t r = vr + v;
+                    if(r < row_end && cursor[v] < row_offsets[r+1] && col_indices[cursor[v]] == col){
+                        group.values.push_back(values[cursor[v]]);
+                        cursor[v]++;
+                    }
+                    else{
+                        group.values.push_back(ValueType(0));
+                    }
+                }
+            }
+            group.row_offsets.push_back(CheckedCast<IndexType>(group.col_indices.size(), "hybrid row offset"));
+        }
+    }
+}
+
+// Pack the values of a group into the word layout used by
+// compute_ref_integers and AlignValues: scaleA words of TypeA per vector, the
+// value of row av of word tt stored at bit (av * preA).
+template <typename TypeA, typename ValueType, typename IndexType>
+void PackGroupValues(const HybridGroup<ValueType, IndexType> &group, int preA, int scaleA, TypeA *packed){
+    const int64_t num_vectors = group.col_indices.size();
+    const int per_word = group.vec_length / scaleA;
+    const uint64_t mask = (uint64_t(1) << preA) - 1;
+    for(int64_t j = 0; j < num_vectors; j++){
+        for(int tt = 0; tt < scaleA; tt++){
+            uint64_t word = 0;
+            for(int av = 0; av < per_word; av++){
+                uint64_t value = static_cast<uint64_t>(static_cast<int64_t>(group.values[j * group.vec_length + tt * per_word + av])) & mask;
+                word |= value << (av * preA);
+            }
+            packed[j * scaleA + tt] = static_cast<TypeA>(word);
+        }
+    }
+}
+
+// CPU executor: out (rows x n, row-major) = hybrid * rhs (cols x n, row-major)
+template <typename ValueType, typename IndexType, typename RhsType, typename OutType>
+double HybridSpmmCpu(const HybridMatrix<ValueType, IndexType> &hybrid, const RhsType *rhs, int64_t n, OutType *out){
+    std::memset(out, 0, static_cast<int64_t>(hybrid.rows) * n * sizeof(OutType));
+    double flops = 0;
+    for(int g = 0; g < 3; g++){
+        const HybridGroup<ValueType, IndexType> &group = hybrid.groups[g];
+        const int vec_length = group.vec_length;
+        for(int64_t r = 0; r < static_cast<int64_t>(group.NumVectorRows()); r++){
+            const int64_t out_row = VectorRowOutputRow(group, r);
+            for(int64_t j = group.row_offsets[r]; j < group.row_offsets[r+1]; j++){
+                const RhsType *rhs_row = rhs + static_cast<int64_t>(group.col_indices[j]) * n;
+                for(int v = 0; v < vec_length; v++){
+                    // rows in the padding of the last panel do not exist
+                    if(out_row + v >= hybrid.rows) break;
+                    const OutType a = static_cast<OutType>(group.values[j * vec_length + v]);
+                    OutType *out_row_ptr = out + (out_row + v) * n;
+                    for(int64_t c = 0; c < n; c++)
+                        out_row_ptr[c] += a * static_cast<OutType>(rhs_row[c]);
+                }
+                flops += 2.0 * vec_length * n;
+            }
+        }
+    }
+    return flops;
+}
+
+#endif
@@ -0,0 +1,243 @@
+#ifndef MATRIX_FEATURES_H
+#define MATRIX_FEATURES_H
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include "smtx_io.h"
+
+// Structural features of a benchmark matrix used for kernel selection and
+// reordering, and a binary catalog that stores them for a whole dataset.
+
+// Row lengths are bucketed by powers of two: bucket 0 counts empty rows,
+// bucket b > 0 rows with [2^(b-1), 2^b) nonzeros, the last bucket the rest.
+#define FEATURE_ROW_BUCKETS 20
+// Padding for mma_k_dim 8 (SDDMM), 16 and 32 (SpMM)
+#define FEATURE_MMA_K_DIMS 3
+// Fill efficiency when grouping 2, 4 and 8 consecutive rows into a vector
+#define FEATURE_VEC_LENGTHS 3
+
+static const int kFeatureMmaKDims[FEATURE_MMA_K_DIMS] = {8, 16, 32};
+static const int kFeatureVecLengths[FEATURE_VEC_LENGTHS] = {2, 4, 8};
+
+// Fixed size record, written to the catalog as is
+struct MatrixFeatures{
+    int64_t rows;
+    int64_t k;
+    int64_t nonzeros;
+    int64_t row_histogram[FEATURE_ROW_BUCKETS];
+    double density;
+    double row_mean;
+    double row_cv;
+    int64_t row_max;
+    double empty_row_fraction;
+    // Nonzeros after padding every row to a multiple of mma_k_dim, over nonzeros
+    double padding_ratio[FEATURE_MMA_K_DIMS];
+    // Rows between two accesses of the same column in a row major sweep,
+    // over the accesses that reuse a column
+    double reuse_distance_mean;
+    double reuse_distance_median;
+    // Fraction of the accesses that touch a column seen before
+    double reuse_fraction;
+    // Nonzeros over the slots of the vectors needed to cover them when
+    // vec_length consecutive rows form one vector row
+    double vec_fill[FEATURE_VEC_LENGTHS];
+};
+
+inline int RowLengthBucket(int64_t length){
+    int bucket = 0;
+    while(length > 0 && bucket < FEATURE_ROW_BUCKETS - 1){
+        length >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+inline MatrixFeatures ComputeMatrixFeatures(int64_t rows, int64_t k, const int *row_offsets, const int *col_indices){
+    MatrixFeatures features;
+    memset(&features, 0, sizeof(features));
+    features.rows = rows;
+    features.k = k;
+    features.nonzeros = row_offsets[rows] - row_offsets[0];
+    features.density = rows > 0 && k > 0 ? static_cast<double>(features.nonzeros) / (static_cast<double>(rows) * k) : 0;
+    features.row_mean = rows > 0 ? static_cast<double>(features.nonzeros) / rows : 0;
+
+    double var = 0;
+    int64_t empty = 0;
+    int64_t padded[FEATURE_MMA_K_DIMS] = {0};
+    for(int64_t i = 0; i < rows; i++){
+        const int64_t length = row_offsets[i+1] - row_offsets[i];
+        features.row_histogram[RowLengthBucket(length)]++;
+        features.row_max = std::max(features.row_max, length);
+        var += (length - features.row_mean) * (length - features.row_mean);
+        if(length == 0) empty++;
+        for(int d = 0; d < FEATURE_MMA_K_DIMS; d++)
+            padded[d] += (length + kFeatureMmaKDims[d] - 1) / kFeatureMmaKDims[d] * kFeatureMmaKDims[d];
+    }
+    features.row_cv = features.row_mean > 0 ? std::sqrt(var / rows) / features.row_mean : 0;
+    features.empty_row_fraction = rows > 0 ? static_cast<double>(empty) / rows : 0;
+    for(int d = 0; d < FEATURE_MMA_K_DIMS; d++)
+        features.padding_ratio[d] = features.nonzeros > 0 ? static_cast<double>(padded[d]) / features.nonzeros : 1;
+
+    // Reuse distance: last row that touched each column
+    std::vector<int64_t> last_row(k, -1);
+    std::vector<int64_t> distances;
+    distances.reserve(features.nonzeros);
+    for(int64_t i = 0; i < rows; i++){
+        for(int j = row_offsets[i]; j < row_offsets[i+1]; j++){
+            const int col = col_indices[j];
+            if(last_row[col] >= 0) distances.push_back(i - last_row[col]);
+            last_row[col] = i;
+        }
+    }
+    if(!distances.empty()){
+        double sum = 0;
+        for(size_t i = 0; i < distances.size(); i++) sum += distances[i];
+        features.reuse_distance_mean = sum / distances.size();
+        std::nth_element(distances.begin(), distances.begin() + distances.size() / 2, distances.end());
+        features.reuse_distance_median = static_cast<double>(distances[distances.size() / 2]);
+    }
+    features.reuse_fraction = features.nonzeros > 0 ? static_cast<double>(distances.size()) / features.nonzeros : 0;
+
+    // Vector fill: distinct columns of each group of vec_length rows
+    std::vector<int64_t> seen_in_group(k, -1);
+    for(int v = 0; v < FEATURE_VEC_LENGTHS; v++){
+        const int vec_length = kFeatureVecLengths[v];
+        std::fill(seen_in_group.begin(), seen_in_group.end(), -1);
+        int64_t vectors = 0;
+        for(int64_t i = 0; i < rows; i++){
+            const int64_t group = i / vec_length;
+            for(int j = row_offsets[i]; j < row_offsets[i+1]; j++){
+                if(seen_in_group[col_indices[j]] != group){
+                    seen_in_group[col_indices[j]] = group;
+                    vectors++;
+                }
+            }
+        }
+        features.vec_fill[v] = vectors > 0 ? static_cast<double>(features.nonzeros) / (vectors * vec_length) : 1;
+    }
+    return features;
+}
+
+// Catalog file layout, little endian as written by the host:
+//   header   {magic, version, count, record_size}
+//   records  count MatrixFeatures, sorted by name
+//   names    count (name_offset, name_length) entries, then the name bytes
+// Lookups binary search the sorted names without parsing any text.
+
+#define FEATURE_CATALOG_MAGIC 0x4654434dU    // "MCTF"
+#define FEATURE_CATALOG_VERSION 1
+
+struct FeatureCatalogHeader{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t count;
+    uint64_t record_size;
+};
+
+struct FeatureCatalog{
+    std::vector<std::string> names;     // sorted
+    std::vector<MatrixFeatures> records;
+
+    const MatrixFeatures *Find(const std::string &name) const {
+        std::vector<std::string>::const_iterator it = std::lower_bound(names.begin(), names.end(), name);
+        if(it == names.end() || *it != name) return NULL;
+        return &records[it - names.begin()];
+    }
+
+    // Insert or replace, keeping the names sorted
+    void Put(const std::string &name, const MatrixFeatures &features){
+        std::vector<std::string>::iterator it = std::lower_bound(names.begin(), names.end(), name);
+        const size_t index = it - names.begin();
+        if(it != names.end() && *it == name){
+            records[index] = features;
+            return;
+        }
+        names.insert(it, name);
+        records.insert(records.begin() + index, features);
+    }
+};
+
+// A missing file is an empty catalog; a file written by another version or
+// with another record layout is rejected.
+inline bool LoadFeatureCatalog(const std::string &path, FeatureCatalog &catalog){
+    catalog.names.clear();
+    catalog.records.clear();
+    FILE *in = fopen(path.c_str(), "rb");
+    if(in == NULL) return true;
+    FeatureCatalogHeader header;
+    bool ok = fread(&header, sizeof(header), 1, in) == 1 && header.magic == FEATURE_CATALOG_MAGIC &&
+              header.version == FEATURE_CATALOG_VERSION && header.record_size == sizeof(MatrixFeatures);
+    if(ok){
+        catalog.records.resize(header.count);
+        std::vector<uint64_t> offsets(header.count * 2);
+        ok = fread(catalog.records.data(), sizeof(MatrixFeatures), header.count, in) == header.count &&
+             fread(offsets.data(), sizeof(uint64_t), offsets.size(), in) == offsets.size();
+        std::vector<char> bytes;
+        if(ok && header.count > 0){
+            bytes.resize(offsets[2*header.count - 2] + offsets[2*header.count - 1]);
+            ok = fread(bytes.data(), 1, bytes.size(), in) == bytes.size();
+        }
+        for(uint64_t i = 0; ok && i < header.count; i++)
+            catalog.names.push_back(std::string(bytes.data() + offsets[2*i], offsets[2*i+1]));
+    }
+    fclose(in);
+    if(!ok){
+        fprintf(stderr, "%s: not a feature catalog of this version\n", path.c_str());
+        catalog.names.clear();
+        catalog.records.clear();
+    }
+    return ok;
+}
+
+inline bool SaveFeatureCatalog(const std::string &path, const FeatureCatalog &catalog){
+    // Write to a temporary file first so an interrupted run keeps the old catalog
+    const std::string tmp_path = path + ".tmp";
+    FILE *out = fopen(tmp_path.c_str(), "wb");
+    if(out == NULL){
+        fprintf(stderr, "Failed to open %s\n", tmp_path.c_str());
+        return false;
+    }
+    FeatureCatalogHeader header;
+    header.magic = FEATURE_CATALOG_MAGIC;
+    header.version = FEATURE_CATALOG_VERSION;
+    header.count = catalog.names.size();
+    header.record_size = sizeof(MatrixFeatures);
+    std::vector<uint64_t> offsets;
+    uint64_t offset = 0;
+    for(size_t i = 0; i < catalog.names.size(); i++){
+        offsets.push_back(offset);
+        offsets.push_back(catalog.names[i].size());
+        offset += catalog.names[i].size();
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+              fwrite(catalog.records.data(), sizeof(MatrixFeatures), catalog.records.size(), out) == catalog.records.size() &&
+              fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), out) == offsets.size();
+    for(size_t i = 0; ok && i < catalog.names.size(); i++)
+        ok = fwrite(catalog.names[i].data(), 1, catalog.names[i].size(), out) == catalog.names[i].size();
+    ok = (fclose(out) == 0) && ok;
+    if(!ok || rename(tmp_path.c_str(), path.c_str()) != 0){
+        fprintf(stderr, "Failed to write %s\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+inline void PrintMatrixFeatures(FILE *out, const std::string &name, const MatrixFeatures &f){
+    fprintf(out, "%s: rows %lld k %lld nnz %lld density %.4f row mean %.2f cv %.3f max %lld empty %.3f\n",
+            name.c_str(), (long long)f.rows, (long long)f.k, (long long)f.nonzeros, f.density, f.row_mean, f.row_cv,
+            (long long)f.row_max, f.empty_row_fraction);
+    fprintf(out, "  padding k8 %.3f k16 %.3f k32 %.3f, vec fill v2 %.3f v4 %.3f v8 %.3f\n", f.padding_ratio[0],
+            f.padding_ratio[1], f.padding_ratio[2], f.vec_fill[0], f.vec_fill[1], f.vec_fill[2]);
+    fprintf(out, "  reuse fraction %.3f distance mean %.2f median %.0f\n  row histogram", f.reuse_fraction,
+            f.reuse_distance_mean, f.reuse_distance_median);
+    int last = FEATURE_ROW_BUCKETS - 1;
+    while(last > 0 && f.row_histogram[last] == 0) last--;
+    for(int b = 0; b <= last; b++) fprintf(out, " %lld", (long long)f.row_histogram[b]);
+    fprintf(out, "\n");
+}
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef RESULTS_STORE_H
+#define RESULTS_STORE_H
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include "bench_report.h"
+
+// Append-only results store shared by every revision that is benchmarked.
+// One tab separated line per measured configuration:
+//   revision time op preA preB n vec_length kernel_config matrix count mean_ms median_ms stddev_ms
+// Lines are only ever appended; a line cut short by a crash has fewer fields
+// and is ignored on load. Lines written before kernel_config was recorded
+// have 12 fields and load with kernel_config "unknown", so they are never
+// compared with measurements of a known configuration.
+
+struct StoredResult{
+    std::string revision;
+    int64_t time;                       // seconds since the epoch
+    std::string op;
+    int preA;
+    int preB;
+    int64_t n;
+    int vec_length;
+    std::string kernel_config;
+    std::string matrix;
+    int64_t count;
+    double mean_ms;
+    double median_ms;
+    double stddev_ms;
+
+    // Identifies the configuration across revisions
+    std::string Key() const {
+        std::ostringstream key;
+        key << op << '\t' << preA << '\t' << preB << '\t' << n << '\t' << vec_length << '\t' << kernel_config << '\t'
+            << matrix;
+        return key.str();
+    }
+};
+
+// Short hash of the checked out revision, "unknown" outside a git tree
+inline std::string CurrentGitRevision(){
+    FILE *pipe = popen("git rev-parse --short HEAD 2>/dev/null", "r");
+    if(pipe == NULL) return "unknown";
+    char buffer[128] = {0};
+    std::string revision;
+    if(fgets(buffer, sizeof(buffer), pipe) != NULL) revision = buffer;
+    pclose(pipe);
+    while(!revision.empty() && (revision[revision.size()-1] == '\n' || revision[revision.size()-1] == '\r'))
+        revision.erase(revision.size()-1);
+    return revision.empty() ? "unknown" : revision;
+}
+
+inline bool LoadResults(const std::string &path, std::vector<StoredResult> &results){
+    std::ifstream infile(path, std::ifstream::in);
+    if(!infile.is_open()){
+        fprintf(stderr, "Failed to open %s\n", path.c_str());
+        return false;
+    }
+    std::string line;
+    while(std::getline(infile, line)){
+        if(line.empty() || line[0] == '#') continue;
+        std::vector<std::string> fields;
+        std::stringstream stream(line);
+        std::string field;
+        while(std::getline(stream, field, '\t')) fields.push_back(field);
+        if(fields.size() != 12 && fields.size() != 13) continue;
+        // The older lines have no kernel_config column
+        const size_t c = fields.size() - 12;
+        StoredResult result;
+        result.revision = fields[0];
+        result.time = atoll(fields[1].c_str());
+        result.op = fields[2];
+        result.preA = atoi(fields[3].c_str());
+        result.preB = atoi(fields[4].c_str());
+        result.n = atoll(fields[5].c_str());
+        result.vec_length = atoi(fields[6].c_str());
+        result.kernel_config = c ? fields[7] : "unknown";
+        result.matrix = fields[7 + c];
+        result.count = atoll(fields[8 + c].c_str());
+        result.mean_ms = atof(fields[9 + c].c_str());
+        result.median_ms = atof(fields[10 + c].c_str());
+        result.stddev_ms = atof(fields[11 + c].c_str());
+        results.push_back(result);
+    }
+    return true;
+}
+
+// Append the successful records of a driver run
+inline bool AppendResults(const std::string &path, const std::string &revision, const std::vector<BenchRecord> &records){
+    FILE *out = fopen(path.c_str(), "a");
+    if(out == NULL){
+        fprintf(stderr, "Failed to open %s\n", path.c_str());
+        return false;
+    }
+    const long long now = static_cast<long long>(time(NULL));
+    for(size_t r = 0; r < records.size(); r++){
+        const BenchRecord &rec = records[r];
+        if(rec.status != "ok" || rec.times_ms.empty()) continue;
+        const TimingStats stats = rec.Stats();
+        fprintf(out, "%s\t%lld\t%s\t%d\t%d\t%lld\t%d\t%s\t%s\t%lld\t%.6f\t%.6f\t%.6f\n", revision.c_str(), now,
+                rec.op.c_str(), rec.preA, rec.preB, (long long)rec.n, rec.vec_length, rec.kernel_config.c_str(),
+                rec.matrix.c_str(), (long long)stats.count, stats.mean, stats.median, stats.stddev);
+    }
+    return fclose(out) == 0;
+}
+
+// Regularized incomplete beta function I_x(a, b), continued fraction of
+// Numerical Recipes (betacf)
+inline double IncompleteBetaFraction(double a, double b, double x){
+    const double tiny = 1e-300;
+    double c = 1, d = 1 - (a + b) * x / (a + 1);
+    if(std::fabs(d) < tiny) d = tiny;
+    d = 1 / d;
+    double h = d;
+    for(int m = 1; m <= 200; m++){
+        const int m2 = 2 * m;
+        double aa = m * (b - m) * x / ((a + m2 - 1) * (a + m2));
+        d = 1 + aa * d;
+        if(std::fabs(d) < tiny) d = tiny;
+        c = 1 + aa / c;
+        if(std::fabs(c) < tiny) c = tiny;
+        d = 1 / d;
+        h *= d * c;
+        aa = -(a + m) * (a + b + m) * x / ((a + m2) * (a + m2 + 1));
+        d = 1 + aa * d;
+        if(std::fabs(d) < tiny) d = tiny;
+        c = 1 + aa / c;
+        if(std::fabs(c) < tiny) c = tiny;
+        d = 1 / d;
+        const double del = d * c;
+        h *= del;
+        if(std::fabs(del - 1) < 1e-12) break;
+    }
+    return h;
+}
+
+inline double IncompleteBeta(double a, double b, double x){
+    if(x <= 0) return 0;
+    if(x >= 1) return 1;
+    const double front = std::exp(std::lgamma(a + b) - std::lgamma(a) - std::lgamma(b) + a * std::log(x) +
+                                  b * std::log(1 - x));
+    if(x < (a + 1) / (a + b + 2)) return front * IncompleteBetaFraction(a, b, x) / a;
+    return 1 - front * IncompleteBetaFraction(b, a, 1 - x) / b;
+}
+
+struct WelchTest{
+    double t;
+    double dof;
+    double p_value;                     // two-sided
+};
+
+// Welch's t-test for the difference of two means with unequal variances
+inline WelchTest WelchTTest(double mean_a, double stddev_a, int64_t count_a, double mean_b, double stddev_b, int64_t count_b){
+    WelchTest test;
+    test.t = 0;
+    test.dof = 0;
+    test.p_value = 1;
+    if(count_a < 2 || count_b < 2) return test;
+    const double va = stddev_a * stddev_a / count_a;
+    const double vb = stddev_b * stddev_b / count_b;
+    if(va + vb <= 0){
+        test.p_value = (mean_a == mean_b) ? 1 : 0;
+        return test;
+    }
+    test.t = (mean_b - mean_a) / std::sqrt(va + vb);
+    test.dof = (va + vb) * (va + vb) / (va * va / (count_a - 1) + vb * vb / (count_b - 1));
+    test.p_value = IncompleteBeta(test.dof / 2, 0.5, test.dof / (test.dof + test.t * test.t));
+    return test;
+}
+
+#endif
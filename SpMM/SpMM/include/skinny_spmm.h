@@ -0,0 +1,208 @@
+#ifndef SKINNY_SPMM_H
+#define SKINNY_SPMM_H
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#include "arena.h"
+
+// Skinny-N SpMM (n <= kSkinnyMaxN, e.g. batch-1 inference), where the
+// Tile_N = 128 wmmaSpmm kernels would leave almost every column of their
+// tile idle. The skinny kernels run a warp per vector row and several rows
+// per block; with so few columns the rhs rows they gather stay in cache and
+// the lhs values are the traffic that matters, so they take the values in
+// their own packed layout:
+//
+//   word (j / items) * vec_length + v of a padded row holds lane v of the
+//   items = 32 / preA_cut consecutive nonzeros j .. j + items - 1
+//
+// With 8-bit values nonzero j + i is byte i of the word, so a word is the
+// operand of one dp4a. With 4-bit values nonzero j + i is the low nibble of
+// byte i for i < 4 and the high nibble of byte i - 4 otherwise, so the two
+// nibble planes (word & 0x0f0f0f0f and (word >> 4) & 0x0f0f0f0f) are again
+// four consecutive nonzeros each.
+//
+// Rows are padded to mma_k_dim as for the other kernels (AlignRowOffsets),
+// which is a multiple of items, and the column indices are the aligned ones
+// without the 4-bit shuffle. The rhs is the usual row-major packed matrix
+// with 32 / preB values per int, every row starting on a new int. Values
+// are read as unsigned like the u8 / u4 mma of the other kernels.
+
+static const int kSkinnyMaxN = 16;
+
+// Precision pairs with a skinny kernel
+inline bool SkinnySpmmSupported(int preA_cut, int preB){
+    return (preA_cut == 4 && preB == 4) || (preA_cut == 8 && preB == 4) || (preA_cut == 8 && preB == 8);
+}
+
+// Whether an SpMM of n columns runs on the skinny kernels
+inline bool UseSkinnySpmm(int preA_cut, int preB, int64_t n){
+    return n <= kSkinnyMaxN && SkinnySpmmSupported(preA_cut, preB);
+}
+
+// Ints of a packed rhs row
+inline int64_t SkinnyRowWords(int64_t n, int preB){
+    return (n * preB + 31) / 32;
+}
+
+// Ints of the packed values of aligned_num_item vectors
+inline int64_t SkinnyValueWords(int64_t aligned_num_item, int vec_length, int preA_cut){
+    return aligned_num_item / (32 / preA_cut) * vec_length;
+}
+
+// Repack the aligned values (scaleA words of TypeA per vector, as consumed by
+// AlignValues) into the skinny layout. packed holds SkinnyValueWords ints.
+template <typename TypeA, typename IndexType>
+void PackSkinnyValues(IndexType aligned_num_item, int vec_length, int preA, int preA_cut, int scaleA,
+                      const TypeA *aligned_values, int *packed){
+    const int items = 32 / preA_cut;
+    const int lanes_per_word = vec_length / scaleA;
+    const uint64_t mask = ((uint64_t)1 << preA_cut) - 1;
+    std::memset(packed, 0, SkinnyValueWords(aligned_num_item, vec_length, preA_cut) * sizeof(int));
+    for(int64_t j = 0; j < static_cast<int64_t>(aligned_num_item); j++){
+        const int64_t group = j / items;
+        const int i = static_cast<int>(j % items);
+        const int shift = preA_cut == 8 ? i * 8 : (i % 4) * 8 + (i / 4) * 4;
+        for(int v = 0; v < vec_length; v++){
+            const uint64_t word = static_cast<uint64_t>(aligned_values[j * scaleA + v / lanes_per_word]);
+            const uint32_t value = static_cast<uint32_t>((word >> ((v % lanes_per_word) * preA)) & mask);
+            packed[group * vec_length + v] |= static_cast<int>(value << shift);
+        }
+    }
+}
+
+// The four rhs values of column c in rows cols[0..3], as int16 lanes
+inline uint64_t SkinnyGatherRhs(const int *rhs, int64_t row_words, int preB, int c, const int *cols){
+    const int items = 32 / preB;
+    const uint32_t mask = (1u << preB) - 1;
+    uint64_t quad = 0;
+    for(int i = 0; i < 4; i++){
+        if(cols[i] < 0) continue;
+        const uint32_t word = static_cast<uint32_t>(rhs[cols[i] * row_words + c / items]);
+        quad |= static_cast<uint64_t>((word >> ((c % items) * preB)) & mask) << (i * 16);
+    }
+    return quad;
+}
+
+// acc[v * n + c] += sum_i a[v] byte i * b[c] int16 lane i for one plane of
+// four nonzeros: a holds vec_length words, b n quads
+inline void SkinnyPlaneMac(const uint32_t *a, const uint64_t *b, int vec_length, int n, int32_t *acc){
+    int v = 0;
+#ifdef __AVX2__
+    // Four lanes (16 bytes) at a time: the madd pairs of lane v sit in ints
+    // 2v and 2v + 1, added up once at the end of the row
+    for(; v + 4 <= vec_length; v += 4){
+        const __m256i a16 = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + v)));
+        for(int c = 0; c < n; c++){
+            const __m256i pairs = _mm256_madd_epi16(a16, _mm256_set1_epi64x(static_cast<long long>(b[c])));
+            // pairs (v, c) -> acc slots of lanes v .. v + 3 kept as pair sums
+            __m256i *slot = reinterpret_cast<__m256i *>(acc + (static_cast<int64_t>(vec_length) * n + (v / 4) * n * 8 + c * 8));
+            _mm256_storeu_si256(slot, _mm256_add_epi32(_mm256_loadu_si256(slot), pairs));
+        }
+    }
+#endif
+    for(; v < vec_length; v++){
+        for(int c = 0; c < n; c++){
+            int32_t sum = 0;
+            for(int i = 0; i < 4; i++)
+                sum += static_cast<int32_t>((a[v] >> (i * 8)) & 255) * static_cast<int32_t>((b[c] >> (i * 16)) & 0xffff);
+            acc[v * n + c] += sum;
+        }
+    }
+}
+
+// Ints of the per-thread accumulator of SkinnySpmmCpu
+inline int64_t SkinnyAccumulatorInts(int vec_length, int n){
+    // vec_length * n results, then 8 pair sums per (4 lanes, column)
+    return static_cast<int64_t>(vec_length) * n + (vec_length / 4) * n * 8;
+}
+
+// Threads SkinnySpmmCpu splits m_vec vector rows over (threads = 0 for the
+// hardware concurrency), at least 64 rows each
+inline int SkinnySpmmCpuThreads(int64_t m_vec, int threads){
+    if(threads <= 0) threads = static_cast<int>(std::thread::hardware_concurrency());
+    return static_cast<int>(std::max<int64_t>(1, std::min<int64_t>(std::max(threads, 1), m_vec / 64)));
+}
+
+// Per-thread workspace of SkinnySpmmCpu: the operation count, n rhs quads,
+// the accumulators and the lhs planes, padded to a cache line so that the
+// threads do not share one
+inline size_t SkinnyThreadWorkspaceBytes(int vec_length, int n){
+    const size_t bytes = sizeof(double) + n * sizeof(uint64_t) + SkinnyAccumulatorInts(vec_length, n) * sizeof(int32_t) +
+                         vec_length * 2 * sizeof(uint32_t);
+    return (bytes + 63) / 64 * 64;
+}
+
+// Workspace SkinnySpmmCpu borrows from the host arena; drivers reserve it
+// with the plan (SpmmPlan::cpu_workspace_bytes)
+inline size_t SkinnySpmmCpuWorkspaceBytes(int64_t m_vec, int vec_length, int n, int threads = 0){
+    return SkinnySpmmCpuThreads(m_vec, threads) * SkinnyThreadWorkspaceBytes(vec_length, n);
+}
+
+// CPU skinny SpMM on the packed layout: out (m_vec * vec_length x n, int32,
+// row-major) = A * rhs. aligned_row_offsets holds (begin, end) pairs. Vector
+// rows are split over threads (0 for the hardware concurrency). The thread
+// workspaces come from the host arena, so repeated calls allocate nothing
+// once it is warm. Returns the number of operations.
+inline double SkinnySpmmCpu(int64_t m_vec, int vec_length, int n, int preA_cut, int preB,
+                            const int *aligned_row_offsets, const int *aligned_col_indices,
+                            const int *packed_values, const int *rhs, int32_t *out, int threads = 0){
+    const int items = 32 / preA_cut;
+    const int64_t row_words = SkinnyRowWords(n, preB);
+    threads = SkinnySpmmCpuThreads(m_vec, threads);
+    const size_t thread_bytes = SkinnyThreadWorkspaceBytes(vec_length, n);
+    ArenaBuffer<char, HostArena> workspace(GlobalHostArena(), threads * thread_bytes);
+
+    std::vector<std::thread> pool;
+    const int64_t chunk = (m_vec + threads - 1) / threads;
+    for(int t = 0; t < threads; t++){
+        pool.push_back(std::thread([&, t](){
+            char *slice = workspace.data() + t * thread_bytes;
+            double &flops = *reinterpret_cast<double *>(slice);
+            uint64_t *quads = reinterpret_cast<uint64_t *>(slice + sizeof(double));
+            int32_t *acc = reinterpret_cast<int32_t *>(quads + n);
+            const int64_t acc_ints = SkinnyAccumulatorInts(vec_length, n);
+            uint32_t *planes = reinterpret_cast<uint32_t *>(acc + acc_ints);
+            flops = 0;
+            const int64_t row_end = std::min(m_vec, (t + 1) * chunk);
+            for(int64_t r = t * chunk; r < row_end; r++){
+                std::fill(acc, acc + acc_ints, 0);
+                const int64_t begin = aligned_row_offsets[r * 2], end = aligned_row_offsets[r * 2 + 1];
+                for(int64_t j = begin; j < end; j += items){
+                    const uint32_t *words = reinterpret_cast<const uint32_t *>(packed_values) + j / items * vec_length;
+                    // One plane of four nonzeros for 8-bit values, two for 4-bit
+                    for(int p = 0; p < items / 4; p++){
+                        for(int v = 0; v < vec_length; v++)
+                            planes[v] = items == 4 ? words[v] : (words[v] >> (p * 4)) & 0x0f0f0f0fu;
+                        for(int c = 0; c < n; c++)
+                            quads[c] = SkinnyGatherRhs(rhs, row_words, preB, c, aligned_col_indices + j + p * 4);
+                        SkinnyPlaneMac(planes, quads, vec_length, n, acc);
+                    }
+                }
+                int32_t *out_rows = out + r * vec_length * n;
+                for(int v = 0; v < vec_length; v++){
+                    for(int c = 0; c < n; c++){
+                        int32_t sum = acc[v * n + c];
+                        if(v < vec_length / 4 * 4){
+                            const int32_t *pairs = acc + static_cast<int64_t>(vec_length) * n + (v / 4) * n * 8 + c * 8;
+                            sum += pairs[(v % 4) * 2] + pairs[(v % 4) * 2 + 1];
+                        }
+                        out_rows[v * n + c] = sum;
+                    }
+                }
+                flops += 2.0 * (end - begin) * vec_length * n;
+            }
+        }));
+    }
+    for(size_t t = 0; t < pool.size(); t++) pool[t].join();
+
+    double total = 0;
+    for(int t = 0; t < threads; t++) total += *reinterpret_cast<const double *>(workspace.data() + t * thread_bytes);
+    return total;
+}
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef SMTX_IO_H
+#define SMTX_IO_H
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <stdio.h>
+
+// Loader for the .smtx benchmark files: the first line is
+// "m_vec, k, nnz_vec", followed by m_vec + 1 row offsets and nnz_vec column
+// indices, separated by spaces.
+
+struct SmtxMatrix{
+    int64_t m_vec;
+    int64_t k;
+    int64_t nonzeros_vec;
+    std::vector<int> row_offsets;
+    std::vector<int> col_indices;
+};
+
+inline bool ReadSmtx(const std::string &path, SmtxMatrix &matrix){
+    std::ifstream infile(path, std::ifstream::in);
+    if(!infile.is_open()){
+        fprintf(stderr, "Failed to open %s\n", path.c_str());
+        return false;
+    }
+    std::string line;
+    std::getline(infile, line, ',');
+    matrix.m_vec = std::stoll(line);
+    std::getline(infile, line, ',');
+    matrix.k = std::stoll(line);
+    std::getline(infile, line, '\n');
+    matrix.nonzeros_vec = std::stoll(line);
+
+    matrix.row_offsets.resize(matrix.m_vec + 1);
+    for(int64_t i = 0; i < matrix.m_vec + 1; i++){
+        if(!(infile >> matrix.row_offsets[i])){
+            fprintf(stderr, "%s: truncated row offsets\n", path.c_str());
+            return false;
+        }
+    }
+    matrix.col_indices.resize(matrix.nonzeros_vec);
+    for(int64_t i = 0; i < matrix.nonzeros_vec; i++){
+        if(!(infile >> matrix.col_indices[i])){
+            fprintf(stderr, "%s: truncated column indices\n", path.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif
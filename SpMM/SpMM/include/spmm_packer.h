@@ -0,0 +1,259 @@
+#ifndef SPMM_PACKER_H
+#define SPMM_PACKER_H
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "index_utils.h"
+#include "skinny_spmm.h"
+#include "trace.h"
+
+// Host-side packing of a vector-sparse CSR matrix into the layout consumed by
+// the wmmaSpmm kernels. IndexType is the type of the row offsets and column
+// indices (int for the device path, int64_t for large host-only problems);
+// element counts inside the loops are always 64-bit.
+
+// The mma k-dimension used by the kernels for a given precision pair
+inline int MmaKDim(int preA_cut, int preB){
+    if (preA_cut == 4 || preB == 4)
+        return 32;
+    return 16;
+}
+
+// Pad every vector row to a multiple of mma_k_dim. aligned_row_offsets holds
+// m_vec (begin, end) pairs: begin is the padded start of the row and end is
+// begin + the real number of nonzeros. Returns the padded number of vectors.
+template <typename IndexType>
+IndexType AlignRowOffsets(IndexType m_vec, const IndexType *row_offsets, int mma_k_dim,
+                          IndexType *aligned_row_offsets){
+    TRACE_SCOPE("align row offsets");
+    int64_t aligned_num_item = 0;
+    aligned_row_offsets[0] = 0;
+    for(int64_t i = 1; i < static_cast<int64_t>(m_vec) + 1; i++){
+        int64_t num_item = row_offsets[i] - row_offsets[i-1];
+        //ceiling
+        aligned_num_item += (num_item + mma_k_dim - 1) / mma_k_dim * mma_k_dim;
+        if(i != m_vec)
+            aligned_row_offsets[i*2] = CheckedCast<IndexType>(aligned_num_item, "aligned_num_item");
+        aligned_row_offsets[i*2-1] = aligned_row_offsets[i*2-2] + num_item;
+    }
+    return CheckedCast<IndexType>(aligned_num_item, "aligned_num_item");
+}
+
+// Scatter the column indices into the padded rows. Padding slots hold -1.
+template <typename IndexType>
+void AlignColIndices(IndexType m_vec, const IndexType *row_offsets, const IndexType *col_indices,
+                     const IndexType *aligned_row_offsets, IndexType aligned_num_item,
+                     IndexType *aligned_col_indices){
+    TRACE_SCOPE("align col indices");
+    for(int64_t i = 0; i < static_cast<int64_t>(aligned_num_item); i++)
+        aligned_col_indices[i] = -1;
+
+    for(int64_t i = 1; i < static_cast<int64_t>(m_vec) + 1; i++){
+        int64_t offset_begin = row_offsets[i-1];
+        int64_t offset_end = row_offsets[i];
+        for(int64_t j = offset_begin; j < offset_end; j++)
+            aligned_col_indices[aligned_row_offsets[(i-1)*2] + j - offset_begin] = col_indices[j];
+    }
+}
+
+// Interleave every 8 column indices as expected by the mma_k_dim = 32 kernels
+template <typename IndexType>
+void ShuffleColIndices(IndexType aligned_num_item, const IndexType *aligned_col_indices,
+                       IndexType *aligned_col_indices_shuffle){
+    TRACE_SCOPE("shuffle col indices");
+    for(int64_t i = 0; i < static_cast<int64_t>(aligned_num_item); i++)
+        aligned_col_indices_shuffle[i] = -1;
+
+    for(int64_t i = 0; i < static_cast<int64_t>(aligned_num_item)/8; i++){
+        for(int j = 0; j < 8; j++){
+            aligned_col_indices_shuffle[i*8 + (j%2)*4 + j/2] = aligned_col_indices[i*8 + j];
+        }
+    }
+}
+
+// Scatter the packed vector values (scaleA words of TypeA per vector) into the
+// padded rows. Padding slots are zero.
+template <typename TypeA, typename IndexType>
+void AlignValues(IndexType m_vec, const IndexType *row_offsets, const IndexType *aligned_row_offsets,
+                 IndexType aligned_num_item, int scaleA, const TypeA *values, TypeA *aligned_values){
+    TRACE_SCOPE("align values");
+    int64_t num_words = CheckedMul(aligned_num_item, scaleA, "aligned values");
+    std::memset(aligned_values, 0, num_words * sizeof(TypeA));
+
+    for(int64_t i = 1; i < static_cast<int64_t>(m_vec) + 1; i++){
+        int64_t offset_begin = static_cast<int64_t>(row_offsets[i-1]) * scaleA;
+        int64_t offset_end = static_cast<int64_t>(row_offsets[i]) * scaleA;
+        for(int64_t j = offset_begin; j < offset_end; j++)
+            aligned_values[static_cast<int64_t>(aligned_row_offsets[(i-1)*2]) * scaleA + j - offset_begin] = values[j];
+    }
+}
+
+// mma_k_dim-wise transpose of the aligned values, followed for the mixed
+// precision kernels by the decomposition of each value into 4-bit (or 8-bit)
+// planes. Both output buffers hold aligned_num_item * scaleA words and must be
+// zero-initialized. Which of the two the kernel consumes is decided by
+// UseDecomposedValues.
+template <typename TypeA, typename IndexType>
+void TransposeDecomposeValues(IndexType aligned_num_item, int vec_length, int mma_k_dim, int preA_cut,
+                              const TypeA *aligned_values, TypeA *aligned_values_transpose,
+                              TypeA *aligned_values_transpose_decompose){
+    TRACE_SCOPE("transpose decompose values");
+    const int64_t num_item = aligned_num_item;
+
+    // mma_k_dim-wise transpose for 8-bit int
+    const unsigned char * aligned_values_char = reinterpret_cast<const unsigned char *>(aligned_values);
+    unsigned char * aligned_values_transpose_char = reinterpret_cast<unsigned char *>(aligned_values_transpose);
+    unsigned char * aligned_values_transpose_decompose_char = reinterpret_cast<unsigned char *>(aligned_values_transpose_decompose);
+
+    // mma_k_dim-wise transpose for 12-bit int
+    const unsigned short * aligned_values_short = reinterpret_cast<const unsigned short *>(aligned_values);
+    unsigned short * aligned_values_transpose_short = reinterpret_cast<unsigned short *>(aligned_values_transpose);
+    unsigned short * aligned_values_transpose_decompose_short = reinterpret_cast<unsigned short *>(aligned_values_transpose_decompose);
+
+    // for 8-bit int
+    if(preA_cut == 8){
+        for(int64_t i = 0; i < num_item*vec_length; i+=(mma_k_dim*vec_length))
+            for(int j = 0; j < mma_k_dim; j++)
+                for(int v = 0; v < vec_length; v++)
+                    aligned_values_transpose_char[i+v*mma_k_dim+j] = aligned_values_char[i+j*vec_length+v];
+
+        //for mixed precision
+        if(mma_k_dim == 32){
+            unsigned char mask = 15;
+            for(int64_t i = 0; i < num_item*vec_length; i+=(mma_k_dim*vec_length))
+                for(int j = 0; j < mma_k_dim*vec_length; j++){
+                    int intra_char_offset_0 = (j%2)*4;
+                    int intra_char_offset_1 = ((j+1)%2)*4;
+                    aligned_values_transpose_decompose_char[i+j/2] |= ((aligned_values_transpose_char[i+j] & mask) << intra_char_offset_0);
+                    aligned_values_transpose_decompose_char[i+mma_k_dim*vec_length/2+j/2] |= ((aligned_values_transpose_char[i+j] & (mask << 4)) >> intra_char_offset_1);
+                }
+        }
+    }
+    else if((preA_cut == 12 || preA_cut == 16) && mma_k_dim == 32){
+        // 12-bit values use three 4-bit planes, 16-bit values use four
+        const int planes = preA_cut / 4;
+        for(int64_t i = 0; i < num_item*vec_length; i+=(mma_k_dim*vec_length))
+            for(int j = 0; j < mma_k_dim; j++)
+                for(int v = 0; v < vec_length; v++)
+                    aligned_values_transpose_short[i+v*mma_k_dim+j] = aligned_values_short[i+j*vec_length+v];
+
+        unsigned short mask = 15;
+        const int plane_stride = mma_k_dim*vec_length/4;
+        for(int64_t i = 0; i < num_item*vec_length; i+=(mma_k_dim*vec_length))
+            for(int j = 0; j < mma_k_dim*vec_length; j++){
+                // the j%4-th nibble of each output short collects plane p of value j
+                int dst_shift = (j%4)*4;
+                for(int p = 0; p < planes; p++){
+                    unsigned short nibble = (aligned_values_transpose_short[i+j] >> (p*4)) & mask;
+                    aligned_values_transpose_decompose_short[i+p*plane_stride+j/4] |= (nibble << dst_shift);
+                }
+            }
+    }
+    else if((preA_cut == 12 || preA_cut == 16) && mma_k_dim == 16){
+        // the high byte of a 12-bit value only carries 4 meaningful bits
+        unsigned char high_mask = (preA_cut == 12) ? 15 : 255;
+        for(int64_t i = 0; i < num_item*vec_length*2; i+=(mma_k_dim*vec_length*2))
+            for(int j = 0; j < mma_k_dim; j++)
+                for(int v = 0; v < vec_length*2; v+=2){
+                    aligned_values_transpose_decompose_char[i+j+(v/2)*mma_k_dim] = aligned_values_char[i+j*vec_length*2+v];
+                    aligned_values_transpose_decompose_char[i+mma_k_dim*vec_length+j+(v/2)*mma_k_dim] = aligned_values_char[i+j*vec_length*2+v+1] & high_mask;
+                }
+    }
+    else if(preA_cut == 4){ // for 4-bit int
+        unsigned char mask = 15; // 0b00001111
+        for(int64_t i = 0; i < num_item*(vec_length/2); i+=(mma_k_dim*(vec_length/2)))
+            for(int j = 0; j < mma_k_dim; j++)
+                for(int v = 0; v < vec_length/2; v++){
+                    int intra_char_offset_0 = (j%2)*4;
+                    int intra_char_offset_1 = ((j+1)%2)*4;
+                    aligned_values_transpose_char[i+mma_k_dim*v+j/2] |= ((aligned_values_char[i+j*(vec_length/2)+v] & mask) << intra_char_offset_0);
+                    aligned_values_transpose_char[i+mma_k_dim*v+mma_k_dim/2+j/2] |= ((aligned_values_char[i+j*(vec_length/2)+v] & (mask << 4)) >> intra_char_offset_1);
+                }
+    }
+}
+
+// The kernels whose lhs precision exceeds the rhs precision consume the
+// decomposed planes, all others the plain transpose.
+inline bool UseDecomposedValues(int preA_cut, int preB){
+    return preA_cut > preB || (preA_cut == 16 && preB == 16);
+}
+
+// Buffer sizes of one SpMM shape, computed from the row offsets alone. The
+// drivers reserve HostBuffers() and DeviceBuffers() in their arenas (see
+// arena.h) before packing, so that repeated calls with the same shape take
+// every buffer from the free lists.
+struct SpmmPlan{
+    int64_t m_vec;
+    int64_t k;
+    int64_t n;
+    int vec_length;
+    int mma_k_dim;
+    int64_t nonzeros_vec;
+    int64_t aligned_num_item;
+    size_t value_bytes;                 // values as generated, before alignment
+    size_t transposed_value_bytes;      // values gathered into A^T, 0 without a transposed plan
+    size_t aligned_value_bytes;         // each of the aligned and transposed copies
+    size_t rhs_bytes;
+    size_t output_bytes;
+    size_t cpu_workspace_bytes;         // workspace of the CPU backend of the shape (SkinnySpmmCpu), 0 if none
+
+    // Host staging: aligned row offsets, aligned and shuffled column indices,
+    // values, rhs, the aligned, transposed and decomposed values, row
+    // indices, the values of A^T, and for verify the reference and device
+    // copies of the output and the CPU workspace
+    std::vector<size_t> HostBuffers(bool verify) const {
+        const size_t index = sizeof(int);
+        size_t buffers[] = {m_vec * 2 * index, aligned_num_item * index, aligned_num_item * index, value_bytes, rhs_bytes,
+                            aligned_value_bytes, aligned_value_bytes, aligned_value_bytes, m_vec * index};
+        std::vector<size_t> sizes(buffers, buffers + 9);
+        if(transposed_value_bytes) sizes.push_back(transposed_value_bytes);
+        if(verify){
+            sizes.push_back(output_bytes);
+            sizes.push_back(output_bytes);
+            if(cpu_workspace_bytes) sizes.push_back(cpu_workspace_bytes);
+        }
+        return sizes;
+    }
+
+    // Device: row offsets, column indices, row indices, values, rhs, output
+    std::vector<size_t> DeviceBuffers() const {
+        const size_t index = sizeof(int);
+        size_t buffers[] = {m_vec * 2 * index, aligned_num_item * index, m_vec * index, aligned_value_bytes, rhs_bytes,
+                            output_bytes};
+        return std::vector<size_t>(buffers, buffers + 6);
+    }
+};
+
+// word_bytes is sizeof(TypeA), scaleA the number of words per vector and
+// rhs_word_bytes the size of a packed rhs word. For A^T row_offsets are
+// those of the transposed plan and source_nonzeros_vec the nonzero vectors
+// of A, whose values are generated and gathered into A^T.
+template <typename IndexType>
+SpmmPlan MakeSpmmPlan(int64_t m_vec, const IndexType *row_offsets, int64_t k, int64_t n, int vec_length, int preA,
+                      int preA_cut, int preB, int scaleA, size_t word_bytes, size_t rhs_word_bytes,
+                      int64_t source_nonzeros_vec = -1){
+    SpmmPlan plan;
+    plan.m_vec = m_vec;
+    plan.k = k;
+    plan.n = n;
+    plan.vec_length = vec_length;
+    plan.mma_k_dim = MmaKDim(preA_cut, preB);
+    plan.nonzeros_vec = row_offsets[m_vec];
+    plan.aligned_num_item = 0;
+    for(int64_t i = 0; i < m_vec; i++){
+        const int64_t num_item = row_offsets[i+1] - row_offsets[i];
+        plan.aligned_num_item += (num_item + plan.mma_k_dim - 1) / plan.mma_k_dim * plan.mma_k_dim;
+    }
+    const bool transposed = source_nonzeros_vec >= 0;
+    const int64_t nonzeros = CheckedMul(transposed ? source_nonzeros_vec : plan.nonzeros_vec, vec_length, "nonzeros");
+    plan.value_bytes = CheckedPackedWords(CheckedMul(nonzeros, scaleA, "values"), preA, static_cast<int>(word_bytes), "values") * word_bytes;
+    plan.transposed_value_bytes = transposed ? CheckedMul(plan.nonzeros_vec, scaleA, "transposed values") * word_bytes : 0;
+    plan.aligned_value_bytes = CheckedMul(plan.aligned_num_item, scaleA, "aligned values") * word_bytes;
+    plan.rhs_bytes = CheckedMul(k, CheckedPackedWords(n, preB, static_cast<int>(rhs_word_bytes), "rhs row"), "rhs matrix") * rhs_word_bytes;
+    plan.output_bytes = CheckedMul(CheckedMul(m_vec, vec_length, "m"), n, "m * n") * sizeof(int);
+    plan.cpu_workspace_bytes = UseSkinnySpmm(preA_cut, preB, n) ?
+        SkinnySpmmCpuWorkspaceBytes(m_vec, vec_length, static_cast<int>(n)) : 0;
+    return plan;
+}
+
+#endif
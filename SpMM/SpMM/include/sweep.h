@@ -0,0 +1,173 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <unistd.h>
+
+// Dataset sweep: the cross product of the matrices of the eval_matrices lists,
+// N, vec_length and (preA, preB), run as one benchmark process per point.
+// Finished points are appended to a results file so that an interrupted sweep
+// resumes where it stopped.
+
+struct SweepPoint{
+    std::string matrix;                 // as written in the matrix list
+    int n;
+    int vec_length;
+    int preA;
+    int preB;
+
+    // Identifies the point in the results file
+    std::string Key() const {
+        std::ostringstream key;
+        key << matrix << '\t' << n << '\t' << vec_length << '\t' << preA << '\t' << preB;
+        return key.str();
+    }
+};
+
+struct SweepResult{
+    // "ok", "failed" (non-zero exit) or "noresult" (no runtime line)
+    std::string status;
+    int exit_code;
+    double runtime_ms;
+    double wall_s;
+};
+
+// Read one matrix per line; duplicates across the lists are kept once
+inline bool LoadSweepMatrices(const std::vector<std::string> &lists, std::vector<std::string> &matrices){
+    std::set<std::string> seen;
+    for(size_t l = 0; l < lists.size(); l++){
+        std::ifstream infile(lists[l], std::ifstream::in);
+        if(!infile.is_open()){
+            fprintf(stderr, "Failed to open matrix list %s\n", lists[l].c_str());
+            return false;
+        }
+        std::string line;
+        while(std::getline(infile, line)){
+            if(!line.empty() && line[line.size()-1] == '\r') line.erase(line.size()-1);
+            if(line.empty() || line[0] == '#' || !seen.insert(line).second) continue;
+            matrices.push_back(line);
+        }
+    }
+    return true;
+}
+
+// Points in the order the launch_*.py scripts visit them
+inline std::vector<SweepPoint> MakeSweepPoints(const std::vector<std::string> &matrices, const std::vector<int> &n,
+                                               const std::vector<int> &vec_length,
+                                               const std::vector<std::pair<int, int> > &precisions){
+    std::vector<SweepPoint> points;
+    for(size_t p = 0; p < precisions.size(); p++)
+        for(size_t i = 0; i < n.size(); i++)
+            for(size_t v = 0; v < vec_length.size(); v++)
+                for(size_t m = 0; m < matrices.size(); m++){
+                    SweepPoint point;
+                    point.matrix = matrices[m];
+                    point.n = n[i];
+                    point.vec_length = vec_length[v];
+                    point.preA = precisions[p].first;
+                    point.preB = precisions[p].second;
+                    points.push_back(point);
+                }
+    return points;
+}
+
+// Results file: one tab separated line per finished point,
+//   matrix n vec_length preA preB status exit_code runtime_ms wall_s
+// A line cut short by a crash has fewer fields and is ignored. A point that
+// appears twice keeps its last status.
+inline std::map<std::string, SweepResult> LoadSweepResults(const std::string &path){
+    std::map<std::string, SweepResult> results;
+    std::ifstream infile(path, std::ifstream::in);
+    if(!infile.is_open()) return results;
+    std::string line;
+    while(std::getline(infile, line)){
+        if(line.empty() || line[0] == '#') continue;
+        std::vector<std::string> fields;
+        std::stringstream stream(line);
+        std::string field;
+        while(std::getline(stream, field, '\t')) fields.push_back(field);
+        if(fields.size() != 9) continue;
+        SweepResult result;
+        result.status = fields[5];
+        result.exit_code = atoi(fields[6].c_str());
+        result.runtime_ms = atof(fields[7].c_str());
+        result.wall_s = atof(fields[8].c_str());
+        results[fields[0] + '\t' + fields[1] + '\t' + fields[2] + '\t' + fields[3] + '\t' + fields[4]] = result;
+    }
+    return results;
+}
+
+// Append one line and push it to disk before the point counts as done
+inline bool AppendSweepResult(FILE *file, const SweepPoint &point, const SweepResult &result){
+    std::ostringstream line;
+    line << point.Key() << '\t' << result.status << '\t' << result.exit_code << '\t' << result.runtime_ms << '\t'
+         << result.wall_s << '\n';
+    const std::string text = line.str();
+    if(fwrite(text.data(), 1, text.size(), file) != text.size() || fflush(file) != 0) return false;
+    return fsync(fileno(file)) == 0;
+}
+
+// Runtime reported by a benchmark: the last "... runtime X ms" line, the form
+// all the spmm/sddmm benchmarks and the plot scripts use
+inline bool ParseRuntimeMs(const std::string &output, double &runtime_ms){
+    bool found = false;
+    std::stringstream stream(output);
+    std::string line;
+    while(std::getline(stream, line)){
+        const size_t pos = line.find("runtime ");
+        if(pos == std::string::npos || line.find(" ms", pos) == std::string::npos) continue;
+        char *end = NULL;
+        const double value = strtod(line.c_str() + pos + 8, &end);
+        if(end != line.c_str() + pos + 8){
+            runtime_ms = value;
+            found = true;
+        }
+    }
+    return found;
+}
+
+// Quote a value for /bin/sh
+inline std::string ShellQuote(const std::string &s){
+    std::string quoted = "'";
+    for(size_t i = 0; i < s.size(); i++){
+        if(s[i] == '\'') quoted += "'\\''";
+        else quoted += s[i];
+    }
+    return quoted + "'";
+}
+
+// Expand {matrix}, {n}, {v}, {preA} and {preB} in a command template
+inline std::string ExpandSweepCommand(const std::string &pattern, const SweepPoint &point, const std::string &matrix_path){
+    std::string command;
+    for(size_t i = 0; i < pattern.size(); i++){
+        if(pattern[i] != '{'){
+            command += pattern[i];
+            continue;
+        }
+        const size_t close = pattern.find('}', i);
+        if(close == std::string::npos){
+            command += pattern.substr(i);
+            break;
+        }
+        const std::string name = pattern.substr(i + 1, close - i - 1);
+        std::ostringstream value;
+        if(name == "matrix") value << ShellQuote(matrix_path);
+        else if(name == "n") value << point.n;
+        else if(name == "v") value << point.vec_length;
+        else if(name == "preA") value << point.preA;
+        else if(name == "preB") value << point.preB;
+        else value << '{' << name << '}';
+        command += value.str();
+        i = close;
+    }
+    return command;
+}
+
+#endif
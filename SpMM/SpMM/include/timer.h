@@ -0,0 +1,175 @@
+#ifndef TIMER_H
+#define TIMER_H
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <stdio.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Timing statistics and host clocks for the benchmarks. The device side
+// (event pool, L2 flush) is in cuda_timer.h.
+
+struct TimingStats{
+    int64_t count;
+    double mean;
+    double median;
+    double p95;
+    double p99;
+    double min;
+    double max;
+    double stddev;
+    // Half width of the 95% confidence interval of the mean
+    double ci95;
+
+    double RelativeCi() const { return mean > 0 ? ci95 / mean : 0; }
+};
+
+// Percentile of sorted samples with linear interpolation between ranks
+inline double Percentile(const std::vector<double> &sorted, double p){
+    if(sorted.empty()) return 0;
+    const double rank = p / 100.0 * (sorted.size() - 1);
+    const size_t lo = static_cast<size_t>(std::floor(rank));
+    const size_t hi = std::min(lo + 1, sorted.size() - 1);
+    return sorted[lo] + (sorted[hi] - sorted[lo]) * (rank - lo);
+}
+
+// Two-sided 95% Student t quantile for dof degrees of freedom. plot/confinter.py
+// uses the normal quantile, which is too narrow for the short runs of the
+// adaptive mode.
+inline double StudentT95(int64_t dof){
+    static const double table[30] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                     2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                     2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+    if(dof < 1) return 0;
+    if(dof <= 30) return table[dof - 1];
+    return 1.96 + 2.4 / dof;
+}
+
+template <typename T>
+TimingStats ComputeTimingStats(const std::vector<T> &samples){
+    TimingStats stats;
+    std::vector<double> sorted(samples.begin(), samples.end());
+    std::sort(sorted.begin(), sorted.end());
+    stats.count = sorted.size();
+    if(sorted.empty()){
+        stats.mean = stats.median = stats.p95 = stats.p99 = stats.min = stats.max = stats.stddev = stats.ci95 = 0;
+        return stats;
+    }
+    double sum = 0;
+    for(size_t i = 0; i < sorted.size(); i++) sum += sorted[i];
+    stats.mean = sum / sorted.size();
+    double var = 0;
+    for(size_t i = 0; i < sorted.size(); i++) var += (sorted[i] - stats.mean) * (sorted[i] - stats.mean);
+    stats.stddev = sorted.size() > 1 ? std::sqrt(var / (sorted.size() - 1)) : 0;
+    stats.ci95 = StudentT95(stats.count - 1) * stats.stddev / std::sqrt(static_cast<double>(stats.count));
+    stats.median = Percentile(sorted, 50);
+    stats.p95 = Percentile(sorted, 95);
+    stats.p99 = Percentile(sorted, 99);
+    stats.min = sorted.front();
+    stats.max = sorted.back();
+    return stats;
+}
+
+inline void PrintTimingStats(const char *name, const TimingStats &stats){
+    printf("%s median %.6f ms, p95 %.6f ms, p99 %.6f ms, stddev %.6f ms, 95%% CI [%.6f, %.6f] ms, %lld iterations\n",
+           name, stats.median, stats.p95, stats.p99, stats.stddev, stats.mean - stats.ci95, stats.mean + stats.ci95,
+           (long long)stats.count);
+}
+
+// How many iterations to run. With target_rel_ci > 0 the iterations are
+// repeated in growing batches, from min_iters up to max_iters, until the 95%
+// confidence interval is within target_rel_ci of the mean.
+struct TimingOptions{
+    int warmup;
+    int min_iters;
+    int max_iters;
+    double target_rel_ci;
+    // Evict the caches before every timed iteration for cold-cache numbers
+    bool flush_cache;
+};
+
+inline TimingOptions FixedTimingOptions(int warmup, int iters){
+    TimingOptions options;
+    options.warmup = warmup;
+    options.min_iters = iters;
+    options.max_iters = iters;
+    options.target_rel_ci = 0;
+    options.flush_cache = false;
+    return options;
+}
+
+// Drive an adaptive measurement: run_batch(iters, samples) appends iters
+// samples. Returns the statistics of all samples.
+template <typename RunBatch>
+TimingStats RunTimed(const TimingOptions &options, RunBatch run_batch, std::vector<double> &samples){
+    samples.clear();
+    int batch = std::max(options.min_iters, 1);
+    while(true){
+        run_batch(batch, samples);
+        TimingStats stats = ComputeTimingStats(samples);
+        const int done = static_cast<int>(samples.size());
+        if(options.target_rel_ci <= 0 || done >= options.max_iters || stats.RelativeCi() <= options.target_rel_ci)
+            return stats;
+        batch = std::min(done, options.max_iters - done);
+    }
+}
+
+// Host clocks, NowNs() in nanoseconds
+struct SteadyClock{
+    static double NowNs(){
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
+
+// Time stamp counter, converted with a rate measured once against
+// steady_clock. Falls back to steady_clock where there is no TSC.
+struct RdtscClock{
+#if defined(__x86_64__) || defined(__i386__)
+    static double TicksPerNs(){
+        static double ticks_per_ns = 0;
+        if(ticks_per_ns == 0){
+            const double t0 = SteadyClock::NowNs();
+            const uint64_t c0 = __rdtsc();
+            while(SteadyClock::NowNs() - t0 < 10e6) {}
+            ticks_per_ns = (__rdtsc() - c0) / (SteadyClock::NowNs() - t0);
+        }
+        return ticks_per_ns;
+    }
+    static double NowNs(){
+        return __rdtsc() / TicksPerNs();
+    }
+#else
+    static double NowNs(){ return SteadyClock::NowNs(); }
+#endif
+};
+
+// Evict the CPU caches by streaming through a buffer larger than the LLC
+inline void FlushHostCache(){
+    static std::vector<char> buffer(64 << 20);
+    volatile char sink = 0;
+    for(size_t i = 0; i < buffer.size(); i += 64){
+        buffer[i] += 1;
+        sink += buffer[i];
+    }
+    (void)sink;
+}
+
+// Time a host function with Clock; samples are in ms
+template <typename Clock, typename Fn>
+TimingStats TimeHost(const TimingOptions &options, Fn fn, std::vector<double> &samples){
+    for(int i = 0; i < options.warmup; i++) fn();
+    return RunTimed(options, [&](int iters, std::vector<double> &out){
+        for(int i = 0; i < iters; i++){
+            if(options.flush_cache) FlushHostCache();
+            const double start = Clock::NowNs();
+            fn();
+            out.push_back((Clock::NowNs() - start) * 1e-6);
+        }
+    }, samples);
+}
+
+#endif
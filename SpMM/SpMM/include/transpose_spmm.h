@@ -0,0 +1,342 @@
+#ifndef TRANSPOSE_SPMM_H
+#define TRANSPOSE_SPMM_H
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <thread>
+#include <vector>
+#include "index_utils.h"
+#include "trace.h"
+
+// Transposed-operand SpMM: out = A^T * B for a vector-sparse CSR A of m_vec
+// vector rows (vec_length rows each) and k columns, B holding m_vec *
+// vec_length rows. Two entry points share one cached conversion:
+//
+// - The CPU path walks a vector CSC of A (VectorCsc): column c of A is
+//   output row c, and every vector of the column adds vec_length rows of B.
+// - The packed path runs the regular wmmaSpmm kernels on A^T stored as a
+//   vector-sparse CSR with the same vec_length: vector row g of A^T covers
+//   the columns g * vec_length .. g * vec_length + vec_length - 1 of A and
+//   each vector row r of A that has a vector in any of them becomes one
+//   block of vec_length nonzero vectors at the columns r * vec_length + v.
+//   Lanes without a vector in A are explicit zeros. The output has
+//   m_vec * vec_length rows, of which the first k are A^T * B.
+//
+// The structure only depends on the sparsity pattern, so it is built once
+// per (pattern, vec_length) and kept in a TransposeCache; the values are
+// regathered with TransposeVectorValues whenever A changes (e.g. a weight
+// update between two backward passes).
+
+template <typename IndexType>
+struct VectorCsc{
+    int64_t m_vec;
+    int64_t k;
+    std::vector<IndexType> col_offsets;     // k + 1
+    // Vector row of every nonzero vector, increasing within a column
+    std::vector<IndexType> row_indices;
+    // Index of the vector in the CSR arrays of A
+    std::vector<IndexType> positions;
+};
+
+template <typename IndexType>
+struct TransposedSpmmPlan{
+    int vec_length;
+    int64_t rows;                           // k of A, the real output rows
+    int64_t m_vec;                          // vector rows of A^T
+    int64_t k;                              // rows of B, m_vec * vec_length of A
+    VectorCsc<IndexType> csc;
+    // Vector-sparse CSR of A^T; every row holds whole blocks of vec_length
+    // vectors, so vector e belongs to block e / vec_length
+    std::vector<IndexType> row_offsets;
+    std::vector<IndexType> col_indices;
+    // vec_length entries per block: the CSR index of the vector of A that
+    // feeds lane u of the block, -1 if there is none
+    std::vector<IndexType> block_sources;
+    double build_ms;
+
+    int64_t NonzerosVec() const { return row_offsets.empty() ? 0 : row_offsets.back(); }
+};
+
+// Run fn(begin, end) over count items split into contiguous chunks, one per
+// thread (0 for the hardware concurrency)
+template <typename Fn>
+void TransposeParallelFor(int64_t count, int threads, Fn fn){
+    if(threads <= 0) threads = static_cast<int>(std::thread::hardware_concurrency());
+    threads = static_cast<int>(std::max<int64_t>(1, std::min<int64_t>(std::max(threads, 1), count)));
+    if(threads == 1){
+        fn(static_cast<int64_t>(0), count);
+        return;
+    }
+    std::vector<std::thread> pool;
+    const int64_t chunk = (count + threads - 1) / threads;
+    for(int t = 0; t < threads; t++){
+        const int64_t begin = std::min(count, t * chunk), end = std::min(count, (t + 1) * chunk);
+        pool.push_back(std::thread([&fn, begin, end](){ fn(begin, end); }));
+    }
+    for(size_t t = 0; t < pool.size(); t++) pool[t].join();
+}
+
+// CSR -> CSC of the nonzero vectors. Every thread counts the columns of its
+// vector rows, the counts are turned into per-thread column bases and the
+// threads scatter their rows again, so the rows of a column stay sorted
+// without a sort. The per-thread histograms cost threads * k counters, so
+// the thread count is capped at nonzeros / k.
+template <typename IndexType>
+VectorCsc<IndexType> BuildVectorCsc(int64_t m_vec, int64_t k, const IndexType *row_offsets,
+                                    const IndexType *col_indices, int threads = 0){
+    TRACE_SCOPE("build vector csc");
+    VectorCsc<IndexType> csc;
+    csc.m_vec = m_vec;
+    csc.k = k;
+    const int64_t nonzeros_vec = row_offsets[m_vec];
+    if(threads <= 0) threads = static_cast<int>(std::thread::hardware_concurrency());
+    threads = static_cast<int>(std::max<int64_t>(1, std::min<int64_t>(std::min<int64_t>(threads, m_vec),
+                                                                          nonzeros_vec / std::max<int64_t>(k, 1))));
+    const int64_t chunk = (m_vec + threads - 1) / threads;
+
+    std::vector<int64_t> counts(CheckedMul(threads, k, "csc histograms"), 0);
+    TransposeParallelFor(threads, threads, [&](int64_t t_begin, int64_t t_end){
+        for(int64_t t = t_begin; t < t_end; t++){
+            int64_t *count = counts.data() + t * k;
+            const int64_t row_end = std::min(m_vec, (t + 1) * chunk);
+            for(int64_t r = t * chunk; r < row_end; r++)
+                for(int64_t j = row_offsets[r]; j < row_offsets[r + 1]; j++)
+                    count[col_indices[j]]++;
+        }
+    });
+
+    csc.col_offsets.resize(k + 1);
+    int64_t offset = 0;
+    for(int64_t c = 0; c < k; c++){
+        csc.col_offsets[c] = CheckedCast<IndexType>(offset, "csc offsets");
+        for(int t = 0; t < threads; t++){
+            const int64_t count = counts[t * k + c];
+            counts[t * k + c] = offset;
+            offset += count;
+        }
+    }
+    csc.col_offsets[k] = CheckedCast<IndexType>(offset, "csc offsets");
+
+    csc.row_indices.resize(nonzeros_vec);
+    csc.positions.resize(nonzeros_vec);
+    TransposeParallelFor(threads, threads, [&](int64_t t_begin, int64_t t_end){
+        for(int64_t t = t_begin; t < t_end; t++){
+            int64_t *next = counts.data() + t * k;
+            const int64_t row_end = std::min(m_vec, (t + 1) * chunk);
+            for(int64_t r = t * chunk; r < row_end; r++)
+                for(int64_t j = row_offsets[r]; j < row_offsets[r + 1]; j++){
+                    const int64_t slot = next[col_indices[j]]++;
+                    csc.row_indices[slot] = static_cast<IndexType>(r);
+                    csc.positions[slot] = static_cast<IndexType>(j);
+                }
+        }
+    });
+    return csc;
+}
+
+// Merge the CSC columns of group g (sorted by vector row) and call
+// fn(r, sources) for every vector row r present in any of them, sources
+// holding the CSR index of the vector of column g * vec_length + u or -1
+template <typename IndexType, typename Fn>
+void ForEachTransposedBlock(const VectorCsc<IndexType> &csc, int64_t g, int vec_length, Fn fn){
+    int64_t next[8], end[8];
+    IndexType sources[8];
+    for(int u = 0; u < vec_length; u++){
+        const int64_t c = std::min(g * vec_length + u, csc.k);
+        next[u] = csc.col_offsets[c];
+        end[u] = c < csc.k ? static_cast<int64_t>(csc.col_offsets[c + 1]) : next[u];
+    }
+    while(true){
+        int64_t r = -1;
+        for(int u = 0; u < vec_length; u++)
+            if(next[u] < end[u] && (r < 0 || csc.row_indices[next[u]] < r)) r = csc.row_indices[next[u]];
+        if(r < 0) return;
+        for(int u = 0; u < vec_length; u++)
+            sources[u] = (next[u] < end[u] && csc.row_indices[next[u]] == r) ? csc.positions[next[u]++] : -1;
+        fn(r, sources);
+    }
+}
+
+// Build the CSC and the vector-sparse CSR of A^T. vec_length is at most 8.
+template <typename IndexType>
+TransposedSpmmPlan<IndexType> MakeTransposedSpmmPlan(int64_t m_vec, int64_t k, int vec_length, const IndexType *row_offsets,
+                                                     const IndexType *col_indices, int threads = 0){
+    const double t0 = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    TransposedSpmmPlan<IndexType> plan;
+    plan.vec_length = vec_length;
+    plan.rows = k;
+    plan.m_vec = (k + vec_length - 1) / vec_length;
+    plan.k = CheckedMul(m_vec, vec_length, "rows of A");
+    plan.csc = BuildVectorCsc<IndexType>(m_vec, k, row_offsets, col_indices, threads);
+
+    TRACE_SCOPE("transpose vector csr");
+    // Blocks per row of A^T, then the rows are filled in parallel
+    std::vector<int64_t> blocks(plan.m_vec + 1, 0);
+    TransposeParallelFor(plan.m_vec, threads, [&](int64_t begin, int64_t end){
+        for(int64_t g = begin; g < end; g++)
+            ForEachTransposedBlock(plan.csc, g, vec_length, [&](int64_t, const IndexType *){ blocks[g + 1]++; });
+    });
+    for(int64_t g = 0; g < plan.m_vec; g++) blocks[g + 1] += blocks[g];
+
+    const int64_t nonzeros_vec = CheckedMul(blocks[plan.m_vec], vec_length, "transposed nonzeros");
+    plan.row_offsets.resize(plan.m_vec + 1);
+    for(int64_t g = 0; g < plan.m_vec + 1; g++)
+        plan.row_offsets[g] = CheckedCast<IndexType>(blocks[g] * vec_length, "transposed row offsets");
+    CheckedCast<IndexType>(plan.k, "rows of A");
+    plan.col_indices.resize(nonzeros_vec);
+    plan.block_sources.resize(nonzeros_vec);
+    TransposeParallelFor(plan.m_vec, threads, [&](int64_t begin, int64_t end){
+        for(int64_t g = begin; g < end; g++){
+            int64_t e = plan.row_offsets[g];
+            ForEachTransposedBlock(plan.csc, g, vec_length, [&](int64_t r, const IndexType *sources){
+                for(int v = 0; v < vec_length; v++){
+                    plan.col_indices[e + v] = static_cast<IndexType>(r * vec_length + v);
+                    plan.block_sources[e + v] = sources[v];
+                }
+                e += vec_length;
+            });
+        }
+    });
+    plan.build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count() - t0;
+    return plan;
+}
+
+// Lane v of vector j of a packed value array (scaleA words of TypeA per
+// vector, preA bits per lane)
+template <typename TypeA>
+inline uint64_t VectorLane(const TypeA *values, int64_t j, int v, int preA, int scaleA, int lanes_per_word){
+    const uint64_t mask = preA == 64 ? ~static_cast<uint64_t>(0) : (static_cast<uint64_t>(1) << preA) - 1;
+    const uint64_t word = static_cast<uint64_t>(values[j * scaleA + v / lanes_per_word]);
+    return (word >> ((v % lanes_per_word) * preA)) & mask;
+}
+
+// Gather the values of A^T in the layout of the input values: lane u of
+// vector e of A^T is lane v = col_indices[e] % vec_length of the vector that
+// feeds lane u of its block. transposed holds NonzerosVec() * scaleA words.
+template <typename TypeA, typename IndexType>
+void TransposeVectorValues(const TransposedSpmmPlan<IndexType> &plan, int preA, int scaleA, const TypeA *values,
+                           TypeA *transposed, int threads = 0){
+    TRACE_SCOPE("transpose vector values");
+    const int vec_length = plan.vec_length;
+    const int lanes_per_word = vec_length / scaleA;
+    const int64_t num_blocks = plan.NonzerosVec() / vec_length;
+    TransposeParallelFor(num_blocks, threads, [&](int64_t begin, int64_t end){
+        std::memset(transposed + begin * vec_length * scaleA, 0, (end - begin) * vec_length * scaleA * sizeof(TypeA));
+        for(int64_t b = begin; b < end; b++){
+            const IndexType *sources = plan.block_sources.data() + b * vec_length;
+            for(int u = 0; u < vec_length; u++){
+                if(sources[u] < 0) continue;
+                for(int v = 0; v < vec_length; v++){
+                    const uint64_t lane = VectorLane<TypeA>(values, sources[u], v, preA, scaleA, lanes_per_word);
+                    TypeA &word = transposed[(b * vec_length + v) * scaleA + u / lanes_per_word];
+                    word = static_cast<TypeA>(static_cast<uint64_t>(word) | (lane << ((u % lanes_per_word) * preA)));
+                }
+            }
+        }
+    });
+}
+
+// CPU A^T * B on the CSC: out (rows x n, int32, row-major). values are the
+// CSR values of A, rhs holds 32 / preB unsigned values per int with every
+// row starting on a new int. Output rows are split over threads. Returns
+// the number of operations.
+template <typename TypeA, typename IndexType>
+double TransposedSpmmCpu(const TransposedSpmmPlan<IndexType> &plan, int preA, int preA_cut, int preB, int scaleA,
+                         const TypeA *values, const int *rhs, int64_t n, int32_t *out, int threads = 0){
+    TRACE_SCOPE("transposed spmm cpu");
+    const VectorCsc<IndexType> &csc = plan.csc;
+    const int vec_length = plan.vec_length;
+    const int lanes_per_word = vec_length / scaleA;
+    const uint64_t mask_cut = (static_cast<uint64_t>(1) << preA_cut) - 1;
+    const int items = 32 / preB;
+    const uint32_t mask_b = preB == 32 ? ~0u : (1u << preB) - 1;
+    const int64_t row_words = CheckedPackedWords(n, preB, sizeof(int), "rhs row");
+    TransposeParallelFor(plan.rows, threads, [&](int64_t begin, int64_t end){
+        for(int64_t c = begin; c < end; c++){
+            int32_t *out_row = out + c * n;
+            std::fill(out_row, out_row + n, 0);
+            for(int64_t i = csc.col_offsets[c]; i < csc.col_offsets[c + 1]; i++){
+                const int64_t r = csc.row_indices[i];
+                for(int v = 0; v < vec_length; v++){
+                    const int32_t a = static_cast<int32_t>(VectorLane<TypeA>(values, csc.positions[i], v, preA, scaleA, lanes_per_word) & mask_cut);
+                    if(a == 0) continue;
+                    const uint32_t *rhs_row = reinterpret_cast<const uint32_t *>(rhs) + (r * vec_length + v) * row_words;
+                    for(int64_t w = 0; w < row_words; w++){
+                        const uint32_t word = rhs_row[w];
+                        const int count = static_cast<int>(std::min<int64_t>(items, n - w * items));
+                        for(int t = 0; t < count; t++)
+                            out_row[w * items + t] += a * static_cast<int32_t>((word >> (t * preB)) & mask_b);
+                    }
+                }
+            }
+        }
+    });
+    return 2.0 * csc.row_indices.size() * vec_length * n;
+}
+
+// FNV-1a hash of the CSR arrays of a pattern
+template <typename IndexType>
+uint64_t HashVectorPattern(int64_t m_vec, const IndexType *row_offsets, const IndexType *col_indices){
+    uint64_t hash = 1469598103934665603ull;
+    const auto mix = [&hash](const IndexType *data, int64_t count){
+        const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+        for(int64_t i = 0; i < count * static_cast<int64_t>(sizeof(IndexType)); i++){
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+    };
+    mix(row_offsets, m_vec + 1);
+    mix(col_indices + row_offsets[0], row_offsets[m_vec] - row_offsets[0]);
+    return hash;
+}
+
+// Transposed plans by sparsity pattern. A pattern is identified by the
+// content of its CSR arrays (HashVectorPattern), the number of nonzero
+// vectors and the shape, not by where the arrays live: a pattern edited in
+// place gets a new plan, and an identical pattern in other arrays reuses
+// the cached one. Get hashes the arrays, which is O(nonzeros) and far
+// cheaper than building a plan.
+template <typename IndexType>
+class TransposeCache{
+public:
+    const TransposedSpmmPlan<IndexType> &Get(int64_t m_vec, int64_t k, int vec_length, const IndexType *row_offsets,
+                                             const IndexType *col_indices, int threads = 0){
+        Key key(HashVectorPattern<IndexType>(m_vec, row_offsets, col_indices), row_offsets[m_vec] - row_offsets[0],
+                m_vec, k, vec_length);
+        typename std::map<Key, TransposedSpmmPlan<IndexType> >::iterator it = plans_.find(key);
+        if(it == plans_.end()){
+            it = plans_.insert(std::make_pair(key, MakeTransposedSpmmPlan<IndexType>(m_vec, k, vec_length, row_offsets,
+                                                                                     col_indices, threads))).first;
+            misses_++;
+        }
+        else hits_++;
+        return it->second;
+    }
+
+    void Clear(){ plans_.clear(); }
+    int64_t hits() const { return hits_; }
+    int64_t misses() const { return misses_; }
+
+private:
+    struct Key{
+        uint64_t hash;
+        int64_t nonzeros_vec;
+        int64_t m_vec, k;
+        int vec_length;
+        Key(uint64_t h, int64_t nnz, int64_t m, int64_t kk, int v)
+            : hash(h), nonzeros_vec(nnz), m_vec(m), k(kk), vec_length(v) {}
+        bool operator<(const Key &other) const {
+            if(hash != other.hash) return hash < other.hash;
+            if(nonzeros_vec != other.nonzeros_vec) return nonzeros_vec < other.nonzeros_vec;
+            if(m_vec != other.m_vec) return m_vec < other.m_vec;
+            if(k != other.k) return k < other.k;
+            return vec_length < other.vec_length;
+        }
+    };
+    std::map<Key, TransposedSpmmPlan<IndexType> > plans_;
+    int64_t hits_ = 0, misses_ = 0;
+};
+
+#endif
@@ -0,0 +1,303 @@
+#ifndef VERIFIER_H
+#define VERIFIER_H
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Parallel comparison of a device output against the CPU reference. The
+// output is split into chunks checked by a pool of threads; every thread
+// keeps its own counters so the only merge is at the end.
+//
+// Modes:
+//   exact     integer outputs of the quantized kernels
+//   ulp       fp16 outputs (deq_spmm, deq_sddmm) given as raw half bits,
+//             mismatch when the two values are more than max_ulp apart
+//   relative  float or fp16 outputs, mismatch when
+//             |got - expected| > abs_tol + rel_tol * |expected|
+//
+// Mismatches are located in a rows x cols output, row-major or in the
+// interleaved layout of the SDDMM output values, where row j is a nonzero
+// vector, col v its lane and groups of interleave vectors are stored lane by
+// lane (cpu_sddmm.h):
+//
+//   index = (j / interleave) * interleave * cols + interleave * v + j % interleave
+//
+// Tiles are tile_rows x tile_cols blocks of the output (one thread block of
+// the kernel), and the lane is the thread of the m8n8 mma accumulator
+// fragment that holds the element: (row % 8) * 4 + (col % 8) / 2, or
+// (v % 8) * 4 + (j % 8) / 2 for the SDDMM, whose fragment rows are the
+// vector lanes.
+
+enum VerifyMode{
+    kVerifyExact,
+    kVerifyUlp,
+    kVerifyRelative
+};
+
+struct VerifyLayout{
+    int64_t rows;
+    int64_t cols;
+    int64_t tile_rows;
+    int64_t tile_cols;
+    int64_t interleave;                 // 0 for row-major
+};
+
+struct VerifyOptions{
+    VerifyMode mode;
+    int max_ulp;
+    double rel_tol;
+    double abs_tol;
+    int max_report;                     // mismatches listed
+    int threads;                        // 0 for the hardware concurrency
+    VerifyLayout layout;
+};
+
+inline VerifyOptions DefaultVerifyOptions(int64_t rows, int64_t cols, int64_t tile_rows, int64_t tile_cols){
+    VerifyOptions options;
+    options.mode = kVerifyExact;
+    options.max_ulp = 2;
+    options.rel_tol = 1e-2;
+    options.abs_tol = 1e-3;
+    options.max_report = 10;
+    options.threads = 0;
+    options.layout.rows = rows;
+    options.layout.cols = cols;
+    options.layout.tile_rows = std::max<int64_t>(tile_rows, 1);
+    options.layout.tile_cols = std::max<int64_t>(tile_cols, 1);
+    options.layout.interleave = 0;
+    return options;
+}
+
+// SDDMM output values: aligned_num_item vectors of vec_length lanes, stored
+// in groups of alignment vectors, tile_vectors vectors per thread block
+inline VerifyOptions SddmmVerifyOptions(int64_t aligned_num_item, int64_t vec_length, int64_t alignment, int64_t tile_vectors){
+    VerifyOptions options = DefaultVerifyOptions(aligned_num_item, vec_length, tile_vectors, vec_length);
+    options.layout.interleave = alignment;
+    return options;
+}
+
+struct Mismatch{
+    int64_t index;
+    int64_t row;
+    int64_t col;
+    int64_t tile_row;
+    int64_t tile_col;
+    int lane;
+    double got;
+    double expected;
+};
+
+struct VerifyReport{
+    int64_t checked;
+    int64_t errors;
+    double max_abs_error;
+    std::vector<Mismatch> first;        // lowest indices first
+    int64_t tiles_m;
+    int64_t tiles_n;
+    std::vector<int64_t> tile_errors;   // tiles_m x tiles_n, row-major
+
+    bool Passed() const { return errors == 0; }
+};
+
+inline Mismatch LocateMismatch(const VerifyLayout &layout, int64_t index, double got, double expected){
+    Mismatch mismatch;
+    mismatch.index = index;
+    if(layout.interleave > 0){
+        const int64_t group = layout.interleave * layout.cols;
+        mismatch.row = (index / group) * layout.interleave + index % layout.interleave;
+        mismatch.col = (index % group) / layout.interleave;
+        mismatch.lane = static_cast<int>((mismatch.col % 8) * 4 + (mismatch.row % 8) / 2);
+    }
+    else{
+        mismatch.row = index / layout.cols;
+        mismatch.col = index % layout.cols;
+        mismatch.lane = static_cast<int>((mismatch.row % 8) * 4 + (mismatch.col % 8) / 2);
+    }
+    mismatch.tile_row = mismatch.row / layout.tile_rows;
+    mismatch.tile_col = mismatch.col / layout.tile_cols;
+    mismatch.got = got;
+    mismatch.expected = expected;
+    return mismatch;
+}
+
+inline float HalfBitsToFloat(uint16_t h){
+    const uint32_t sign = (h & 0x8000u) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ffu;
+    uint32_t bits;
+    if(exponent == 0x1f) bits = sign | 0x7f800000u | (mantissa << 13);
+    else if(exponent != 0) bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    else if(mantissa == 0) bits = sign;
+    else{
+        // Subnormal: normalize the mantissa
+        exponent = 113;
+        while((mantissa & 0x400u) == 0){
+            mantissa <<= 1;
+            exponent--;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3ffu) << 13);
+    }
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+// Distance in representable halfs, on a line where -0 and +0 coincide
+inline int64_t HalfUlpDistance(uint16_t a, uint16_t b){
+    const int64_t ia = (a & 0x8000u) ? -static_cast<int64_t>(a & 0x7fffu) : static_cast<int64_t>(a);
+    const int64_t ib = (b & 0x8000u) ? -static_cast<int64_t>(b & 0x7fffu) : static_cast<int64_t>(b);
+    return ia > ib ? ia - ib : ib - ia;
+}
+
+// Per-thread state, merged by RunVerify
+struct VerifyPartial{
+    int64_t errors;
+    double max_abs_error;
+    std::vector<Mismatch> first;
+    std::vector<int64_t> tile_errors;
+};
+
+template <typename Compare>
+VerifyReport RunVerify(int64_t count, const VerifyOptions &options, Compare compare){
+    const VerifyLayout &layout = options.layout;
+    VerifyReport report;
+    report.checked = count;
+    report.errors = 0;
+    report.max_abs_error = 0;
+    report.tiles_m = (layout.rows + layout.tile_rows - 1) / layout.tile_rows;
+    report.tiles_n = (layout.cols + layout.tile_cols - 1) / layout.tile_cols;
+    report.tile_errors.assign(report.tiles_m * report.tiles_n, 0);
+
+    int threads = options.threads > 0 ? options.threads : static_cast<int>(std::thread::hardware_concurrency());
+    // Not worth a thread below a few hundred thousand elements
+    threads = static_cast<int>(std::max<int64_t>(1, std::min<int64_t>(std::max(threads, 1), count / (1 << 18))));
+    std::vector<VerifyPartial> partials(threads);
+    const int64_t chunk = (count + threads - 1) / threads;
+    std::vector<std::thread> pool;
+    for(int t = 0; t < threads; t++){
+        pool.push_back(std::thread([&, t](){
+            VerifyPartial &partial = partials[t];
+            partial.errors = 0;
+            partial.max_abs_error = 0;
+            partial.tile_errors.assign(report.tile_errors.size(), 0);
+            const int64_t begin = std::min(count, t * chunk);
+            const int64_t end = std::min(count, begin + chunk);
+            compare(begin, end, [&](int64_t index, double got, double expected){
+                const Mismatch mismatch = LocateMismatch(layout, index, got, expected);
+                partial.errors++;
+                partial.max_abs_error = std::max(partial.max_abs_error, std::fabs(got - expected));
+                partial.tile_errors[mismatch.tile_row * report.tiles_n + mismatch.tile_col]++;
+                if(static_cast<int>(partial.first.size()) < options.max_report) partial.first.push_back(mismatch);
+            });
+        }));
+    }
+    for(size_t t = 0; t < pool.size(); t++) pool[t].join();
+
+    // Chunks are in index order, so the first mismatches are those of the
+    // earliest chunks
+    for(int t = 0; t < threads; t++){
+        report.errors += partials[t].errors;
+        report.max_abs_error = std::max(report.max_abs_error, partials[t].max_abs_error);
+        for(size_t i = 0; i < partials[t].tile_errors.size(); i++) report.tile_errors[i] += partials[t].tile_errors[i];
+        for(size_t i = 0; i < partials[t].first.size() && static_cast<int>(report.first.size()) < options.max_report; i++)
+            report.first.push_back(partials[t].first[i]);
+    }
+    return report;
+}
+
+// Exact comparison of 32-bit integer outputs
+inline VerifyReport VerifyExact(const int *got, const int *expected, int64_t count, const VerifyOptions &options){
+    return RunVerify(count, options, [&](int64_t begin, int64_t end, const std::function<void(int64_t, double, double)> &fail){
+        int64_t i = begin;
+#ifdef __AVX2__
+        // Skip equal blocks of 8 and fall back to scalar on a difference
+        for(; i + 8 <= end; i += 8){
+            const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(got + i));
+            const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(expected + i));
+            const int equal = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b)));
+            if(equal == 0xff) continue;
+            for(int l = 0; l < 8; l++)
+                if(!(equal & (1 << l))) fail(i + l, got[i + l], expected[i + l]);
+        }
+#endif
+        for(; i < end; i++)
+            if(got[i] != expected[i]) fail(i, got[i], expected[i]);
+    });
+}
+
+// fp16 outputs given as raw half bits, compared by options.mode (ulp or relative)
+inline VerifyReport VerifyHalf(const uint16_t *got, const uint16_t *expected, int64_t count, const VerifyOptions &options){
+    return RunVerify(count, options, [&](int64_t begin, int64_t end, const std::function<void(int64_t, double, double)> &fail){
+        for(int64_t i = begin; i < end; i++){
+            if(got[i] == expected[i]) continue;
+            const float g = HalfBitsToFloat(got[i]);
+            const float e = HalfBitsToFloat(expected[i]);
+            bool mismatch;
+            if(options.mode == kVerifyUlp) mismatch = std::isnan(g) || std::isnan(e) || HalfUlpDistance(got[i], expected[i]) > options.max_ulp;
+            else if(options.mode == kVerifyRelative) mismatch = !(std::fabs(g - e) <= options.abs_tol + options.rel_tol * std::fabs(e));
+            else mismatch = true;
+            if(mismatch) fail(i, g, e);
+        }
+    });
+}
+
+inline VerifyReport VerifyFloat(const float *got, const float *expected, int64_t count, const VerifyOptions &options){
+    return RunVerify(count, options, [&](int64_t begin, int64_t end, const std::function<void(int64_t, double, double)> &fail){
+        for(int64_t i = begin; i < end; i++){
+            const bool mismatch = (options.mode == kVerifyExact) ? got[i] != expected[i] :
+                                  !(std::fabs(got[i] - expected[i]) <= options.abs_tol + options.rel_tol * std::fabs(expected[i]));
+            if(mismatch) fail(i, got[i], expected[i]);
+        }
+    });
+}
+
+// Error count per tile as a character map, downsampled to at most 64 x 32 cells
+inline void PrintErrorHeatmap(FILE *out, const VerifyReport &report){
+    const char shades[] = " .:-=+*#%@";
+    const int64_t cells_n = std::min<int64_t>(report.tiles_n, 64);
+    const int64_t cells_m = std::min<int64_t>(report.tiles_m, 32);
+    std::vector<int64_t> cells(cells_m * cells_n, 0);
+    int64_t peak = 0;
+    for(int64_t i = 0; i < report.tiles_m; i++)
+        for(int64_t j = 0; j < report.tiles_n; j++){
+            int64_t &cell = cells[(i * cells_m / report.tiles_m) * cells_n + j * cells_n / report.tiles_n];
+            cell += report.tile_errors[i * report.tiles_n + j];
+            peak = std::max(peak, cell);
+        }
+    fprintf(out, "error heatmap, %lld x %lld tiles in %lld x %lld cells, '@' = %lld errors\n",
+            (long long)report.tiles_m, (long long)report.tiles_n, (long long)cells_m, (long long)cells_n, (long long)peak);
+    for(int64_t i = 0; i < cells_m; i++){
+        fprintf(out, "|");
+        for(int64_t j = 0; j < cells_n; j++){
+            const int64_t c = cells[i * cells_n + j];
+            fputc(c == 0 ? shades[0] : shades[1 + (c * 9 - 1) / peak], out);
+        }
+        fprintf(out, "|\n");
+    }
+}
+
+inline void PrintVerifyReport(FILE *out, const char *name, const VerifyReport &report){
+    if(report.Passed()){
+        fprintf(out, "%s: %lld values match\n", name, (long long)report.checked);
+        return;
+    }
+    fprintf(out, "%s: %lld of %lld values differ, max abs error %g\n", name, (long long)report.errors,
+            (long long)report.checked, report.max_abs_error);
+    for(size_t i = 0; i < report.first.size(); i++){
+        const Mismatch &m = report.first[i];
+        fprintf(out, "  [%lld] row %lld col %lld tile (%lld, %lld) lane %d: got %g expected %g\n", (long long)m.index,
+                (long long)m.row, (long long)m.col, (long long)m.tile_row, (long long)m.tile_col, m.lane, m.got, m.expected);
+    }
+    PrintErrorHeatmap(out, report);
+}
+
+#endif
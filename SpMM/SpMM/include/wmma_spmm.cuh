@@ -1,6 +1,8 @@
 #include "cuda_fp16.h"
 #ifndef WMMA_SPMM_H
 #define WMMA_SPMM_H
+#include "epilogue.h"
+#include "skinny_spmm.h"
 
 namespace spmm{
 
@@ -76,6 +78,94 @@ cudaError_t wmmaSpmm_16b(int m_vec, int vec_length, int n, int k,
     const int* __restrict__ rhs_matrix,
     int* __restrict__ output_matrix);
 
+typedef cudaError_t (*WmmaSpmmKernel)(int, int, int, int, const int*, const int*, const int*,
+    const int*, const int*, int*);
+
+// The dispatcher for a precision pair, NULL if there is none
+inline WmmaSpmmKernel SelectWmmaSpmm(int preA_cut, int preB){
+    if (preA_cut == 4 && preB == 4) return wmmaSpmm_4b;
+    if (preA_cut == 8 && preB == 4) return wmmaSpmm_8b4b;
+    if (preA_cut == 12 && preB == 4) return wmmaSpmm_12b4b;
+    if (preA_cut == 16 && preB == 4) return wmmaSpmm_16b4b;
+    if (preA_cut == 8 && preB == 8) return wmmaSpmm_8b;
+    if (preA_cut == 12 && preB == 8) return wmmaSpmm_12b8b;
+    if (preA_cut == 16 && preB == 8) return wmmaSpmm_16b8b;
+    if (preA_cut == 16 && preB == 16) return wmmaSpmm_16b;
+    return NULL;
+}
+
+// The 4-bit and 8-bit kernels with a fused epilogue (epilogue.h). output_matrix
+// holds dimM x EpilogueRowWords(n, epilogue.out_bits) ints.
+cudaError_t wmmaSpmmEpilogue_4b(int m_vec, int vec_length, int n, int k,
+    const int* __restrict__ row_indices,
+    const int* __restrict__ row_offsets,
+    const int* __restrict__ column_indices,
+    const int* __restrict__ values,
+    const int* __restrict__ rhs_matrix,
+    const SpmmEpilogue &epilogue,
+    int* __restrict__ output_matrix);
+
+cudaError_t wmmaSpmmEpilogue_8b(int m_vec, int vec_length, int n, int k,
+    const int* __restrict__ row_indices,
+    const int* __restrict__ row_offsets,
+    const int* __restrict__ column_indices,
+    const int* __restrict__ values,
+    const int* __restrict__ rhs_matrix,
+    const SpmmEpilogue &epilogue,
+    int* __restrict__ output_matrix);
+
+typedef cudaError_t (*WmmaSpmmEpilogueKernel)(int, int, int, int, const int*, const int*, const int*,
+    const int*, const int*, const SpmmEpilogue&, int*);
+
+// Only the pairs whose output feeds the same kernel as the next layer's rhs
+// have an epilogue, NULL for the others
+inline WmmaSpmmEpilogueKernel SelectWmmaSpmmEpilogue(int preA_cut, int preB){
+    if (preA_cut == 4 && preB == 4) return wmmaSpmmEpilogue_4b;
+    if (preA_cut == 8 && preB == 8) return wmmaSpmmEpilogue_8b;
+    return NULL;
+}
+
+// The skinny-N kernels (skinny_spmm.h), for n <= kSkinnyMaxN. values is the
+// PackSkinnyValues layout and column_indices the unshuffled aligned indices;
+// k is unused.
+cudaError_t wmmaSpmmSkinny_4b(int m_vec, int vec_length, int n, int k,
+    const int* __restrict__ row_indices,
+    const int* __restrict__ row_offsets,
+    const int* __restrict__ column_indices,
+    const int* __restrict__ values,
+    const int* __restrict__ rhs_matrix,
+    int* __restrict__ output_matrix);
+
+cudaError_t wmmaSpmmSkinny_8b4b(int m_vec, int vec_length, int n, int k,
+    const int* __restrict__ row_indices,
+    const int* __restrict__ row_offsets,
+    const int* __restrict__ column_indices,
+    const int* __restrict__ values,
+    const int* __restrict__ rhs_matrix,
+    int* __restrict__ output_matrix);
+
+cudaError_t wmmaSpmmSkinny_8b(int m_vec, int vec_length, int n, int k,
+    const int* __restrict__ row_indices,
+    const int* __restrict__ row_offsets,
+    const int* __restrict__ column_indices,
+    const int* __restrict__ values,
+    const int* __restrict__ rhs_matrix,
+    int* __restrict__ output_matrix);
+
+inline WmmaSpmmKernel SelectWmmaSpmmSkinny(int preA_cut, int preB){
+    if (preA_cut == 4 && preB == 4) return wmmaSpmmSkinny_4b;
+    if (preA_cut == 8 && preB == 4) return wmmaSpmmSkinny_8b4b;
+    if (preA_cut == 8 && preB == 8) return wmmaSpmmSkinny_8b;
+    return NULL;
+}
+
+// The dispatcher for n columns: the skinny kernel when UseSkinnySpmm, which
+// also decides how the values are packed, the Tile_N kernels otherwise
+inline WmmaSpmmKernel SelectWmmaSpmm(int preA_cut, int preB, int n){
+    if (UseSkinnySpmm(preA_cut, preB, n)) return SelectWmmaSpmmSkinny(preA_cut, preB);
+    return SelectWmmaSpmm(preA_cut, preB);
+}
+
 } // namespace spmm
 
 #endif
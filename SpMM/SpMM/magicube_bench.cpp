@@ -0,0 +1,657 @@
+#include <cuda_runtime.h>
+#include <cuda_fp16.h>
+#include <random>
+#include <assert.h>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <cublas_v2.h>
+#include <cusparse.h>
+#include "include/bm_test_utils.h"
+#include "include/index_utils.h"
+#include "include/wmma_spmm.cuh"
+#include "include/cublas_gemm.cuh"
+#include "include/spmm_packer.h"
+#include "include/cpu_spmm.h"
+#include "include/cost_model.h"
+#include "include/smtx_io.h"
+#include "include/bench_options.h"
+#include "include/bench_report.h"
+#include "include/cuda_timer.h"
+#include "include/results_store.h"
+#include "include/trace.h"
+#include "include/verifier.h"
+#include "include/cuda_arena.h"
+#include "include/transpose_spmm.h"
+#include "include/hybrid_format.h"
+#include "include/autotuner.h"
+// The quantized SDDMM kernels live in the SDDMM project
+#include "../../SDDMM/SDDMM/include/wmma_sddmm.cuh"
+#include "../../SDDMM/SDDMM/include/cpu_sddmm.h"
+
+// Unified benchmark driver: runs the Magicube SpMM, the Magicube SDDMM, the
+// cuBLAS dense and the cuSPARSE sparse baselines over a list of matrices and writes one record per
+// configuration as JSON or CSV. See include/bench_options.h for the options.
+// Host and device buffers come from the arenas of include/cuda_arena.h, so
+// only the first configuration of a shape allocates.
+
+typedef ArenaBuffer<int, HostArena> HostInts;
+typedef ArenaBuffer<int, DeviceArena> DeviceInts;
+
+inline TimingOptions BenchTimingOptions(const BenchOptions &options){
+    TimingOptions timing = FixedTimingOptions(options.warmup, options.iters);
+    if(options.target_ci > 0){
+        timing.target_rel_ci = options.target_ci;
+        timing.max_iters = std::max(options.iters, options.max_iters);
+    }
+    timing.flush_cache = options.flush;
+    return timing;
+}
+
+// Same packing, launch and check as BmFN in spmm_benchmark.cpp. preA is the
+// storage precision of a value (16 for 12-bit values) and preA_cut the
+// precision used by the kernel. With transposed set the kernel runs A^T * B
+// on the vector-sparse CSR of A^T from the plan (see transpose_spmm.h) and is
+// checked against the CSC path on the CPU. For n <= kSkinnyMaxN the skinny
+// kernels run on their own value layout (see skinny_spmm.h).
+template <typename TypeA>
+void RunSpmm(const SmtxMatrix &matrix, int dimN, int vec_length, int preA, int preA_cut, int preB, int scaleA,
+             const BenchOptions &options, BenchRecord &record, const TransposedSpmmPlan<int> *transposed = NULL){
+    std::default_random_engine generator;
+    const int m_vec = CheckedCast<int>(transposed ? transposed->m_vec : matrix.m_vec, "m_vec");
+    const int dimK = CheckedCast<int>(transposed ? transposed->k : matrix.k, "k");
+    const int64_t dimM = CheckedMul(m_vec, vec_length, "dimM");
+    const int64_t nonzeros_vec = transposed ? transposed->NonzerosVec() : matrix.nonzeros_vec;
+    const int64_t nonzeros = CheckedMul(matrix.nonzeros_vec, vec_length, "nonzeros");
+    const int64_t output_size = CheckedMul(dimM, dimN, "dimM * dimN");
+    const int mma_k_dim = MmaKDim(preA_cut, preB);
+    const bool skinny = UseSkinnySpmm(preA_cut, preB, dimN);
+    const SpmmKernelConfig config = SpmmDispatchedConfig(preA_cut, preB, dimN);
+    const int *row_offsets = transposed ? transposed->row_offsets.data() : matrix.row_offsets.data();
+    const int *col_indices = transposed ? transposed->col_indices.data() : matrix.col_indices.data();
+
+    TraceSpan stage("spmm pack");
+    const SpmmPlan plan = MakeSpmmPlan<int>(m_vec, row_offsets, dimK, dimN, vec_length, preA, preA_cut, preB, scaleA,
+                                            sizeof(TypeA), sizeof(int), transposed ? matrix.nonzeros_vec : -1);
+    record.m = transposed ? transposed->rows : dimM;
+    record.k = dimK;
+    record.n = dimN;
+    record.nonzeros_vec = nonzeros_vec;
+    record.kernel_config = SpmmKernelConfigName(config) + (options.sorted ? "_sorted" : "");
+    record.aligned_nonzeros_vec = plan.aligned_num_item;
+    if(!FitsDeviceIndex(output_size) || !FitsDeviceIndex(static_cast<int64_t>(plan.aligned_value_bytes)) ||
+       !FitsDeviceIndex(static_cast<int64_t>(plan.rhs_bytes))){
+        record.status = "exceeds the 32-bit index range of the device kernels";
+        return;
+    }
+
+    HostArena &host = GlobalHostArena();
+    DeviceArena &device = GlobalDeviceArena();
+    host.Reserve(plan.HostBuffers(options.verify));
+    device.Reserve(plan.DeviceBuffers());
+    HostInts aligned_row_offsets(host, m_vec * 2);
+    const int aligned_num_item = AlignRowOffsets<int>(m_vec, row_offsets, mma_k_dim, aligned_row_offsets.data());
+    const int64_t aligned_value_words = CheckedMul(aligned_num_item, scaleA, "aligned values");
+    const int64_t rhs_row_words = CheckedPackedWords(dimN, preB, sizeof(int), "rhs row");
+    const int64_t rhs_words = CheckedMul(dimK, rhs_row_words, "rhs matrix");
+
+    HostInts aligned_col_indices(host, aligned_num_item);
+    HostInts aligned_col_indices_shuffle(host, aligned_num_item);
+    AlignColIndices<int>(m_vec, row_offsets, col_indices, aligned_row_offsets.data(), aligned_num_item, aligned_col_indices.data());
+    ShuffleColIndices<int>(aligned_num_item, aligned_col_indices.data(), aligned_col_indices_shuffle.data());
+
+    const int64_t value_words = CheckedPackedWords(CheckedMul(nonzeros, scaleA, "values"), preA, sizeof(TypeA), "values");
+    ArenaBuffer<TypeA, HostArena> values(host, value_words);
+    HostInts rhs_matrix(host, rhs_words);
+    MakeDenseMatrix<TypeA>(1, value_words, values.data(), generator);
+    MakeDenseMatrix<int>(dimK, rhs_row_words, rhs_matrix.data(), generator);
+    // The values are generated for A and gathered into A^T
+    ArenaBuffer<TypeA, HostArena> transposed_values(host, transposed ? CheckedMul(nonzeros_vec, scaleA, "transposed values") : 0);
+    if(transposed) TransposeVectorValues<TypeA, int>(*transposed, preA, scaleA, values.data(), transposed_values.data());
+
+    ArenaBuffer<TypeA, HostArena> aligned_values(host, aligned_value_words);
+    ArenaBuffer<TypeA, HostArena> aligned_values_transpose(host, skinny ? 0 : aligned_value_words, true);
+    ArenaBuffer<TypeA, HostArena> aligned_values_transpose_decompose(host, skinny ? 0 : aligned_value_words, true);
+    // Never more bytes than the aligned values, so it fits their device buffer
+    HostInts skinny_values(host, skinny ? SkinnyValueWords(aligned_num_item, vec_length, preA_cut) : 0);
+    AlignValues<TypeA, int>(m_vec, row_offsets, aligned_row_offsets.data(), aligned_num_item, scaleA,
+                            transposed ? transposed_values.data() : values.data(), aligned_values.data());
+    if(skinny)
+        PackSkinnyValues<TypeA, int>(aligned_num_item, vec_length, preA, preA_cut, scaleA, aligned_values.data(),
+                                     skinny_values.data());
+    else
+        TransposeDecomposeValues<TypeA, int>(aligned_num_item, vec_length, mma_k_dim, preA_cut, aligned_values.data(),
+                                             aligned_values_transpose.data(), aligned_values_transpose_decompose.data());
+    const void *device_values = skinny ? static_cast<const void *>(skinny_values.data()) :
+                                UseDecomposedValues(preA_cut, preB) ? static_cast<const void *>(aligned_values_transpose_decompose.data()) :
+                                static_cast<const void *>(aligned_values_transpose.data());
+    const size_t device_value_bytes = skinny ? skinny_values.size() * sizeof(int) : aligned_value_words * sizeof(TypeA);
+    // The skinny kernels take the aligned indices without the 4-bit shuffle
+    const int *device_col_indices = (mma_k_dim == 32 && !skinny) ? aligned_col_indices_shuffle.data() : aligned_col_indices.data();
+
+    HostInts row_indices(host, m_vec);
+    if(options.sorted) SortedRowSwizzle(m_vec, row_offsets, row_indices.data());
+    else IdentityRowSwizzle(m_vec, row_indices.data());
+
+    stage.Next("spmm copy to device");
+    DeviceInts device_row_offsets(device, m_vec * 2), device_col_indices_buffer(device, aligned_num_item),
+               device_row_indices(device, m_vec), device_rhs_matrix(device, rhs_words), device_output(device, output_size);
+    ArenaBuffer<TypeA, DeviceArena> device_values_buffer(device, aligned_value_words);
+    int *d_row_offsets = device_row_offsets.data(), *d_col_indices = device_col_indices_buffer.data();
+    int *d_row_indices = device_row_indices.data(), *d_rhs_matrix = device_rhs_matrix.data();
+    int *d_output_value = device_output.data();
+    int *d_values = reinterpret_cast<int *>(device_values_buffer.data());
+    checkCuda(cudaMemcpy(d_row_offsets, aligned_row_offsets.data(), (m_vec*2) * sizeof(int), cudaMemcpyHostToDevice));
+    checkCuda(cudaMemcpy(d_col_indices, device_col_indices, aligned_num_item * sizeof(int), cudaMemcpyHostToDevice));
+    checkCuda(cudaMemcpy(d_row_indices, row_indices.data(), m_vec * sizeof(int), cudaMemcpyHostToDevice));
+    checkCuda(cudaMemcpy(d_values, device_values, device_value_bytes, cudaMemcpyHostToDevice));
+    checkCuda(cudaMemcpy(d_rhs_matrix, rhs_matrix.data(), rhs_words * sizeof(int), cudaMemcpyHostToDevice));
+
+    stage.Next("spmm kernel loop");
+    spmm::WmmaSpmmKernel kernel = spmm::SelectWmmaSpmm(preA_cut, preB, dimN);
+    TimeDevice(BenchTimingOptions(options), [&](){
+        kernel(m_vec, vec_length, dimN, dimK, d_row_indices, d_row_offsets, d_col_indices, d_values, d_rhs_matrix, d_output_value);
+    }, record.times_ms);
+
+    SpmmCost cost = EstimateDispatchedSpmmCost<int>(m_vec, row_offsets, dimN, vec_length, preA_cut, preB,
+                                                    DefaultMachineModel());
+    // Useful work of A (or A^T) alone, without the explicit zeros of A^T
+    record.flops = 2.0 * nonzeros * dimN;
+    record.bytes = static_cast<double>(cost.index_bytes + cost.value_bytes + cost.rhs_bytes + cost.output_bytes);
+
+    if(options.verify){
+        stage.Next("spmm verify");
+        HostInts output_value_host(host, output_size);
+        HostInts output_value_cuda(host, output_size);
+        // Only the first rows of the A^T output are real rows
+        const int64_t checked_rows = transposed ? transposed->rows : dimM;
+        if(transposed)
+            TransposedSpmmCpu<TypeA, int>(*transposed, preA, preA_cut, preB, scaleA, values.data(), rhs_matrix.data(), dimN,
+                                          output_value_host.data());
+        else
+            compute_ref_integers<TypeA, int>(values.data(), rhs_matrix.data(), output_value_host.data(), dimM, dimK, dimN,
+                                             preA, preA_cut, preB, vec_length, row_offsets, col_indices, m_vec, scaleA);
+        checkCuda(cudaMemcpy(output_value_cuda.data(), d_output_value, output_size * sizeof(int), cudaMemcpyDeviceToHost));
+        VerifyReport report = VerifyExact(output_value_cuda.data(), output_value_host.data(), checked_rows * dimN,
+                                          DefaultVerifyOptions(checked_rows, dimN, vec_length, config.tile_n));
+        if(!report.Passed()) PrintVerifyReport(stderr, "SpMM", report);
+        record.errors = report.errors;
+        record.verified = record.errors ? "fail" : "pass";
+    }
+
+}
+
+// Pick the word type and the number of words per vector used by
+// spmm_benchmark.cpp for this precision and vec_length
+void RunSpmmConfig(const SmtxMatrix &matrix, int dimN, int vec_length, int preA, int preB,
+                   const BenchOptions &options, BenchRecord &record, const TransposedSpmmPlan<int> *transposed = NULL){
+    if(spmm::SelectWmmaSpmm(preA, preB, dimN) == NULL || (vec_length != 2 && vec_length != 4 && vec_length != 8)){
+        record.status = "unsupported precision and vec_length";
+        return;
+    }
+    const int storage = (preA == 12) ? 16 : preA;
+    const int vector_bits = storage * vec_length;
+    if(preA == 16 && preB == 16)
+        RunSpmm<short>(matrix, dimN, vec_length, storage, preA, preB, vector_bits / 16, options, record, transposed);
+    else if(vector_bits >= 64)
+        RunSpmm<long long>(matrix, dimN, vec_length, storage, preA, preB, vector_bits / 64, options, record, transposed);
+    else if(vector_bits == 32)
+        RunSpmm<int>(matrix, dimN, vec_length, storage, preA, preB, 1, options, record, transposed);
+    else if(vector_bits == 16)
+        RunSpmm<short>(matrix, dimN, vec_length, storage, preA, preB, 1, options, record, transposed);
+    else
+        RunSpmm<char>(matrix, dimN, vec_length, storage, preA, preB, 1, options, record, transposed);
+}
+
+// SpMM at the vec_length the cost model executor stored in the tuning
+// database for matrices like this one (see autotune.cpp): the matrix is split into vectors of that length
+// first. Without a record, or with one that does not divide vec_length, it
+// runs as stored.
+void RunSpmmTuned(const SmtxMatrix &matrix, int dimN, int vec_length, int preA, int preB,
+                  const std::map<std::string, TuningRecord> &db, const BenchOptions &options, BenchRecord &record){
+    const SpmmFeatures features = ComputeSpmmFeatures(matrix.m_vec, matrix.k, matrix.row_offsets.data(), dimN,
+                                                      vec_length, preA, preB);
+    const TuningRecord *tuned = FindTuningRecord(db, features, "model");
+    if(tuned == NULL || tuned->candidate.vec_length >= vec_length || vec_length % tuned->candidate.vec_length != 0){
+        RunSpmmConfig(matrix, dimN, vec_length, preA, preB, options, record);
+        return;
+    }
+    const int factor = vec_length / tuned->candidate.vec_length;
+    SmtxMatrix split;
+    split.m_vec = CheckedMul(matrix.m_vec, factor, "split m_vec");
+    split.k = matrix.k;
+    split.nonzeros_vec = CheckedMul(matrix.nonzeros_vec, factor, "split nonzeros");
+    split.row_offsets = SplitVectorRows(matrix.m_vec, matrix.row_offsets.data(), factor);
+    split.col_indices = SplitVectorColumns(matrix.m_vec, matrix.row_offsets.data(), matrix.col_indices.data(), factor);
+    fprintf(stderr, "tuned v=%d -> v=%d (%s)\n", vec_length, tuned->candidate.vec_length, tuned->source.c_str());
+    record.vec_length = tuned->candidate.vec_length;
+    RunSpmmConfig(split, dimN, tuned->candidate.vec_length, preA, preB, options, record);
+}
+
+// A^T * B on the cached transposed plan of the matrix; the conversion is
+// paid once per matrix and vec_length
+void RunSpmmTransposedConfig(const SmtxMatrix &matrix, int dimN, int vec_length, int preA, int preB,
+                             TransposeCache<int> &cache, const BenchOptions &options, BenchRecord &record){
+    if(vec_length != 2 && vec_length != 4 && vec_length != 8){
+        record.status = "unsupported precision and vec_length";
+        return;
+    }
+    const int64_t misses = cache.misses();
+    const TransposedSpmmPlan<int> &transposed = cache.Get(matrix.m_vec, matrix.k, vec_length, matrix.row_offsets.data(),
+                                                          matrix.col_indices.data());
+    if(cache.misses() != misses)
+        fprintf(stderr, "transposed plan v=%d: %lld -> %lld vectors in %.3f ms\n", vec_length, (long long)matrix.nonzeros_vec,
+                (long long)transposed.NonzerosVec(), transposed.build_ms);
+    RunSpmmConfig(matrix, dimN, vec_length, preA, preB, options, record, &transposed);
+}
+
+// compute_ref_integers on one group of a hybrid matrix, its rows scattered
+// to the output rows of the group's panels. TypeA holds one vector of
+// vec_length preA-bit values.
+template <typename TypeA>
+void HybridGroupRef(const HybridGroup<int, int> &group, int64_t rows, int dimK, int dimN, int preA, int preB,
+                    const int *rhs_matrix, int *out){
+    const int64_t vector_rows = group.NumVectorRows();
+    if(vector_rows == 0) return;
+    HostArena &host = GlobalHostArena();
+    ArenaBuffer<TypeA, HostArena> packed(host, group.col_indices.size());
+    PackGroupValues<TypeA, int, int>(group, preA, 1, packed.data());
+    const int64_t group_rows = CheckedMul(vector_rows, group.vec_length, "hybrid group rows");
+    HostInts group_out(host, CheckedMul(group_rows, dimN, "hybrid group output"));
+    compute_ref_integers<TypeA, int>(packed.data(), rhs_matrix, group_out.data(), group_rows, dimK, dimN, preA, preA, preB,
+                                     group.vec_length, group.row_offsets.data(), group.col_indices.data(), vector_rows, 1);
+    for(int64_t r = 0; r < vector_rows; r++){
+        const int64_t out_row = VectorRowOutputRow(group, r);
+        for(int v = 0; v < group.vec_length && out_row + v < rows; v++){
+            const int *src = group_out.data() + (r * group.vec_length + v) * dimN;
+            std::copy(src, src + dimN, out + (out_row + v) * dimN);
+        }
+    }
+}
+
+// CPU executor of the hybrid format (include/hybrid_format.h). The rows of
+// the matrix file are taken as scalar rows with random preA-bit values, every
+// panel of 8 rows gets the vec_length of the smallest footprint, and
+// HybridSpmmCpu is timed. The check runs compute_ref_integers on every group
+// of the hybrid matrix through the packed values of PackGroupValues.
+void RunHybrid(const SmtxMatrix &matrix, int dimN, int preA, int preB, const BenchOptions &options, BenchRecord &record){
+    if((preA != 4 && preA != 8) || (preB != 4 && preB != 8)){
+        record.status = "unsupported precision";
+        return;
+    }
+    std::default_random_engine generator;
+    const int rows = CheckedCast<int>(matrix.m_vec, "rows");
+    const int dimK = CheckedCast<int>(matrix.k, "k");
+    const int64_t output_size = CheckedMul(rows, dimN, "rows * n");
+    record.m = rows;
+    record.k = dimK;
+    record.n = dimN;
+    record.vec_length = 0;
+
+    TraceSpan stage("hybrid convert");
+    HostArena &host = GlobalHostArena();
+    std::uniform_int_distribution<int> value_distribution(0, (1 << preA) - 1);
+    HostInts values(host, matrix.nonzeros_vec);
+    for(int64_t i = 0; i < values.size(); i++) values[i] = value_distribution(generator);
+    HybridMatrix<int, int> hybrid;
+    CsrToHybrid<int, int>(rows, dimK, matrix.row_offsets.data(), matrix.col_indices.data(), values.data(),
+                          MmaKDim(preA, preB), preA, hybrid);
+    int64_t stored_vectors = 0, stored_values = 0;
+    for(int g = 0; g < 3; g++){
+        const HybridGroup<int, int> &group = hybrid.groups[g];
+        stored_vectors += group.col_indices.size();
+        stored_values += group.values.size();
+        fprintf(stderr, "hybrid v=%d: %lld panels, %lld vectors\n", group.vec_length, (long long)group.panel_ids.size(),
+                (long long)group.col_indices.size());
+    }
+    record.nonzeros_vec = matrix.nonzeros_vec;
+    record.aligned_nonzeros_vec = stored_values;
+
+    // Same packed rhs as RunSpmm, unpacked for the executor
+    const int64_t rhs_row_words = CheckedPackedWords(dimN, preB, sizeof(int), "rhs row");
+    HostInts rhs_matrix(host, CheckedMul(dimK, rhs_row_words, "rhs matrix"));
+    MakeDenseMatrix<int>(dimK, rhs_row_words, rhs_matrix.data(), generator);
+    HostInts rhs_values(host, CheckedMul(dimK, dimN, "rhs values"));
+    const int items = 32 / preB;
+    for(int64_t r = 0; r < dimK; r++)
+        for(int64_t c = 0; c < dimN; c++)
+            rhs_values[r * dimN + c] = static_cast<int>((static_cast<uint32_t>(rhs_matrix[r * rhs_row_words + c / items])
+                                                         >> ((c % items) * preB)) & ((1u << preB) - 1));
+
+    stage.Next("hybrid cpu spmm");
+    HostInts output(host, output_size);
+    // Few iterations: this is a host executor
+    TimeHost<SteadyClock>(FixedTimingOptions(1, 3), [&](){
+        HybridSpmmCpu<int, int, int, int>(hybrid, rhs_values.data(), dimN, output.data());
+    }, record.times_ms);
+    record.flops = 2.0 * matrix.nonzeros_vec * dimN;
+    record.bytes = static_cast<double>(stored_values * sizeof(int) + stored_vectors * sizeof(int) +
+                                       rhs_values.size() * sizeof(int) + output_size * sizeof(int));
+
+    if(options.verify){
+        stage.Next("hybrid verify");
+        HostInts reference(host, output_size, true);
+        for(int g = 0; g < 3; g++){
+            const HybridGroup<int, int> &group = hybrid.groups[g];
+            const int vector_bits = preA * group.vec_length;
+            if(vector_bits == 64) HybridGroupRef<long long>(group, rows, dimK, dimN, preA, preB, rhs_matrix.data(), reference.data());
+            else if(vector_bits == 32) HybridGroupRef<int>(group, rows, dimK, dimN, preA, preB, rhs_matrix.data(), reference.data());
+            else if(vector_bits == 16) HybridGroupRef<short>(group, rows, dimK, dimN, preA, preB, rhs_matrix.data(), reference.data());
+            else HybridGroupRef<char>(group, rows, dimK, dimN, preA, preB, rhs_matrix.data(), reference.data());
+        }
+        VerifyReport report = VerifyExact(output.data(), reference.data(), output_size,
+                                          DefaultVerifyOptions(rows, dimN, kHybridPanelRows, dimN));
+        if(!report.Passed()) PrintVerifyReport(stderr, "Hybrid SpMM", report);
+        record.errors = report.errors;
+        record.verified = record.errors ? "fail" : "pass";
+    }
+}
+
+// Same packing, launch and check as BmFN in SDDMM/SDDMM/sddmm_benchmark.cpp
+void RunSddmm(const SmtxMatrix &matrix, int dimK, int vec_length, int preA, int preB,
+              const BenchOptions &options, BenchRecord &record){
+    if(preA != preB || (preA != 4 && preA != 8 && preA != 16) || (vec_length != 2 && vec_length != 4 && vec_length != 8)){
+        record.status = "unsupported precision and vec_length";
+        return;
+    }
+    std::default_random_engine generator;
+    const int alignment = 8;
+    const int m_vec = CheckedCast<int>(matrix.m_vec, "m_vec");
+    const int m = CheckedCast<int>(CheckedMul(m_vec, vec_length, "m"), "m");
+    const int n = CheckedCast<int>(matrix.k, "n");
+    const int *row_offsets = matrix.row_offsets.data();
+
+    TraceSpan stage("sddmm pack");
+    HostArena &host = GlobalHostArena();
+    DeviceArena &device = GlobalDeviceArena();
+    HostInts aligned_row_offsets(host, m_vec * 2);
+    const int aligned_num_item = AlignRowOffsets<int>(m_vec, row_offsets, alignment, aligned_row_offsets.data());
+    record.m = m;
+    record.k = dimK;
+    record.n = n;
+    record.nonzeros_vec = matrix.nonzeros_vec;
+    record.aligned_nonzeros_vec = aligned_num_item;
+    record.kernel_config = options.sorted ? "sorted" : "default";
+
+    const int64_t output_size = CheckedMul(aligned_num_item, vec_length, "output values");
+    const int64_t lhs_words = CheckedPackedWords(CheckedMul(m, dimK, "m * k"), preA, sizeof(int), "lhs matrix");
+    const int64_t rhs_words = CheckedPackedWords(CheckedMul(n, dimK, "n * k"), preB, sizeof(int), "rhs matrix");
+    if(!FitsDeviceIndex(output_size) || !FitsDeviceIndex(CheckedMul(lhs_words, sizeof(int), "lhs matrix")) ||
+       !FitsDeviceIndex(CheckedMul(rhs_words, sizeof(int), "rhs matrix"))){
+        record.status = "exceeds the 32-bit index range of the device kernels";
+        return;
+    }
+
+    HostInts aligned_col_indices(host, aligned_num_item);
+    AlignColIndices<int>(m_vec, row_offsets, matrix.col_indices.data(), aligned_row_offsets.data(), aligned_num_item,
+                         aligned_col_indices.data());
+    HostInts lhs_matrix(host, lhs_words);
+    HostInts rhs_matrix(host, rhs_words);
+    MakeDenseMatrix<int>(m, dimK/(32/preA), lhs_matrix.data(), generator);
+    MakeDenseMatrix<int>(n, dimK/(32/preB), rhs_matrix.data(), generator);
+    HostInts row_indices(host, m_vec);
+    if(options.sorted) SortedRowSwizzle(m_vec, row_offsets, row_indices.data());
+    else IdentityRowSwizzle(m_vec, row_indices.data());
+
+    stage.Next("sddmm copy to device");
+    DeviceInts device_row_offsets(device, m_vec * 2), device_col_indices(device, aligned_num_item),
+               device_row_indices(device, m_vec), device_lhs_matrix(device, lhs_words), device_rhs_matrix(device, rhs_words),
+               device_output(device, output_size);
+    int *d_row_offsets = device_row_offsets.data(), *d_col_indices = device_col_indices.data();
+    int *d_row_indices = device_row_indices.data(), *d_lhs_matrix = device_lhs_matrix.data();
+    int *d_rhs_matrix = device_rhs_matrix.data(), *d_output_values = device_output.data();
+    checkCuda(cudaMemcpy(d_row_offsets, aligned_row_offsets.data(), (m_vec*2) * sizeof(int), cudaMemcpyHostToDevice));
+    checkCuda(cudaMemcpy(d_col_indices, aligned_col_indices.data(), aligned_num_item * sizeof(int), cudaMemcpyHostToDevice));
+    checkCuda(cudaMemcpy(d_row_indices, row_indices.data(), m_vec * sizeof(int), cudaMemcpyHostToDevice));
+    checkCuda(cudaMemcpy(d_lhs_matrix, lhs_matrix.data(), lhs_words * sizeof(int), cudaMemcpyHostToDevice));
+    checkCuda(cudaMemcpy(d_rhs_matrix, rhs_matrix.data(), rhs_words * sizeof(int), cudaMemcpyHostToDevice));
+    checkCuda(cudaMemset(d_output_values, 0, output_size * sizeof(int)));
+
+    stage.Next("sddmm kernel loop");
+    TimeDevice(BenchTimingOptions(options), [&](){
+        if(preA == 4) sddmm::wmmaSddmm_4b(m_vec, dimK, n, d_row_indices, d_row_offsets, d_col_indices, d_lhs_matrix, d_rhs_matrix, d_output_values, vec_length);
+        else if(preA == 8) sddmm::wmmaSddmm_8b(m_vec, dimK, n, d_row_indices, d_row_offsets, d_col_indices, d_lhs_matrix, d_rhs_matrix, d_output_values, vec_length);
+        else sddmm::wmmaSddmm_16b(m_vec, dimK, n, d_row_indices, d_row_offsets, d_col_indices, d_lhs_matrix, d_rhs_matrix, d_output_values, vec_length);
+    }, record.times_ms);
+
+    record.flops = 2.0 * matrix.nonzeros_vec * vec_length * dimK;
+    // Both dense operands, the indices and the output values
+    record.bytes = static_cast<double>(lhs_words + rhs_words + aligned_num_item + output_size) * sizeof(int);
+
+    if(options.verify){
+        stage.Next("sddmm verify");
+        HostInts output_value_host(host, output_size, true);
+        HostInts output_value_cuda(host, output_size);
+        Host_sddmm_integers<int>(lhs_matrix.data(), rhs_matrix.data(), output_value_host.data(), m, dimK, n, preA, preB,
+                                 vec_length, aligned_row_offsets.data(), aligned_col_indices.data(), m_vec, alignment);
+        checkCuda(cudaMemcpy(output_value_cuda.data(), d_output_values, output_size * sizeof(int), cudaMemcpyDeviceToHost));
+        VerifyReport report = VerifyExact(output_value_cuda.data(), output_value_host.data(), output_size,
+                                          SddmmVerifyOptions(aligned_num_item, vec_length, alignment, 64));
+        if(!report.Passed()) PrintVerifyReport(stderr, "SDDMM", report);
+        record.errors = report.errors;
+        record.verified = record.errors ? "fail" : "pass";
+    }
+
+}
+
+// Dense half precision GEMM of the same shape as the SpMM
+void RunCublas(const SmtxMatrix &matrix, int dimN, int vec_length, const BenchOptions &options, BenchRecord &record){
+    const int m = CheckedCast<int>(CheckedMul(matrix.m_vec, vec_length, "m"), "m");
+    const int dimK = CheckedCast<int>(matrix.k, "k");
+    record.m = m;
+    record.k = dimK;
+    record.n = dimN;
+    record.nonzeros_vec = record.aligned_nonzeros_vec = matrix.nonzeros_vec;
+
+    const int64_t lhs_size = CheckedMul(m, dimK, "m * k");
+    const int64_t rhs_size = CheckedMul(dimK, dimN, "k * n");
+    const int64_t output_size = CheckedMul(m, dimN, "m * n");
+    std::default_random_engine generator;
+    std::uniform_real_distribution<float> distribution(0.0, 1.0);
+    std::vector<half> lhs_matrix(lhs_size), rhs_matrix(rhs_size);
+    for(int64_t i = 0; i < lhs_size; i++) lhs_matrix[i] = __float2half(distribution(generator));
+    for(int64_t i = 0; i < rhs_size; i++) rhs_matrix[i] = __float2half(distribution(generator));
+
+    half *d_lhs_matrix, *d_rhs_matrix, *d_output_matrix;
+    checkCuda(cudaMalloc(&d_lhs_matrix, lhs_size * sizeof(half)));
+    checkCuda(cudaMalloc(&d_rhs_matrix, rhs_size * sizeof(half)));
+    checkCuda(cudaMalloc(&d_output_matrix, output_size * sizeof(half)));
+    checkCuda(cudaMemcpy(d_lhs_matrix, lhs_matrix.data(), lhs_size * sizeof(half), cudaMemcpyHostToDevice));
+    checkCuda(cudaMemcpy(d_rhs_matrix, rhs_matrix.data(), rhs_size * sizeof(half), cudaMemcpyHostToDevice));
+
+    cublasHandle_t handle;
+    checkCublas(cublasCreate(&handle));
+    TimeDevice(BenchTimingOptions(options), [&](){
+        cublasGeMM(handle, m, dimK, dimN, d_rhs_matrix, d_lhs_matrix, d_output_matrix);
+    }, record.times_ms);
+    cublasDestroy(handle);
+
+    record.flops = 2.0 * m * dimK * dimN;
+    record.bytes = static_cast<double>(lhs_size + rhs_size + output_size) * sizeof(half);
+
+    cudaFree(d_lhs_matrix);
+    cudaFree(d_rhs_matrix);
+    cudaFree(d_output_matrix);
+}
+
+// cuSPARSE half precision CSR SpMM on the scalar rows of the matrix: every
+// vector row becomes vec_length rows with the same columns
+void RunCusparse(const SmtxMatrix &matrix, int dimN, int vec_length, const BenchOptions &options, BenchRecord &record){
+    const int m = CheckedCast<int>(CheckedMul(matrix.m_vec, vec_length, "m"), "m");
+    const int dimK = CheckedCast<int>(matrix.k, "k");
+    const int nonzeros = CheckedCast<int>(CheckedMul(matrix.nonzeros_vec, vec_length, "nonzeros"), "nonzeros");
+    record.m = m;
+    record.k = dimK;
+    record.n = dimN;
+    record.nonzeros_vec = record.aligned_nonzeros_vec = matrix.nonzeros_vec;
+    record.kernel_config = "csr_alg2";
+
+    std::vector<int> row_offsets(m + 1, 0), col_indices(nonzeros);
+    int64_t e = 0;
+    for(int64_t i = 0; i < matrix.m_vec; i++){
+        for(int v = 0; v < vec_length; v++){
+            for(int64_t j = matrix.row_offsets[i]; j < matrix.row_offsets[i+1]; j++)
+                col_indices[e++] = matrix.col_indices[j];
+            row_offsets[i * vec_length + v + 1] = static_cast<int>(e);
+        }
+    }
+    const int64_t rhs_size = CheckedMul(dimK, dimN, "k * n");
+    const int64_t output_size = CheckedMul(m, dimN, "m * n");
+    std::default_random_engine generator;
+    std::uniform_real_distribution<float> distribution(0.0, 1.0);
+    std::vector<half> values(nonzeros), rhs_matrix(rhs_size);
+    for(int i = 0; i < nonzeros; i++) values[i] = __float2half(distribution(generator));
+    for(int64_t i = 0; i < rhs_size; i++) rhs_matrix[i] = __float2half(distribution(generator));
+
+    int *d_row_offsets, *d_col_indices;
+    half *d_values, *d_rhs_matrix, *d_output_matrix;
+    checkCuda(cudaMalloc(&d_row_offsets, (m + 1) * sizeof(int)));
+    checkCuda(cudaMalloc(&d_col_indices, nonzeros * sizeof(int)));
+    checkCuda(cudaMalloc(&d_values, nonzeros * sizeof(half)));
+    checkCuda(cudaMalloc(&d_rhs_matrix, rhs_size * sizeof(half)));
+    checkCuda(cudaMalloc(&d_output_matrix, output_size * sizeof(half)));
+    checkCuda(cudaMemcpy(d_row_offsets, row_offsets.data(), (m + 1) * sizeof(int), cudaMemcpyHostToDevice));
+    checkCuda(cudaMemcpy(d_col_indices, col_indices.data(), nonzeros * sizeof(int), cudaMemcpyHostToDevice));
+    checkCuda(cudaMemcpy(d_values, values.data(), nonzeros * sizeof(half), cudaMemcpyHostToDevice));
+    checkCuda(cudaMemcpy(d_rhs_matrix, rhs_matrix.data(), rhs_size * sizeof(half), cudaMemcpyHostToDevice));
+
+    cusparseHandle_t handle;
+    cusparseSpMatDescr_t lhs_sparse;
+    cusparseDnMatDescr_t rhs_dense, output_dense;
+    checkCusparse(cusparseCreate(&handle));
+    checkCusparse(cusparseCreateCsr(&lhs_sparse, m, dimK, nonzeros, d_row_offsets, d_col_indices, d_values,
+                                    CUSPARSE_INDEX_32I, CUSPARSE_INDEX_32I, CUSPARSE_INDEX_BASE_ZERO, CUDA_R_16F));
+    checkCusparse(cusparseCreateDnMat(&rhs_dense, dimK, dimN, dimN, d_rhs_matrix, CUDA_R_16F, CUSPARSE_ORDER_ROW));
+    checkCusparse(cusparseCreateDnMat(&output_dense, m, dimN, dimN, d_output_matrix, CUDA_R_16F, CUSPARSE_ORDER_ROW));
+    // Half operands accumulate in float
+    const float alpha = 1.0f, beta = 0.0f;
+    size_t buffer_size = 0;
+    checkCusparse(cusparseSpMM_bufferSize(handle, CUSPARSE_OPERATION_NON_TRANSPOSE, CUSPARSE_OPERATION_NON_TRANSPOSE,
+                                          &alpha, lhs_sparse, rhs_dense, &beta, output_dense, CUDA_R_32F,
+                                          CUSPARSE_SPMM_CSR_ALG2, &buffer_size));
+    void *d_buffer = NULL;
+    checkCuda(cudaMalloc(&d_buffer, std::max<size_t>(buffer_size, 1)));
+    TimeDevice(BenchTimingOptions(options), [&](){
+        cusparseSpMM(handle, CUSPARSE_OPERATION_NON_TRANSPOSE, CUSPARSE_OPERATION_NON_TRANSPOSE, &alpha, lhs_sparse,
+                     rhs_dense, &beta, output_dense, CUDA_R_32F, CUSPARSE_SPMM_CSR_ALG2, d_buffer);
+    }, record.times_ms);
+    cusparseDestroyDnMat(rhs_dense);
+    cusparseDestroyDnMat(output_dense);
+    cusparseDestroySpMat(lhs_sparse);
+    cusparseDestroy(handle);
+
+    record.flops = 2.0 * nonzeros * dimN;
+    record.bytes = static_cast<double>(nonzeros) * (sizeof(half) + sizeof(int)) + (m + 1) * sizeof(int) +
+                   static_cast<double>(rhs_size + output_size) * sizeof(half);
+
+    cudaFree(d_buffer);
+    cudaFree(d_row_offsets);
+    cudaFree(d_col_indices);
+    cudaFree(d_values);
+    cudaFree(d_rhs_matrix);
+    cudaFree(d_output_matrix);
+}
+
+void PrintUsage(){
+    printf("This script runs the Magicube SpMM and SDDMM and the cuBLAS and cuSPARSE baselines over a list of matrices.\n");
+    printf("\n");
+    printf("usage: ./magicube_bench --matrix [bm] [--name value ...]\n");
+    printf("options\n");
+    printf("--op          :   comma separated list of spmm, spmm_t (A^T * B), hybrid (CPU executor of the per-panel\n");
+    printf("                  vec_length format), sddmm, cublas, cusparse (half CSR SpMM). Default spmm.\n");
+    printf("--matrix      :   comma separated list of sparse matrix benchmarks, can be repeated.\n");
+    printf("--matrix-list :   file with one benchmark path per line.\n");
+    printf("--dataset-dir :   prefix of relative benchmark paths.\n");
+    printf("--n           :   comma separated list of the dense dimension (N of SpMM, K of SDDMM). Default 256.\n");
+    printf("--v           :   comma separated list of vector lengths, can be {2, 4, 8}. Default 8.\n");
+    printf("--preA        :   lhs precision. Default 8.\n");
+    printf("--preB        :   rhs precision. Default 8.\n");
+    printf("--sort        :   1 to sort the rows to balance the workload. Default 1.\n");
+    printf("--verify      :   1 to check the results against the CPU reference. Default 0.\n");
+    printf("--warmup      :   untimed launches before timing. Default 16.\n");
+    printf("--iters       :   timed launches. Default 512.\n");
+    printf("--target-ci   :   repeat until the 95%% CI is within this fraction of the mean. Default 0 (off).\n");
+    printf("--max-iters   :   upper bound of the timed launches with --target-ci. Default 8192.\n");
+    printf("--flush       :   1 to flush the L2 cache before every timed launch. Default 0.\n");
+    printf("--format      :   json or csv. Default json.\n");
+    printf("--output      :   output file. Default stdout.\n");
+    printf("--store       :   results store to append the measurements to, see compare_results.\n");
+    printf("--revision    :   revision recorded in the store. Default the git revision.\n");
+    printf("--tuning-db   :   autotune database; spmm runs at the vec_length the model executor tuned for the matrix.\n");
+    printf("--config      :   file with one 'name = value' option per line.\n");
+}
+
+int main(int argc, char **argv){
+    if (argc < 2 || strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0){
+        PrintUsage();
+        return argc < 2 ? 1 : 0;
+    }
+    BenchOptions options = DefaultBenchOptions();
+    if(!ParseBenchOptions(argc, argv, options)) return 1;
+
+    std::map<std::string, TuningRecord> tuning_db;
+    if(!options.tuning_db.empty()) tuning_db = LoadTuningDb(options.tuning_db);
+
+    std::vector<BenchRecord> records;
+    // Transposed plans of the current matrix
+    TransposeCache<int> transpose_cache;
+    for(size_t mi = 0; mi < options.matrices.size(); mi++){
+        transpose_cache.Clear();
+        // Blocks cached for the shapes of the previous matrix are unlikely to
+        // fit this one; give them back instead of holding every shape of the
+        // sweep
+        GlobalHostArena().Trim();
+        GlobalDeviceArena().Trim();
+        SmtxMatrix matrix;
+        const std::string path = MatrixPath(options, options.matrices[mi]);
+        TraceSpan read_span("read matrix");
+        const bool loaded = ReadSmtx(path, matrix);
+        read_span.End();
+        if(!loaded){
+            BenchRecord record = MakeBenchRecord("load", options.matrices[mi], 0, options.preA, options.preB);
+            record.status = "failed to load";
+            records.push_back(record);
+            continue;
+        }
+        for(size_t oi = 0; oi < options.ops.size(); oi++)
+        for(size_t vi = 0; vi < options.vec_length.size(); vi++)
+        for(size_t ni = 0; ni < options.n.size(); ni++){
+            const std::string &op = options.ops[oi];
+            // The hybrid format chooses the vec_length per panel
+            if(op == "hybrid" && vi > 0) continue;
+            BenchRecord record = MakeBenchRecord(op, options.matrices[mi], options.vec_length[vi], options.preA, options.preB);
+            fprintf(stderr, "%s %s v=%d n=%d\n", op.c_str(), options.matrices[mi].c_str(), options.vec_length[vi], options.n[ni]);
+            if(op == "spmm" && !tuning_db.empty())
+                RunSpmmTuned(matrix, options.n[ni], options.vec_length[vi], options.preA, options.preB, tuning_db, options, record);
+            else if(op == "spmm") RunSpmmConfig(matrix, options.n[ni], options.vec_length[vi], options.preA, options.preB, options, record);
+            else if(op == "spmm_t")
+                RunSpmmTransposedConfig(matrix, options.n[ni], options.vec_length[vi], options.preA, options.preB, transpose_cache,
+                                        options, record);
+            else if(op == "hybrid") RunHybrid(matrix, options.n[ni], options.preA, options.preB, options, record);
+            else if(op == "sddmm") RunSddmm(matrix, options.n[ni], options.vec_length[vi], options.preA, options.preB, options, record);
+            else if(op == "cublas") RunCublas(matrix, options.n[ni], options.vec_length[vi], options, record);
+            else if(op == "cusparse") RunCusparse(matrix, options.n[ni], options.vec_length[vi], options, record);
+            else record.status = "unknown op";
+            records.push_back(record);
+        }
+    }
+
+    FILE *out = options.output.empty() ? stdout : fopen(options.output.c_str(), "w");
+    if(out == NULL){
+        fprintf(stderr, "Failed to open %s\n", options.output.c_str());
+        return 1;
+    }
+    if(options.format == "csv") WriteBenchCsv(out, records);
+    else WriteBenchJson(out, records);
+    if(out != stdout) fclose(out);
+    GlobalHostArena().PrintStats(stderr);
+    GlobalDeviceArena().PrintStats(stderr);
+    // Before the CUDA runtime shuts down, see cuda_arena.h
+    GlobalDeviceArena().Trim();
+    if(!options.store.empty() &&
+       !AppendResults(options.store, options.revision.empty() ? CurrentGitRevision() : options.revision, records))
+        return 1;
+    return 0;
+}
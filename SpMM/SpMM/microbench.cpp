@@ -0,0 +1,334 @@
+#include <cuda_runtime.h>
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "include/bm_test_utils.h"
+#include "include/bench_options.h"
+#include "include/spmm_packer.h"
+#include "include/cpu_spmm.h"
+#include "include/smtx_io.h"
+#include "include/timer.h"
+#include "../../SDDMM/SDDMM/include/cpu_sddmm.h"
+
+// Microbenchmarks of the host side of the benchmark drivers: the .smtx
+// parser, the packer, the row swizzle, the dense generator and the CPU
+// references. Every case runs over the cross product of --rows, --k and
+// --sparsity on a synthetic uniform matrix and reports the median time and
+// the throughput.
+//
+//   ./microbench --filter transpose --rows 1024,8192 --sparsity 0.7,0.9 --format csv
+
+struct MicroOptions{
+    std::vector<int> rows;              // m_vec
+    std::vector<int> k;
+    std::vector<std::string> sparsity;
+    int n;                              // dense dimension of the references
+    int vec_length;
+    std::string filter;
+    TimingOptions timing;
+    std::string format;                 // text or csv
+};
+
+struct MicroProblem{
+    int m_vec;
+    int k;
+    double sparsity;
+    std::vector<int> row_offsets;
+    std::vector<int> col_indices;
+};
+
+struct MicroResult{
+    std::string name;
+    const MicroProblem *problem;
+    TimingStats stats;
+    double bytes;                       // per iteration
+    double items;                       // per iteration, see the case
+};
+
+// Every column of every row is kept with probability 1 - sparsity
+inline void MakeMicroProblem(int m_vec, int k, double sparsity, MicroProblem &problem){
+    std::default_random_engine generator(m_vec * 31 + k);
+    std::uniform_real_distribution<double> distribution(0.0, 1.0);
+    problem.m_vec = m_vec;
+    problem.k = k;
+    problem.sparsity = sparsity;
+    problem.row_offsets.assign(1, 0);
+    problem.col_indices.clear();
+    for(int i = 0; i < m_vec; i++){
+        for(int j = 0; j < k; j++)
+            if(distribution(generator) >= sparsity) problem.col_indices.push_back(j);
+        problem.row_offsets.push_back(static_cast<int>(problem.col_indices.size()));
+    }
+}
+
+inline void PrintMicroResult(const MicroOptions &options, const MicroResult &result, bool header){
+    const TimingStats &stats = result.stats;
+    const double seconds = stats.median * 1e-3;
+    const double gbs = seconds > 0 ? result.bytes / seconds / 1e9 : 0;
+    const double mitems = seconds > 0 ? result.items / seconds / 1e6 : 0;
+    if(options.format == "csv"){
+        if(header) printf("name,m_vec,k,sparsity,nonzeros_vec,iterations,median_ms,p95_ms,ci95_ms,gbs,mitems_per_s\n");
+        printf("%s,%d,%d,%.3f,%d,%lld,%.6f,%.6f,%.6f,%.3f,%.3f\n", result.name.c_str(), result.problem->m_vec,
+               result.problem->k, result.problem->sparsity, result.problem->row_offsets.back(), (long long)stats.count,
+               stats.median, stats.p95, stats.ci95, gbs, mitems);
+        return;
+    }
+    if(header) printf("%-36s %8s %6s %6s %6s %11s %11s %10s %12s\n", "case", "m_vec", "k", "sp", "iters", "median ms",
+                      "p95 ms", "GB/s", "Mitems/s");
+    printf("%-36s %8d %6d %6.2f %6lld %11.4f %11.4f %10.2f %12.2f\n", result.name.c_str(), result.problem->m_vec,
+           result.problem->k, result.problem->sparsity, (long long)stats.count, stats.median, stats.p95, gbs, mitems);
+}
+
+class MicroRunner{
+public:
+    MicroRunner(const MicroOptions &options): options_(options), printed_(0) {}
+
+    // Time fn on problem; bytes and items are what one call processes
+    void Run(const std::string &name, const MicroProblem &problem, double bytes, double items,
+             const std::function<void()> &fn){
+        if(!options_.filter.empty() && name.find(options_.filter) == std::string::npos) return;
+        MicroResult result;
+        result.name = name;
+        result.problem = &problem;
+        result.bytes = bytes;
+        result.items = items;
+        std::vector<double> samples;
+        result.stats = TimeHost<SteadyClock>(options_.timing, fn, samples);
+        PrintMicroResult(options_, result, printed_++ == 0);
+        fflush(stdout);
+    }
+
+private:
+    const MicroOptions &options_;
+    int printed_;
+};
+
+// Parse: write the problem as .smtx and read it back; items are nonzeros
+void BenchParse(MicroRunner &runner, const MicroProblem &problem){
+    char path[] = "/tmp/microbench_XXXXXX";
+    const int fd = mkstemp(path);
+    if(fd < 0) return;
+    FILE *out = fdopen(fd, "w");
+    fprintf(out, "%d, %d, %d\n", problem.m_vec, problem.k, problem.row_offsets.back());
+    for(size_t i = 0; i < problem.row_offsets.size(); i++) fprintf(out, "%s%d", i ? " " : "", problem.row_offsets[i]);
+    fprintf(out, "\n");
+    for(size_t i = 0; i < problem.col_indices.size(); i++) fprintf(out, "%s%d", i ? " " : "", problem.col_indices[i]);
+    fprintf(out, "\n");
+    const long file_bytes = ftell(out);
+    fclose(out);
+    runner.Run("smtx_parse", problem, file_bytes, problem.col_indices.size(), [&](){
+        SmtxMatrix matrix;
+        ReadSmtx(path, matrix);
+    });
+    unlink(path);
+}
+
+void BenchIndices(MicroRunner &runner, const MicroProblem &problem){
+    const int m_vec = problem.m_vec;
+    std::vector<int> aligned_row_offsets(m_vec * 2);
+    const int index_bytes = (m_vec + 1) * sizeof(int);
+    for(int mma_k_dim = 8; mma_k_dim <= 32; mma_k_dim *= 2){
+        runner.Run("align_row_offsets/k" + std::to_string(mma_k_dim), problem, index_bytes + m_vec * 2 * sizeof(int),
+                   m_vec, [&](){
+            AlignRowOffsets<int>(m_vec, problem.row_offsets.data(), mma_k_dim, aligned_row_offsets.data());
+        });
+    }
+    const int aligned_num_item = AlignRowOffsets<int>(m_vec, problem.row_offsets.data(), 16, aligned_row_offsets.data());
+    std::vector<int> aligned_col_indices(aligned_num_item), shuffled(aligned_num_item);
+    runner.Run("align_col_indices", problem, (problem.col_indices.size() + aligned_num_item) * sizeof(int),
+               problem.col_indices.size(), [&](){
+        AlignColIndices<int>(m_vec, problem.row_offsets.data(), problem.col_indices.data(), aligned_row_offsets.data(),
+                             aligned_num_item, aligned_col_indices.data());
+    });
+    runner.Run("shuffle_col_indices", problem, 2.0 * aligned_num_item * sizeof(int), aligned_num_item, [&](){
+        ShuffleColIndices<int>(aligned_num_item, aligned_col_indices.data(), shuffled.data());
+    });
+    std::vector<int> row_indices(m_vec);
+    runner.Run("sorted_row_swizzle", problem, (m_vec + 1 + m_vec) * sizeof(int), m_vec, [&](){
+        SortedRowSwizzle(m_vec, problem.row_offsets.data(), row_indices.data());
+    });
+}
+
+// Align and transpose/decompose the values of one precision; TypeA and scaleA
+// follow the mapping of spmm_benchmark for vec_length
+template <typename TypeA>
+void BenchValues(MicroRunner &runner, const MicroProblem &problem, int vec_length, int preA, int preA_cut, int preB,
+                 int scaleA){
+    const int m_vec = problem.m_vec;
+    const int mma_k_dim = MmaKDim(preA_cut, preB);
+    std::vector<int> aligned_row_offsets(m_vec * 2);
+    const int aligned_num_item = AlignRowOffsets<int>(m_vec, problem.row_offsets.data(), mma_k_dim,
+                                                      aligned_row_offsets.data());
+    const int64_t nonzeros_vec = problem.col_indices.size();
+    std::vector<TypeA> values(nonzeros_vec * scaleA);
+    std::vector<TypeA> aligned(static_cast<int64_t>(aligned_num_item) * scaleA);
+    std::vector<TypeA> transpose(aligned.size()), decompose(aligned.size());
+    std::default_random_engine generator;
+    MakeDenseMatrix<TypeA>(1, values.size(), values.data(), generator);
+
+    const std::string suffix = "/a" + std::to_string(preA_cut) + "b" + std::to_string(preB);
+    runner.Run("align_values" + suffix, problem, (values.size() + aligned.size()) * sizeof(TypeA), nonzeros_vec, [&](){
+        AlignValues<TypeA, int>(m_vec, problem.row_offsets.data(), aligned_row_offsets.data(), aligned_num_item, scaleA,
+                                values.data(), aligned.data());
+    });
+    runner.Run("transpose_decompose" + suffix, problem, 3.0 * aligned.size() * sizeof(TypeA), aligned_num_item, [&](){
+        TransposeDecomposeValues<TypeA, int>(aligned_num_item, vec_length, mma_k_dim, preA_cut, aligned.data(),
+                                             transpose.data(), decompose.data());
+    });
+}
+
+void BenchMakeDense(MicroRunner &runner, const MicroProblem &problem, int n){
+    const int64_t words = static_cast<int64_t>(problem.k) * n / 4;
+    std::vector<int> rhs(words);
+    std::default_random_engine generator;
+    runner.Run("make_dense_matrix", problem, words * sizeof(int), words, [&](){
+        MakeDenseMatrix<int>(problem.k, n / 4, rhs.data(), generator);
+    });
+}
+
+// 8-bit references; items are multiply-adds
+void BenchReferences(MicroRunner &runner, const MicroProblem &problem, int n, int vec_length){
+    const int m_vec = problem.m_vec;
+    const int64_t nonzeros_vec = problem.col_indices.size();
+    const int64_t m = static_cast<int64_t>(m_vec) * vec_length;
+    std::default_random_engine generator;
+
+    // SpMM: A is m x k with vec_length 8-bit values per long long word
+    if(vec_length == 8){
+        std::vector<long long> values(nonzeros_vec);
+        std::vector<int> rhs(static_cast<int64_t>(problem.k) * n / 4);
+        std::vector<int> out(m * n);
+        MakeDenseMatrix<long long>(1, values.size(), values.data(), generator);
+        MakeDenseMatrix<int>(problem.k, n / 4, rhs.data(), generator);
+        runner.Run("compute_ref_integers/a8b8", problem, (values.size() * 8 + rhs.size() * 4 + out.size() * 4.0),
+                   static_cast<double>(nonzeros_vec) * vec_length * n, [&](){
+            compute_ref_integers<long long, int>(values.data(), rhs.data(), out.data(), m, problem.k, n, 8, 8, 8,
+                                                 vec_length, problem.row_offsets.data(), problem.col_indices.data(),
+                                                 m_vec, 1);
+        });
+    }
+
+    // SDDMM: the matrix columns are the N of the output, n is the inner K
+    std::vector<int> aligned_row_offsets(m_vec * 2);
+    const int aligned_num_item = AlignRowOffsets<int>(m_vec, problem.row_offsets.data(), 8, aligned_row_offsets.data());
+    std::vector<int> aligned_col_indices(aligned_num_item);
+    AlignColIndices<int>(m_vec, problem.row_offsets.data(), problem.col_indices.data(), aligned_row_offsets.data(),
+                         aligned_num_item, aligned_col_indices.data());
+    std::vector<int> lhs(m * n / 4), rhs(static_cast<int64_t>(problem.k) * n / 4);
+    std::vector<int> out(static_cast<int64_t>(aligned_num_item) * vec_length);
+    MakeDenseMatrix<int>(m, n / 4, lhs.data(), generator);
+    MakeDenseMatrix<int>(problem.k, n / 4, rhs.data(), generator);
+    runner.Run("host_sddmm_integers/a8b8", problem, (lhs.size() + rhs.size() + out.size()) * 4.0,
+               static_cast<double>(nonzeros_vec) * vec_length * n, [&](){
+        Host_sddmm_integers<int>(lhs.data(), rhs.data(), out.data(), m, n, problem.k, 8, 8, vec_length,
+                                 aligned_row_offsets.data(), aligned_col_indices.data(), m_vec, 8);
+    });
+}
+
+void PrintUsage(){
+    printf("./microbench [--name value]...\n");
+    printf("--rows       :   m_vec of the synthetic matrices, comma separated. Default 1024,8192.\n");
+    printf("--k          :   columns of the synthetic matrices, comma separated. Default 1024.\n");
+    printf("--sparsity   :   fraction of zeros, comma separated. Default 0.7,0.9,0.98.\n");
+    printf("--n          :   dense dimension of the references, multiple of 4. Default 64.\n");
+    printf("--v          :   vec_length of the packer and references. Default 8.\n");
+    printf("--filter     :   run only the cases whose name contains this string.\n");
+    printf("--target-ci  :   relative 95%% CI to reach. Default 0.02.\n");
+    printf("--max-iters  :   upper bound of the iterations per case. Default 200.\n");
+    printf("--format     :   text or csv. Default text.\n");
+}
+
+int main(int argc, char **argv){
+    if(argc == 2 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0)){
+        PrintUsage();
+        return 0;
+    }
+    MicroOptions options;
+    options.n = 64;
+    options.vec_length = 8;
+    options.format = "text";
+    options.timing = FixedTimingOptions(1, 5);
+    options.timing.target_rel_ci = 0.02;
+    options.timing.max_iters = 200;
+    for(int i = 1; i < argc; i++){
+        std::string arg(argv[i]);
+        if(arg.compare(0, 2, "--") != 0 || i + 1 >= argc){
+            fprintf(stderr, "Expected --name value, got %s\n", arg.c_str());
+            PrintUsage();
+            return 1;
+        }
+        const std::string name = arg.substr(2);
+        const std::string value(argv[++i]);
+        bool ok = true;
+        if(name == "rows") ok = ParseIntList(value, options.rows);
+        else if(name == "k") ok = ParseIntList(value, options.k);
+        else if(name == "sparsity") SplitList(value, options.sparsity);
+        else if(name == "n") ok = ParseInt(value, options.n) && options.n > 0 && options.n % 4 == 0;
+        else if(name == "v") ok = ParseInt(value, options.vec_length) &&
+                                  (options.vec_length == 2 || options.vec_length == 4 || options.vec_length == 8);
+        else if(name == "filter") options.filter = value;
+        else if(name == "target-ci") options.timing.target_rel_ci = atof(value.c_str());
+        else if(name == "max-iters") ok = ParseInt(value, options.timing.max_iters);
+        else if(name == "format"){
+            options.format = value;
+            ok = (value == "text" || value == "csv");
+        }
+        else{
+            fprintf(stderr, "Unknown option: %s\n", name.c_str());
+            return 1;
+        }
+        if(!ok){
+            fprintf(stderr, "Invalid value for %s: %s\n", name.c_str(), value.c_str());
+            return 1;
+        }
+    }
+    if(options.rows.empty()){
+        options.rows.push_back(1024);
+        options.rows.push_back(8192);
+    }
+    if(options.k.empty()) options.k.push_back(1024);
+    if(options.sparsity.empty()){
+        options.sparsity.push_back("0.7");
+        options.sparsity.push_back("0.9");
+        options.sparsity.push_back("0.98");
+    }
+
+    MicroRunner runner(options);
+    const int v = options.vec_length;
+    for(size_t r = 0; r < options.rows.size(); r++)
+    for(size_t c = 0; c < options.k.size(); c++)
+    for(size_t s = 0; s < options.sparsity.size(); s++){
+        MicroProblem problem;
+        MakeMicroProblem(options.rows[r], options.k[c], atof(options.sparsity[s].c_str()), problem);
+        BenchParse(runner, problem);
+        BenchIndices(runner, problem);
+        // Word types of spmm_benchmark for v = 2, 4, 8
+        if(v == 8){
+            BenchValues<int>(runner, problem, v, 4, 4, 4, 1);
+            BenchValues<long long>(runner, problem, v, 8, 8, 8, 1);
+            BenchValues<long long>(runner, problem, v, 16, 12, 8, 2);
+            BenchValues<long long>(runner, problem, v, 16, 16, 8, 2);
+        }
+        else if(v == 4){
+            BenchValues<short>(runner, problem, v, 4, 4, 4, 1);
+            BenchValues<int>(runner, problem, v, 8, 8, 8, 1);
+            BenchValues<long long>(runner, problem, v, 16, 12, 8, 1);
+            BenchValues<long long>(runner, problem, v, 16, 16, 8, 1);
+        }
+        else{
+            BenchValues<char>(runner, problem, v, 4, 4, 4, 1);
+            BenchValues<short>(runner, problem, v, 8, 8, 8, 1);
+            BenchValues<int>(runner, problem, v, 16, 12, 8, 1);
+            BenchValues<int>(runner, problem, v, 16, 16, 8, 1);
+        }
+        BenchMakeDense(runner, problem, options.n);
+        BenchReferences(runner, problem, options.n, v);
+    }
+    return 0;
+}
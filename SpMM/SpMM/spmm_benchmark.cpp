@@ -5,6 +5,16 @@
 #include <algorithm>
 #include <stdio.h>
 #include "include/bm_test_utils.h"
+#include "include/index_utils.h"
+#include "include/spmm_packer.h"
+#include "include/cpu_spmm.h"
+#include "include/skinny_spmm.h"
+#include "include/epilogue.h"
+#include "include/cuda_timer.h"
+#include "include/trace.h"
+#include "include/verifier.h"
+#include "include/host_memory.h"
+#include "include/cost_model.h"
 #include "include/cuda_spmm.cuh"
 #include "include/wmma_spmm.cuh"
 #include "include/cublas_gemm.cuh"
@@ -15,13 +25,6 @@
 #include <cusparse.h>
 #include <iostream>
 
-int power2n(int n){
-    int exp=1;
-    for(int i=0; i < n; i++)
-        exp *= 2;
-    return exp;
-}
-
 //template <typename TypeA>
 //double compute_ref_integers(TypeA *A, int *B, int *ref_C, int M_GLOBAL, int K_GLOBAL, int N_GLOBAL, int preA, int preB, int vec_length, int *row_offsets, int *col_indices, int m_vec) {
 //    TypeA maskA = (TypeA)(power2n(preA)-1); //0b0000000011111111 for 8 bits
@@ -65,82 +68,30 @@ int power2n(int n){
 //    return flops;
 //}
 
-// vector type size larger than long long
-template <typename TypeA>
-double compute_ref_integers(TypeA *A, int *B, int *ref_C, int M_GLOBAL, int K_GLOBAL, int N_GLOBAL, int preA, int preA_cut, int preB, int vec_length, int *row_offsets, int *col_indices, int m_vec, int scaleA) {
-    //int maskA = (int)(power2n(preA)-1); //0b0000000011111111 for 8 bits
-    //int maskB = power2n(preB)-1; //0b0000000011111111 for 8 bits
-    //int maskA_cut = (int)(power2n(preA_cut)-1); //0b0000111111111111 for 12 bits
-    
-    TypeA maskA = (TypeA)(power2n(preA)-1); //0b0000000011111111 for 8 bits
-    int maskB = power2n(preB)-1; //0b0000000011111111 for 8 bits
-    TypeA maskA_cut = (TypeA)(power2n(preA_cut)-1); //0b0000111111111111 for 12 bits
-
-    // Initialize the output matrix with 0
-    for(int i=0; i < M_GLOBAL * N_GLOBAL; i++){
-        ref_C[i] = 0;
-    }
-
-    TypeA *A_vec_tiles = new TypeA[scaleA];
-    double flops = 0;     
-    int b_tile = 32/preB;
-    // printf("cpu: maskA %d, maskA_cut %d, maskB %d, vec_length %d, b_tile %d\n", maskA, maskA_cut, maskB, vec_length, b_tile); 
-    // traverse all the vector rows
-    for(int i=0; i < m_vec; i++){
-        // traverse all the nonzero columns in this row
-        for(int j=row_offsets[i]; j < row_offsets[i+1]; j++){
-            int col_idx = col_indices[j];
-	    for(int t=0; t<scaleA; t++)
-	        A_vec_tiles[t] = A[j * scaleA + t];
-            // traverse all the elements in the vector
-	    for(int tt=0; tt<scaleA; tt++){
-	        TypeA A_vec_tile = A_vec_tiles[tt];
-                for(int av=0; av < vec_length/scaleA; av++){
-                    int row_idx = i*vec_length + av + tt*vec_length/scaleA;
-                    int shift_a = av*preA;
-                    int a_val = (int)((((maskA << shift_a) & A_vec_tile) >> shift_a) & maskA_cut);
-                    for(int n=0; n < N_GLOBAL/b_tile; n++){
-	                int B_tile = B[col_idx * (N_GLOBAL/b_tile) + n];
-                        for(int bv=0; bv < b_tile; bv++){
-	            	    int shift_b = bv*preB;
-                            int b_val = ((maskB << shift_b) & B_tile) >> shift_b;
-	                    //if(a_val>maskA_cut || a_val<0 || b_val<0 || b_val>maskB)
-	                    //    printf("cpu compute error: %d, %d, maskA_cut %d, maskB %d \n", a_val, b_val, maskA_cut, maskB);
-                            ref_C[row_idx*N_GLOBAL + n*b_tile + bv] += a_val*b_val;
-	            	    //if(i == 1 && av == 1)
-	                    //    printf("a_val %d, b_val %d, intermediate value %d\n", a_val, b_val, a_val*b_val);
-                            flops += 2.0;
-	                }
-                    }
-                }
-	    }
-        }
-    }
-    return flops;
-}
-
 template <typename TypeA, typename TypeB, typename OutType, typename IndexType, typename DTypeVec, typename ITypeVec, cudaDataType_t DCuSPARSE>
-void BmFN(std::string benchmark, int N, int vec_length, int kernel, bool sorted, bool func, int sparse, int preA, int preA_cut, int preB, int scaleA){
+void BmFN(std::string benchmark, int N, int vec_length, int kernel, bool sorted, bool func, int sparse, int preA, int preA_cut, int preB, int scaleA, int epilogue_mode, int out_bits){
+
+    // Pipeline stages are traced with MAGICUBE_TRACE=trace.json, see include/trace.h
+    TraceSpan stage("read matrix");
 
     // Open the benchmark file
     std::ifstream infile(benchmark, std::ifstream::in);
     std::string line;
     // get the Size of the benchmark
+    // All sizes are kept in 64-bit on the host, see include/index_utils.h
     std::getline(infile, line, ',');
     const int m_vec = std::stoi(line);
-    const int dimM = m_vec * vec_length;
+    const int64_t dimM = CheckedMul(m_vec, vec_length, "dimM");
     std::getline(infile, line, ',');
     const int dimK = std::stoi(line);
     std::getline(infile, line, '\n');
     const int nonzeros_vec = std::stoi(line);
-    const int nonzeros = nonzeros_vec * vec_length;
+    const int64_t nonzeros = CheckedMul(nonzeros_vec, vec_length, "nonzeros");
     const int dimN = N;
-    int mma_k_dim = 16;
-
-    if(preA_cut == 4 || preB == 4)
-        mma_k_dim = 32;
-    else
-        mma_k_dim = 16;
+    const int64_t output_size = CheckedMul(dimM, dimN, "dimM * dimN");
+    int mma_k_dim = MmaKDim(preA_cut, preB);
+    // Small N runs on the skinny kernels, which take their own value layout
+    const bool skinny = kernel == 0 && UseSkinnySpmm(preA_cut, preB, dimN);
 
     printf("preA %d, preA_cut %d, preB %d, vec_length %d \n", preA, preA_cut, preB, vec_length); 
     printf("m_vec %d, dimN %d, nonzeros_vec %d, dimk %d, mma_k_dim %d \n", m_vec, dimN, nonzeros_vec, dimK, mma_k_dim); 
@@ -160,481 +111,170 @@ void BmFN(std::string benchmark, int N, int vec_length, int kernel, bool sorted,
 
     // SpMM
     if (sparse == 1){
-        int *row_offsets = new int[m_vec + 1];
+        // Host buffers are counted by include/host_memory.h and released as
+        // soon as the next stage has consumed them
+        HostMemory::Get().SetStage("read matrix");
+        HostArray<int> row_offsets(m_vec + 1);
         for(int i = 0; i < m_vec + 1; i++){
             if (i == m_vec) std::getline(infile, line, '\n');
             else std::getline(infile, line, ' ');
             row_offsets[i] = std::stoi(line);
         }
-        int *col_indices = new int[nonzeros_vec];
-        IndexType *col_indices_sputnik = new IndexType[nonzeros_vec];
+        HostArray<int> col_indices(nonzeros_vec);
         for(int i = 0; i < nonzeros_vec; i++){
             std::getline(infile, line, ' ');
             col_indices[i] = std::stoi(line);
-            col_indices_sputnik[i] = (IndexType)std::stoi(line);
         }
 
-        int *aligned_row_offsets = new int[m_vec*2];
-	int aligned_num_item = 0;
-	//int warp_width = 32;
-	//if(preA == 8 && preB == 8 && vec_length == 4)
-	//    warp_width = 16;
-	//else if(preA == 8 && preB == 8 && vec_length == 8)
-	//    warp_width = 16;
-	//else if(preA == 8 && preB == 4 && vec_length == 4)
-	//    warp_width = 32;
-        //else if(preA == 4 && preB == 4 && vec_length == 8)
-        //    warp_width = 32;
-	//else if(preA == 4 && preB == 4 && vec_length == 4)
-        //    warp_width = 32;
-        //    //warp_width = 64;
-
-	aligned_row_offsets[0] = aligned_num_item;
-	for(int i = 1; i < m_vec + 1; i++){
-	    int num_item = row_offsets[i] - row_offsets[i-1];
-            //ceiling
-	    aligned_num_item += (num_item + mma_k_dim - 1) / mma_k_dim * mma_k_dim;
-	    //aligned_num_item += (num_item + warp_width - 1) / warp_width * warp_width;
-	    if(i != m_vec)
-	        aligned_row_offsets[i*2] = aligned_num_item;
-	    aligned_row_offsets[i*2-1] = aligned_row_offsets[i*2-2] + num_item;
-	}
+        stage.Next("pack indices");
+        HostMemory::Get().SetStage("pack indices");
+        HostArray<int> aligned_row_offsets(m_vec*2);
+        int aligned_num_item = AlignRowOffsets<int>(m_vec, row_offsets.get(), mma_k_dim, aligned_row_offsets.get());
 
 	std::cout << " nonzero_vec: " << nonzeros_vec << " aligned_ nonzero_vec: " << aligned_num_item  << "\n" ;
-        int *aligned_col_indices = new int[aligned_num_item];
-        int *aligned_col_indices_shuffle = new int[aligned_num_item];
-	for(int i = 0; i < aligned_num_item; i++){
-	    aligned_col_indices[i] = -1;
-	    aligned_col_indices_shuffle[i] = -1;
-	}
 
-	for(int i = 1; i < m_vec + 1; i++){
-	    int offset_begin = row_offsets[i-1];
-	    int offset_end = row_offsets[i];
-	    for(int j = offset_begin; j < offset_end; j++)
-	        aligned_col_indices[aligned_row_offsets[(i-1)*2] + j - offset_begin] = col_indices[j];
-	}
+        // The kernels index the output, the values and the rhs with 32-bit offsets
+        const int64_t aligned_value_words = CheckedMul(aligned_num_item, scaleA, "aligned values");
+        // Every rhs row starts on a new word, which matters when N is skinny
+        const size_t rhs_bytes = CheckedMul(dimK, CheckedPackedWords(dimN, preB, sizeof(TypeB), "rhs row"), "rhs matrix") * sizeof(TypeB);
+        if(!FitsDeviceIndex(output_size) || !FitsDeviceIndex(CheckedMul(aligned_value_words, sizeof(TypeA), "aligned values")) ||
+           !FitsDeviceIndex(static_cast<int64_t>(rhs_bytes))){
+            printf("Problem size exceeds the 32-bit index range of the device kernels!\n");
+            return;
+        }
 
-	for(int i = 0; i < aligned_num_item/8; i++){
-	    for(int j = 0; j < 8; j++){
-	        aligned_col_indices_shuffle[i*8 + (j%2)*4 + j/2] = aligned_col_indices[i*8 + j];
-	    }
-	}
+        // The 4-bit kernels (mma k = 32) read the shuffled column indices,
+        // the skinny ones the plain indices
+        HostArray<int> aligned_col_indices(aligned_num_item);
+        AlignColIndices<int>(m_vec, row_offsets.get(), col_indices.get(), aligned_row_offsets.get(), aligned_num_item, aligned_col_indices.get());
+        if(mma_k_dim == 32 && !skinny){
+            HostArray<int> aligned_col_indices_shuffle(aligned_num_item);
+            ShuffleColIndices<int>(aligned_num_item, aligned_col_indices.get(), aligned_col_indices_shuffle.get());
+            std::copy(aligned_col_indices_shuffle.get(), aligned_col_indices_shuffle.get() + aligned_num_item, aligned_col_indices.get());
+        }
 
-	TypeA *values;
-	TypeA *aligned_values;
-	TypeA *aligned_values_transpose;
-	TypeA *aligned_values_transpose_decompose;
-	TypeB *rhs_matrix;
 	assert(sizeof(TypeA) * 8 * scaleA / preA == vec_length);
 
-        values = new TypeA[nonzeros * scaleA * preA / (sizeof(TypeA)*8)];
-        rhs_matrix = new TypeB[dimK * dimN * preB / (sizeof(TypeB)*8)];
-
-        MakeDenseMatrix<TypeA>(1, nonzeros * scaleA * preA / (sizeof(TypeA)*8), values, generator);
-        MakeDenseMatrix<TypeB>(dimK, dimN * preB / (sizeof(TypeB)*8), rhs_matrix, generator);
-
-        aligned_values = new TypeA[aligned_num_item * scaleA];
-        aligned_values_transpose = new TypeA[aligned_num_item * scaleA];
-        aligned_values_transpose_decompose = new TypeA[aligned_num_item * scaleA];
-	for(int i = 0; i < aligned_num_item * scaleA; i++){
-	    aligned_values[i] = 0;
-	    aligned_values_transpose[i] = 0;
-	    aligned_values_transpose_decompose[i] = 0;
-	}
-
-	for(int i = 1; i < m_vec + 1; i++){
-	    int offset_begin = row_offsets[i-1] * scaleA;
-	    int offset_end = row_offsets[i] * scaleA;
-	    for(int j = offset_begin; j < offset_end; j++)
-	        aligned_values[aligned_row_offsets[(i-1)*2] * scaleA + j - offset_begin] = values[j];
-	}
-
-	// mma_k_dim-wise transpose for 8-bit int
-	unsigned char * aligned_values_char = reinterpret_cast<unsigned char *>(aligned_values);
-	unsigned char * aligned_values_transpose_char = reinterpret_cast<unsigned char *>(aligned_values_transpose);
-	unsigned char * aligned_values_transpose_decompose_char = reinterpret_cast<unsigned char *>(aligned_values_transpose_decompose);
-
-	// mma_k_dim-wise transpose for 12-bit int
-	unsigned short * aligned_values_short = reinterpret_cast<unsigned short *>(aligned_values);
-	unsigned short * aligned_values_transpose_short = reinterpret_cast<unsigned short *>(aligned_values_transpose);
-	unsigned short * aligned_values_transpose_decompose_short = reinterpret_cast<unsigned short *>(aligned_values_transpose_decompose);
-
-        // for 8-bit int
-	if(preA_cut == 8){
-	    for(int i = 0; i < aligned_num_item*vec_length; i+=(mma_k_dim*vec_length))
-	        for(int j = 0; j < mma_k_dim; j++)
-	            for(int v = 0; v < vec_length; v++)
-	                aligned_values_transpose_char[i+v*mma_k_dim+j] = aligned_values_char[i+j*vec_length+v];
-
-	    //for mixed precision
-	    if(mma_k_dim == 32){
-		unsigned char mask = 15;
-	        for(int i = 0; i < aligned_num_item*vec_length; i+=(mma_k_dim*vec_length))
-	            for(int j = 0; j < mma_k_dim*vec_length; j++){
-			int intra_char_offset_0 = (j%2)*4;
-			int intra_char_offset_1 = ((j+1)%2)*4;
-			aligned_values_transpose_decompose_char[i+j/2] |= ((aligned_values_transpose_char[i+j] & mask) << intra_char_offset_0);
-			aligned_values_transpose_decompose_char[i+mma_k_dim*vec_length/2+j/2] |= ((aligned_values_transpose_char[i+j] & (mask << 4)) >> intra_char_offset_1);
-		    }
-	    }
-	}
-	else if(preA_cut == 12 && mma_k_dim == 32){
-	    for(int i = 0; i < aligned_num_item*vec_length; i+=(mma_k_dim*vec_length))
-	        for(int j = 0; j < mma_k_dim; j++)
-	            for(int v = 0; v < vec_length; v++)
-	                aligned_values_transpose_short[i+v*mma_k_dim+j] = aligned_values_short[i+j*vec_length+v];
-
-            unsigned short mask = 15;
-            for(int i = 0; i < aligned_num_item*vec_length; i+=(mma_k_dim*vec_length))
-                for(int j = 0; j < mma_k_dim*vec_length; j++){
-		    if(j%4 == 0){
-            	        aligned_values_transpose_decompose_short[i+j/4] |= (aligned_values_transpose_short[i+j] & mask);
-            	        aligned_values_transpose_decompose_short[i+mma_k_dim*vec_length/4+j/4] |= ((aligned_values_transpose_short[i+j] & (mask << 4)) >> 4);
-            	        aligned_values_transpose_decompose_short[i+2*mma_k_dim*vec_length/4+j/4] |= ((aligned_values_transpose_short[i+j] & (mask << 8)) >> 8);
-		    }
-		    if(j%4 == 1){
-            	        aligned_values_transpose_decompose_short[i+j/4] |= ((aligned_values_transpose_short[i+j] & mask) << 4);
-            	        aligned_values_transpose_decompose_short[i+mma_k_dim*vec_length/4+j/4] |= (aligned_values_transpose_short[i+j] & (mask << 4));
-            	        aligned_values_transpose_decompose_short[i+2*mma_k_dim*vec_length/4+j/4] |= ((aligned_values_transpose_short[i+j] & (mask << 8)) >> 4);
-		    }
-		    if(j%4 == 2){
-            	        aligned_values_transpose_decompose_short[i+j/4] |= ((aligned_values_transpose_short[i+j] & mask) << 8);
-            	        aligned_values_transpose_decompose_short[i+mma_k_dim*vec_length/4+j/4] |= ((aligned_values_transpose_short[i+j] & (mask << 4)) << 4);
-            	        aligned_values_transpose_decompose_short[i+2*mma_k_dim*vec_length/4+j/4] |= (aligned_values_transpose_short[i+j] & (mask << 8));
-		    }
-		    if(j%4 == 3){
-            	        aligned_values_transpose_decompose_short[i+j/4] |= ((aligned_values_transpose_short[i+j] & mask) << 12);
-            	        aligned_values_transpose_decompose_short[i+mma_k_dim*vec_length/4+j/4] |= ((aligned_values_transpose_short[i+j] & (mask << 4)) << 8);
-            	        aligned_values_transpose_decompose_short[i+2*mma_k_dim*vec_length/4+j/4] |= ((aligned_values_transpose_short[i+j] & (mask << 8)) << 4);
-		    }
-                }
-	}
-	else if(preA_cut == 12 && mma_k_dim == 16){
-	    unsigned char mask = 15;
-	    for(int i = 0; i < aligned_num_item*vec_length*2; i+=(mma_k_dim*vec_length*2))
-	        for(int j = 0; j < mma_k_dim; j++)
-	            for(int v = 0; v < vec_length*2; v+=2){
-	                aligned_values_transpose_decompose_char[i+j+(v/2)*mma_k_dim] = aligned_values_char[i+j*vec_length*2+v];
-	                aligned_values_transpose_decompose_char[i+mma_k_dim*vec_length+j+(v/2)*mma_k_dim] = aligned_values_char[i+j*vec_length*2+v+1] & mask;
-		    }
-	}
-	else if(preA_cut == 16 && mma_k_dim == 32){
-	    for(int i = 0; i < aligned_num_item*vec_length; i+=(mma_k_dim*vec_length))
-	        for(int j = 0; j < mma_k_dim; j++)
-	            for(int v = 0; v < vec_length; v++)
-	                aligned_values_transpose_short[i+v*mma_k_dim+j] = aligned_values_short[i+j*vec_length+v];
-
-            unsigned short mask = 15;
-            for(int i = 0; i < aligned_num_item*vec_length; i+=(mma_k_dim*vec_length))
-                for(int j = 0; j < mma_k_dim*vec_length; j++){
-		    if(j%4 == 0){
-            	        aligned_values_transpose_decompose_short[i+j/4] |= (aligned_values_transpose_short[i+j] & mask);
-            	        aligned_values_transpose_decompose_short[i+mma_k_dim*vec_length/4+j/4] |= ((aligned_values_transpose_short[i+j] & (mask << 4)) >> 4);
-            	        aligned_values_transpose_decompose_short[i+2*mma_k_dim*vec_length/4+j/4] |= ((aligned_values_transpose_short[i+j] & (mask << 8)) >> 8);
-            	        aligned_values_transpose_decompose_short[i+3*mma_k_dim*vec_length/4+j/4] |= ((aligned_values_transpose_short[i+j] & (mask << 12)) >> 12);
-		    }
-		    if(j%4 == 1){
-            	        aligned_values_transpose_decompose_short[i+j/4] |= ((aligned_values_transpose_short[i+j] & mask) << 4);
-            	        aligned_values_transpose_decompose_short[i+mma_k_dim*vec_length/4+j/4] |= (aligned_values_transpose_short[i+j] & (mask << 4));
-            	        aligned_values_transpose_decompose_short[i+2*mma_k_dim*vec_length/4+j/4] |= ((aligned_values_transpose_short[i+j] & (mask << 8)) >> 4);
-            	        aligned_values_transpose_decompose_short[i+3*mma_k_dim*vec_length/4+j/4] |= ((aligned_values_transpose_short[i+j] & (mask << 12)) >> 8);
-		    }
-		    if(j%4 == 2){
-            	        aligned_values_transpose_decompose_short[i+j/4] |= ((aligned_values_transpose_short[i+j] & mask) << 8);
-            	        aligned_values_transpose_decompose_short[i+mma_k_dim*vec_length/4+j/4] |= ((aligned_values_transpose_short[i+j] & (mask << 4)) << 4);
-            	        aligned_values_transpose_decompose_short[i+2*mma_k_dim*vec_length/4+j/4] |= (aligned_values_transpose_short[i+j] & (mask << 8));
-            	        aligned_values_transpose_decompose_short[i+3*mma_k_dim*vec_length/4+j/4] |= ((aligned_values_transpose_short[i+j] & (mask << 12)) >> 4);
-		    }
-		    if(j%4 == 3){
-            	        aligned_values_transpose_decompose_short[i+j/4] |= ((aligned_values_transpose_short[i+j] & mask) << 12);
-            	        aligned_values_transpose_decompose_short[i+mma_k_dim*vec_length/4+j/4] |= ((aligned_values_transpose_short[i+j] & (mask << 4)) << 8);
-            	        aligned_values_transpose_decompose_short[i+2*mma_k_dim*vec_length/4+j/4] |= ((aligned_values_transpose_short[i+j] & (mask << 8)) << 4);
-            	        aligned_values_transpose_decompose_short[i+3*mma_k_dim*vec_length/4+j/4] |= (aligned_values_transpose_short[i+j] & (mask << 12));
-		    }
-                }
-	}
-	else if(preA_cut == 16 && mma_k_dim == 16){
-	    for(int i = 0; i < aligned_num_item*vec_length*2; i+=(mma_k_dim*vec_length*2))
-	        for(int j = 0; j < mma_k_dim; j++)
-	            for(int v = 0; v < vec_length*2; v+=2){
-	                aligned_values_transpose_decompose_char[i+j+(v/2)*mma_k_dim] = aligned_values_char[i+j*vec_length*2+v];
-	                aligned_values_transpose_decompose_char[i+mma_k_dim*vec_length+j+(v/2)*mma_k_dim] = aligned_values_char[i+j*vec_length*2+v+1];
-		    }
-	}
-	else if(preA_cut == 4){ // for 4-bit int
-	    unsigned char mask = 15; // 0b00001111
-	    for(int i = 0; i < aligned_num_item*(vec_length/2); i+=(mma_k_dim*(vec_length/2)))
-	        for(int j = 0; j < mma_k_dim; j++)
-	            for(int v = 0; v < vec_length/2; v++){
-			int intra_char_offset_0 = (j%2)*4;
-			int intra_char_offset_1 = ((j+1)%2)*4;
-	                aligned_values_transpose_char[i+mma_k_dim*v+j/2] |= ((aligned_values_char[i+j*(vec_length/2)+v] & mask) << intra_char_offset_0);
-	                aligned_values_transpose_char[i+mma_k_dim*v+mma_k_dim/2+j/2] |= ((aligned_values_char[i+j*(vec_length/2)+v] & (mask << 4)) >> intra_char_offset_1);
-			//if((i<8) && (j<8))
-			//    printf("%x, %x, %x\n", aligned_values_char[i+j*(vec_length/2)+v], aligned_values_transpose_char[i+mma_k_dim*v+j/2], aligned_values_transpose_char[i+mma_k_dim*v+mma_k_dim/2+j/2]);
-		    }
-	}
-	//}
-
-        // Allocate the host output
-        int *output_value_host = new int[dimM * dimN];
-        double flops = 0;
-
-        if(func){
-            flops = compute_ref_integers<TypeA>(values, rhs_matrix, output_value_host, dimM, dimK, dimN, preA, preA_cut, preB, vec_length, row_offsets, col_indices, m_vec, scaleA);
-	    flops = flops/1000.0/1000.0/1000.0;
-            std::cout << "total Gflops: " << flops << "\n";
-        }// end if func
-
-
-        int *row_indices = new int[m_vec];
+        const int64_t value_words = CheckedPackedWords(CheckedMul(nonzeros, scaleA, "values"), preA, sizeof(TypeA), "values");
+        const int64_t rhs_row_words = CheckedPackedWords(dimN, preB, sizeof(TypeB), "rhs row");
+        stage.Next("generate values");
+        HostMemory::Get().SetStage("generate values");
+        HostArray<TypeA> values(value_words);
+        HostArray<TypeB> rhs_matrix(CheckedMul(dimK, rhs_row_words, "rhs matrix"));
+
+        MakeDenseMatrix<TypeA>(1, value_words, values.get(), generator);
+        MakeDenseMatrix<TypeB>(dimK, rhs_row_words, rhs_matrix.get(), generator);
+
+        // Only one of the transposed layouts is uploaded; the other is
+        // dropped right after TransposeDecomposeValues
+        stage.Next("pack values");
+        HostMemory::Get().SetStage("pack values");
+        HostArray<TypeA> aligned_values_transpose(skinny ? 0 : aligned_value_words, true);
+        HostArray<TypeA> aligned_values_transpose_decompose(skinny ? 0 : aligned_value_words, true);
+        HostArray<int> skinny_values(skinny ? SkinnyValueWords(aligned_num_item, vec_length, preA_cut) : 0);
+        {
+            HostArray<TypeA> aligned_values(aligned_value_words);
+            AlignValues<TypeA, int>(m_vec, row_offsets.get(), aligned_row_offsets.get(), aligned_num_item, scaleA, values.get(), aligned_values.get());
+            if(skinny)
+                PackSkinnyValues<TypeA, int>(aligned_num_item, vec_length, preA, preA_cut, scaleA, aligned_values.get(), skinny_values.get());
+            else
+                TransposeDecomposeValues<TypeA, int>(aligned_num_item, vec_length, mma_k_dim, preA_cut,
+                    aligned_values.get(), aligned_values_transpose.get(), aligned_values_transpose_decompose.get());
+        }
+        if(skinny){
+            aligned_values_transpose.reset();
+            aligned_values_transpose_decompose.reset();
+        }
+        else if(UseDecomposedValues(preA_cut, preB)) aligned_values_transpose.reset();
+        else aligned_values_transpose_decompose.reset();
+        const void *aligned_values_packed = skinny ? static_cast<const void *>(skinny_values.get()) :
+            aligned_values_transpose.get() != NULL ? static_cast<const void *>(aligned_values_transpose.get()) :
+            static_cast<const void *>(aligned_values_transpose_decompose.get());
+        const size_t packed_value_bytes = skinny ? skinny_values.size() * sizeof(int) : aligned_value_words * sizeof(TypeA);
+
+        stage.Next("row swizzle");
+        HostMemory::Get().SetStage("row swizzle");
+        HostArray<int> row_indices(m_vec);
         if(sorted){
             //printf("Sort CSR based on row length\n");
-            SortedRowSwizzle(m_vec, row_offsets, row_indices);
+            SortedRowSwizzle(m_vec, row_offsets.get(), row_indices.get());
         }
         else{
             //printf("Process the rows in order\n");
-            IdentityRowSwizzle(m_vec, row_indices);
+            IdentityRowSwizzle(m_vec, row_indices.get());
         }
         
         // Device
         int *d_row_offsets, *d_col_indices, *d_row_indices;
-        IndexType *d_col_indices_sputnik;
         int *d_values; 
 	TypeB *d_rhs_matrix;
         OutType *d_output_value;
-	int *aligned_values_transpose_decompose_int = reinterpret_cast<int *>(aligned_values_transpose_decompose);
-	int *aligned_values_transpose_int = reinterpret_cast<int *>(aligned_values_transpose);
 
+        stage.Next("device alloc");
         checkCuda(cudaMalloc(&d_row_offsets, (m_vec*2) * sizeof(int)));
         checkCuda(cudaMalloc(&d_col_indices, aligned_num_item * sizeof(int)));
-        checkCuda(cudaMalloc(&d_col_indices_sputnik, nonzeros_vec * sizeof(IndexType)));
         checkCuda(cudaMalloc(&d_row_indices, m_vec * sizeof(int)));
 
 	
-        checkCuda(cudaMalloc(&d_values, aligned_num_item * sizeof(TypeA) * scaleA));
-        checkCuda(cudaMalloc(&d_rhs_matrix, dimK * dimN * preB / 8));
-        checkCuda(cudaMalloc(&d_output_value, (dimM * dimN) * sizeof(OutType)));
+        checkCuda(cudaMalloc(&d_values, packed_value_bytes));
+        checkCuda(cudaMalloc(&d_rhs_matrix, rhs_bytes));
+        checkCuda(cudaMalloc(&d_output_value, output_size * sizeof(OutType)));
+
+        stage.Next("copy to device");
+        HostMemory::Get().SetStage("copy to device");
+        checkCuda(cudaMemcpy(d_row_offsets, aligned_row_offsets.get(), (m_vec*2) * sizeof(int), cudaMemcpyHostToDevice));
+        checkCuda(cudaMemcpy(d_col_indices, aligned_col_indices.get(), aligned_num_item * sizeof(int), cudaMemcpyHostToDevice));
+        checkCuda(cudaMemcpy(d_values, aligned_values_packed, packed_value_bytes, cudaMemcpyHostToDevice));
+        checkCuda(cudaMemcpy(d_rhs_matrix, rhs_matrix.get(), rhs_bytes, cudaMemcpyHostToDevice));
+        checkCuda(cudaMemcpy(d_row_indices, row_indices.get(), m_vec * sizeof(int), cudaMemcpyHostToDevice));
+        // The skinny CPU kernel runs on the packed operands after the reference
+        if(!skinny || !func){
+            aligned_row_offsets.reset();
+            aligned_col_indices.reset();
+            skinny_values.reset();
+        }
+        aligned_values_transpose.reset();
+        aligned_values_transpose_decompose.reset();
+        row_indices.reset();
 
-        checkCuda(cudaMemcpy(d_row_offsets, aligned_row_offsets , (m_vec*2) * sizeof(int), cudaMemcpyHostToDevice));
-	if(mma_k_dim == 16){
-            checkCuda(cudaMemcpy(d_col_indices, aligned_col_indices, aligned_num_item * sizeof(int), cudaMemcpyHostToDevice));
-	}
-	else if(mma_k_dim == 32){
-            checkCuda(cudaMemcpy(d_col_indices, aligned_col_indices_shuffle, aligned_num_item * sizeof(int), cudaMemcpyHostToDevice));
-	}
-        
-	if(preA_cut > preB || (preA_cut == 16 && preB == 16))
-            checkCuda(cudaMemcpy(d_values, aligned_values_transpose_decompose_int, aligned_num_item * sizeof(TypeA) * scaleA, cudaMemcpyHostToDevice));
-	else
-            checkCuda(cudaMemcpy(d_values, aligned_values_transpose_int, aligned_num_item * sizeof(TypeA) * scaleA, cudaMemcpyHostToDevice));
-        checkCuda(cudaMemcpy(d_rhs_matrix, rhs_matrix, dimK * dimN * preB / 8, cudaMemcpyHostToDevice));
-        checkCuda(cudaMemcpy(d_row_indices, row_indices, m_vec * sizeof(int), cudaMemcpyHostToDevice));
-        checkCuda(cudaMemcpy(d_col_indices_sputnik, col_indices_sputnik, nonzeros_vec * sizeof(IndexType), cudaMemcpyHostToDevice));
-        
+        // The reference runs once the staging buffers are gone, so the host
+        // output never coexists with them
+        HostArray<int> output_value_host;
+        double flops = 0;
+        stage.Next("reference spmm");
+        HostMemory::Get().SetStage("reference spmm");
+        if(func){
+            output_value_host.allocate(output_size);
+            flops = compute_ref_integers<TypeA, int>(values.get(), rhs_matrix.get(), output_value_host.get(), dimM, dimK, dimN, preA, preA_cut, preB, vec_length, row_offsets.get(), col_indices.get(), m_vec, scaleA);
+	    flops = flops/1000.0/1000.0/1000.0;
+            std::cout << "total Gflops: " << flops << "\n";
+        }// end if func
+        values.reset();
+        if(!skinny || !func) rhs_matrix.reset();
+        row_offsets.reset();
+        col_indices.reset();
+
+        stage.Next("kernel loop");
+        HostMemory::Get().SetStage("kernel loop");
         cudaProfilerStart();
-	float spmm_ms_avg = 0.0f;
 	int NUM_PROFILES = 512;
-        if((kernel == 0) && (preA_cut == 4) && (preB == 4)){
-            //printf("Using WMMA \n");
-	    //warmup
-	    for(int iter=0; iter<16; ++iter){
-                spmm::wmmaSpmm_4b(m_vec, vec_length, dimN, dimK, d_row_indices, d_row_offsets, d_col_indices, d_values, d_rhs_matrix, d_output_value);
-	    }
-	    for(int iter=0; iter<NUM_PROFILES; ++iter){
-	        float spmm_ms = 0.0f;
-	        cudaEvent_t spmm_start;
-	        cudaEvent_t spmm_end;
-	        cudaEventCreate(&spmm_start);
-	        cudaEventCreate(&spmm_end);
-	        cudaEventRecord(spmm_start);
-                spmm::wmmaSpmm_4b(m_vec, vec_length, dimN, dimK, d_row_indices, d_row_offsets, d_col_indices, d_values, d_rhs_matrix, d_output_value);
-	        cudaEventRecord(spmm_end);
-	        cudaEventSynchronize(spmm_end);
-	        cudaEventElapsedTime(&spmm_ms, spmm_start, spmm_end);
-                cudaEventDestroy(spmm_start);
-                cudaEventDestroy(spmm_end);
-                spmm_ms_avg += spmm_ms;
-	    }
-        }
-	else if((kernel == 0) && (preA_cut == 8) && (preB == 4)){
-	    //warmup
-	    for(int iter=0; iter<16; ++iter){
-                spmm::wmmaSpmm_8b4b(m_vec, vec_length, dimN, dimK, d_row_indices, d_row_offsets, d_col_indices, d_values, d_rhs_matrix, d_output_value);
-            }
-	    for(int iter=0; iter<NUM_PROFILES; ++iter){
-	        float spmm_ms = 0.0f;
-	        cudaEvent_t spmm_start;
-	        cudaEvent_t spmm_end;
-	        cudaEventCreate(&spmm_start);
-	        cudaEventCreate(&spmm_end);
-	        cudaEventRecord(spmm_start);
-                spmm::wmmaSpmm_8b4b(m_vec, vec_length, dimN, dimK, d_row_indices, d_row_offsets, d_col_indices, d_values, d_rhs_matrix, d_output_value);
-	        cudaEventRecord(spmm_end);
-	        cudaEventSynchronize(spmm_end);
-	        cudaEventElapsedTime(&spmm_ms, spmm_start, spmm_end);
-                cudaEventDestroy(spmm_start);
-                cudaEventDestroy(spmm_end);
-                spmm_ms_avg += spmm_ms;
-	    }
-        }
-	else if((kernel == 0) && (preA_cut == 12) && (preB == 4)){
-	    //warmup
-	    for(int iter=0; iter<16; ++iter){
-                spmm::wmmaSpmm_12b4b(m_vec, vec_length, dimN, dimK, d_row_indices, d_row_offsets, d_col_indices, d_values, d_rhs_matrix, d_output_value);
-            }
-	    for(int iter=0; iter<NUM_PROFILES; ++iter){
-	        float spmm_ms = 0.0f;
-	        cudaEvent_t spmm_start;
-	        cudaEvent_t spmm_end;
-	        cudaEventCreate(&spmm_start);
-	        cudaEventCreate(&spmm_end);
-	        cudaEventRecord(spmm_start);
-                spmm::wmmaSpmm_12b4b(m_vec, vec_length, dimN, dimK, d_row_indices, d_row_offsets, d_col_indices, d_values, d_rhs_matrix, d_output_value);
-	        cudaEventRecord(spmm_end);
-	        cudaEventSynchronize(spmm_end);
-	        cudaEventElapsedTime(&spmm_ms, spmm_start, spmm_end);
-                cudaEventDestroy(spmm_start);
-                cudaEventDestroy(spmm_end);
-                spmm_ms_avg += spmm_ms;
-	    }
-        }
-	else if((kernel == 0) && (preA_cut == 16) && (preB == 4)){
-	    //warmup
-	    for(int iter=0; iter<16; ++iter){
-                spmm::wmmaSpmm_16b4b(m_vec, vec_length, dimN, dimK, d_row_indices, d_row_offsets, d_col_indices, d_values, d_rhs_matrix, d_output_value);
-            }
-	    for(int iter=0; iter<NUM_PROFILES; ++iter){
-	        float spmm_ms = 0.0f;
-	        cudaEvent_t spmm_start;
-	        cudaEvent_t spmm_end;
-	        cudaEventCreate(&spmm_start);
-	        cudaEventCreate(&spmm_end);
-	        cudaEventRecord(spmm_start);
-                spmm::wmmaSpmm_16b4b(m_vec, vec_length, dimN, dimK, d_row_indices, d_row_offsets, d_col_indices, d_values, d_rhs_matrix, d_output_value);
-	        cudaEventRecord(spmm_end);
-	        cudaEventSynchronize(spmm_end);
-	        cudaEventElapsedTime(&spmm_ms, spmm_start, spmm_end);
-                cudaEventDestroy(spmm_start);
-                cudaEventDestroy(spmm_end);
-                spmm_ms_avg += spmm_ms;
-	    }
-        }
-	else if((kernel == 0) && (preA_cut == 8) && (preB == 8)){
-	    //warmup
-	    for(int iter=0; iter<16; ++iter){
-                spmm::wmmaSpmm_8b(m_vec, vec_length, dimN, dimK, d_row_indices, d_row_offsets, d_col_indices, d_values, d_rhs_matrix, d_output_value);
-            }
-	    for(int iter=0; iter<NUM_PROFILES; ++iter){
-	        float spmm_ms = 0.0f;
-	        cudaEvent_t spmm_start;
-	        cudaEvent_t spmm_end;
-	        cudaEventCreate(&spmm_start);
-	        cudaEventCreate(&spmm_end);
-	        cudaEventRecord(spmm_start);
-                //spmm::wmmaSpmm_8b4v(m_vec, vec_length, dimN, dimK, d_row_indices, d_row_offsets, d_col_indices, d_values, d_rhs_matrix, d_output_value);
-                spmm::wmmaSpmm_8b(m_vec, vec_length, dimN, dimK, d_row_indices, d_row_offsets, d_col_indices, d_values, d_rhs_matrix, d_output_value);
-	        cudaEventRecord(spmm_end);
-	        cudaEventSynchronize(spmm_end);
-	        cudaEventElapsedTime(&spmm_ms, spmm_start, spmm_end);
-                cudaEventDestroy(spmm_start);
-                cudaEventDestroy(spmm_end);
-                spmm_ms_avg += spmm_ms;
-	    }
-        }
-	else if((kernel == 0) && (preA_cut == 12) && (preB == 8)){
-	    //warmup
-	    for(int iter=0; iter<16; ++iter){
-                spmm::wmmaSpmm_12b8b(m_vec, vec_length, dimN, dimK, d_row_indices, d_row_offsets, d_col_indices, d_values, d_rhs_matrix, d_output_value);
-            }
-	    for(int iter=0; iter<NUM_PROFILES; ++iter){
-	        float spmm_ms = 0.0f;
-	        cudaEvent_t spmm_start;
-	        cudaEvent_t spmm_end;
-	        cudaEventCreate(&spmm_start);
-	        cudaEventCreate(&spmm_end);
-	        cudaEventRecord(spmm_start);
-                spmm::wmmaSpmm_12b8b(m_vec, vec_length, dimN, dimK, d_row_indices, d_row_offsets, d_col_indices, d_values, d_rhs_matrix, d_output_value);
-	        cudaEventRecord(spmm_end);
-	        cudaEventSynchronize(spmm_end);
-	        cudaEventElapsedTime(&spmm_ms, spmm_start, spmm_end);
-                cudaEventDestroy(spmm_start);
-                cudaEventDestroy(spmm_end);
-                spmm_ms_avg += spmm_ms;
-	    }
-        }
-	else if((kernel == 0) && (preA_cut == 16) && (preB == 8)){
-	    //warmup
-	    for(int iter=0; iter<16; ++iter){
-                spmm::wmmaSpmm_16b8b(m_vec, vec_length, dimN, dimK, d_row_indices, d_row_offsets, d_col_indices, d_values, d_rhs_matrix, d_output_value);
-            }
-	    for(int iter=0; iter<NUM_PROFILES; ++iter){
-	        float spmm_ms = 0.0f;
-	        cudaEvent_t spmm_start;
-	        cudaEvent_t spmm_end;
-	        cudaEventCreate(&spmm_start);
-	        cudaEventCreate(&spmm_end);
-	        cudaEventRecord(spmm_start);
-                spmm::wmmaSpmm_16b8b(m_vec, vec_length, dimN, dimK, d_row_indices, d_row_offsets, d_col_indices, d_values, d_rhs_matrix, d_output_value);
-	        cudaEventRecord(spmm_end);
-	        cudaEventSynchronize(spmm_end);
-	        cudaEventElapsedTime(&spmm_ms, spmm_start, spmm_end);
-                cudaEventDestroy(spmm_start);
-                cudaEventDestroy(spmm_end);
-                spmm_ms_avg += spmm_ms;
-	    }
-        }
-	else if((kernel == 0) && (preA_cut == 16) && (preB == 16)){
-	    //warmup
-	    for(int iter=0; iter<16; ++iter){
-                spmm::wmmaSpmm_16b(m_vec, vec_length, dimN, dimK, d_row_indices, d_row_offsets, d_col_indices, d_values, d_rhs_matrix, d_output_value);
-            }
-	    for(int iter=0; iter<NUM_PROFILES; ++iter){
-	        float spmm_ms = 0.0f;
-	        cudaEvent_t spmm_start;
-	        cudaEvent_t spmm_end;
-	        cudaEventCreate(&spmm_start);
-	        cudaEventCreate(&spmm_end);
-	        cudaEventRecord(spmm_start);
-                spmm::wmmaSpmm_16b(m_vec, vec_length, dimN, dimK, d_row_indices, d_row_offsets, d_col_indices, d_values, d_rhs_matrix, d_output_value);
-	        cudaEventRecord(spmm_end);
-	        cudaEventSynchronize(spmm_end);
-	        cudaEventElapsedTime(&spmm_ms, spmm_start, spmm_end);
-                cudaEventDestroy(spmm_start);
-                cudaEventDestroy(spmm_end);
-                spmm_ms_avg += spmm_ms;
-	    }
-        }
-	else if(kernel == 0){
-            //printf("Using WMMA \n");
-	    //for(int iter=0; iter<NUM_PROFILES; ++iter){
-	    //    float spmm_ms = 0.0f;
-	    //    cudaEvent_t spmm_start;
-	    //    cudaEvent_t spmm_end;
-	    //    cudaEventCreate(&spmm_start);
-	    //    cudaEventCreate(&spmm_end);
-	    //    cudaEventRecord(spmm_start);
-            //    spmm::wmmaSpmm(m_vec, vec_length, k, n, d_row_indices, d_row_offsets, d_col_indices, d_values, d_rhs_matrix, d_output_value);
-	    //    cudaEventRecord(spmm_end);
-	    //    cudaEventSynchronize(spmm_end);
-	    //    cudaEventElapsedTime(&spmm_ms, spmm_start, spmm_end);
-            //    cudaEventDestroy(spmm_start);
-            //    cudaEventDestroy(spmm_end);
-            //    spmm_ms_avg += spmm_ms;
-	    //}
-            //spmm_ms_avg = spmm_ms_avg/(float)NUM_PROFILES/1000.0;
-            //std::cout << "performance GFLOP/s: " << flops/spmm_ms_avg << "\n";
-            printf("Unsupported Kernel \n");
+        std::vector<double> spmm_samples;
+        TimingStats spmm_stats = ComputeTimingStats(spmm_samples);
+        spmm::WmmaSpmmKernel spmm_kernel = (kernel == 0) ? spmm::SelectWmmaSpmm(preA_cut, preB, dimN) : NULL;
+        if(skinny) printf("Skinny SpMM kernel for N = %d\n", dimN);
+        if(spmm_kernel != NULL){
+            spmm_stats = TimeDevice(FixedTimingOptions(16, NUM_PROFILES), [&](){
+                spmm_kernel(m_vec, vec_length, dimN, dimK, d_row_indices, d_row_offsets, d_col_indices, d_values, d_rhs_matrix, d_output_value);
+            }, spmm_samples);
         }
         else{
             printf("Unsupported Kernel \n");
         }
 
-	std::cout << "Magicube SpMM runtime " << spmm_ms_avg/(float)NUM_PROFILES << " ms" << "\n";
+	std::cout << "Magicube SpMM runtime " << spmm_stats.mean << " ms" << "\n";
+        PrintTimingStats("Magicube SpMM", spmm_stats);
 	if (func){
-            spmm_ms_avg = spmm_ms_avg/(float)NUM_PROFILES/1000.0;
-            std::cout << "performance TOP/s: " << flops/spmm_ms_avg/1000.0 << "\n";
+            std::cout << "performance TOP/s: " << flops/(spmm_stats.mean/1000.0)/1000.0 << "\n";
 	}
 
         cudaProfilerStop();
@@ -713,44 +353,140 @@ void BmFN(std::string benchmark, int N, int vec_length, int kernel, bool sorted,
 
 
         if (func){
-            OutType *output_value_cuda = new OutType[dimM * dimN];
-            checkCuda(cudaMemcpy(output_value_cuda, d_output_value, dimM * dimN * sizeof(OutType), cudaMemcpyDeviceToHost));
-
-            // Verify the result
-            int errors = 0;
-            int counter = 0;
-            for (int j=0; j < dimM * dimN; j++){
-		if (output_value_cuda[j] > 0) counter++;
-                if ((output_value_cuda[j] - output_value_host[j]) != 0){
-                    errors ++;
-                }
-            }
-            if (errors > 0) {
-                printf( "SPMM does not agree with SEQUENTIAL! %d errors!\n",errors);
+            stage.Next("copy to host");
+            HostMemory::Get().SetStage("copy to host");
+            HostArray<OutType> output_value_cuda(output_size);
+            checkCuda(cudaMemcpy(output_value_cuda.get(), d_output_value, output_size * sizeof(OutType), cudaMemcpyDeviceToHost));
+
+            stage.Next("verify");
+            HostMemory::Get().SetStage("verify");
+            // Verify the result; a thread block computes vec_length x Tile_N outputs
+            VerifyOptions verify_options = DefaultVerifyOptions(dimM, dimN, vec_length,
+                                                                skinny ? dimN : DefaultSpmmKernelConfig(preA_cut, preB).tile_n);
+            VerifyReport report = VerifyExact(output_value_cuda.get(), output_value_host.get(), output_size, verify_options);
+            if (!report.Passed()) {
+                printf( "SPMM does not agree with SEQUENTIAL! %lld errors!\n", (long long)report.errors);
+                PrintVerifyReport(stdout, "SpMM", report);
             }else {
                 printf("Results verification: PASS\n");
             }
-	    //printf("counter = %d\n", counter);
-            delete output_value_cuda;
-        }
 
+            // The CPU skinny kernel on the same packed operands
+            if (skinny){
+                stage.Next("skinny cpu");
+                HostMemory::Get().SetStage("skinny cpu");
+                // The thread workspaces come from the host arena; warm it so
+                // the timed calls allocate nothing
+                GlobalHostArena().Reserve(std::vector<size_t>(1, SkinnySpmmCpuWorkspaceBytes(m_vec, vec_length, dimN)));
+                std::vector<double> cpu_samples;
+                TimingStats cpu_stats = TimeHost<SteadyClock>(FixedTimingOptions(2, 16), [&](){
+                    SkinnySpmmCpu(m_vec, vec_length, dimN, preA_cut, preB, aligned_row_offsets.get(), aligned_col_indices.get(),
+                                  skinny_values.get(), rhs_matrix.get(), output_value_cuda.get());
+                }, cpu_samples);
+                PrintTimingStats("Skinny SpMM CPU", cpu_stats);
+                report = VerifyExact(output_value_cuda.get(), output_value_host.get(), output_size, verify_options);
+                if (!report.Passed()) {
+                    printf( "Skinny CPU SpMM does not agree with SEQUENTIAL! %lld errors!\n", (long long)report.errors);
+                    PrintVerifyReport(stdout, "Skinny CPU SpMM", report);
+                }else {
+                    printf("Skinny CPU verification: PASS\n");
+                }
+            }
+        }
+        aligned_row_offsets.reset();
+        aligned_col_indices.reset();
+        skinny_values.reset();
+        rhs_matrix.reset();
+
+        // Fused epilogue: bias, activation and requantization in the output tile
+        spmm::WmmaSpmmEpilogueKernel epilogue_kernel = skinny ? NULL : spmm::SelectWmmaSpmmEpilogue(preA_cut, preB);
+        if (epilogue_mode > 0 && epilogue_kernel == NULL){
+            printf("Unsupported Epilogue for preA %d preB %d\n", preA_cut, preB);
+        }
+        else if (epilogue_mode > 0){
+            stage.Next("epilogue");
+            HostMemory::Get().SetStage("epilogue");
+            HostArray<int> bias(dimM);
+            MakeDenseMatrix<int>(1, dimM, bias.get(), generator);
+            // Bias in [-64, 63] accumulator units
+            for(int64_t i = 0; i < dimM; i++) bias[i] = bias[i] % 128 - 64;
+
+            // The accumulators map to [-4, 4] (where GELU is not linear) and
+            // their largest magnitude to the top of the requantized range
+            SpmmEpilogue epilogue = IdentityEpilogue();
+            epilogue.activation = epilogue_mode - 1;
+            epilogue.out_bits = out_bits;
+            int max_acc = 1;
+            if (func)
+                for(int64_t i = 0; i < output_size; i++) max_acc = std::max(max_acc, std::abs(output_value_host[i]) + 64);
+            epilogue.scale = max_acc / 4.0f;
+            epilogue.out_scale = ((1 << std::min(out_bits, 16)) - 1) / 4.0f;
+
+            const int64_t epilogue_words = CheckedMul(dimM, EpilogueRowWords(dimN, out_bits), "epilogue output");
+            int *d_bias, *d_epilogue_output;
+            checkCuda(cudaMalloc(&d_bias, dimM * sizeof(int)));
+            checkCuda(cudaMalloc(&d_epilogue_output, epilogue_words * sizeof(int)));
+            checkCuda(cudaMemcpy(d_bias, bias.get(), dimM * sizeof(int), cudaMemcpyHostToDevice));
+
+            SpmmEpilogue d_epilogue = epilogue;
+            d_epilogue.bias = d_bias;
+            std::vector<double> epilogue_samples;
+            TimingStats epilogue_stats = TimeDevice(FixedTimingOptions(16, NUM_PROFILES), [&](){
+                epilogue_kernel(m_vec, vec_length, dimN, dimK, d_row_indices, d_row_offsets, d_col_indices, d_values, d_rhs_matrix, d_epilogue, d_epilogue_output);
+            }, epilogue_samples);
+            PrintTimingStats("Magicube SpMM + epilogue", epilogue_stats);
+            std::cout << "epilogue output bytes: " << epilogue_words * sizeof(int) << " (int32 output " << output_size * sizeof(int) << ")\n";
+
+            if (func){
+                epilogue.bias = bias.get();
+                HostArray<int> epilogue_output_host(epilogue_words);
+                HostArray<int> epilogue_output_cuda(epilogue_words);
+                ApplyEpilogueRef(output_value_host.get(), dimM, dimN, epilogue, epilogue_output_host.get());
+                checkCuda(cudaMemcpy(epilogue_output_cuda.get(), d_epilogue_output, epilogue_words * sizeof(int), cudaMemcpyDeviceToHost));
+
+                // The device and host tanhf may round differently, so a GELU
+                // output is allowed one unit of the output off
+                VerifyOptions verify_options = DefaultVerifyOptions(dimM, dimN, vec_length,
+                                                                    DefaultSpmmKernelConfig(preA_cut, preB).tile_n);
+                VerifyReport report;
+                if (epilogue.activation == kEpilogueGelu){
+                    HostArray<int> got(output_size), expected(output_size);
+                    EpilogueUnpack(epilogue_output_cuda.get(), dimM, dimN, out_bits, got.get());
+                    EpilogueUnpack(epilogue_output_host.get(), dimM, dimN, out_bits, expected.get());
+                    HostArray<float> got_float(output_size), expected_float(output_size);
+                    std::copy(got.get(), got.get() + output_size, got_float.get());
+                    std::copy(expected.get(), expected.get() + output_size, expected_float.get());
+                    verify_options.mode = kVerifyRelative;
+                    verify_options.abs_tol = 1.0;
+                    verify_options.rel_tol = out_bits == 32 ? 1e-5 : 0.0;
+                    report = VerifyFloat(got_float.get(), expected_float.get(), output_size, verify_options);
+                }
+                else{
+                    verify_options.layout.cols = EpilogueRowWords(dimN, out_bits);
+                    report = VerifyExact(epilogue_output_cuda.get(), epilogue_output_host.get(), epilogue_words, verify_options);
+                }
+                if (!report.Passed()) {
+                    printf( "SPMM epilogue does not agree with SEQUENTIAL! %lld errors!\n", (long long)report.errors);
+                    PrintVerifyReport(stdout, "SpMM epilogue", report);
+                }else {
+                    printf("Epilogue verification: PASS\n");
+                }
+            }
+            cudaFree(d_bias);
+            cudaFree(d_epilogue_output);
+        }
 
         // Free the memory
+        stage.Next("free");
         cudaFree(d_row_offsets);
         cudaFree(d_col_indices);
         cudaFree(d_row_indices);
-        cudaFree(d_col_indices_sputnik);
         cudaFree(d_values);
         cudaFree(d_rhs_matrix);
         cudaFree(d_output_value);
 
-        delete row_offsets;
-        delete col_indices;
-        delete col_indices_sputnik;
-        delete row_indices;
-        delete values;
-        delete rhs_matrix;
-        delete output_value_host;
+        output_value_host.reset();
+        HostMemory::Get().Print(stdout);
     }
 }
 
@@ -761,11 +497,12 @@ int main(int argc, char **argv){
         printf("The A_mxn can be a sparse matrix in CSR format loaded from the benchmark [bm], or a row-major dense matrix.\n");
         printf("The B_kxn and C_mxn are row-major dense matrices.\n");
         printf("\n");
-        printf("usage: ./spmm_benchmark [bm] [n] [v] [kernel] [sort] [function] [sparse] [preA] [preB]\n");
+        printf("usage: ./spmm_benchmark [bm] [n] [v] [kernel] [sort] [function] [sparse] [preA] [preB] [epilogue] [out_bits]\n");
         printf("arguments\n");
         printf("bm      :   path to the sparse matrix benchmark.\n");
         printf("            e.g.: /raid/datasets/dlmc/rn50/random_pruning/0.5/bottleneck_2_block_group3_5_1.smtx\n");
         printf("n       :   the length of dimension n.\n");
+        printf("            n <= 16 runs the skinny kernels for 4b4b, 8b4b and 8b8b (kernel = 0).\n");
         printf("v       :   the vector length of the column vector sparsity, can be {1, 2, 4, 8}. \n");
         printf("kernel  :   kernel = 0 & v=2, 4, 8,    the wmmaSpMM is used. \n");
         printf("            kernel = 1 & v=1, 2, 4, 8, the cudaSpMM is used. \n");
@@ -788,6 +525,9 @@ int main(int argc, char **argv){
         printf("           preB = 12, use 12-bit int precision; \n");
         printf("           preB = 8, use 8-bit int precision; \n");
         printf("           preB = 4, use 4-bit int precision; \n");
+        printf("epilogue:   optional, fused into the 4b4b and 8b8b kernels after the plain run;\n");
+        printf("            epilogue = 0, none (default); 1, bias; 2, bias + ReLU; 3, bias + GELU\n");
+        printf("out_bits:   optional, output of the epilogue: 32 (int32, default), 8 or 4 (packed)\n");
     }
     // Run the benchmark
     else{
@@ -800,35 +540,37 @@ int main(int argc, char **argv){
         int sparse = std::atoi(argv[7]);
         int preA = std::atoi(argv[8]);
         int preB = std::atoi(argv[9]);
+        int epilogue_mode = argc > 10 ? std::atoi(argv[10]) : 0;
+        int out_bits = argc > 11 ? std::atoi(argv[11]) : 32;
         std::cout << "Sparse matrix: " << benchmark << "\n" ;
 
-	if ((preA == 4) && (preB == 4) && (vec_length == 8)) BmFN<int, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 1);
-	else if ((preA == 4) && (preB == 4) && (vec_length == 4)) BmFN<short, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 1);
-	else if ((preA == 4) && (preB == 4) && (vec_length == 2)) BmFN<char, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 1);
-	else if ((preA == 8) && (preB == 4) && (vec_length == 8)) BmFN<long long, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 1);
-	else if ((preA == 8) && (preB == 4) && (vec_length == 4)) BmFN<int, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 1);
-	else if ((preA == 8) && (preB == 4) && (vec_length == 2)) BmFN<short, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 1);
-	else if ((preA == 12) && (preB == 4) && (vec_length == 8)) BmFN<long long, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, 16, preA, preB, 2);
-	else if ((preA == 12) && (preB == 4) && (vec_length == 4)) BmFN<long long, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, 16, preA, preB, 1);
-	else if ((preA == 12) && (preB == 4) && (vec_length == 2)) BmFN<int, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, 16, preA, preB, 1);
-	else if ((preA == 16) && (preB == 4) && (vec_length == 8)) BmFN<long long, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 2);
-	else if ((preA == 16) && (preB == 4) && (vec_length == 4)) BmFN<long long, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 1);
-	else if ((preA == 16) && (preB == 4) && (vec_length == 2)) BmFN<int, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 1);
-	else if ((preA == 8) && (preB == 8) && (vec_length == 8)) BmFN<long long, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 1);
-	else if ((preA == 8) && (preB == 8) && (vec_length == 4)) BmFN<int, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 1);
-	else if ((preA == 8) && (preB == 8) && (vec_length == 2)) BmFN<short, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 1);
-	else if ((preA == 12) && (preB == 8) && (vec_length == 8)) BmFN<long long, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, 16, preA, preB, 2);
-	else if ((preA == 12) && (preB == 8) && (vec_length == 4)) BmFN<long long, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, 16, preA, preB, 1);
-	else if ((preA == 12) && (preB == 8) && (vec_length == 2)) BmFN<int, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, 16, preA, preB, 1);
-	else if ((preA == 16) && (preB == 8) && (vec_length == 8)) BmFN<long long, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 2);
-	else if ((preA == 16) && (preB == 8) && (vec_length == 4)) BmFN<long long, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 1);
-	else if ((preA == 16) && (preB == 8) && (vec_length == 2)) BmFN<int, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 1);
+	if ((preA == 4) && (preB == 4) && (vec_length == 8)) BmFN<int, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 1, epilogue_mode, out_bits);
+	else if ((preA == 4) && (preB == 4) && (vec_length == 4)) BmFN<short, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 1, epilogue_mode, out_bits);
+	else if ((preA == 4) && (preB == 4) && (vec_length == 2)) BmFN<char, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 1, epilogue_mode, out_bits);
+	else if ((preA == 8) && (preB == 4) && (vec_length == 8)) BmFN<long long, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 1, epilogue_mode, out_bits);
+	else if ((preA == 8) && (preB == 4) && (vec_length == 4)) BmFN<int, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 1, epilogue_mode, out_bits);
+	else if ((preA == 8) && (preB == 4) && (vec_length == 2)) BmFN<short, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 1, epilogue_mode, out_bits);
+	else if ((preA == 12) && (preB == 4) && (vec_length == 8)) BmFN<long long, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, 16, preA, preB, 2, epilogue_mode, out_bits);
+	else if ((preA == 12) && (preB == 4) && (vec_length == 4)) BmFN<long long, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, 16, preA, preB, 1, epilogue_mode, out_bits);
+	else if ((preA == 12) && (preB == 4) && (vec_length == 2)) BmFN<int, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, 16, preA, preB, 1, epilogue_mode, out_bits);
+	else if ((preA == 16) && (preB == 4) && (vec_length == 8)) BmFN<long long, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 2, epilogue_mode, out_bits);
+	else if ((preA == 16) && (preB == 4) && (vec_length == 4)) BmFN<long long, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 1, epilogue_mode, out_bits);
+	else if ((preA == 16) && (preB == 4) && (vec_length == 2)) BmFN<int, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 1, epilogue_mode, out_bits);
+	else if ((preA == 8) && (preB == 8) && (vec_length == 8)) BmFN<long long, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 1, epilogue_mode, out_bits);
+	else if ((preA == 8) && (preB == 8) && (vec_length == 4)) BmFN<int, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 1, epilogue_mode, out_bits);
+	else if ((preA == 8) && (preB == 8) && (vec_length == 2)) BmFN<short, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 1, epilogue_mode, out_bits);
+	else if ((preA == 12) && (preB == 8) && (vec_length == 8)) BmFN<long long, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, 16, preA, preB, 2, epilogue_mode, out_bits);
+	else if ((preA == 12) && (preB == 8) && (vec_length == 4)) BmFN<long long, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, 16, preA, preB, 1, epilogue_mode, out_bits);
+	else if ((preA == 12) && (preB == 8) && (vec_length == 2)) BmFN<int, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, 16, preA, preB, 1, epilogue_mode, out_bits);
+	else if ((preA == 16) && (preB == 8) && (vec_length == 8)) BmFN<long long, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 2, epilogue_mode, out_bits);
+	else if ((preA == 16) && (preB == 8) && (vec_length == 4)) BmFN<long long, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 1, epilogue_mode, out_bits);
+	else if ((preA == 16) && (preB == 8) && (vec_length == 2)) BmFN<int, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 1, epilogue_mode, out_bits);
 	//else if ((preA == 16) && (preB == 8) && (vec_length == 8)) BmFN<short, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 8);
 	//else if ((preA == 16) && (preB == 8) && (vec_length == 4)) BmFN<short, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 4);
 	//else if ((preA == 16) && (preB == 8) && (vec_length == 2)) BmFN<short, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 2);
-	else if ((preA == 16) && (preB == 16) && (vec_length == 8)) BmFN<short, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 8);
-	else if ((preA == 16) && (preB == 16) && (vec_length == 4)) BmFN<short, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 4);
-	else if ((preA == 16) && (preB == 16) && (vec_length == 2)) BmFN<short, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 2);
+	else if ((preA == 16) && (preB == 16) && (vec_length == 8)) BmFN<short, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 8, epilogue_mode, out_bits);
+	else if ((preA == 16) && (preB == 16) && (vec_length == 4)) BmFN<short, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 4, epilogue_mode, out_bits);
+	else if ((preA == 16) && (preB == 16) && (vec_length == 2)) BmFN<short, int, int, short, half2, short2, CUDA_R_16F>(benchmark, dimN, vec_length, kernel, sorted, func, sparse, preA, preA, preB, 2, epilogue_mode, out_bits);
 	else printf("Unsupported precision and vec_length!\n");
     }
     printf("\n");
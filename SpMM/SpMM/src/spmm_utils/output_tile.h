@@ -1,7 +1,44 @@
 #ifndef SPMM_OUTPUT_Tile_H
 #define SPMM_OUTPUT_Tile_H
+#include "../../include/epilogue.h"
 
 namespace spmm{
+    // Stores Run consecutive accumulators of one output row through the
+    // epilogue (include/epilogue.h). column is a multiple of Run, which is a
+    // multiple of 32 / out_bits, so every thread writes whole packed ints.
+    template <int Run>
+    __device__ __forceinline__ void EpilogueStore(
+        const SpmmEpilogue &epilogue,
+        const int* fragment,
+        int row, int column, int cols,
+        int* output_matrix)
+    {
+        const int bias = epilogue.bias != NULL ? __ldg(epilogue.bias + row) : 0;
+        __align__(16) int values[Run];
+        #pragma unroll
+        for (int i = 0; i < Run; i++)
+            values[i] = EpilogueValue(epilogue, fragment[i], bias);
+
+        if (epilogue.out_bits == 32){
+            int4* output = reinterpret_cast<int4 *>(output_matrix + row * cols + column);
+            #pragma unroll
+            for (int i = 0; i < Run / 4; i++)
+                output[i] = reinterpret_cast<int4 *>(values)[i];
+        }
+        else if (epilogue.out_bits == 8){
+            int* output = output_matrix + row * (cols / 4) + column / 4;
+            #pragma unroll
+            for (int i = 0; i < Run / 4; i++)
+                output[i] = EpiloguePack(values + i * 4, 8);
+        }
+        else{
+            int* output = output_matrix + row * (cols / 8) + column / 8;
+            #pragma unroll
+            for (int i = 0; i < Run / 8; i++)
+                output[i] = EpiloguePack(values + i * 8, 4);
+        }
+    }
+
     template <typename LoadType, typename OutType, int Tile_K, int BlockWidth, int VecLength>
     struct OutputTile{
 
@@ -161,6 +198,8 @@ namespace spmm{
         //
         int lane_id_;
         int valid_tsize_;
+        int row_;
+        int column_offset_;
         // The register file fragment with the results to store
         int* output_fragment_;
         int4* output_matrix_;
@@ -178,6 +217,8 @@ namespace spmm{
             const int output_offset = (m_index_vec * vec_length + (lane_id % 32) / 4) * cols + column_offset;
             output_matrix_ = reinterpret_cast<int4 *>(output_matrix + output_offset);
 	    lane_id_ = lane_id;
+            row_ = m_index_vec * vec_length + (lane_id % 32) / 4;
+            column_offset_ = column_offset;
         }
 
         // Store
@@ -188,6 +229,13 @@ namespace spmm{
                 *(output_matrix_ + output_off + 1) = *(reinterpret_cast<int4 *>(output_fragment_) + 1);
 	    }
         }
+
+        // Store through the epilogue; output_matrix is the int32 or packed output
+        __device__ __forceinline__ void Store(const SpmmEpilogue &epilogue, int cols, int* output_matrix){
+            int column = column_offset_ + ((lane_id_ % 4) * 2 + (lane_id_ / 32) * 8) * 4;
+	    if(lane_id_ % 32 < valid_tsize_)
+                EpilogueStore<8>(epilogue, output_fragment_, row_, column, cols, output_matrix);
+        }
     };
 
     // 4 warps Tile_N = 128 16-bit 8-bit v=2 4
@@ -470,6 +518,8 @@ namespace spmm{
         //
         int lane_id_;
         int valid_tsize_;
+        int row_;
+        int column_offset_;
         // The register file fragment with the results to store
         int4* output_fragment_;
         int4* output_matrix_;
@@ -487,6 +537,8 @@ namespace spmm{
             const int output_offset = (m_index_vec * vec_length + (lane_id % 32) / 4) * cols + column_offset;
             output_matrix_ = reinterpret_cast<int4 *>(output_matrix + output_offset);
 	    lane_id_ = lane_id;
+            row_ = m_index_vec * vec_length + (lane_id % 32) / 4;
+            column_offset_ = column_offset;
         }
 
         // Store
@@ -499,6 +551,13 @@ namespace spmm{
                 *(output_matrix_ + output_off + 3) = *(output_fragment_ + 3);
 	    }
         }
+
+        // Store through the epilogue; output_matrix is the int32 or packed output
+        __device__ __forceinline__ void Store(const SpmmEpilogue &epilogue, int cols, int* output_matrix){
+            int column = column_offset_ + ((lane_id_ % 4) * 4 + (lane_id_ / 32) * 16) * 4;
+	    if(lane_id_ % 32 < valid_tsize_)
+                EpilogueStore<16>(epilogue, reinterpret_cast<const int *>(output_fragment_), row_, column, cols, output_matrix);
+        }
     };
 
     template<typename OutType>
@@ -623,7 +623,7 @@ namespace spmm{
 //4-bit Tile_N = 128 with 2 warps
 template <typename LoadType, typename IndexType, typename VecType, 
           typename OutType, int Tile_K, 
-          int Tile_N, int Warps, int VecLength>
+          int Tile_N, int Warps, int VecLength, bool Epilogue>
 __global__ void wmmaSpmm_kernel_4b(
     int m_vec, int dimN, int dimK, 
     const int* __restrict__ row_indices, 
@@ -631,7 +631,8 @@ __global__ void wmmaSpmm_kernel_4b(
     const int* __restrict__ column_indices,
     const VecType* __restrict__ values,
     const int* __restrict__ rhs_matrix,
-    OutType* __restrict__ output_matrix)
+    OutType* __restrict__ output_matrix,
+    SpmmEpilogue epilogue)
 {
     // For the wmma based implementation, we have Tile_M = 1
     int m_index_vec = blockIdx.x;
@@ -710,13 +711,14 @@ __global__ void wmmaSpmm_kernel_4b(
     } 
 
     wmmaOutputTile_4b<OutType> output_tile_storer(lane_id, VecLength, m_index_vec, dimN_index, dimN, output_fragment, output_matrix);
-    output_tile_storer.Store();
+    if (Epilogue) output_tile_storer.Store(epilogue, dimN, output_matrix);
+    else output_tile_storer.Store();
 }
 
 //8-bit Tile_N = 128 with 4 warps
 template <typename LoadType, typename IndexType, typename VecType, 
           typename OutType, int Tile_K, 
-          int Tile_N, int Warps, int VecLength>
+          int Tile_N, int Warps, int VecLength, bool Epilogue>
 __global__ void wmmaSpmm_kernel_8b(
     int m_vec, int dimN, int dimK, 
     const int* __restrict__ row_indices, 
@@ -724,7 +726,8 @@ __global__ void wmmaSpmm_kernel_8b(
     const int* __restrict__ column_indices,
     const VecType* __restrict__ values,
     const int* __restrict__ rhs_matrix,
-    OutType* __restrict__ output_matrix)
+    OutType* __restrict__ output_matrix,
+    SpmmEpilogue epilogue)
 {
     // For the wmma based implementation, we have Tile_M = 1
     int m_index_vec = blockIdx.x;
@@ -803,7 +806,8 @@ __global__ void wmmaSpmm_kernel_8b(
     } 
 
     wmmaOutputTile_8b<OutType> output_tile_storer(lane_id, VecLength, m_index_vec, dimN_index, dimN, output_fragment, output_matrix);
-    output_tile_storer.Store();
+    if (Epilogue) output_tile_storer.Store(epilogue, dimN, output_matrix);
+    else output_tile_storer.Store();
 }
 
 //16-bit 8-bit Tile_N = 128 with 4 warps
@@ -2096,12 +2100,17 @@ cudaError_t wmmaSpmm_4b_template(
     const int* __restrict__ column_indices,
     const VecType* __restrict__ values,
     const int* __restrict__ rhs_matrix,
-    int* __restrict__ output_matrix)
+    int* __restrict__ output_matrix,
+    const SpmmEpilogue* epilogue)
 {
     dim3 grid_dim(ceil(static_cast<float>(m_vec) / Tile_M), ceil(static_cast<float>(n) / Tile_N), 1);
     dim3 block_dim(WarpWidth * Warps, Tile_M, 1);
-    wmmaSpmm_kernel_4b<int, int, VecType, int, Tile_K, Tile_N, Warps, VecLength><<<grid_dim, block_dim>>>(
-        m_vec, n, k, row_indices, row_offsets, column_indices, values, rhs_matrix, output_matrix);
+    if(epilogue == NULL)
+        wmmaSpmm_kernel_4b<int, int, VecType, int, Tile_K, Tile_N, Warps, VecLength, false><<<grid_dim, block_dim>>>(
+            m_vec, n, k, row_indices, row_offsets, column_indices, values, rhs_matrix, output_matrix, IdentityEpilogue());
+    else
+        wmmaSpmm_kernel_4b<int, int, VecType, int, Tile_K, Tile_N, Warps, VecLength, true><<<grid_dim, block_dim>>>(
+            m_vec, n, k, row_indices, row_offsets, column_indices, values, rhs_matrix, output_matrix, *epilogue);
 
     return cudaGetLastError();
 }
@@ -2118,15 +2127,48 @@ cudaError_t wmmaSpmm_4b(int m_vec, int vec_length, int n, int k,
     switch(vec_length){
         case 2:
             return wmmaSpmm_4b_template<int, char, 1, 32, 128, 32, 2, 2>(m_vec, vec_length, n, k, row_indices, 
-        		    row_offsets, column_indices, reinterpret_cast<const char *>(values), rhs_matrix, output_matrix);
+        		    row_offsets, column_indices, reinterpret_cast<const char *>(values), rhs_matrix, output_matrix, NULL);
             break;
         case 4:
             return wmmaSpmm_4b_template<int, short, 1, 32, 128, 32, 2, 4>(m_vec, vec_length, n, k, row_indices, 
-        		    row_offsets, column_indices, reinterpret_cast<const short *>(values), rhs_matrix, output_matrix);
+        		    row_offsets, column_indices, reinterpret_cast<const short *>(values), rhs_matrix, output_matrix, NULL);
             break;
         case 8:
             return wmmaSpmm_4b_template<int, int, 1, 32, 128, 32, 2, 8>(m_vec, vec_length, n, k, row_indices, 
-        		    row_offsets, column_indices, values, rhs_matrix, output_matrix);
+        		    row_offsets, column_indices, values, rhs_matrix, output_matrix, NULL);
+            break;
+        default:
+            printf("Unsupported Vector Length!\n");
+            return cudaGetLastError();
+    }
+}
+
+//4-bit Tile_N = 128 with 2 warps, fused epilogue
+cudaError_t wmmaSpmmEpilogue_4b(int m_vec, int vec_length, int n, int k, 
+    const int* __restrict__ row_indices, 
+    const int* __restrict__ row_offsets,
+    const int* __restrict__ column_indices,
+    const int* __restrict__ values,
+    const int* __restrict__ rhs_matrix,
+    const SpmmEpilogue &epilogue,
+    int* __restrict__ output_matrix)
+{
+    if(!EpilogueSupported(epilogue)){
+        printf("Unsupported Epilogue!\n");
+        return cudaErrorInvalidValue;
+    }
+    switch(vec_length){
+        case 2:
+            return wmmaSpmm_4b_template<int, char, 1, 32, 128, 32, 2, 2>(m_vec, vec_length, n, k, row_indices, 
+        		    row_offsets, column_indices, reinterpret_cast<const char *>(values), rhs_matrix, output_matrix, &epilogue);
+            break;
+        case 4:
+            return wmmaSpmm_4b_template<int, short, 1, 32, 128, 32, 2, 4>(m_vec, vec_length, n, k, row_indices, 
+        		    row_offsets, column_indices, reinterpret_cast<const short *>(values), rhs_matrix, output_matrix, &epilogue);
+            break;
+        case 8:
+            return wmmaSpmm_4b_template<int, int, 1, 32, 128, 32, 2, 8>(m_vec, vec_length, n, k, row_indices, 
+        		    row_offsets, column_indices, values, rhs_matrix, output_matrix, &epilogue);
             break;
         default:
             printf("Unsupported Vector Length!\n");
@@ -2142,13 +2184,18 @@ cudaError_t wmmaSpmm_8b_template(
     const int* __restrict__ column_indices,
     const VecType* __restrict__ values,
     const int* __restrict__ rhs_matrix,
-    int* __restrict__ output_matrix)
+    int* __restrict__ output_matrix,
+    const SpmmEpilogue* epilogue)
 {
     dim3 grid_dim(ceil(static_cast<float>(m_vec) / Tile_M), ceil(static_cast<float>(n) / Tile_N), 1);
     dim3 block_dim(WarpWidth * Warps, Tile_M, 1);
 
-    wmmaSpmm_kernel_8b<int, int, VecType, int, Tile_K, Tile_N, Warps, VecLength><<<grid_dim, block_dim>>>(
-        m_vec, n, k, row_indices, row_offsets, column_indices, values, rhs_matrix, output_matrix);
+    if(epilogue == NULL)
+        wmmaSpmm_kernel_8b<int, int, VecType, int, Tile_K, Tile_N, Warps, VecLength, false><<<grid_dim, block_dim>>>(
+            m_vec, n, k, row_indices, row_offsets, column_indices, values, rhs_matrix, output_matrix, IdentityEpilogue());
+    else
+        wmmaSpmm_kernel_8b<int, int, VecType, int, Tile_K, Tile_N, Warps, VecLength, true><<<grid_dim, block_dim>>>(
+            m_vec, n, k, row_indices, row_offsets, column_indices, values, rhs_matrix, output_matrix, *epilogue);
     return cudaGetLastError();
 }
 
@@ -2164,15 +2211,48 @@ cudaError_t wmmaSpmm_8b(int m_vec, int vec_length, int n, int k,
     switch(vec_length){
         case 2:
             return wmmaSpmm_8b_template<int, short, 1, 16, 128, 32, 4, 2>(m_vec, vec_length, n, k, row_indices, 
-        		    row_offsets, column_indices, reinterpret_cast<const short *>(values), rhs_matrix, output_matrix);
+        		    row_offsets, column_indices, reinterpret_cast<const short *>(values), rhs_matrix, output_matrix, NULL);
             break;
         case 4:
             return wmmaSpmm_8b_template<int, int, 1, 16, 128, 32, 4, 4>(m_vec, vec_length, n, k, row_indices, 
-        		    row_offsets, column_indices, values, rhs_matrix, output_matrix);
+        		    row_offsets, column_indices, values, rhs_matrix, output_matrix, NULL);
             break;
         case 8:
             return wmmaSpmm_8b_template<int, long long, 1, 16, 128, 32, 4, 8>(m_vec, vec_length, n, k, row_indices, 
-        		    row_offsets, column_indices, reinterpret_cast<const long long *>(values), rhs_matrix, output_matrix);
+        		    row_offsets, column_indices, reinterpret_cast<const long long *>(values), rhs_matrix, output_matrix, NULL);
+            break;
+        default:
+            printf("Unsupported Vector Length!\n");
+            return cudaGetLastError();
+    }
+}
+
+//8-bit Tile_N = 128 with 4 warps, fused epilogue
+cudaError_t wmmaSpmmEpilogue_8b(int m_vec, int vec_length, int n, int k, 
+    const int* __restrict__ row_indices, 
+    const int* __restrict__ row_offsets,
+    const int* __restrict__ column_indices,
+    const int* __restrict__ values,
+    const int* __restrict__ rhs_matrix,
+    const SpmmEpilogue &epilogue,
+    int* __restrict__ output_matrix)
+{
+    if(!EpilogueSupported(epilogue)){
+        printf("Unsupported Epilogue!\n");
+        return cudaErrorInvalidValue;
+    }
+    switch(vec_length){
+        case 2:
+            return wmmaSpmm_8b_template<int, short, 1, 16, 128, 32, 4, 2>(m_vec, vec_length, n, k, row_indices, 
+        		    row_offsets, column_indices, reinterpret_cast<const short *>(values), rhs_matrix, output_matrix, &epilogue);
+            break;
+        case 4:
+            return wmmaSpmm_8b_template<int, int, 1, 16, 128, 32, 4, 4>(m_vec, vec_length, n, k, row_indices, 
+        		    row_offsets, column_indices, values, rhs_matrix, output_matrix, &epilogue);
+            break;
+        case 8:
+            return wmmaSpmm_8b_template<int, long long, 1, 16, 128, 32, 4, 8>(m_vec, vec_length, n, k, row_indices, 
+        		    row_offsets, column_indices, reinterpret_cast<const long long *>(values), rhs_matrix, output_matrix, &epilogue);
             break;
         default:
             printf("Unsupported Vector Length!\n");
@@ -2457,6 +2537,203 @@ cudaError_t wmmaSpmm_16b(int m_vec, int vec_length, int n, int k,
             return cudaGetLastError();
     }
 }
+
+//Skinny N (n <= kSkinnyMaxN, see skinny_spmm.h): one warp per vector row and
+//Warps rows per block. Lane l accumulates column l % Tile_N over every
+//(32 / Tile_N)-th packed word of the row with dp4a, and the lanes sharing a
+//column are reduced with shuffles.
+template <int PreA, int PreB, int Tile_N, int Warps, int VecLength>
+__global__ void wmmaSpmm_kernel_skinny(
+    int m_vec, int dimN, int rhs_row_words,
+    const int* __restrict__ row_indices, 
+    const int* __restrict__ row_offsets,
+    const int* __restrict__ column_indices,
+    const int* __restrict__ values,
+    const int* __restrict__ rhs_matrix,
+    int* __restrict__ output_matrix)
+{
+    // Nonzeros per packed lhs word, rhs values per int, lanes per column
+    constexpr int kItemsA = 32 / PreA;
+    constexpr int kItemsB = 32 / PreB;
+    constexpr int kGroups = 32 / Tile_N;
+
+    const int lane_id = threadIdx.x % 32;
+    int m_index_vec = blockIdx.x * Warps + threadIdx.x / 32;
+    // The whole warp leaves together, so the shuffles below see every lane
+    if (m_index_vec >= m_vec) return;
+    m_index_vec = __ldg(row_indices + m_index_vec);
+
+    int row_offset_vec = __ldg(row_offsets + m_index_vec*2);
+    int nonzeros = __ldg(row_offsets + m_index_vec*2 + 1) - row_offset_vec;
+
+    const int column = lane_id % Tile_N;
+    const int group = lane_id / Tile_N;
+    const bool active = column < dimN;
+    const int rhs_word = column / kItemsB;
+    const int rhs_shift = (column % kItemsB) * PreB;
+    const unsigned rhs_mask = (1u << PreB) - 1;
+
+    // Rows start on a multiple of mma_k_dim, so on a whole packed word
+    const int* values_row = values + row_offset_vec / kItemsA * VecLength;
+    const int* columns_row = column_indices + row_offset_vec;
+    const int words = (nonzeros + kItemsA - 1) / kItemsA;
+
+    unsigned acc[VecLength] = {};
+    for(int w = group; w < words; w += kGroups){
+        // The rhs values of the word's nonzeros in column, four bytes per
+        // plane; padding slots have index -1 and zero values
+        unsigned rhs[kItemsA / 4];
+        #pragma unroll
+        for(int p = 0; p < kItemsA / 4; p++){
+            unsigned packed = 0;
+            #pragma unroll
+            for(int i = 0; i < 4; i++){
+                const int col = __ldg(columns_row + w * kItemsA + p * 4 + i);
+                if(active && col >= 0)
+                    packed |= ((static_cast<unsigned>(__ldg(rhs_matrix + col * rhs_row_words + rhs_word)) >> rhs_shift) & rhs_mask) << (i * 8);
+            }
+            rhs[p] = packed;
+        }
+
+        // The VecLength ints of a word, 16-byte aligned for VecLength 4 and 8
+        __align__(16) int lhs[VecLength];
+        if(VecLength % 4 == 0){
+            #pragma unroll
+            for(int v = 0; v < VecLength; v += 4)
+                *reinterpret_cast<int4 *>(lhs + v) = __ldg(reinterpret_cast<const int4 *>(values_row + w * VecLength + v));
+        }
+        else{
+            #pragma unroll
+            for(int v = 0; v < VecLength; v += 2)
+                *reinterpret_cast<int2 *>(lhs + v) = __ldg(reinterpret_cast<const int2 *>(values_row + w * VecLength + v));
+        }
+
+        #pragma unroll
+        for(int v = 0; v < VecLength; v++){
+            if(PreA == 8){
+                acc[v] = __dp4a(static_cast<unsigned>(lhs[v]), rhs[0], acc[v]);
+            }
+            else{
+                acc[v] = __dp4a(static_cast<unsigned>(lhs[v]) & 0x0f0f0f0fu, rhs[0], acc[v]);
+                acc[v] = __dp4a((static_cast<unsigned>(lhs[v]) >> 4) & 0x0f0f0f0fu, rhs[kItemsA / 4 - 1], acc[v]);
+            }
+        }
+    }
+
+    #pragma unroll
+    for(int v = 0; v < VecLength; v++){
+        #pragma unroll
+        for(int offset = Tile_N; offset < 32; offset *= 2)
+            acc[v] += __shfl_xor_sync(0xffffffff, acc[v], offset);
+    }
+
+    // Lane v % kGroups of every column stores lane v of the vector
+    if(active){
+        #pragma unroll
+        for(int v = 0; v < VecLength; v++)
+            if(v % kGroups == group)
+                output_matrix[(m_index_vec * VecLength + v) * dimN + column] = static_cast<int>(acc[v]);
+    }
+}
+
+template <int PreA, int PreB, int Warps, int VecLength>
+cudaError_t wmmaSpmmSkinny_template(
+    int m_vec, int n, 
+    const int* __restrict__ row_indices, 
+    const int* __restrict__ row_offsets,
+    const int* __restrict__ column_indices,
+    const int* __restrict__ values,
+    const int* __restrict__ rhs_matrix,
+    int* __restrict__ output_matrix)
+{
+    dim3 grid_dim(ceil(static_cast<float>(m_vec) / Warps), 1, 1);
+    dim3 block_dim(32 * Warps, 1, 1);
+    const int rhs_row_words = SkinnyRowWords(n, PreB);
+    if(n <= 1)
+        wmmaSpmm_kernel_skinny<PreA, PreB, 1, Warps, VecLength><<<grid_dim, block_dim>>>(
+            m_vec, n, rhs_row_words, row_indices, row_offsets, column_indices, values, rhs_matrix, output_matrix);
+    else if(n <= 2)
+        wmmaSpmm_kernel_skinny<PreA, PreB, 2, Warps, VecLength><<<grid_dim, block_dim>>>(
+            m_vec, n, rhs_row_words, row_indices, row_offsets, column_indices, values, rhs_matrix, output_matrix);
+    else if(n <= 4)
+        wmmaSpmm_kernel_skinny<PreA, PreB, 4, Warps, VecLength><<<grid_dim, block_dim>>>(
+            m_vec, n, rhs_row_words, row_indices, row_offsets, column_indices, values, rhs_matrix, output_matrix);
+    else if(n <= 8)
+        wmmaSpmm_kernel_skinny<PreA, PreB, 8, Warps, VecLength><<<grid_dim, block_dim>>>(
+            m_vec, n, rhs_row_words, row_indices, row_offsets, column_indices, values, rhs_matrix, output_matrix);
+    else
+        wmmaSpmm_kernel_skinny<PreA, PreB, 16, Warps, VecLength><<<grid_dim, block_dim>>>(
+            m_vec, n, rhs_row_words, row_indices, row_offsets, column_indices, values, rhs_matrix, output_matrix);
+    return cudaGetLastError();
+}
+
+template <int PreA, int PreB>
+cudaError_t wmmaSpmmSkinny(int m_vec, int vec_length, int n, 
+    const int* __restrict__ row_indices, 
+    const int* __restrict__ row_offsets,
+    const int* __restrict__ column_indices,
+    const int* __restrict__ values,
+    const int* __restrict__ rhs_matrix,
+    int* __restrict__ output_matrix)
+{
+    if(n < 1 || n > kSkinnyMaxN){
+        printf("Unsupported N for the skinny SpMM!\n");
+        return cudaErrorInvalidValue;
+    }
+    switch(vec_length){
+        case 2:
+            return wmmaSpmmSkinny_template<PreA, PreB, 4, 2>(m_vec, n, row_indices, 
+        		    row_offsets, column_indices, values, rhs_matrix, output_matrix);
+            break;
+        case 4:
+            return wmmaSpmmSkinny_template<PreA, PreB, 4, 4>(m_vec, n, row_indices, 
+        		    row_offsets, column_indices, values, rhs_matrix, output_matrix);
+            break;
+        case 8:
+            return wmmaSpmmSkinny_template<PreA, PreB, 4, 8>(m_vec, n, row_indices, 
+        		    row_offsets, column_indices, values, rhs_matrix, output_matrix);
+            break;
+        default:
+            printf("Unsupported Vector Length!\n");
+            return cudaGetLastError();
+    }
+}
+
+//4-bit skinny N
+cudaError_t wmmaSpmmSkinny_4b(int m_vec, int vec_length, int n, int k, 
+    const int* __restrict__ row_indices, 
+    const int* __restrict__ row_offsets,
+    const int* __restrict__ column_indices,
+    const int* __restrict__ values,
+    const int* __restrict__ rhs_matrix,
+    int* __restrict__ output_matrix)
+{
+    return wmmaSpmmSkinny<4, 4>(m_vec, vec_length, n, row_indices, row_offsets, column_indices, values, rhs_matrix, output_matrix);
+}
+
+//8-bit 4-bit skinny N
+cudaError_t wmmaSpmmSkinny_8b4b(int m_vec, int vec_length, int n, int k, 
+    const int* __restrict__ row_indices, 
+    const int* __restrict__ row_offsets,
+    const int* __restrict__ column_indices,
+    const int* __restrict__ values,
+    const int* __restrict__ rhs_matrix,
+    int* __restrict__ output_matrix)
+{
+    return wmmaSpmmSkinny<8, 4>(m_vec, vec_length, n, row_indices, row_offsets, column_indices, values, rhs_matrix, output_matrix);
+}
+
+//8-bit skinny N
+cudaError_t wmmaSpmmSkinny_8b(int m_vec, int vec_length, int n, int k, 
+    const int* __restrict__ row_indices, 
+    const int* __restrict__ row_offsets,
+    const int* __restrict__ column_indices,
+    const int* __restrict__ values,
+    const int* __restrict__ rhs_matrix,
+    int* __restrict__ output_matrix)
+{
+    return wmmaSpmmSkinny<8, 8>(m_vec, vec_length, n, row_indices, row_offsets, column_indices, values, rhs_matrix, output_matrix);
+}
 //cudaError_t wmmaSpmm_8b4b4v(int m_vec, int vec_length, int n, int k, 
 //    const int* __restrict__ row_indices, 
 //    const int* __restrict__ row_offsets,
@@ -0,0 +1,250 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <signal.h>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/bench_options.h"
+#include "include/sweep.h"
+
+// Resumable dataset sweep. Replaces the serial launch_*.py loops: the points
+// are shared by a pool of workers, each running one benchmark process at a
+// time, and every finished point is checkpointed to the results file.
+//
+//   ./sweep --list eval_matrices/s50.txt,eval_matrices/s70.txt --n 128,256 --v 2,4,8 --prec 16:8,8:8 --jobs 2
+//
+// Restarting the same command skips the points already in the results file.
+
+struct SweepOptions{
+    std::vector<std::string> lists;
+    std::string dataset_dir;
+    std::vector<int> n;
+    std::vector<int> vec_length;
+    std::vector<std::pair<int, int> > precisions;
+    std::string command;
+    int jobs;
+    // Worker i runs with CUDA_VISIBLE_DEVICES=devices[i % size]
+    std::vector<std::string> devices;
+    std::string results;
+    std::string log_dir;
+    bool retry_failed;
+    bool dry_run;
+};
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void HandleStop(int){ g_stop = 1; }
+
+static void PrintUsage(){
+    printf("./sweep [--name value]...\n");
+    printf("--list         :   matrix list files (eval_matrices/s*.txt), comma separated.\n");
+    printf("--dataset-dir  :   prefix of the matrix paths. Default $dataset_dir.\n");
+    printf("--n            :   N of SpMM / K of SDDMM, comma separated. Default 128,256.\n");
+    printf("--v            :   vec_length, comma separated. Default 2,4,8.\n");
+    printf("--prec         :   preA:preB pairs, comma separated. Default 8:8.\n");
+    printf("--command      :   command template with {matrix} {n} {v} {preA} {preB}.\n");
+    printf("                   Default \"./spmm_benchmark {matrix} {n} {v} 0 1 0 1 {preA} {preB}\".\n");
+    printf("--jobs         :   concurrent benchmark processes. Default 1.\n");
+    printf("--devices      :   GPUs assigned round robin to the workers, comma separated.\n");
+    printf("--results      :   checkpoint/results file. Default sweep_results.tsv.\n");
+    printf("--log-dir      :   keep the output of every point in this directory.\n");
+    printf("--retry-failed :   1 to rerun the points recorded as failed. Default 0.\n");
+    printf("--dry-run      :   1 to print the pending commands only. Default 0.\n");
+}
+
+static bool ParsePrecisions(const std::string &value, std::vector<std::pair<int, int> > &precisions){
+    std::vector<std::string> items;
+    SplitList(value, items);
+    for(size_t i = 0; i < items.size(); i++){
+        const size_t colon = items[i].find(':');
+        int preA, preB;
+        if(colon == std::string::npos || !ParseInt(items[i].substr(0, colon), preA) ||
+           !ParseInt(items[i].substr(colon + 1), preB)) return false;
+        precisions.push_back(std::make_pair(preA, preB));
+    }
+    return !items.empty();
+}
+
+static bool ParseSweepOptions(int argc, char **argv, SweepOptions &options){
+    options.command = "./spmm_benchmark {matrix} {n} {v} 0 1 0 1 {preA} {preB}";
+    options.jobs = 1;
+    options.results = "sweep_results.tsv";
+    options.retry_failed = false;
+    options.dry_run = false;
+    const char *dataset_dir = getenv("dataset_dir");
+    if(dataset_dir != NULL) options.dataset_dir = dataset_dir;
+
+    for(int i = 1; i < argc; i++){
+        std::string arg(argv[i]);
+        if(arg.compare(0, 2, "--") != 0 || i + 1 >= argc){
+            fprintf(stderr, "Expected --name value, got %s\n", arg.c_str());
+            return false;
+        }
+        const std::string name = arg.substr(2);
+        const std::string value(argv[++i]);
+        bool ok = true;
+        if(name == "list") SplitList(value, options.lists);
+        else if(name == "dataset-dir") options.dataset_dir = value;
+        else if(name == "n") ok = ParseIntList(value, options.n);
+        else if(name == "v") ok = ParseIntList(value, options.vec_length);
+        else if(name == "prec") ok = ParsePrecisions(value, options.precisions);
+        else if(name == "command") options.command = value;
+        else if(name == "jobs") ok = ParseInt(value, options.jobs) && options.jobs > 0;
+        else if(name == "devices") SplitList(value, options.devices);
+        else if(name == "results") options.results = value;
+        else if(name == "log-dir") options.log_dir = value;
+        else if(name == "retry-failed") options.retry_failed = (value == "1" || value == "true");
+        else if(name == "dry-run") options.dry_run = (value == "1" || value == "true");
+        else{
+            fprintf(stderr, "Unknown option: %s\n", name.c_str());
+            return false;
+        }
+        if(!ok){
+            fprintf(stderr, "Invalid value for %s: %s\n", name.c_str(), value.c_str());
+            return false;
+        }
+    }
+    if(options.n.empty()){
+        options.n.push_back(128);
+        options.n.push_back(256);
+    }
+    if(options.vec_length.empty()){
+        options.vec_length.push_back(2);
+        options.vec_length.push_back(4);
+        options.vec_length.push_back(8);
+    }
+    if(options.precisions.empty()) options.precisions.push_back(std::make_pair(8, 8));
+    if(options.lists.empty()){
+        fprintf(stderr, "No matrix list given, use --list\n");
+        return false;
+    }
+    return true;
+}
+
+static std::string LogName(const SweepPoint &point){
+    std::string name = point.Key();
+    for(size_t i = 0; i < name.size(); i++)
+        if(name[i] == '/' || name[i] == '\t' || name[i] == ' ') name[i] = '_';
+    return name + ".log";
+}
+
+// Run one point; returns false if the process was interrupted, in which case
+// the point is left for the next run
+static bool RunPoint(const SweepOptions &options, const SweepPoint &point, const std::string &device,
+                     SweepResult &result){
+    std::string command = ExpandSweepCommand(options.command, point, options.dataset_dir.empty() ? point.matrix :
+                                             options.dataset_dir + "/" + point.matrix);
+    if(!device.empty()) command = "CUDA_VISIBLE_DEVICES=" + ShellQuote(device) + " " + command;
+    command += " 2>&1";
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    FILE *pipe = popen(command.c_str(), "r");
+    if(pipe == NULL){
+        fprintf(stderr, "Failed to run %s\n", command.c_str());
+        return false;
+    }
+    std::string output;
+    char buffer[4096];
+    size_t count;
+    while((count = fread(buffer, 1, sizeof(buffer), pipe)) > 0) output.append(buffer, count);
+    const int status = pclose(pipe);
+    result.wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if(g_stop || status == -1 || WIFSIGNALED(status)) return false;
+
+    if(!options.log_dir.empty()){
+        const std::string path = options.log_dir + "/" + LogName(point);
+        FILE *log = fopen(path.c_str(), "w");
+        if(log != NULL){
+            fprintf(log, "%s\n%s", command.c_str(), output.c_str());
+            fclose(log);
+        }
+    }
+
+    result.exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    result.runtime_ms = 0;
+    if(result.exit_code != 0) result.status = "failed";
+    else if(!ParseRuntimeMs(output, result.runtime_ms)) result.status = "noresult";
+    else result.status = "ok";
+    return true;
+}
+
+int main(int argc, char **argv){
+    if(argc == 2 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0)){
+        PrintUsage();
+        return 0;
+    }
+    SweepOptions options;
+    if(!ParseSweepOptions(argc, argv, options)){
+        PrintUsage();
+        return 1;
+    }
+
+    std::vector<std::string> matrices;
+    if(!LoadSweepMatrices(options.lists, matrices)) return 1;
+    const std::vector<SweepPoint> all = MakeSweepPoints(matrices, options.n, options.vec_length, options.precisions);
+    const std::map<std::string, SweepResult> done = LoadSweepResults(options.results);
+
+    std::vector<SweepPoint> pending;
+    for(size_t i = 0; i < all.size(); i++){
+        std::map<std::string, SweepResult>::const_iterator it = done.find(all[i].Key());
+        if(it == done.end() || (options.retry_failed && it->second.status != "ok")) pending.push_back(all[i]);
+    }
+    printf("%zu points, %zu done, %zu to run with %d jobs\n", all.size(), all.size() - pending.size(), pending.size(),
+           options.jobs);
+
+    if(options.dry_run){
+        for(size_t i = 0; i < pending.size(); i++)
+            printf("%s\n", ExpandSweepCommand(options.command, pending[i], options.dataset_dir.empty() ?
+                           pending[i].matrix : options.dataset_dir + "/" + pending[i].matrix).c_str());
+        return 0;
+    }
+
+    FILE *results = fopen(options.results.c_str(), "a");
+    if(results == NULL){
+        fprintf(stderr, "Failed to open %s\n", options.results.c_str());
+        return 1;
+    }
+    signal(SIGINT, HandleStop);
+    signal(SIGTERM, HandleStop);
+
+    std::atomic<size_t> next(0);
+    std::atomic<size_t> finished(0);
+    std::atomic<bool> write_failed(false);
+    std::mutex results_mutex;
+    std::vector<std::thread> workers;
+    for(int w = 0; w < options.jobs; w++){
+        const std::string device = options.devices.empty() ? "" : options.devices[w % options.devices.size()];
+        workers.push_back(std::thread([&, device](){
+            while(!g_stop && !write_failed){
+                const size_t i = next++;
+                if(i >= pending.size()) break;
+                SweepResult result;
+                if(!RunPoint(options, pending[i], device, result)) continue;
+                std::lock_guard<std::mutex> lock(results_mutex);
+                if(!AppendSweepResult(results, pending[i], result)){
+                    fprintf(stderr, "Failed to write %s\n", options.results.c_str());
+                    write_failed = true;
+                    break;
+                }
+                printf("[%zu/%zu] %s: %s %.4f ms\n", ++finished, pending.size(), pending[i].Key().c_str(),
+                       result.status.c_str(), result.runtime_ms);
+                fflush(stdout);
+            }
+        }));
+    }
+    for(size_t w = 0; w < workers.size(); w++) workers[w].join();
+    fclose(results);
+
+    if(g_stop){
+        printf("Interrupted after %zu points, rerun the same command to resume\n", (size_t)finished);
+        return 130;
+    }
+    return write_failed ? 1 : 0;
+}
@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <random>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/cpu_spmm.h"
+#include "include/transpose_spmm.h"
+
+// Host check of the transposed SpMM (include/transpose_spmm.h) on random
+// vector-sparse patterns. For every pattern, vec_length and precision it
+// compares against a dense A^T * B:
+//
+// - TransposedSpmmCpu on the CSC of A,
+// - compute_ref_integers on the A^T CSR of the plan with the values
+//   gathered by TransposeVectorValues, i.e. what the packed path uploads.
+//
+// It also checks that TransposeCache keys on the pattern content: the same
+// pattern in other arrays hits, a pattern edited in place misses.
+//
+//   ./transpose_check [trials] [seed]
+
+// Dense A^T * B: A holds m_vec * vec_length rows and k columns, B the same
+// rows and n columns of 32 / preB unsigned values per int
+template <typename TypeA>
+std::vector<int> DenseTransposedSpmm(int64_t m_vec, int64_t k, int vec_length, const std::vector<int> &row_offsets,
+                                     const std::vector<int> &col_indices, const std::vector<TypeA> &values, int preA,
+                                     int preA_cut, int scaleA, const std::vector<int> &rhs, int64_t n, int preB){
+    const int lanes_per_word = vec_length / scaleA;
+    const uint64_t mask_cut = (static_cast<uint64_t>(1) << preA_cut) - 1;
+    const int items = 32 / preB;
+    const int64_t row_words = (n + items - 1) / items;
+    const int64_t rows = m_vec * vec_length;
+    std::vector<int> dense(rows * k, 0);
+    for(int64_t i = 0; i < m_vec; i++)
+        for(int j = row_offsets[i]; j < row_offsets[i+1]; j++)
+            for(int v = 0; v < vec_length; v++)
+                dense[(i * vec_length + v) * k + col_indices[j]] =
+                    static_cast<int>(VectorLane<TypeA>(values.data(), j, v, preA, scaleA, lanes_per_word) & mask_cut);
+    std::vector<int> out(k * n, 0);
+    for(int64_t r = 0; r < rows; r++){
+        for(int64_t c = 0; c < k; c++){
+            const int a = dense[r * k + c];
+            if(a == 0) continue;
+            for(int64_t x = 0; x < n; x++){
+                const uint32_t word = static_cast<uint32_t>(rhs[r * row_words + x / items]);
+                out[c * n + x] += a * static_cast<int>((word >> ((x % items) * preB)) & ((1u << preB) - 1));
+            }
+        }
+    }
+    return out;
+}
+
+// Mismatches of both transposed paths on one random pattern
+template <typename TypeA>
+int64_t CheckPattern(std::mt19937 &generator, int vec_length, int preA, int preA_cut, int preB, int scaleA, int threads){
+    const int64_t m_vec = 1 + generator() % 24;
+    const int64_t k = 1 + generator() % 70;
+    const int64_t n = 1 + generator() % 40;
+    const unsigned density = 1 + generator() % 4;
+    std::vector<int> row_offsets(1, 0), col_indices;
+    for(int64_t i = 0; i < m_vec; i++){
+        for(int64_t c = 0; c < k; c++)
+            if(generator() % 8 < density) col_indices.push_back(static_cast<int>(c));
+        row_offsets.push_back(static_cast<int>(col_indices.size()));
+    }
+    std::vector<TypeA> values(col_indices.size() * scaleA);
+    for(size_t i = 0; i < values.size(); i++)
+        values[i] = static_cast<TypeA>((static_cast<uint64_t>(generator()) << 32) | generator());
+    const int items = 32 / preB;
+    const int64_t row_words = (n + items - 1) / items;
+    // Non-negative words: compute_ref_integers extracts the rhs values with
+    // signed shifts
+    std::vector<int> rhs(m_vec * vec_length * row_words);
+    for(size_t i = 0; i < rhs.size(); i++) rhs[i] = static_cast<int>(generator() & 0x7fffffff);
+
+    const std::vector<int> expected = DenseTransposedSpmm<TypeA>(m_vec, k, vec_length, row_offsets, col_indices, values,
+                                                                 preA, preA_cut, scaleA, rhs, n, preB);
+    const TransposedSpmmPlan<int> plan = MakeTransposedSpmmPlan<int>(m_vec, k, vec_length, row_offsets.data(),
+                                                                     col_indices.data(), threads);
+    int64_t errors = 0;
+
+    std::vector<int32_t> csc_out(k * n);
+    TransposedSpmmCpu<TypeA, int>(plan, preA, preA_cut, preB, scaleA, values.data(), rhs.data(), n, csc_out.data(), threads);
+    for(int64_t i = 0; i < k * n; i++) errors += csc_out[i] != expected[i];
+
+    std::vector<TypeA> transposed(std::max<int64_t>(plan.NonzerosVec() * scaleA, 1));
+    TransposeVectorValues<TypeA, int>(plan, preA, scaleA, values.data(), transposed.data(), threads);
+    // The plan pads A^T to m_vec * vec_length output rows; only the first k
+    // are real, the others have to come out zero
+    std::vector<int> csr_out(plan.m_vec * vec_length * n);
+    compute_ref_integers<TypeA, int>(transposed.data(), rhs.data(), csr_out.data(), plan.m_vec * vec_length, plan.k, n,
+                                     preA, preA_cut, preB, vec_length, plan.row_offsets.data(), plan.col_indices.data(),
+                                     plan.m_vec, scaleA);
+    for(int64_t i = 0; i < static_cast<int64_t>(csr_out.size()); i++)
+        errors += csr_out[i] != (i < k * n ? expected[i] : 0);
+
+    if(errors)
+        printf("  v=%d preA %d (cut %d) preB %d: m_vec %lld k %lld n %lld, %lld mismatches\n", vec_length, preA,
+               preA_cut, preB, (long long)m_vec, (long long)k, (long long)n, (long long)errors);
+    return errors;
+}
+
+// Content keys: a copy of the pattern hits, an in-place edit misses
+static bool CheckCacheKeys(){
+    std::vector<int> row_offsets = {0, 2, 3, 5};
+    std::vector<int> col_indices = {0, 3, 1, 2, 4};
+    TransposeCache<int> cache;
+    cache.Get(3, 6, 4, row_offsets.data(), col_indices.data());
+    std::vector<int> row_offsets_copy(row_offsets), col_indices_copy(col_indices);
+    cache.Get(3, 6, 4, row_offsets_copy.data(), col_indices_copy.data());
+    const bool copy_hits = cache.hits() == 1 && cache.misses() == 1;
+    col_indices[1] = 5;
+    const TransposedSpmmPlan<int> &edited = cache.Get(3, 6, 4, row_offsets.data(), col_indices.data());
+    const bool edit_misses = cache.misses() == 2;
+    // Column 5 of A is now populated, column 3 is empty
+    const bool edit_rebuilt = edited.csc.col_offsets[6] - edited.csc.col_offsets[5] == 1 &&
+                              edited.csc.col_offsets[4] == edited.csc.col_offsets[3];
+    printf("cache: copy hits %s, in-place edit misses %s, rebuilt %s\n", copy_hits ? "yes" : "no",
+           edit_misses ? "yes" : "no", edit_rebuilt ? "yes" : "no");
+    return copy_hits && edit_misses && edit_rebuilt;
+}
+
+int main(int argc, char **argv){
+    if(argc > 1 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0)){
+        printf("usage: ./transpose_check [trials] [seed]\n");
+        return 0;
+    }
+    const int trials = argc > 1 ? atoi(argv[1]) : 50;
+    std::mt19937 generator(argc > 2 ? atoi(argv[2]) : 1);
+
+    int64_t errors = 0;
+    for(int t = 0; t < trials; t++){
+        // Serial and threaded conversions alternate
+        const int threads = t % 2 ? 4 : 1;
+        // Word types as picked by magicube_bench for (preA, vec_length)
+        errors += CheckPattern<long long>(generator, 8, 8, 8, 8, 1, threads);
+        errors += CheckPattern<long long>(generator, 8, 8, 8, 4, 1, threads);
+        errors += CheckPattern<int>(generator, 4, 8, 8, 8, 1, threads);
+        errors += CheckPattern<short>(generator, 2, 8, 8, 4, 1, threads);
+        errors += CheckPattern<int>(generator, 8, 4, 4, 4, 1, threads);
+        errors += CheckPattern<short>(generator, 4, 4, 4, 4, 1, threads);
+        errors += CheckPattern<long long>(generator, 8, 16, 16, 4, 2, threads);
+        errors += CheckPattern<long long>(generator, 4, 16, 12, 4, 1, threads);
+    }
+    printf("%d trials, %lld mismatches\n", trials, (long long)errors);
+    const bool cache_ok = CheckCacheKeys();
+
+    const bool ok = errors == 0 && cache_ok;
+    printf("%s\n", ok ? "PASSED" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,189 @@
+#ifndef BLOCKED_ELL_H
+#define BLOCKED_ELL_H
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Quantized Blocked-ELL matrices and a CPU SpMM on them.
+//
+// The layout follows cusparseCreateBlockedEll: ell_col_ind holds
+// blocks_per_row block-column indices per block row (-1 for padding blocks)
+// and the values are a row-major (rows x blocks_per_row * block_size) array,
+// so every block row is a sequence of contiguous dense blocks. 8-bit values
+// are stored one per byte, 4-bit values two per byte (low nibble first).
+
+struct BlockedEllMatrix{
+    int rows;           // padded to a multiple of block_size
+    int cols;           // padded to a multiple of block_size
+    int block_size;
+    int blocks_per_row;
+    int bits;           // 8 or 4
+    float scale;        // quantized = round(value * scale)
+    std::vector<int> ell_col_ind;
+    std::vector<int8_t> values;
+
+    int NumBlockRows() const { return rows / block_size; }
+    int EllCols() const { return blocks_per_row * block_size; }
+};
+
+inline int8_t QuantizeValue(float value, float scale, int bits){
+    const float qmax = static_cast<float>((1 << (bits - 1)) - 1);
+    float q = std::nearbyint(value * scale);
+    q = std::max(-qmax - 1.0f, std::min(qmax, q));
+    return static_cast<int8_t>(q);
+}
+
+// Convert a vector-sparse CSR matrix (m_vec vector rows of length vec_length,
+// vec_length values per nonzero vector) to a quantized Blocked-ELL matrix.
+// block_size can be any positive size, a block row gathers the block columns
+// touched by any of its rows.
+inline void VectorCsrToBlockedEll(int m_vec, int vec_length, int n, const int *row_offsets,
+                                  const int *col_indices, const float *values, int block_size,
+                                  int bits, float scale, BlockedEllMatrix &ell){
+    const int rows = m_vec * vec_length;
+    ell.block_size = block_size;
+    ell.rows = (rows + block_size - 1) / block_size * block_size;
+    ell.cols = (n + block_size - 1) / block_size * block_size;
+    ell.bits = bits;
+    ell.scale = scale;
+    const int num_block_rows = ell.rows / block_size;
+
+    // Collect the block columns of every block row
+    std::vector<std::vector<int> > block_cols(num_block_rows);
+    for(int i = 0; i < m_vec; i++){
+        for(int v = 0; v < vec_length; v++){
+            const int block_row = (i * vec_length + v) / block_size;
+            for(int j = row_offsets[i]; j < row_offsets[i+1]; j++)
+                block_cols[block_row].push_back(col_indices[j] / block_size);
+        }
+    }
+    ell.blocks_per_row = 0;
+    for(int b = 0; b < num_block_rows; b++){
+        std::sort(block_cols[b].begin(), block_cols[b].end());
+        block_cols[b].erase(std::unique(block_cols[b].begin(), block_cols[b].end()), block_cols[b].end());
+        ell.blocks_per_row = std::max<int>(ell.blocks_per_row, block_cols[b].size());
+    }
+
+    ell.ell_col_ind.assign(static_cast<int64_t>(num_block_rows) * ell.blocks_per_row, -1);
+    for(int b = 0; b < num_block_rows; b++)
+        std::copy(block_cols[b].begin(), block_cols[b].end(), ell.ell_col_ind.begin() + static_cast<int64_t>(b) * ell.blocks_per_row);
+
+    // Scatter the quantized values into their blocks
+    const int64_t ell_cols = ell.EllCols();
+    std::vector<int8_t> dense_values(ell.rows * ell_cols, 0);
+    for(int i = 0; i < m_vec; i++){
+        for(int v = 0; v < vec_length; v++){
+            const int row = i * vec_length + v;
+            const int block_row = row / block_size;
+            const std::vector<int> &cols = block_cols[block_row];
+            for(int j = row_offsets[i]; j < row_offsets[i+1]; j++){
+                const int col = col_indices[j];
+                const int slot = std::lower_bound(cols.begin(), cols.end(), col / block_size) - cols.begin();
+                dense_values[row * ell_cols + slot * block_size + col % block_size] =
+                    QuantizeValue(values[static_cast<int64_t>(j) * vec_length + v], scale, bits);
+            }
+        }
+    }
+
+    if(bits == 8){
+        ell.values.swap(dense_values);
+    }
+    else{
+        ell.values.assign((dense_values.size() + 1) / 2, 0);
+        for(size_t e = 0; e < dense_values.size(); e++)
+            ell.values[e / 2] |= static_cast<int8_t>((dense_values[e] & 15) << ((e % 2) * 4));
+    }
+}
+
+// out[0:n] += a0 * b0[0:n] + a1 * b1[0:n]
+inline void BlockedEllAxpy2(int32_t a0, int32_t a1, const int8_t *b0, const int8_t *b1, int32_t *out, int n){
+    int c = 0;
+#ifdef __AVX2__
+    // (a0, a1) pairs against interleaved (b0, b1) int16 pairs with madd
+    const __m256i a_pair = _mm256_set1_epi32(static_cast<int>((static_cast<uint32_t>(a1) << 16) |
+                                                              (static_cast<uint32_t>(a0) & 0xffff)));
+    for(; c + 16 <= n; c += 16){
+        __m256i vb0 = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(b0 + c)));
+        __m256i vb1 = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(b1 + c)));
+        // lo holds columns 0-3 and 8-11, hi holds 4-7 and 12-15
+        __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi16(vb0, vb1), a_pair);
+        __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi16(vb0, vb1), a_pair);
+        __m256i *out_ptr = reinterpret_cast<__m256i *>(out + c);
+        _mm256_storeu_si256(out_ptr, _mm256_add_epi32(_mm256_loadu_si256(out_ptr), _mm256_permute2x128_si256(lo, hi, 0x20)));
+        _mm256_storeu_si256(out_ptr + 1, _mm256_add_epi32(_mm256_loadu_si256(out_ptr + 1), _mm256_permute2x128_si256(lo, hi, 0x31)));
+    }
+#endif
+    for(; c < n; c++)
+        out[c] += a0 * b0[c] + a1 * b1[c];
+}
+
+// Bytes of the unpacked block row BlockedEllSpmmCpu works in
+inline int64_t BlockedEllWorkspaceBytes(int blocks_per_row, int block_size){
+    return static_cast<int64_t>(block_size) * blocks_per_row * block_size;
+}
+
+// Blocked-ELL SpMM on the CPU: out (rows x n) = A (rows x cols) * rhs (cols x n).
+// rhs is row-major int8, out is row-major int32. A's values are 8-bit (one per
+// byte) or 4-bit (two per byte); a block row is unpacked once into workspace
+// (BlockedEllWorkspaceBytes) and then multiplied block by block against the
+// contiguous rhs rows. The caller owns workspace so timed loops do not
+// allocate.
+inline double BlockedEllSpmmCpu(int num_block_rows, int blocks_per_row, int block_size, int bits,
+                                const int *ell_col_ind, const int8_t *values, const int8_t *rhs,
+                                int n, int32_t *out, int8_t *workspace){
+    const int ell_cols = blocks_per_row * block_size;
+    int8_t *block_row_values = workspace;
+    const int64_t block_row_size = BlockedEllWorkspaceBytes(blocks_per_row, block_size);
+    std::memset(out, 0, static_cast<int64_t>(num_block_rows) * block_size * n * sizeof(int32_t));
+    double flops = 0;
+
+    for(int br = 0; br < num_block_rows; br++){
+        const int64_t value_offset = static_cast<int64_t>(br) * block_size * ell_cols;
+        if(bits == 8){
+            std::memcpy(block_row_values, values + value_offset, block_row_size);
+        }
+        else{
+            for(int64_t e = 0; e < block_row_size; e++){
+                const int64_t idx = value_offset + e;
+                // Extract the nibble from the unsigned byte, then sign-extend it
+                const uint8_t byte = static_cast<uint8_t>(values[idx / 2]);
+                const int nibble = (byte >> ((idx % 2) * 4)) & 0xf;
+                block_row_values[e] = static_cast<int8_t>((nibble ^ 8) - 8);
+            }
+        }
+
+        for(int b = 0; b < blocks_per_row; b++){
+            const int block_col = ell_col_ind[static_cast<int64_t>(br) * blocks_per_row + b];
+            if(block_col < 0) continue;
+            const int8_t *rhs_block = rhs + static_cast<int64_t>(block_col) * block_size * n;
+            for(int r = 0; r < block_size; r++){
+                const int8_t *a = block_row_values + static_cast<int64_t>(r) * ell_cols + b * block_size;
+                int32_t *out_row = out + (static_cast<int64_t>(br) * block_size + r) * n;
+                int cv = 0;
+                for(; cv + 2 <= block_size; cv += 2)
+                    BlockedEllAxpy2(a[cv], a[cv+1], rhs_block + static_cast<int64_t>(cv) * n,
+                                    rhs_block + static_cast<int64_t>(cv + 1) * n, out_row, n);
+                if(cv < block_size)
+                    BlockedEllAxpy2(a[cv], 0, rhs_block + static_cast<int64_t>(cv) * n,
+                                    rhs_block + static_cast<int64_t>(cv) * n, out_row, n);
+            }
+            flops += 2.0 * block_size * block_size * n;
+        }
+    }
+    return flops;
+}
+
+// workspace is grown to the size the matrix needs and can be reused
+inline double BlockedEllSpmmCpu(const BlockedEllMatrix &ell, const int8_t *rhs, int n, int32_t *out,
+                                std::vector<int8_t> &workspace){
+    workspace.resize(std::max<int64_t>(workspace.size(), BlockedEllWorkspaceBytes(ell.blocks_per_row, ell.block_size)));
+    return BlockedEllSpmmCpu(ell.NumBlockRows(), ell.blocks_per_row, ell.block_size, ell.bits,
+                             ell.ell_col_ind.data(), ell.values.data(), rhs, n, out, workspace.data());
+}
+
+#endif
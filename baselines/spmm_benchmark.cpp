@@ -7,6 +7,7 @@
 #include "include/cuda_spmm.cuh"
 #include "include/wmma_spmm.cuh"
 #include "include/cublas_gemm.cuh"
+#include "include/blocked_ell.h"
 #include <fstream>
 #include <string>
 #include <cuda_profiler_api.h>
@@ -16,6 +17,50 @@
 #include <iostream>
 
 
+// Convert the vector-sparse CSR A (m_vec x n, values in [-1, 1]) to a
+// quantized Blocked-ELL matrix with VectorCsrToBlockedEll and check
+// BlockedEllSpmmCpu on it against the CSR product of the same quantized
+// values. Returns the number of mismatches.
+template <typename InType>
+int CheckBlockedEllConverter(int m_vec, int vec_length, int n, int k, const int *row_offsets, const int *col_indices,
+                             const InType *values, const InType *rhs_matrix, int bits){
+    const int m = m_vec * vec_length;
+    const int nonzeros = row_offsets[m_vec] * vec_length;
+    const float scale = static_cast<float>((1 << (bits - 1)) - 1);
+    std::vector<float> float_values(nonzeros);
+    for (int i = 0; i < nonzeros; i ++) float_values[i] = (float)values[i];
+    BlockedEllMatrix ell;
+    VectorCsrToBlockedEll(m_vec, vec_length, n, row_offsets, col_indices, float_values.data(), vec_length, bits, scale, ell);
+
+    // 8-bit rhs, zero in the padding rows of the last block column
+    std::vector<int8_t> rhs(static_cast<int64_t>(ell.cols) * k, 0);
+    for (int64_t i = 0; i < static_cast<int64_t>(n) * k; i ++) rhs[i] = QuantizeValue((float)rhs_matrix[i], 127.0f, 8);
+
+    std::vector<int32_t> output_ell(static_cast<int64_t>(ell.rows) * k);
+    std::vector<int8_t> workspace;
+    BlockedEllSpmmCpu(ell, rhs.data(), k, output_ell.data(), workspace);
+
+    std::vector<int32_t> output_ref(static_cast<int64_t>(m) * k, 0);
+    for (int i = 0; i < m_vec; i ++){
+        for (int j = row_offsets[i]; j < row_offsets[i+1]; j ++){
+            for (int v = 0; v < vec_length; v ++){
+                const int32_t a = QuantizeValue(float_values[j * vec_length + v], scale, bits);
+                const int8_t *b = rhs.data() + static_cast<int64_t>(col_indices[j]) * k;
+                int32_t *out = output_ref.data() + static_cast<int64_t>(i * vec_length + v) * k;
+                for (int l = 0; l < k; l ++) out[l] += a * b[l];
+            }
+        }
+    }
+
+    int errors = 0;
+    for (int64_t j = 0; j < static_cast<int64_t>(m) * k; j ++)
+        if (output_ell[j] != output_ref[j]) errors ++;
+    // The padding rows of the last block row stay zero
+    for (int64_t j = static_cast<int64_t>(m) * k; j < static_cast<int64_t>(ell.rows) * k; j ++)
+        if (output_ell[j] != 0) errors ++;
+    return errors;
+}
+
 template <typename InType, typename OutType, typename IndexType, typename DTypeVec, typename ITypeVec, cudaDataType_t DCuSPARSE>
 void BmFN(std::string benchmark, int dimK, int vec_length, int kernel, bool sorted, bool func, int sparse){
 
@@ -244,6 +289,16 @@ void BmFN(std::string benchmark, int dimK, int vec_length, int kernel, bool sort
                 printf("Results verified: they agree.\n");
             }
             delete output_value_cuda;
+
+            // The same matrix through the Blocked-ELL converter, 8-bit and 4-bit
+            for (int bits = 8; bits >= 4; bits -= 4){
+                int ell_errors = CheckBlockedEllConverter(m_vec, vec_length, n, k, row_offsets, col_indices, values, rhs_matrix, bits);
+                if (ell_errors > 0) {
+                    printf( "%d-bit Blocked ELL CPU SpMM does not agree with the CSR reference! %d errors!\n", bits, ell_errors);
+                }else {
+                    printf("%d-bit Blocked ELL CPU SpMM verified: it agrees.\n", bits);
+                }
+            }
         }
 
 
@@ -536,30 +591,12 @@ void BmFN(std::string benchmark, int dimK, int vec_length, int kernel, bool sort
 
         // Functional verification
         if (func){
-            float *output_value_host = new float[A_num_rows * k];
-            // traverse all the vector rows
-            for (int i=0; i < m_vec; i++){
-                // traverse all the rows within the row vector group
-                for (int v=0; v < A_ell_blocksize; v++){
-                    int row_idx = i * A_ell_blocksize + v;
-                    // travers all the output column s
-                    for (int j=0; j < k; j++){
-                        float psum = 0;
-                        // traverse all the column blocks
-                        for (int c=0; c < A_num_col_block_nz; c++){
-                            int col_idx_base = A_columns[i * A_num_col_block_nz + c] * A_ell_blocksize;
-                            // traverse the column block size
-                            for (int cv=0; cv < A_ell_blocksize; cv++){
-                                int col_idx = col_idx_base + cv;
-                                // psum += (float)A_values[row_idx * A_ell_cols + c * A_ell_blocksize + cv] * (float)rhs_matrix[col_idx * k + j];
-                                psum += (float)A_values[row_idx * A_ell_cols + c * A_ell_blocksize + cv] * (float)rhs_matrix[col_idx * k + j];
-                            }
-                        }
-                        output_value_host[row_idx * k + j] = psum;
-                    }
-                }
-            }
-            
+            // Blocked-ELL SpMM on the CPU over the same contiguous blocks
+            int *output_value_host = new int[A_num_rows * k];
+            std::vector<int8_t> ell_workspace(BlockedEllWorkspaceBytes(A_num_col_block_nz, A_ell_blocksize));
+            BlockedEllSpmmCpu(m_vec, A_num_col_block_nz, A_ell_blocksize, 8, A_columns,
+                              reinterpret_cast<const int8_t *>(A_values),
+                              reinterpret_cast<const int8_t *>(rhs_matrix), k, output_value_host, ell_workspace.data());
 
             OutType *output_value_cuda = new OutType[A_num_rows * k];
             checkCuda(cudaMemcpy(output_value_cuda, d_output_value, A_num_rows * k * sizeof(OutType), cudaMemcpyDeviceToHost));
@@ -8,6 +8,7 @@ import nvtx
 from torch.nn.modules import dropout
 from attention import MultiheadAttention as MultiheadAttention_
 from spattention import spMultiheadAttention
+from sparse_mlp import SparseMLP, prune_vectors
 #from verify.static_mask import static_random_mask
 from verify.static_mask import static_random_mask_aligned
 from torch.cuda.amp import autocast
@@ -35,6 +36,9 @@ parser.add_argument('--sparsity', type=float, default=0.9, help='mask sparsity')
 parser.add_argument('--vec_length', type=int, default=8, help='vector length')
 parser.add_argument('--model', choices=['sparse', 'dense', 'both'], default='sparse', help='which model to launch')
 parser.add_argument('--mem', action='store_true', help="If set, the peak memory usage will be reported")
+parser.add_argument('--calibrate', choices=['none', 'absmax', 'percentile', 'mse'], default='none',
+                    help='calibrate per-head q, k, v scales with this method instead of the fixed scale')
+parser.add_argument('--sparse_mlp', action='store_true', help="If set, the sparse model runs its MLP as vector-sparse quantized layers")
 args = parser.parse_args()
 
 def profile_(model):
@@ -64,6 +68,11 @@ class SparseTransformerBlock(nn.Module):
         self.layer_norm2 = nn.LayerNorm(normalized_shape=embed_dim)
         self.linear1 = nn.Linear(embed_dim, mlp_dim)
         self.linear2 = nn.Linear(mlp_dim, embed_dim)
+        self.mlp = None
+        if args.sparse_mlp:
+            prune_vectors(self.linear1, sparsity, args.vec_length)
+            prune_vectors(self.linear2, sparsity, args.vec_length)
+            self.mlp = SparseMLP([self.linear1, self.linear2], ['none', 'none'], args.vec_length, args.lhs_pre, args.rhs_pre)
 
     def forward(self, x):
         with nvtx.annotate("Layer Norm 1"):
@@ -77,6 +86,10 @@ class SparseTransformerBlock(nn.Module):
             out = out[0] + x
         with nvtx.annotate("Layer Norm 2"):
             out = self.layer_norm2(out)
+        if self.mlp is not None:
+            with nvtx.annotate("Sparse MLP"):
+                out = self.mlp(out)
+            return out + x
         with nvtx.annotate("Linear 1"):
             out = self.linear1(out)
         with nvtx.annotate("Linear 2"):
@@ -144,6 +157,16 @@ class SparseTransformerEncoder(nn.Module):
         self.layer_norm = nn.LayerNorm(normalized_shape=embed_dim)
         self.linear = nn.Linear(embed_dim, num_class)
 
+    def calibrate(self, x, method):
+        # One forward pass observing q, k and v of every attention layer
+        attentions = [m for m in self.modules() if isinstance(m, spMultiheadAttention)]
+        for attention in attentions:
+            attention.start_calibration(args.rhs_pre, method)
+        with torch.no_grad():
+            self(x)
+        for attention in attentions:
+            attention.finish_calibration()
+
     @profile_('sparse')
     def forward(self, x):
         out = self.encoder(x) * np.sqrt(self.embed_dim)
@@ -198,6 +221,8 @@ def sparse_profile():
     spTrans.cuda().eval().half()
 
     x = torch.randint(low=0, high=args.vocab_size, size=(args.bs, args.seq_len), dtype=torch.int32, device='cuda')
+    if args.calibrate != 'none':
+        spTrans.calibrate(x, args.calibrate)
     if args.mem:
         out = spTrans(x)
     else:
@@ -0,0 +1,76 @@
+import torch
+import torch.nn as nn
+from typing import List
+
+from sptrans.calibration import Calibrator
+from sptrans.sparse_mlp import SparseMLP as SparseMLPExecutor
+
+
+_activations = {
+    'none': lambda x: x,
+    'relu': torch.nn.functional.relu,
+    'gelu': torch.nn.functional.gelu,
+}
+
+
+def prune_vectors(linear: nn.Linear, sparsity: float, vec_length: int):
+    # Zeroes the column vectors of vec_length output rows with the smallest
+    # L2 norm, the sparsity pattern of the deq_spmm kernels
+    with torch.no_grad():
+        weight = linear.weight
+        out_features, in_features = weight.shape
+        norms = weight.float().view(out_features // vec_length, vec_length, in_features).norm(dim=1)
+        num_pruned = int(norms.numel() * sparsity)
+        if num_pruned == 0:
+            return
+        threshold = norms.flatten().kthvalue(num_pruned).values
+        keep = (norms > threshold).repeat_interleave(vec_length, dim=0)
+        weight.mul_(keep.to(weight.dtype))
+
+
+class SparseMLP(nn.Module):
+    # A chain of pruned linear layers run by the sptrans.sparse_mlp executor:
+    # every layer is a quantized deq_spmm followed by bias, activation and the
+    # quantization of the next input, without returning to Python in between.
+    #
+    # The executor is built on the first forward from the current weights,
+    # with the input scales calibrated (absmax) on that batch; call prepare()
+    # again after changing the weights.
+    def __init__(self, linears: List[nn.Linear], activations: List[str], vec_length: int = 8,
+                 lhs_pre: int = 8, rhs_pre: int = 8):
+        super(SparseMLP, self).__init__()
+        assert len(linears) == len(activations)
+        self.linears = nn.ModuleList(linears)
+        self.activations = activations
+        self.vec_length = vec_length
+        self.lhs_pre = lhs_pre
+        self.rhs_pre = rhs_pre
+        self.executor = None
+
+    def prepare(self, x: torch.Tensor):
+        # Input scales from the float chain on x
+        input_scales = []
+        with torch.no_grad():
+            h = x.reshape(-1, x.size(-1))
+            for linear, activation in zip(self.linears, self.activations):
+                calibrator = Calibrator(self.rhs_pre)
+                calibrator.observe(h)
+                input_scales.append(float(calibrator.scales()[0, 0]))
+                h = _activations[activation](linear(h))
+
+        self.executor = SparseMLPExecutor()
+        for linear, activation, input_scale in zip(self.linears, self.activations, input_scales):
+            self.executor.add_layer(linear.weight, linear.bias, self.vec_length, self.lhs_pre, self.rhs_pre,
+                                    activation, input_scale)
+
+    def forward(self, x: torch.Tensor) -> torch.Tensor:
+        if self.executor is None:
+            self.prepare(x)
+        out = self.executor.forward(x.reshape(-1, x.size(-1)).contiguous())
+        return out.view(*x.shape[:-1], -1)
+
+    def forward_cpu(self, x: torch.Tensor) -> torch.Tensor:
+        if self.executor is None:
+            self.prepare(x)
+        out = self.executor.forward_cpu(x.reshape(-1, x.size(-1)))
+        return out.view(*x.shape[:-1], -1)
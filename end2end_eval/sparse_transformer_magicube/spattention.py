@@ -17,6 +17,7 @@ from sptrans.deq_spmm import bspmm_4b
 from sptrans.deq_spmm import bspmm_8b4b
 from sptrans.deq_spmm import bspmm_16b
 from sptrans.q_softmax import q_bcsr_softmax
+from sptrans.calibration import Calibrator
 
 
 def sp_multi_head_attention_forward(
@@ -48,12 +49,28 @@ def sp_multi_head_attention_forward(
     v_proj_weight: Optional[torch.Tensor] = None,
     static_k: Optional[torch.Tensor] = None,            # TODO
     static_v: Optional[torch.Tensor] = None,            # TODO
+    qkv_scales: Optional[Tuple[torch.Tensor, torch.Tensor, torch.Tensor]] = None,  # per-head scales of q, k, v from sptrans.calibration
+    calibrators: Optional[Tuple[Calibrator, Calibrator, Calibrator]] = None,        # if given, observe q, k, v before quantization
 ) -> Tuple[torch.Tensor, Optional[torch.Tensor]]:
 
     scale_qkv = 36.0
     #scale_sfmx = 255.0
     scale_sfmx = 32.0
 
+    if qkv_scales is not None:
+        # {num_heads, 1} float32 tensors; the dequantization scale of every
+        # batch entry is the product of the scales of its two operands
+        # Calibrator.scales() is on the CPU, the quantization kernels take
+        # the scales on the device of the input
+        scale_q, scale_k, scale_v = (s.to(query.device) for s in qkv_scales)
+        assert scale_q.size(1) == 1 and scale_k.size(1) == 1 and scale_v.size(1) == 1
+        scale_qk = (scale_q * scale_k).flatten()
+        scale_av = (scale_v * scale_sfmx).flatten()
+    else:
+        scale_q = scale_k = scale_v = scale_qkv
+        scale_qk = scale_qkv*scale_qkv
+        scale_av = scale_qkv*scale_sfmx
+
     # Get problem size
     tgt_len, bsz, embed_dim = query.size()
     assert embed_dim == embed_dim_to_check
@@ -181,6 +198,10 @@ def sp_multi_head_attention_forward(
             if key_padding_mask is not None:
                 key_padding_mask = torch.nn.functional.pad(key_padding_mask, (0, 1))
 
+    if calibrators is not None:
+        for calibrator, x in zip(calibrators, (q, k, v)):
+            calibrator.observe(x)
+
     with nvtx.annotate("QKV quantization"):
         #q_abs_max = torch.max(torch.abs(q))
         #k_abs_max = torch.max(torch.abs(k))
@@ -188,18 +209,18 @@ def sp_multi_head_attention_forward(
         #q = bquantization(q, rhs_pre, scale_qkv/q_abs_max*q_abs_max)
         #k = bquantization(k, rhs_pre, scale_qkv/q_abs_max*q_abs_max)
         #v = bquantization(v, rhs_pre, scale_qkv/q_abs_max*q_abs_max)
-        q = bquantization(q, rhs_pre, scale_qkv)
-        k = bquantization(k, rhs_pre, scale_qkv)
-        v = bquantization(v, rhs_pre, scale_qkv)
+        q = bquantization(q, rhs_pre, scale_q)
+        k = bquantization(k, rhs_pre, scale_k)
+        v = bquantization(v, rhs_pre, scale_v)
     
     # batched matrix multiplication
     with nvtx.annotate("sp QK^T"):
         if rhs_pre == 8:
-            attn_output_weights = bsddmm_8b(row_indices, row_offsets, column_indices, q, k, vec_length, rhs_pre, scale_qkv*scale_qkv)
+            attn_output_weights = bsddmm_8b(row_indices, row_offsets, column_indices, q, k, vec_length, rhs_pre, scale_qk)
         if rhs_pre == 4:
-            attn_output_weights = bsddmm_4b(row_indices, row_offsets, column_indices, q, k, vec_length, rhs_pre, scale_qkv*scale_qkv)
+            attn_output_weights = bsddmm_4b(row_indices, row_offsets, column_indices, q, k, vec_length, rhs_pre, scale_qk)
         if rhs_pre == 16:
-            attn_output_weights = bsddmm_16b(row_indices, row_offsets, column_indices, q, k, vec_length, rhs_pre, scale_qkv*scale_qkv)
+            attn_output_weights = bsddmm_16b(row_indices, row_offsets, column_indices, q, k, vec_length, rhs_pre, scale_qk)
 
     with nvtx.annotate("sp Softmax"):
         attn_output_weights = q_bcsr_softmax(row_indices, row_offsets, attn_output_weights, scaling, scale_sfmx, vec_length, batch_size, lhs_pre)
@@ -211,15 +232,15 @@ def sp_multi_head_attention_forward(
     # batch multiplication with the value
     with nvtx.annotate("sp AV"):
         if lhs_pre == 8 and rhs_pre == 8:
-            attn_output = bspmm_8b(row_indices, row_offsets, column_indices, attn_output_weights, v, vec_length, lhs_pre, rhs_pre, scale_qkv*scale_sfmx)
+            attn_output = bspmm_8b(row_indices, row_offsets, column_indices, attn_output_weights, v, vec_length, lhs_pre, rhs_pre, scale_av)
         if lhs_pre == 16 and rhs_pre == 8:
-            attn_output = bspmm_16b8b(row_indices, row_offsets, column_indices, attn_output_weights, v, vec_length, lhs_pre, rhs_pre, scale_qkv*scale_sfmx)
+            attn_output = bspmm_16b8b(row_indices, row_offsets, column_indices, attn_output_weights, v, vec_length, lhs_pre, rhs_pre, scale_av)
         if lhs_pre == 16 and rhs_pre == 16:
-            attn_output = bspmm_16b(row_indices, row_offsets, column_indices, attn_output_weights, v, vec_length, lhs_pre, rhs_pre, scale_qkv*scale_sfmx)
+            attn_output = bspmm_16b(row_indices, row_offsets, column_indices, attn_output_weights, v, vec_length, lhs_pre, rhs_pre, scale_av)
         if lhs_pre == 8 and rhs_pre == 4:
-            attn_output = bspmm_8b4b(row_indices, row_offsets, column_indices, attn_output_weights, v, vec_length, lhs_pre, rhs_pre, scale_qkv*scale_sfmx)
+            attn_output = bspmm_8b4b(row_indices, row_offsets, column_indices, attn_output_weights, v, vec_length, lhs_pre, rhs_pre, scale_av)
         if lhs_pre == 4 and rhs_pre == 4:
-            attn_output = bspmm_4b(row_indices, row_offsets, column_indices, attn_output_weights, v, vec_length, lhs_pre, rhs_pre, scale_qkv*scale_sfmx)
+            attn_output = bspmm_4b(row_indices, row_offsets, column_indices, attn_output_weights, v, vec_length, lhs_pre, rhs_pre, scale_av)
     
     # transpose the output and concatenate the heads
     with nvtx.annotate("sp Output transpose"):
@@ -239,10 +260,24 @@ def sp_multi_head_attention_forward(
 class spMultiheadAttention(torch.nn.MultiheadAttention):
     def __init__(self, embed_dim, num_heads, dropout=0., bias=True, add_bias_kv=False, add_zero_attn=False, kdim=None, vdim=None):
         super(spMultiheadAttention, self).__init__(embed_dim, num_heads, dropout, bias, add_bias_kv, add_zero_attn, kdim, vdim)
-    
+        # Per-head scales of q, k, v, see start_calibration; None for the
+        # fixed scale
+        self.qkv_scales = None
+        self.calibrators = None
+
+    def start_calibration(self, bits: int, method: str = 'absmax'):
+        # The following forward calls observe q, k and v; finish_calibration
+        # turns the observations into qkv_scales
+        self.calibrators = tuple(Calibrator(bits, method, 'head', self.num_heads) for _ in range(3))
+
+    def finish_calibration(self):
+        self.qkv_scales = tuple(c.scales().to(self.in_proj_weight.device) for c in self.calibrators)
+        self.calibrators = None
+
     def forward(self, query: torch.Tensor, key: torch.Tensor, value: torch.Tensor, key_padding_mask: Optional[torch.Tensor] = None,
                 need_weights: bool = True, row_indices: Optional[torch.Tensor] = None, row_offsets: Optional[torch.Tensor] = None,
-                column_indices: Optional[torch.Tensor] = None, vec_length: int = 2, lhs_pre: int = 8, rhs_pre: int = 8) -> Tuple[torch.Tensor, Optional[torch.Tensor]]:
+                column_indices: Optional[torch.Tensor] = None, vec_length: int = 2, lhs_pre: int = 8, rhs_pre: int = 8,
+                qkv_scales: Optional[Tuple[torch.Tensor, torch.Tensor, torch.Tensor]] = None) -> Tuple[torch.Tensor, Optional[torch.Tensor]]:
         return sp_multi_head_attention_forward(
             query, key, value, self.embed_dim, self.num_heads,
             self.in_proj_weight, self.in_proj_bias,
@@ -253,4 +288,6 @@ class spMultiheadAttention(torch.nn.MultiheadAttention):
             row_indices=row_indices, row_offsets=row_offsets, column_indices=column_indices,
             vec_length=vec_length,
             lhs_pre=lhs_pre,
-            rhs_pre=rhs_pre)
+            rhs_pre=rhs_pre,
+            qkv_scales=qkv_scales if qkv_scales is not None else self.qkv_scales,
+            calibrators=self.calibrators)
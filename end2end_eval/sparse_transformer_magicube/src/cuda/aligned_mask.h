@@ -0,0 +1,72 @@
+#ifndef ALIGNED_MASK_H
+#define ALIGNED_MASK_H
+#include <torch/extension.h>
+#include <ATen/Parallel.h>
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <tuple>
+#include <vector>
+
+// Padding of a CSR mask to the aligned layout of the deq_spmm and deq_sddmm
+// kernels, shared by sptrans.mask_builder and sptrans.sparse_mlp. The five
+// results are described in mask_builder.cpp.
+
+typedef std::tuple<torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor, int64_t> AlignedMask;
+
+// Rows per parallel_for task
+static const int64_t kGrainSize = 256;
+
+inline AlignedMask align_mask(const int64_t m, const int64_t *row_offsets, const int *column_indices, int64_t mma_k_dim){
+    TORCH_CHECK(mma_k_dim == 8 || mma_k_dim == 16 || mma_k_dim == 32, "mma_k_dim must be 8, 16 or 32");
+
+    // Padded row lengths, then their prefix sum
+    std::vector<int64_t> aligned_begin(m + 1, 0);
+    at::parallel_for(0, m, kGrainSize, [&](int64_t begin, int64_t end){
+        for(int64_t i = begin; i < end; i++){
+            const int64_t num_item = row_offsets[i+1] - row_offsets[i];
+            aligned_begin[i+1] = (num_item + mma_k_dim - 1) / mma_k_dim * mma_k_dim;
+        }
+    });
+    std::partial_sum(aligned_begin.begin(), aligned_begin.end(), aligned_begin.begin());
+    const int64_t aligned_num_item = aligned_begin[m];
+    TORCH_CHECK(aligned_num_item <= std::numeric_limits<int>::max(), "the aligned mask exceeds the int32 index range");
+
+    auto options = torch::TensorOptions().dtype(torch::kInt32);
+    torch::Tensor aligned_row_offsets = torch::empty({m * 2}, options);
+    torch::Tensor aligned_col_indices = torch::empty({aligned_num_item}, options);
+    torch::Tensor aligned_col_indices_shuffle = torch::empty({aligned_num_item}, options);
+    int *offsets_ptr = aligned_row_offsets.data_ptr<int>();
+    int *col_ptr = aligned_col_indices.data_ptr<int>();
+    int *shuffle_ptr = aligned_col_indices_shuffle.data_ptr<int>();
+
+    at::parallel_for(0, m, kGrainSize, [&](int64_t begin, int64_t end){
+        for(int64_t i = begin; i < end; i++){
+            const int64_t num_item = row_offsets[i+1] - row_offsets[i];
+            offsets_ptr[i*2] = static_cast<int>(aligned_begin[i]);
+            offsets_ptr[i*2+1] = static_cast<int>(aligned_begin[i] + num_item);
+            int *row = col_ptr + aligned_begin[i];
+            std::copy(column_indices + row_offsets[i], column_indices + row_offsets[i+1], row);
+            std::fill(row + num_item, col_ptr + aligned_begin[i+1], -1);
+        }
+    });
+
+    // aligned_num_item is a multiple of 8, so every chunk is full
+    at::parallel_for(0, aligned_num_item / 8, kGrainSize * 8, [&](int64_t begin, int64_t end){
+        for(int64_t i = begin; i < end; i++)
+            for(int j = 0; j < 8; j++)
+                shuffle_ptr[i*8 + (j%2)*4 + j/2] = col_ptr[i*8 + j];
+    });
+
+    // Rows by increasing length like np.argsort, ties kept in row order
+    torch::Tensor row_indices = torch::empty({m}, options);
+    int *row_indices_ptr = row_indices.data_ptr<int>();
+    std::iota(row_indices_ptr, row_indices_ptr + m, 0);
+    std::stable_sort(row_indices_ptr, row_indices_ptr + m, [&](int a, int b){
+        return row_offsets[a+1] - row_offsets[a] < row_offsets[b+1] - row_offsets[b];
+    });
+
+    return AlignedMask(aligned_col_indices, aligned_col_indices_shuffle, aligned_row_offsets, row_indices, aligned_num_item);
+}
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef BATCH_OFFSETS_H
+#define BATCH_OFFSETS_H
+#include <torch/extension.h>
+
+// Distinct masks per batch entry (sptrans.mask_builder.pack_masks): the
+// masks are concatenated, row_indices is {batch, m_vec}, row_offsets
+// {batch, m_vec * 2} and batch_offsets {batch + 1} holds the first vector of
+// every mask in the concatenated column_indices and values.
+
+// Checks the mask tensors of a batched op against batch_size and m_vec and
+// returns the device pointer of batch_offsets, or nullptr when it is
+// undefined (one mask shared by every entry).
+inline const int *batch_offsets_data(torch::Tensor batch_offsets, torch::Tensor row_indices, torch::Tensor row_offsets,
+                                     torch::Tensor column_indices, torch::Device device, int batch_size, int m_vec)
+{
+    if(!batch_offsets.defined())
+        return nullptr;
+    TORCH_CHECK(batch_offsets.scalar_type() == torch::kInt32, "batch offsets must be int32");
+    TORCH_CHECK(batch_offsets.device() == device, "batch offsets must be on ", device, ", got ", batch_offsets.device());
+    TORCH_CHECK(batch_offsets.is_contiguous(), "batch offsets must be contiguous");
+    TORCH_CHECK(batch_offsets.numel() == batch_size + 1, "batch offsets have ", batch_offsets.numel(),
+                " entries, expected batch + 1 = ", batch_size + 1);
+    for(const torch::Tensor *t : {&row_indices, &row_offsets, &column_indices}){
+        TORCH_CHECK(t->scalar_type() == torch::kInt32 && t->device() == device && t->is_contiguous(),
+                    "the mask tensors must be contiguous int32 tensors on ", device);
+    }
+    TORCH_CHECK(row_indices.numel() == static_cast<int64_t>(batch_size) * m_vec,
+                "row indices have ", row_indices.numel(), " entries, expected batch * m_vec = ", static_cast<int64_t>(batch_size) * m_vec);
+    TORCH_CHECK(row_offsets.numel() == static_cast<int64_t>(batch_size) * m_vec * 2,
+                "row offsets have ", row_offsets.numel(), " entries, expected batch * m_vec * 2 = ",
+                static_cast<int64_t>(batch_size) * m_vec * 2);
+    return batch_offsets.data_ptr<int>();
+}
+
+#endif
@@ -0,0 +1,182 @@
+#include <torch/extension.h>
+#include <ATen/Parallel.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+
+// Calibration of the quantization scales of sptrans.quantization. A
+// Calibrator observes representative batches of one tensor (q, k, v, ...)
+// and returns the scale tensor taken by the scale overloads of quantization
+// and bquantization:
+//
+//   granularity  "tensor"        {1, 1}
+//                "head"          {num_heads, 1}, batch entry i is head i % num_heads
+//                "channel"       {1, n}, one scale per column
+//                "head_channel"  {num_heads, n}
+//
+//   method       "absmax"        largest magnitude observed
+//                "percentile"    the given percentile of the magnitudes
+//                "mse"           threshold minimizing the squared error of the
+//                                kernels' clamp-and-truncate quantization
+//
+// Scales follow the kernels' convention, quantized = x * scale clamped to the
+// signed range of bits, so scale = (2^(bits-1) - 1) / threshold. The
+// dequantization scale of bsddmm / bspmm is the product of the scales of
+// their two operands.
+//
+// The magnitudes of every scale slot are kept in a histogram whose range
+// doubles whenever a larger value is observed, so any number of batches can
+// be observed in constant memory.
+
+class Calibrator{
+public:
+    Calibrator(int64_t bits, std::string method, std::string granularity, int64_t num_heads,
+               double percentile, int64_t num_candidates)
+        : bits_(bits), method_(method), percentile_(percentile), num_candidates_(num_candidates),
+          groups_(1), channels_(0), per_channel_(false){
+        TORCH_CHECK(bits == 4 || bits == 8, "bits must be 4 or 8, the precisions of quantization and bquantization");
+        TORCH_CHECK(method == "absmax" || method == "percentile" || method == "mse",
+                    "method must be absmax, percentile or mse");
+        TORCH_CHECK(granularity == "tensor" || granularity == "head" || granularity == "channel" ||
+                    granularity == "head_channel", "granularity must be tensor, head, channel or head_channel");
+        TORCH_CHECK(percentile > 0.0 && percentile <= 100.0, "percentile must be in (0, 100]");
+        TORCH_CHECK(num_candidates > 0, "num_candidates must be positive");
+        if(granularity == "head" || granularity == "head_channel"){
+            TORCH_CHECK(num_heads > 0, "num_heads must be positive");
+            groups_ = num_heads;
+        }
+        per_channel_ = granularity == "channel" || granularity == "head_channel";
+    }
+
+    // x is {m, n} or {batch, m, n} with batch = bsz * num_heads
+    void observe(torch::Tensor x){
+        TORCH_CHECK(x.dim() >= 2, "observe takes a matrix or a batch of matrices");
+        torch::Tensor a = x.detach().abs().reshape({-1, x.size(-2), x.size(-1)}).to(torch::kCPU, torch::kFloat32).contiguous();
+        const int64_t entries = a.size(0), rows = a.size(1), n = a.size(2);
+        const int64_t channels = per_channel_ ? n : 1;
+        if(slots_.empty()){
+            channels_ = channels;
+            slots_.resize(groups_ * channels_);
+        }
+        TORCH_CHECK(channels == channels_, "observed ", n, " columns, calibrated with ", channels_);
+        TORCH_CHECK(groups_ == 1 || entries % groups_ == 0, "the batch is not a multiple of num_heads");
+
+        const float *data = a.data_ptr<float>();
+        at::parallel_for(0, static_cast<int64_t>(slots_.size()), 1, [&](int64_t begin, int64_t end){
+            std::vector<float> values;
+            for(int64_t s = begin; s < end; s++){
+                const int64_t group = s / channels_, channel = s % channels_;
+                values.clear();
+                for(int64_t e = group; e < entries; e += groups_){
+                    const float *matrix = data + e * rows * n;
+                    for(int64_t r = 0; r < rows; r++){
+                        if(per_channel_) values.push_back(matrix[r * n + channel]);
+                        else values.insert(values.end(), matrix + r * n, matrix + (r + 1) * n);
+                    }
+                }
+                slots_[s].add(values);
+            }
+        });
+    }
+
+    // float32 {groups, channels} on the CPU; move it to the device of the input
+    torch::Tensor scales() const{
+        TORCH_CHECK(!slots_.empty(), "nothing observed yet");
+        torch::Tensor out = torch::empty({groups_, channels_}, torch::kFloat32);
+        float *out_ptr = out.data_ptr<float>();
+        const double qmax = (1 << (bits_ - 1)) - 1;
+        at::parallel_for(0, static_cast<int64_t>(slots_.size()), 1, [&](int64_t begin, int64_t end){
+            for(int64_t s = begin; s < end; s++){
+                const double threshold = this->threshold(slots_[s], qmax);
+                out_ptr[s] = threshold > 0.0 ? static_cast<float>(qmax / threshold) : 1.0f;
+            }
+        });
+        return out;
+    }
+
+    void reset(){ slots_.clear(); channels_ = 0; }
+
+private:
+    static const int kBins = 1024;
+
+    struct Histogram{
+        double range;
+        double max;
+        std::vector<double> bins;
+
+        Histogram(): range(0.0), max(0.0), bins(kBins, 0.0) {}
+
+        void add(const std::vector<float> &values){
+            double batch_max = 0.0;
+            for(size_t i = 0; i < values.size(); i++) batch_max = std::max(batch_max, static_cast<double>(values[i]));
+            if(range == 0.0) range = batch_max;
+            // Merge pairs of bins until the range covers the batch
+            while(batch_max > range){
+                for(int j = 0; j < kBins / 2; j++) bins[j] = bins[2*j] + bins[2*j+1];
+                std::fill(bins.begin() + kBins / 2, bins.end(), 0.0);
+                range *= 2.0;
+            }
+            max = std::max(max, batch_max);
+            const double scale = range > 0.0 ? kBins / range : 0.0;
+            for(size_t i = 0; i < values.size(); i++)
+                bins[std::min(kBins - 1, static_cast<int>(values[i] * scale))] += 1.0;
+        }
+    };
+
+    double threshold(const Histogram &h, double qmax) const{
+        if(h.max == 0.0 || method_ == "absmax") return h.max;
+        const double width = h.range / kBins;
+
+        if(method_ == "percentile"){
+            double total = 0.0;
+            for(int j = 0; j < kBins; j++) total += h.bins[j];
+            const double target = total * percentile_ / 100.0;
+            double seen = 0.0;
+            for(int j = 0; j < kBins; j++){
+                seen += h.bins[j];
+                if(seen >= target) return std::min(h.max, (j + 1) * width);
+            }
+            return h.max;
+        }
+
+        // mse: error of the bin centers under x -> min(trunc(x * s), qmax) / s
+        double best = h.max, best_error = std::numeric_limits<double>::max();
+        for(int64_t c = 1; c <= num_candidates_; c++){
+            const double t = h.max * c / num_candidates_;
+            const double s = qmax / t;
+            double error = 0.0;
+            for(int j = 0; j < kBins; j++){
+                if(h.bins[j] == 0.0) continue;
+                const double x = (j + 0.5) * width;
+                const double q = std::min(std::floor(x * s), qmax) / s;
+                error += h.bins[j] * (x - q) * (x - q);
+            }
+            if(error < best_error){
+                best_error = error;
+                best = t;
+            }
+        }
+        return best;
+    }
+
+    int64_t bits_;
+    std::string method_;
+    double percentile_;
+    int64_t num_candidates_;
+    int64_t groups_;
+    int64_t channels_;
+    bool per_channel_;
+    std::vector<Histogram> slots_;
+};
+
+PYBIND11_MODULE(TORCH_EXTENSION_NAME, m){
+    py::class_<Calibrator>(m, "Calibrator")
+        .def(py::init<int64_t, std::string, std::string, int64_t, double, int64_t>(),
+             py::arg("bits"), py::arg("method") = "absmax", py::arg("granularity") = "tensor",
+             py::arg("num_heads") = 1, py::arg("percentile") = 99.99, py::arg("num_candidates") = 100)
+        .def("observe", &Calibrator::observe, "Accumulate the magnitudes of a representative batch")
+        .def("scales", &Calibrator::scales, "Quantization scales of the observed batches")
+        .def("reset", &Calibrator::reset, "Forget the observed batches");
+}
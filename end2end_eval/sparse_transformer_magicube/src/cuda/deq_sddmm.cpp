@@ -8,7 +8,8 @@ torch::Tensor deq_sddmm_mma_4b(
     torch::Tensor rhs_matrix,
     int vec_length,
     int bits,
-    float scale);
+    float scale,
+    torch::Tensor out);
 
 torch::Tensor deq_sddmm_mma_8b(
     torch::Tensor row_indices,
@@ -18,7 +19,8 @@ torch::Tensor deq_sddmm_mma_8b(
     torch::Tensor rhs_matrix,
     int vec_length,
     int bits,
-    float scale);
+    float scale,
+    torch::Tensor out);
 
 torch::Tensor batched_deq_sddmm_mma_4b(
     torch::Tensor row_indices,
@@ -28,7 +30,10 @@ torch::Tensor batched_deq_sddmm_mma_4b(
     torch::Tensor rhs_matrix,
     int vec_length,
     int bits,
-    float scale);
+    float scale,
+    torch::Tensor batch_offsets,
+    torch::Tensor entry_scales,
+    torch::Tensor out);
 
 torch::Tensor batched_deq_sddmm_mma_8b(
     torch::Tensor row_indices,
@@ -38,7 +43,10 @@ torch::Tensor batched_deq_sddmm_mma_8b(
     torch::Tensor rhs_matrix,
     int vec_length,
     int bits,
-    float scale);
+    float scale,
+    torch::Tensor batch_offsets,
+    torch::Tensor entry_scales,
+    torch::Tensor out);
 
 torch::Tensor batched_deq_sddmm_mma_16b(
     torch::Tensor row_indices,
@@ -48,7 +56,10 @@ torch::Tensor batched_deq_sddmm_mma_16b(
     torch::Tensor rhs_matrix,
     int vec_length,
     int bits,
-    float scale);
+    float scale,
+    torch::Tensor batch_offsets,
+    torch::Tensor entry_scales,
+    torch::Tensor out);
 
 torch::Tensor sddmm_4b(
     torch::Tensor row_indices,
@@ -60,7 +71,7 @@ torch::Tensor sddmm_4b(
     int bits,
     float scale)
 {
-    return deq_sddmm_mma_4b(row_indices, row_offsets, column_indices, lhs_matrix, rhs_matrix, vec_length, bits, scale);
+    return deq_sddmm_mma_4b(row_indices, row_offsets, column_indices, lhs_matrix, rhs_matrix, vec_length, bits, scale, torch::Tensor());
 }
 
 torch::Tensor bsddmm_4b(
@@ -73,7 +84,7 @@ torch::Tensor bsddmm_4b(
     int bits,
     float scale)
 {
-    return batched_deq_sddmm_mma_4b(row_indices, row_offsets, column_indices, lhs_matrix, rhs_matrix, vec_length, bits, scale);
+    return batched_deq_sddmm_mma_4b(row_indices, row_offsets, column_indices, lhs_matrix, rhs_matrix, vec_length, bits, scale, torch::Tensor(), torch::Tensor(), torch::Tensor());
 }
 
 torch::Tensor sddmm_8b(
@@ -86,7 +97,7 @@ torch::Tensor sddmm_8b(
     int bits,
     float scale)
 {
-    return deq_sddmm_mma_8b(row_indices, row_offsets, column_indices, lhs_matrix, rhs_matrix, vec_length, bits, scale);
+    return deq_sddmm_mma_8b(row_indices, row_offsets, column_indices, lhs_matrix, rhs_matrix, vec_length, bits, scale, torch::Tensor());
 }
 
 torch::Tensor bsddmm_16b(
@@ -99,7 +110,7 @@ torch::Tensor bsddmm_16b(
     int bits,
     float scale)
 {
-    return batched_deq_sddmm_mma_16b(row_indices, row_offsets, column_indices, lhs_matrix, rhs_matrix, vec_length, bits, scale);
+    return batched_deq_sddmm_mma_16b(row_indices, row_offsets, column_indices, lhs_matrix, rhs_matrix, vec_length, bits, scale, torch::Tensor(), torch::Tensor(), torch::Tensor());
 }
 
 torch::Tensor bsddmm_8b(
@@ -112,13 +123,278 @@ torch::Tensor bsddmm_8b(
     int bits,
     float scale)
 {
-    return batched_deq_sddmm_mma_8b(row_indices, row_offsets, column_indices, lhs_matrix, rhs_matrix, vec_length, bits, scale);
+    return batched_deq_sddmm_mma_8b(row_indices, row_offsets, column_indices, lhs_matrix, rhs_matrix, vec_length, bits, scale, torch::Tensor(), torch::Tensor(), torch::Tensor());
+}
+
+// Batched SDDMM with a distinct mask per entry, as packed by
+// sptrans.mask_builder.pack_masks: row_indices is {batch, m_vec}, row_offsets
+// {batch, m_vec * 2}, column_indices is the concatenation of the masks and
+// batch_offsets {batch + 1} the first vector of every mask. The output values
+// are concatenated the same way.
+torch::Tensor bsddmm_4b_masks(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor batch_offsets,
+    torch::Tensor lhs_matrix,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits,
+    float scale)
+{
+    return batched_deq_sddmm_mma_4b(row_indices, row_offsets, column_indices, lhs_matrix, rhs_matrix, vec_length, bits, scale, batch_offsets, torch::Tensor(), torch::Tensor());
+}
+
+torch::Tensor bsddmm_8b_masks(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor batch_offsets,
+    torch::Tensor lhs_matrix,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits,
+    float scale)
+{
+    return batched_deq_sddmm_mma_8b(row_indices, row_offsets, column_indices, lhs_matrix, rhs_matrix, vec_length, bits, scale, batch_offsets, torch::Tensor(), torch::Tensor());
+}
+
+torch::Tensor bsddmm_16b_masks(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor batch_offsets,
+    torch::Tensor lhs_matrix,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits,
+    float scale)
+{
+    return batched_deq_sddmm_mma_16b(row_indices, row_offsets, column_indices, lhs_matrix, rhs_matrix, vec_length, bits, scale, batch_offsets, torch::Tensor(), torch::Tensor());
+}
+
+// out= variants: the values are written to out, a preallocated half tensor
+// of the shape the op returns, which is also returned.
+torch::Tensor sddmm_4b_out(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor lhs_matrix,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits,
+    float scale,
+    torch::Tensor out)
+{
+    return deq_sddmm_mma_4b(row_indices, row_offsets, column_indices, lhs_matrix, rhs_matrix, vec_length, bits, scale, out);
+}
+
+torch::Tensor sddmm_8b_out(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor lhs_matrix,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits,
+    float scale,
+    torch::Tensor out)
+{
+    return deq_sddmm_mma_8b(row_indices, row_offsets, column_indices, lhs_matrix, rhs_matrix, vec_length, bits, scale, out);
+}
+
+torch::Tensor bsddmm_4b_out(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor lhs_matrix,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits,
+    float scale,
+    torch::Tensor out)
+{
+    return batched_deq_sddmm_mma_4b(row_indices, row_offsets, column_indices, lhs_matrix, rhs_matrix, vec_length, bits, scale, torch::Tensor(), torch::Tensor(), out);
+}
+
+torch::Tensor bsddmm_8b_out(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor lhs_matrix,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits,
+    float scale,
+    torch::Tensor out)
+{
+    return batched_deq_sddmm_mma_8b(row_indices, row_offsets, column_indices, lhs_matrix, rhs_matrix, vec_length, bits, scale, torch::Tensor(), torch::Tensor(), out);
+}
+
+torch::Tensor bsddmm_16b_out(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor lhs_matrix,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits,
+    float scale,
+    torch::Tensor out)
+{
+    return batched_deq_sddmm_mma_16b(row_indices, row_offsets, column_indices, lhs_matrix, rhs_matrix, vec_length, bits, scale, torch::Tensor(), torch::Tensor(), out);
+}
+
+torch::Tensor bsddmm_4b_masks_out(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor batch_offsets,
+    torch::Tensor lhs_matrix,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits,
+    float scale,
+    torch::Tensor out)
+{
+    return batched_deq_sddmm_mma_4b(row_indices, row_offsets, column_indices, lhs_matrix, rhs_matrix, vec_length, bits, scale, batch_offsets, torch::Tensor(), out);
+}
+
+torch::Tensor bsddmm_8b_masks_out(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor batch_offsets,
+    torch::Tensor lhs_matrix,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits,
+    float scale,
+    torch::Tensor out)
+{
+    return batched_deq_sddmm_mma_8b(row_indices, row_offsets, column_indices, lhs_matrix, rhs_matrix, vec_length, bits, scale, batch_offsets, torch::Tensor(), out);
+}
+
+torch::Tensor bsddmm_16b_masks_out(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor batch_offsets,
+    torch::Tensor lhs_matrix,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits,
+    float scale,
+    torch::Tensor out)
+{
+    return batched_deq_sddmm_mma_16b(row_indices, row_offsets, column_indices, lhs_matrix, rhs_matrix, vec_length, bits, scale, batch_offsets, torch::Tensor(), out);
+}
+
+// Overloads with a tensor of per-entry dequantization scales in place of
+// the scalar scale: entry i of the batch uses entry_scales[i % numel], e.g.
+// the product of the per-head scales of q and k.
+torch::Tensor bsddmm_4b_scales(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor lhs_matrix,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits,
+    torch::Tensor entry_scales)
+{
+    return batched_deq_sddmm_mma_4b(row_indices, row_offsets, column_indices, lhs_matrix, rhs_matrix, vec_length, bits, 1.0f, torch::Tensor(), entry_scales, torch::Tensor());
+}
+
+torch::Tensor bsddmm_4b_scales_out(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor lhs_matrix,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits,
+    torch::Tensor entry_scales,
+    torch::Tensor out)
+{
+    return batched_deq_sddmm_mma_4b(row_indices, row_offsets, column_indices, lhs_matrix, rhs_matrix, vec_length, bits, 1.0f, torch::Tensor(), entry_scales, out);
+}
+
+torch::Tensor bsddmm_8b_scales(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor lhs_matrix,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits,
+    torch::Tensor entry_scales)
+{
+    return batched_deq_sddmm_mma_8b(row_indices, row_offsets, column_indices, lhs_matrix, rhs_matrix, vec_length, bits, 1.0f, torch::Tensor(), entry_scales, torch::Tensor());
+}
+
+torch::Tensor bsddmm_8b_scales_out(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor lhs_matrix,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits,
+    torch::Tensor entry_scales,
+    torch::Tensor out)
+{
+    return batched_deq_sddmm_mma_8b(row_indices, row_offsets, column_indices, lhs_matrix, rhs_matrix, vec_length, bits, 1.0f, torch::Tensor(), entry_scales, out);
+}
+
+torch::Tensor bsddmm_16b_scales(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor lhs_matrix,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits,
+    torch::Tensor entry_scales)
+{
+    return batched_deq_sddmm_mma_16b(row_indices, row_offsets, column_indices, lhs_matrix, rhs_matrix, vec_length, bits, 1.0f, torch::Tensor(), entry_scales, torch::Tensor());
+}
+
+torch::Tensor bsddmm_16b_scales_out(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor lhs_matrix,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits,
+    torch::Tensor entry_scales,
+    torch::Tensor out)
+{
+    return batched_deq_sddmm_mma_16b(row_indices, row_offsets, column_indices, lhs_matrix, rhs_matrix, vec_length, bits, 1.0f, torch::Tensor(), entry_scales, out);
 }
 
 PYBIND11_MODULE(TORCH_EXTENSION_NAME, m){
     m.def("sddmm_4b", &sddmm_4b, "Custom SDDMM kernel with 4-bit inputs");
     m.def("sddmm_8b", &sddmm_8b, "Custom SDDMM kernel with 8-bit inputs");
     m.def("bsddmm_4b", &bsddmm_4b, "Custom batched SDDMM kernel with 4-bit inputs");
+    m.def("bsddmm_4b", &bsddmm_4b_scales, "Custom batched SDDMM kernel with 4-bit inputs and per-entry scales");
     m.def("bsddmm_8b", &bsddmm_8b, "Custom batched SDDMM kernel with 8-bit inputs");
+    m.def("bsddmm_8b", &bsddmm_8b_scales, "Custom batched SDDMM kernel with 8-bit inputs and per-entry scales");
     m.def("bsddmm_16b", &bsddmm_16b, "Custom batched SDDMM kernel with 16-bit inputs");
+    m.def("bsddmm_16b", &bsddmm_16b_scales, "Custom batched SDDMM kernel with 16-bit inputs and per-entry scales");
+    m.def("bsddmm_4b_masks", &bsddmm_4b_masks, "Custom batched SDDMM kernel with 4-bit inputs and a mask per entry");
+    m.def("bsddmm_8b_masks", &bsddmm_8b_masks, "Custom batched SDDMM kernel with 8-bit inputs and a mask per entry");
+    m.def("bsddmm_16b_masks", &bsddmm_16b_masks, "Custom batched SDDMM kernel with 16-bit inputs and a mask per entry");
+    m.def("sddmm_4b_out", &sddmm_4b_out, "Custom SDDMM kernel with 4-bit inputs writing to out");
+    m.def("sddmm_8b_out", &sddmm_8b_out, "Custom SDDMM kernel with 8-bit inputs writing to out");
+    m.def("bsddmm_4b_out", &bsddmm_4b_out, "Custom batched SDDMM kernel with 4-bit inputs writing to out");
+    m.def("bsddmm_4b_out", &bsddmm_4b_scales_out, "Custom batched SDDMM kernel with 4-bit inputs and per-entry scales writing to out");
+    m.def("bsddmm_8b_out", &bsddmm_8b_out, "Custom batched SDDMM kernel with 8-bit inputs writing to out");
+    m.def("bsddmm_8b_out", &bsddmm_8b_scales_out, "Custom batched SDDMM kernel with 8-bit inputs and per-entry scales writing to out");
+    m.def("bsddmm_16b_out", &bsddmm_16b_out, "Custom batched SDDMM kernel with 16-bit inputs writing to out");
+    m.def("bsddmm_16b_out", &bsddmm_16b_scales_out, "Custom batched SDDMM kernel with 16-bit inputs and per-entry scales writing to out");
+    m.def("bsddmm_4b_masks_out", &bsddmm_4b_masks_out, "Custom batched SDDMM kernel with 4-bit inputs and a mask per entry writing to out");
+    m.def("bsddmm_8b_masks_out", &bsddmm_8b_masks_out, "Custom batched SDDMM kernel with 8-bit inputs and a mask per entry writing to out");
+    m.def("bsddmm_16b_masks_out", &bsddmm_16b_masks_out, "Custom batched SDDMM kernel with 16-bit inputs and a mask per entry writing to out");
 }
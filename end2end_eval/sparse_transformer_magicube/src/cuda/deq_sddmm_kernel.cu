@@ -8,6 +8,10 @@
 #include <cuda.h>
 #include "cuda_fp16.h"
 #include <torch/extension.h>
+#include <c10/cuda/CUDAStream.h>
+#include "output_buffer.h"
+#include "scale_tensor.h"
+#include "batch_offsets.h"
 #include <cuda_runtime.h>
 #include <cmath>
 
@@ -404,12 +408,27 @@ __global__ void batched_wmmaSddmm_kernel_4b(int m_vec, int n, int k,
     const int* __restrict__ rhs_matrix_b,
     int rhs_stride,
     half* __restrict__ output_values_b,
-    int output_stride){
+    int output_stride,
+    const int* __restrict__ batch_offsets,
+    const float* __restrict__ entry_scales,
+    int num_entry_scales){
 
     int entry_idx = blockIdx.z;
     const int* lhs_matrix = lhs_matrix_b + entry_idx * lhs_stride;
     const int* rhs_matrix = rhs_matrix_b + entry_idx * rhs_stride;
     half* output_values = output_values_b + entry_idx * output_stride;
+    if(batch_offsets != nullptr){
+        // Distinct mask per entry, see batched_deq_sddmm_mma_*
+        int mask_offset = __ldg(batch_offsets + entry_idx);
+        output_values = output_values_b + mask_offset * output_stride;
+        column_indices += mask_offset;
+        row_indices += entry_idx * m_vec;
+        row_offsets += entry_idx * m_vec * 2;
+    }
+    if(entry_scales != nullptr){
+        // Per-entry dequantization, e.g. one scale per head
+        scale *= __ldg(entry_scales + entry_idx % num_entry_scales);
+    }
 
     wmmaSddmm_kernel_4b_<Tile_K, Tile_N, VecLength>(m_vec, n, k, 
     scale,
@@ -454,12 +473,27 @@ __global__ void batched_wmmaSddmm_kernel_8b(int m_vec, int n, int k,
     const int* __restrict__ rhs_matrix_b,
     int rhs_stride,
     half* __restrict__ output_values_b,
-    int output_stride){
+    int output_stride,
+    const int* __restrict__ batch_offsets,
+    const float* __restrict__ entry_scales,
+    int num_entry_scales){
 
     int entry_idx = blockIdx.z;
     const int* lhs_matrix = lhs_matrix_b + entry_idx * lhs_stride;
     const int* rhs_matrix = rhs_matrix_b + entry_idx * rhs_stride;
     half* output_values = output_values_b + entry_idx * output_stride;
+    if(batch_offsets != nullptr){
+        // Distinct mask per entry, see batched_deq_sddmm_mma_*
+        int mask_offset = __ldg(batch_offsets + entry_idx);
+        output_values = output_values_b + mask_offset * output_stride;
+        column_indices += mask_offset;
+        row_indices += entry_idx * m_vec;
+        row_offsets += entry_idx * m_vec * 2;
+    }
+    if(entry_scales != nullptr){
+        // Per-entry dequantization, e.g. one scale per head
+        scale *= __ldg(entry_scales + entry_idx % num_entry_scales);
+    }
 
     wmmaSddmm_kernel_8b_<Tile_K, Tile_N, VecLength>(m_vec, n, k, 
     scale,
@@ -482,12 +516,27 @@ __global__ void batched_wmmaSddmm_kernel_16b(int m_vec, int n, int k,
     const int* __restrict__ rhs_matrix_b,
     int rhs_stride,
     half* __restrict__ output_values_b,
-    int output_stride){
+    int output_stride,
+    const int* __restrict__ batch_offsets,
+    const float* __restrict__ entry_scales,
+    int num_entry_scales){
 
     int entry_idx = blockIdx.z;
     const int* lhs_matrix = lhs_matrix_b + entry_idx * lhs_stride;
     const int* rhs_matrix = rhs_matrix_b + entry_idx * rhs_stride;
     half* output_values = output_values_b + entry_idx * output_stride;
+    if(batch_offsets != nullptr){
+        // Distinct mask per entry, see batched_deq_sddmm_mma_*
+        int mask_offset = __ldg(batch_offsets + entry_idx);
+        output_values = output_values_b + mask_offset * output_stride;
+        column_indices += mask_offset;
+        row_indices += entry_idx * m_vec;
+        row_offsets += entry_idx * m_vec * 2;
+    }
+    if(entry_scales != nullptr){
+        // Per-entry dequantization, e.g. one scale per head
+        scale *= __ldg(entry_scales + entry_idx % num_entry_scales);
+    }
 
     wmmaSddmm_kernel_16b_<Tile_K, Tile_N, VecLength>(m_vec, n, k, 
     scale,
@@ -514,7 +563,7 @@ cudaError_t wmmaSddmm_4b_template(
 {
     dim3 grid_dim(ceil(static_cast<float>(m_vec) / Tile_M), ceil(static_cast<float>(n) / Tile_N), 1);
     dim3 block_dim(WarpWidth * Warps, Tile_M, 1);
-    wmmaSddmm_kernel_4b<Tile_K, Tile_N, VecLength><<<grid_dim, block_dim>>>(
+    wmmaSddmm_kernel_4b<Tile_K, Tile_N, VecLength><<<grid_dim, block_dim, 0, c10::cuda::getCurrentCUDAStream()>>>(
         m_vec, n, k, scale, row_indices, row_offsets, column_indices, lhs_matrix, rhs_matrix, output_values);
     return cudaGetLastError();
 }
@@ -534,12 +583,15 @@ cudaError_t batched_wmmaSddmm_4b_template(
     const int* __restrict__ rhs_matrix_b,
     int rhs_stride,
     half* __restrict__ output_values_b,
-    int output_stride)
+    int output_stride,
+    const int* __restrict__ batch_offsets,
+    const float* __restrict__ entry_scales,
+    int num_entry_scales)
 {
     dim3 grid_dim(ceil(static_cast<float>(m_vec) / Tile_M), ceil(static_cast<float>(n) / Tile_N), batch_size);
     dim3 block_dim(WarpWidth * Warps, Tile_M, 1);
-    batched_wmmaSddmm_kernel_4b<Tile_K, Tile_N, VecLength><<<grid_dim, block_dim>>>(
-        m_vec, n, k, scale, row_indices, row_offsets, column_indices, lhs_matrix_b, lhs_stride, rhs_matrix_b, rhs_stride, output_values_b, output_stride);
+    batched_wmmaSddmm_kernel_4b<Tile_K, Tile_N, VecLength><<<grid_dim, block_dim, 0, c10::cuda::getCurrentCUDAStream()>>>(
+        m_vec, n, k, scale, row_indices, row_offsets, column_indices, lhs_matrix_b, lhs_stride, rhs_matrix_b, rhs_stride, output_values_b, output_stride, batch_offsets, entry_scales, num_entry_scales);
     return cudaGetLastError();
 }
 
@@ -558,7 +610,7 @@ cudaError_t wmmaSddmm_8b_template(
 {
     dim3 grid_dim(ceil(static_cast<float>(m_vec) / Tile_M), ceil(static_cast<float>(n) / Tile_N), 1);
     dim3 block_dim(WarpWidth * Warps, Tile_M, 1);
-    wmmaSddmm_kernel_8b<Tile_K, Tile_N, VecLength><<<grid_dim, block_dim>>>(
+    wmmaSddmm_kernel_8b<Tile_K, Tile_N, VecLength><<<grid_dim, block_dim, 0, c10::cuda::getCurrentCUDAStream()>>>(
         m_vec, n, k, scale, row_indices, row_offsets, column_indices, lhs_matrix, rhs_matrix, output_values);
     return cudaGetLastError();
 }
@@ -577,12 +629,15 @@ cudaError_t batched_wmmaSddmm_8b_template(
     const int* __restrict__ rhs_matrix_b,
     int rhs_stride,
     half* __restrict__ output_values_b,
-    int output_stride)
+    int output_stride,
+    const int* __restrict__ batch_offsets,
+    const float* __restrict__ entry_scales,
+    int num_entry_scales)
 {
     dim3 grid_dim(ceil(static_cast<float>(m_vec) / Tile_M), ceil(static_cast<float>(n) / Tile_N), batch_size);
     dim3 block_dim(WarpWidth * Warps, Tile_M, 1);
-    batched_wmmaSddmm_kernel_8b<Tile_K, Tile_N, VecLength><<<grid_dim, block_dim>>>(
-        m_vec, n, k, scale, row_indices, row_offsets, column_indices, lhs_matrix_b, lhs_stride, rhs_matrix_b, rhs_stride, output_values_b, output_stride);
+    batched_wmmaSddmm_kernel_8b<Tile_K, Tile_N, VecLength><<<grid_dim, block_dim, 0, c10::cuda::getCurrentCUDAStream()>>>(
+        m_vec, n, k, scale, row_indices, row_offsets, column_indices, lhs_matrix_b, lhs_stride, rhs_matrix_b, rhs_stride, output_values_b, output_stride, batch_offsets, entry_scales, num_entry_scales);
     return cudaGetLastError();
 }
 
@@ -599,12 +654,15 @@ cudaError_t batched_wmmaSddmm_16b_template(
     const int* __restrict__ rhs_matrix_b,
     int rhs_stride,
     half* __restrict__ output_values_b,
-    int output_stride)
+    int output_stride,
+    const int* __restrict__ batch_offsets,
+    const float* __restrict__ entry_scales,
+    int num_entry_scales)
 {
     dim3 grid_dim(ceil(static_cast<float>(m_vec) / Tile_M), ceil(static_cast<float>(n) / Tile_N), batch_size);
     dim3 block_dim(WarpWidth * Warps, Tile_M, 1);
-    batched_wmmaSddmm_kernel_16b<Tile_K, Tile_N, VecLength><<<grid_dim, block_dim>>>(
-        m_vec, n, k, scale, row_indices, row_offsets, column_indices, lhs_matrix_b, lhs_stride, rhs_matrix_b, rhs_stride, output_values_b, output_stride);
+    batched_wmmaSddmm_kernel_16b<Tile_K, Tile_N, VecLength><<<grid_dim, block_dim, 0, c10::cuda::getCurrentCUDAStream()>>>(
+        m_vec, n, k, scale, row_indices, row_offsets, column_indices, lhs_matrix_b, lhs_stride, rhs_matrix_b, rhs_stride, output_values_b, output_stride, batch_offsets, entry_scales, num_entry_scales);
     return cudaGetLastError();
 }
 
@@ -619,7 +677,10 @@ torch::Tensor batched_deq_sddmm_mma_8b(
     torch::Tensor rhs_matrix,
     int vec_length,
     int bits,
-    float scale)
+    float scale,
+    torch::Tensor batch_offsets,
+    torch::Tensor entry_scales,
+    torch::Tensor out)
 {
     //lhs shape {batch, m, k}
     //rhs shape {batch, n, k}
@@ -641,9 +702,23 @@ torch::Tensor batched_deq_sddmm_mma_8b(
     int rhs_stride = n * k_int32;
     int output_stride = nnz * vec_length;
 
+    // With distinct masks per entry, row_indices is {batch, m_vec},
+    // row_offsets {batch, m_vec * 2}, and batch_offsets {batch + 1} holds the
+    // first vector of every mask in the concatenated column_indices. The
+    // output values are concatenated the same way.
+    const int* batch_offsets_ptr = nullptr;
+    if(batch_offsets.defined()){
+        batch_offsets_ptr = batch_offsets_data(batch_offsets, row_indices, row_offsets, column_indices, lhs_matrix.device(), batch_size, m_vec);
+        output_stride = vec_length;
+    }
+
+    int num_entry_scales;
+    const float* entry_scales_ptr = entry_scales_data(entry_scales, lhs_matrix.device(), &num_entry_scales);
+
     auto options = torch::TensorOptions().dtype(torch::kFloat16).device(lhs_matrix.device());
 
-    auto output_vals = torch::empty({batch_size, nnz * vec_length, }, options);
+    auto output_vals = batch_offsets.defined() ? output_buffer(out, {nnz * vec_length, }, options, "bsddmm")
+                                               : output_buffer(out, {batch_size, nnz * vec_length, }, options, "bsddmm");
 
     switch(vec_length){
         case 2:
@@ -654,7 +729,7 @@ torch::Tensor batched_deq_sddmm_mma_8b(
                 reinterpret_cast<int *>(rhs_matrix.data_ptr<int>()),  
                 rhs_stride, 
                 reinterpret_cast<half *>(output_vals.data_ptr<torch::Half>()), 
-                output_stride);
+                output_stride, batch_offsets_ptr, entry_scales_ptr, num_entry_scales);
             break;
         case 4:
             batched_wmmaSddmm_8b_template<1, 64, 64, 32, 8, 4>(m_vec, n, k, batch_size, scale,
@@ -664,7 +739,7 @@ torch::Tensor batched_deq_sddmm_mma_8b(
                 reinterpret_cast<int *>(rhs_matrix.data_ptr<int>()),  
                 rhs_stride, 
                 reinterpret_cast<half *>(output_vals.data_ptr<torch::Half>()), 
-                output_stride);                
+                output_stride, batch_offsets_ptr, entry_scales_ptr, num_entry_scales);                
             break;
         case 8:
             batched_wmmaSddmm_8b_template<1, 64, 64, 32, 8, 8>(m_vec, n, k, batch_size, scale,
@@ -674,7 +749,7 @@ torch::Tensor batched_deq_sddmm_mma_8b(
                 reinterpret_cast<int *>(rhs_matrix.data_ptr<int>()),  
                 rhs_stride, 
                 reinterpret_cast<half *>(output_vals.data_ptr<torch::Half>()), 
-                output_stride);   
+                output_stride, batch_offsets_ptr, entry_scales_ptr, num_entry_scales);   
             break;
         default:
             printf("Unsupported Vector Length!\n");
@@ -692,7 +767,10 @@ torch::Tensor batched_deq_sddmm_mma_16b(
     torch::Tensor rhs_matrix,
     int vec_length,
     int bits,
-    float scale)
+    float scale,
+    torch::Tensor batch_offsets,
+    torch::Tensor entry_scales,
+    torch::Tensor out)
 {
     //lhs shape {batch, m, k}
     //rhs shape {batch, n, k}
@@ -711,9 +789,23 @@ torch::Tensor batched_deq_sddmm_mma_16b(
     int rhs_stride = n * k_int32;
     int output_stride = nnz * vec_length;
 
+    // With distinct masks per entry, row_indices is {batch, m_vec},
+    // row_offsets {batch, m_vec * 2}, and batch_offsets {batch + 1} holds the
+    // first vector of every mask in the concatenated column_indices. The
+    // output values are concatenated the same way.
+    const int* batch_offsets_ptr = nullptr;
+    if(batch_offsets.defined()){
+        batch_offsets_ptr = batch_offsets_data(batch_offsets, row_indices, row_offsets, column_indices, lhs_matrix.device(), batch_size, m_vec);
+        output_stride = vec_length;
+    }
+
+    int num_entry_scales;
+    const float* entry_scales_ptr = entry_scales_data(entry_scales, lhs_matrix.device(), &num_entry_scales);
+
     auto options = torch::TensorOptions().dtype(torch::kFloat16).device(lhs_matrix.device());
 
-    auto output_vals = torch::empty({batch_size, nnz * vec_length, }, options);
+    auto output_vals = batch_offsets.defined() ? output_buffer(out, {nnz * vec_length, }, options, "bsddmm")
+                                               : output_buffer(out, {batch_size, nnz * vec_length, }, options, "bsddmm");
 
     switch(vec_length){
         case 2:
@@ -724,7 +816,7 @@ torch::Tensor batched_deq_sddmm_mma_16b(
                 reinterpret_cast<int *>(rhs_matrix.data_ptr<int>()),  
                 rhs_stride, 
                 reinterpret_cast<half *>(output_vals.data_ptr<torch::Half>()), 
-                output_stride);
+                output_stride, batch_offsets_ptr, entry_scales_ptr, num_entry_scales);
             break;
         case 4:
             batched_wmmaSddmm_16b_template<1, 64, 64, 32, 8, 4>(m_vec, n, k, batch_size, scale,
@@ -734,7 +826,7 @@ torch::Tensor batched_deq_sddmm_mma_16b(
                 reinterpret_cast<int *>(rhs_matrix.data_ptr<int>()),  
                 rhs_stride, 
                 reinterpret_cast<half *>(output_vals.data_ptr<torch::Half>()), 
-                output_stride);                
+                output_stride, batch_offsets_ptr, entry_scales_ptr, num_entry_scales);                
             break;
         case 8:
             batched_wmmaSddmm_16b_template<1, 32, 64, 32, 8, 8>(m_vec, n, k, batch_size, scale,
@@ -744,7 +836,7 @@ torch::Tensor batched_deq_sddmm_mma_16b(
                 reinterpret_cast<int *>(rhs_matrix.data_ptr<int>()),  
                 rhs_stride, 
                 reinterpret_cast<half *>(output_vals.data_ptr<torch::Half>()), 
-                output_stride);   
+                output_stride, batch_offsets_ptr, entry_scales_ptr, num_entry_scales);   
             break;
         default:
             printf("Unsupported Vector Length!\n");
@@ -763,7 +855,8 @@ torch::Tensor deq_sddmm_mma_8b(
     torch::Tensor rhs_matrix,
     int vec_length,
     int bits,
-    float scale)
+    float scale,
+    torch::Tensor out)
 {
     //lhs shape {m, k}
     //rhs shape {n, k}
@@ -781,7 +874,7 @@ torch::Tensor deq_sddmm_mma_8b(
 
     auto options = torch::TensorOptions().dtype(torch::kFloat16).device(lhs_matrix.device());
 
-    auto output_vals = torch::empty({nnz * vec_length, }, options);
+    auto output_vals = output_buffer(out, {nnz * vec_length, }, options, "sddmm");
 
     switch(vec_length){
         case 2:
@@ -821,7 +914,10 @@ torch::Tensor batched_deq_sddmm_mma_4b(
     torch::Tensor rhs_matrix,
     int vec_length,
     int bits,
-    float scale)
+    float scale,
+    torch::Tensor batch_offsets,
+    torch::Tensor entry_scales,
+    torch::Tensor out)
 {
     //lhs shape {batch, m, k}
     //rhs shape {batch, n, k}
@@ -845,9 +941,23 @@ torch::Tensor batched_deq_sddmm_mma_4b(
     int rhs_stride = n * k_int32;
     int output_stride = nnz * vec_length;
 
+    // With distinct masks per entry, row_indices is {batch, m_vec},
+    // row_offsets {batch, m_vec * 2}, and batch_offsets {batch + 1} holds the
+    // first vector of every mask in the concatenated column_indices. The
+    // output values are concatenated the same way.
+    const int* batch_offsets_ptr = nullptr;
+    if(batch_offsets.defined()){
+        batch_offsets_ptr = batch_offsets_data(batch_offsets, row_indices, row_offsets, column_indices, lhs_matrix.device(), batch_size, m_vec);
+        output_stride = vec_length;
+    }
+
+    int num_entry_scales;
+    const float* entry_scales_ptr = entry_scales_data(entry_scales, lhs_matrix.device(), &num_entry_scales);
+
     auto options = torch::TensorOptions().dtype(torch::kFloat16).device(lhs_matrix.device());
 
-    auto output_vals = torch::empty({batch_size, nnz * vec_length, }, options);
+    auto output_vals = batch_offsets.defined() ? output_buffer(out, {nnz * vec_length, }, options, "bsddmm")
+                                               : output_buffer(out, {batch_size, nnz * vec_length, }, options, "bsddmm");
 
     switch(vec_length){
         case 2:
@@ -858,7 +968,7 @@ torch::Tensor batched_deq_sddmm_mma_4b(
                 reinterpret_cast<int *>(rhs_matrix.data_ptr<int>()),  
                 rhs_stride, 
                 reinterpret_cast<half *>(output_vals.data_ptr<torch::Half>()), 
-                output_stride);
+                output_stride, batch_offsets_ptr, entry_scales_ptr, num_entry_scales);
             break;
         case 4:
             batched_wmmaSddmm_4b_template<1, 64, 64, 32, 8, 4>(m_vec, n, k, batch_size, scale,
@@ -868,7 +978,7 @@ torch::Tensor batched_deq_sddmm_mma_4b(
                 reinterpret_cast<int *>(rhs_matrix.data_ptr<int>()),  
                 rhs_stride, 
                 reinterpret_cast<half *>(output_vals.data_ptr<torch::Half>()), 
-                output_stride);                
+                output_stride, batch_offsets_ptr, entry_scales_ptr, num_entry_scales);                
             break;
         case 8:
             batched_wmmaSddmm_4b_template<1, 64, 64, 32, 8, 8>(m_vec, n, k, batch_size, scale,
@@ -878,7 +988,7 @@ torch::Tensor batched_deq_sddmm_mma_4b(
                 reinterpret_cast<int *>(rhs_matrix.data_ptr<int>()),  
                 rhs_stride, 
                 reinterpret_cast<half *>(output_vals.data_ptr<torch::Half>()), 
-                output_stride);   
+                output_stride, batch_offsets_ptr, entry_scales_ptr, num_entry_scales);   
             break;
         default:
             printf("Unsupported Vector Length!\n");
@@ -896,7 +1006,8 @@ torch::Tensor deq_sddmm_mma_4b(
     torch::Tensor rhs_matrix,
     int vec_length,
     int bits,
-    float scale)
+    float scale,
+    torch::Tensor out)
 {
     //lhs shape {m, k}
     //rhs shape {n, k}
@@ -915,7 +1026,7 @@ torch::Tensor deq_sddmm_mma_4b(
 
     auto options = torch::TensorOptions().dtype(torch::kFloat16).device(lhs_matrix.device());
 
-    auto output_vals = torch::empty({nnz * vec_length, }, options);
+    auto output_vals = output_buffer(out, {nnz * vec_length, }, options, "sddmm");
 
     switch(vec_length){
         case 2:
@@ -1,5 +1,7 @@
 #include <torch/extension.h>
 
+torch::Tensor byte_transpose_4x4(torch::Tensor in);
+
 torch::Tensor batched_deq_spmm_mma_16b(
     torch::Tensor row_indices,
     torch::Tensor row_offsets,
@@ -9,7 +11,10 @@ torch::Tensor batched_deq_spmm_mma_16b(
     int vec_length,
     int bits_lhs,
     int bits_rhs,
-    float scale);
+    float scale,
+    torch::Tensor batch_offsets,
+    torch::Tensor entry_scales,
+    torch::Tensor out);
 
 torch::Tensor batched_deq_spmm_mma_8b(
     torch::Tensor row_indices,
@@ -20,7 +25,10 @@ torch::Tensor batched_deq_spmm_mma_8b(
     int vec_length,
     int bits_lhs,
     int bits_rhs,
-    float scale);
+    float scale,
+    torch::Tensor batch_offsets,
+    torch::Tensor entry_scales,
+    torch::Tensor out);
 
 torch::Tensor batched_deq_spmm_mma_16b8b(
     torch::Tensor row_indices,
@@ -31,7 +39,10 @@ torch::Tensor batched_deq_spmm_mma_16b8b(
     int vec_length,
     int bits_lhs,
     int bits_rhs,
-    float scale);
+    float scale,
+    torch::Tensor batch_offsets,
+    torch::Tensor entry_scales,
+    torch::Tensor out);
 
 torch::Tensor batched_deq_spmm_mma_4b(
     torch::Tensor row_indices,
@@ -42,7 +53,10 @@ torch::Tensor batched_deq_spmm_mma_4b(
     int vec_length,
     int bits_lhs,
     int bits_rhs,
-    float scale);
+    float scale,
+    torch::Tensor batch_offsets,
+    torch::Tensor entry_scales,
+    torch::Tensor out);
 
 torch::Tensor batched_deq_spmm_mma_8b4b(
     torch::Tensor row_indices,
@@ -53,7 +67,10 @@ torch::Tensor batched_deq_spmm_mma_8b4b(
     int vec_length,
     int bits_lhs,
     int bits_rhs,
-    float scale);
+    float scale,
+    torch::Tensor batch_offsets,
+    torch::Tensor entry_scales,
+    torch::Tensor out);
 
 
 torch::Tensor bspmm_4b(
@@ -76,7 +93,10 @@ torch::Tensor bspmm_4b(
                               vec_length,
                               bits_lhs,
                               bits_rhs,
-                              scale);
+                              scale,
+                              torch::Tensor(),
+                              torch::Tensor(),
+                              torch::Tensor());
 }
 
 torch::Tensor bspmm_8b(
@@ -99,7 +119,10 @@ torch::Tensor bspmm_8b(
                               vec_length,
                               bits_lhs,
                               bits_rhs,
-                              scale);
+                              scale,
+                              torch::Tensor(),
+                              torch::Tensor(),
+                              torch::Tensor());
 }
 
 torch::Tensor bspmm_16b(
@@ -122,7 +145,10 @@ torch::Tensor bspmm_16b(
                               vec_length,
                               bits_lhs,
                               bits_rhs,
-                              scale);
+                              scale,
+                              torch::Tensor(),
+                              torch::Tensor(),
+                              torch::Tensor());
 }
 
 
@@ -146,7 +172,10 @@ torch::Tensor bspmm_8b4b(
                                 vec_length,
                                 bits_lhs,
                                 bits_rhs,
-                                scale);
+                                scale,
+                                torch::Tensor(),
+                                torch::Tensor(),
+                                torch::Tensor());
 }
 
 torch::Tensor bspmm_16b8b(
@@ -169,13 +198,452 @@ torch::Tensor bspmm_16b8b(
                                  vec_length,
                                  bits_lhs,
                                  bits_rhs,
-                                 scale);
+                                 scale,
+                                 torch::Tensor(),
+                                 torch::Tensor(),
+                                 torch::Tensor());
+}
+
+
+// Batched SpMM with a distinct mask per entry, as packed by
+// sptrans.mask_builder.pack_masks: row_indices is {batch, m_vec}, row_offsets
+// {batch, m_vec * 2}, column_indices and values are the concatenation of the
+// masks and batch_offsets {batch + 1} the first vector of every mask.
+torch::Tensor bspmm_4b_masks(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor batch_offsets,
+    torch::Tensor values,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits_lhs,
+    int bits_rhs,
+    float scale){
+
+    return batched_deq_spmm_mma_4b(row_indices, row_offsets, column_indices, values, rhs_matrix,
+                                   vec_length, bits_lhs, bits_rhs, scale, batch_offsets, torch::Tensor(), torch::Tensor());
+}
+
+torch::Tensor bspmm_8b_masks(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor batch_offsets,
+    torch::Tensor values,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits_lhs,
+    int bits_rhs,
+    float scale){
+
+    return batched_deq_spmm_mma_8b(row_indices, row_offsets, column_indices, values, rhs_matrix,
+                                   vec_length, bits_lhs, bits_rhs, scale, batch_offsets, torch::Tensor(), torch::Tensor());
+}
+
+torch::Tensor bspmm_16b_masks(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor batch_offsets,
+    torch::Tensor values,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits_lhs,
+    int bits_rhs,
+    float scale){
+
+    return batched_deq_spmm_mma_16b(row_indices, row_offsets, column_indices, values, rhs_matrix,
+                                   vec_length, bits_lhs, bits_rhs, scale, batch_offsets, torch::Tensor(), torch::Tensor());
+}
+
+torch::Tensor bspmm_8b4b_masks(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor batch_offsets,
+    torch::Tensor values,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits_lhs,
+    int bits_rhs,
+    float scale){
+
+    return batched_deq_spmm_mma_8b4b(row_indices, row_offsets, column_indices, values, rhs_matrix,
+                                   vec_length, bits_lhs, bits_rhs, scale, batch_offsets, torch::Tensor(), torch::Tensor());
+}
+
+torch::Tensor bspmm_16b8b_masks(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor batch_offsets,
+    torch::Tensor values,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits_lhs,
+    int bits_rhs,
+    float scale){
+
+    return batched_deq_spmm_mma_16b8b(row_indices, row_offsets, column_indices, values, rhs_matrix,
+                                   vec_length, bits_lhs, bits_rhs, scale, batch_offsets, torch::Tensor(), torch::Tensor());
+}
+
+// out= variants: the product is written to out, a preallocated
+// {batch, m, n} half tensor, which is also returned.
+torch::Tensor bspmm_4b_out(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor values,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits_lhs,
+    int bits_rhs,
+    float scale,
+    torch::Tensor out){
+
+    return batched_deq_spmm_mma_4b(row_indices, row_offsets, column_indices, values, rhs_matrix,
+                                   vec_length, bits_lhs, bits_rhs, scale, torch::Tensor(), torch::Tensor(), out);
+}
+
+torch::Tensor bspmm_8b_out(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor values,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits_lhs,
+    int bits_rhs,
+    float scale,
+    torch::Tensor out){
+
+    return batched_deq_spmm_mma_8b(row_indices, row_offsets, column_indices, values, rhs_matrix,
+                                   vec_length, bits_lhs, bits_rhs, scale, torch::Tensor(), torch::Tensor(), out);
+}
+
+torch::Tensor bspmm_16b_out(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor values,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits_lhs,
+    int bits_rhs,
+    float scale,
+    torch::Tensor out){
+
+    return batched_deq_spmm_mma_16b(row_indices, row_offsets, column_indices, values, rhs_matrix,
+                                    vec_length, bits_lhs, bits_rhs, scale, torch::Tensor(), torch::Tensor(), out);
+}
+
+torch::Tensor bspmm_8b4b_out(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor values,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits_lhs,
+    int bits_rhs,
+    float scale,
+    torch::Tensor out){
+
+    return batched_deq_spmm_mma_8b4b(row_indices, row_offsets, column_indices, values, rhs_matrix,
+                                     vec_length, bits_lhs, bits_rhs, scale, torch::Tensor(), torch::Tensor(), out);
+}
+
+torch::Tensor bspmm_16b8b_out(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor values,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits_lhs,
+    int bits_rhs,
+    float scale,
+    torch::Tensor out){
+
+    return batched_deq_spmm_mma_16b8b(row_indices, row_offsets, column_indices, values, rhs_matrix,
+                                      vec_length, bits_lhs, bits_rhs, scale, torch::Tensor(), torch::Tensor(), out);
+}
+
+torch::Tensor bspmm_4b_masks_out(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor batch_offsets,
+    torch::Tensor values,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits_lhs,
+    int bits_rhs,
+    float scale,
+    torch::Tensor out){
+
+    return batched_deq_spmm_mma_4b(row_indices, row_offsets, column_indices, values, rhs_matrix,
+                                   vec_length, bits_lhs, bits_rhs, scale, batch_offsets, torch::Tensor(), out);
+}
+
+torch::Tensor bspmm_8b_masks_out(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor batch_offsets,
+    torch::Tensor values,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits_lhs,
+    int bits_rhs,
+    float scale,
+    torch::Tensor out){
+
+    return batched_deq_spmm_mma_8b(row_indices, row_offsets, column_indices, values, rhs_matrix,
+                                   vec_length, bits_lhs, bits_rhs, scale, batch_offsets, torch::Tensor(), out);
+}
+
+torch::Tensor bspmm_16b_masks_out(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor batch_offsets,
+    torch::Tensor values,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits_lhs,
+    int bits_rhs,
+    float scale,
+    torch::Tensor out){
+
+    return batched_deq_spmm_mma_16b(row_indices, row_offsets, column_indices, values, rhs_matrix,
+                                    vec_length, bits_lhs, bits_rhs, scale, batch_offsets, torch::Tensor(), out);
+}
+
+torch::Tensor bspmm_8b4b_masks_out(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor batch_offsets,
+    torch::Tensor values,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits_lhs,
+    int bits_rhs,
+    float scale,
+    torch::Tensor out){
+
+    return batched_deq_spmm_mma_8b4b(row_indices, row_offsets, column_indices, values, rhs_matrix,
+                                     vec_length, bits_lhs, bits_rhs, scale, batch_offsets, torch::Tensor(), out);
+}
+
+torch::Tensor bspmm_16b8b_masks_out(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor batch_offsets,
+    torch::Tensor values,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits_lhs,
+    int bits_rhs,
+    float scale,
+    torch::Tensor out){
+
+    return batched_deq_spmm_mma_16b8b(row_indices, row_offsets, column_indices, values, rhs_matrix,
+                                      vec_length, bits_lhs, bits_rhs, scale, batch_offsets, torch::Tensor(), out);
+}
+
+// Overloads with a tensor of per-entry dequantization scales in place of
+// the scalar scale: entry i of the batch uses entry_scales[i % numel], e.g.
+// one scale per head (see sptrans.calibration).
+torch::Tensor bspmm_4b_scales(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor values,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits_lhs,
+    int bits_rhs,
+    torch::Tensor entry_scales){
+
+    return batched_deq_spmm_mma_4b(row_indices, row_offsets, column_indices, values, rhs_matrix,
+                                   vec_length, bits_lhs, bits_rhs, 1.0f, torch::Tensor(), entry_scales, torch::Tensor());
+}
+
+torch::Tensor bspmm_4b_scales_out(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor values,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits_lhs,
+    int bits_rhs,
+    torch::Tensor entry_scales,
+    torch::Tensor out){
+
+    return batched_deq_spmm_mma_4b(row_indices, row_offsets, column_indices, values, rhs_matrix,
+                                   vec_length, bits_lhs, bits_rhs, 1.0f, torch::Tensor(), entry_scales, out);
+}
+
+torch::Tensor bspmm_8b_scales(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor values,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits_lhs,
+    int bits_rhs,
+    torch::Tensor entry_scales){
+
+    return batched_deq_spmm_mma_8b(row_indices, row_offsets, column_indices, values, rhs_matrix,
+                                   vec_length, bits_lhs, bits_rhs, 1.0f, torch::Tensor(), entry_scales, torch::Tensor());
+}
+
+torch::Tensor bspmm_8b_scales_out(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor values,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits_lhs,
+    int bits_rhs,
+    torch::Tensor entry_scales,
+    torch::Tensor out){
+
+    return batched_deq_spmm_mma_8b(row_indices, row_offsets, column_indices, values, rhs_matrix,
+                                   vec_length, bits_lhs, bits_rhs, 1.0f, torch::Tensor(), entry_scales, out);
+}
+
+torch::Tensor bspmm_16b_scales(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor values,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits_lhs,
+    int bits_rhs,
+    torch::Tensor entry_scales){
+
+    return batched_deq_spmm_mma_16b(row_indices, row_offsets, column_indices, values, rhs_matrix,
+                                    vec_length, bits_lhs, bits_rhs, 1.0f, torch::Tensor(), entry_scales, torch::Tensor());
+}
+
+torch::Tensor bspmm_16b_scales_out(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor values,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits_lhs,
+    int bits_rhs,
+    torch::Tensor entry_scales,
+    torch::Tensor out){
+
+    return batched_deq_spmm_mma_16b(row_indices, row_offsets, column_indices, values, rhs_matrix,
+                                    vec_length, bits_lhs, bits_rhs, 1.0f, torch::Tensor(), entry_scales, out);
+}
+
+torch::Tensor bspmm_8b4b_scales(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor values,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits_lhs,
+    int bits_rhs,
+    torch::Tensor entry_scales){
+
+    return batched_deq_spmm_mma_8b4b(row_indices, row_offsets, column_indices, values, rhs_matrix,
+                                     vec_length, bits_lhs, bits_rhs, 1.0f, torch::Tensor(), entry_scales, torch::Tensor());
+}
+
+torch::Tensor bspmm_8b4b_scales_out(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor values,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits_lhs,
+    int bits_rhs,
+    torch::Tensor entry_scales,
+    torch::Tensor out){
+
+    return batched_deq_spmm_mma_8b4b(row_indices, row_offsets, column_indices, values, rhs_matrix,
+                                     vec_length, bits_lhs, bits_rhs, 1.0f, torch::Tensor(), entry_scales, out);
+}
+
+torch::Tensor bspmm_16b8b_scales(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor values,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits_lhs,
+    int bits_rhs,
+    torch::Tensor entry_scales){
+
+    return batched_deq_spmm_mma_16b8b(row_indices, row_offsets, column_indices, values, rhs_matrix,
+                                      vec_length, bits_lhs, bits_rhs, 1.0f, torch::Tensor(), entry_scales, torch::Tensor());
+}
+
+torch::Tensor bspmm_16b8b_scales_out(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor column_indices,
+    torch::Tensor values,
+    torch::Tensor rhs_matrix,
+    int vec_length,
+    int bits_lhs,
+    int bits_rhs,
+    torch::Tensor entry_scales,
+    torch::Tensor out){
+
+    return batched_deq_spmm_mma_16b8b(row_indices, row_offsets, column_indices, values, rhs_matrix,
+                                      vec_length, bits_lhs, bits_rhs, 1.0f, torch::Tensor(), entry_scales, out);
 }
 
 PYBIND11_MODULE(TORCH_EXTENSION_NAME, m){
     m.def("bspmm_4b", &bspmm_4b, "Custom batched 4-bit SpMM kernel");
+    m.def("bspmm_4b", &bspmm_4b_scales, "Custom batched 4-bit SpMM kernel with per-entry scales");
     m.def("bspmm_8b", &bspmm_8b, "Custom batched 8-bit SpMM kernel");
+    m.def("bspmm_8b", &bspmm_8b_scales, "Custom batched 8-bit SpMM kernel with per-entry scales");
     m.def("bspmm_16b", &bspmm_16b, "Custom batched 16-bit SpMM kernel");
+    m.def("bspmm_16b", &bspmm_16b_scales, "Custom batched 16-bit SpMM kernel with per-entry scales");
     m.def("bspmm_8b4b", &bspmm_8b4b, "Custom batched 8-bit 4-bit SpMM kernel");
+    m.def("bspmm_8b4b", &bspmm_8b4b_scales, "Custom batched 8-bit 4-bit SpMM kernel with per-entry scales");
     m.def("bspmm_16b8b", &bspmm_16b8b, "Custom batched 16-bit 8-bit SpMM kernel");
+    m.def("bspmm_16b8b", &bspmm_16b8b_scales, "Custom batched 16-bit 8-bit SpMM kernel with per-entry scales");
+    m.def("bspmm_4b_masks", &bspmm_4b_masks, "Custom batched 4-bit SpMM kernel with a mask per entry");
+    m.def("bspmm_8b_masks", &bspmm_8b_masks, "Custom batched 8-bit SpMM kernel with a mask per entry");
+    m.def("bspmm_16b_masks", &bspmm_16b_masks, "Custom batched 16-bit SpMM kernel with a mask per entry");
+    m.def("bspmm_8b4b_masks", &bspmm_8b4b_masks, "Custom batched 8-bit 4-bit SpMM kernel with a mask per entry");
+    m.def("bspmm_16b8b_masks", &bspmm_16b8b_masks, "Custom batched 16-bit 8-bit SpMM kernel with a mask per entry");
+    m.def("bspmm_4b_out", &bspmm_4b_out, "Custom batched 4-bit SpMM kernel writing to out");
+    m.def("bspmm_4b_out", &bspmm_4b_scales_out, "Custom batched 4-bit SpMM kernel with per-entry scales writing to out");
+    m.def("bspmm_8b_out", &bspmm_8b_out, "Custom batched 8-bit SpMM kernel writing to out");
+    m.def("bspmm_8b_out", &bspmm_8b_scales_out, "Custom batched 8-bit SpMM kernel with per-entry scales writing to out");
+    m.def("bspmm_16b_out", &bspmm_16b_out, "Custom batched 16-bit SpMM kernel writing to out");
+    m.def("bspmm_16b_out", &bspmm_16b_scales_out, "Custom batched 16-bit SpMM kernel with per-entry scales writing to out");
+    m.def("bspmm_8b4b_out", &bspmm_8b4b_out, "Custom batched 8-bit 4-bit SpMM kernel writing to out");
+    m.def("bspmm_8b4b_out", &bspmm_8b4b_scales_out, "Custom batched 8-bit 4-bit SpMM kernel with per-entry scales writing to out");
+    m.def("bspmm_16b8b_out", &bspmm_16b8b_out, "Custom batched 16-bit 8-bit SpMM kernel writing to out");
+    m.def("bspmm_16b8b_out", &bspmm_16b8b_scales_out, "Custom batched 16-bit 8-bit SpMM kernel with per-entry scales writing to out");
+    m.def("bspmm_4b_masks_out", &bspmm_4b_masks_out, "Custom batched 4-bit SpMM kernel with a mask per entry writing to out");
+    m.def("bspmm_8b_masks_out", &bspmm_8b_masks_out, "Custom batched 8-bit SpMM kernel with a mask per entry writing to out");
+    m.def("bspmm_16b_masks_out", &bspmm_16b_masks_out, "Custom batched 16-bit SpMM kernel with a mask per entry writing to out");
+    m.def("bspmm_8b4b_masks_out", &bspmm_8b4b_masks_out, "Custom batched 8-bit 4-bit SpMM kernel with a mask per entry writing to out");
+    m.def("bspmm_16b8b_masks_out", &bspmm_16b8b_masks_out, "Custom batched 16-bit 8-bit SpMM kernel with a mask per entry writing to out");
+    m.def("byte_transpose_4x4", &byte_transpose_4x4, "ByteTranspose4x4 of the 8-bit rhs fragments on groups of four ints");
 }
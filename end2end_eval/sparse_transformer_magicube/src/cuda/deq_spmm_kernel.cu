@@ -1,6 +1,10 @@
 #include <cuda.h>
 #include "cuda_fp16.h"
 #include <torch/extension.h>
+#include <c10/cuda/CUDAStream.h>
+#include "output_buffer.h"
+#include "scale_tensor.h"
+#include "batch_offsets.h"
 #include <cuda_runtime.h>
 #include <cstdint>
 #include <cmath>
@@ -693,12 +697,27 @@ __global__ void batched_wmmaSpmm_kernel_4b(
     const int* __restrict__ rhs_matrix_b,
     int rhs_stride,
     half* __restrict__ output_matrix_b,
-    int output_stride)
+    int output_stride,
+    const int* __restrict__ batch_offsets,
+    const float* __restrict__ entry_scales,
+    int num_entry_scales)
 {
     int entry_idx = blockIdx.z;
     const VecType* values = values_b + entry_idx * values_stride;
     const int* rhs_matrix = rhs_matrix_b + entry_idx * rhs_stride;
     half* output_matrix = output_matrix_b + entry_idx * output_stride;
+    if(batch_offsets != nullptr){
+        // Distinct mask per entry, see batched_deq_spmm_mma_*
+        int mask_offset = __ldg(batch_offsets + entry_idx);
+        values = values_b + mask_offset * values_stride;
+        column_indices += mask_offset;
+        row_indices += entry_idx * m_vec;
+        row_offsets += entry_idx * m_vec * 2;
+    }
+    if(entry_scales != nullptr){
+        // Per-entry dequantization, e.g. one scale per head
+        scale *= __ldg(entry_scales + entry_idx % num_entry_scales);
+    }
 
     wmmaSpmm_kernel_4b_<LoadType, IndexType, VecType, Tile_K, Tile_N, Warps, VecLength>(
     m_vec, dimN, dimK, scale,
@@ -745,12 +764,27 @@ __global__ void batched_wmmaSpmm_kernel_8b(
     const int* __restrict__ rhs_matrix_b,
     int rhs_stride,
     half* __restrict__ output_matrix_b,
-    int output_stride)
+    int output_stride,
+    const int* __restrict__ batch_offsets,
+    const float* __restrict__ entry_scales,
+    int num_entry_scales)
 {
     int entry_idx = blockIdx.z;
     const VecType* values = values_b + entry_idx * values_stride;
     const int* rhs_matrix = rhs_matrix_b + entry_idx * rhs_stride;
     half* output_matrix = output_matrix_b + entry_idx * output_stride;
+    if(batch_offsets != nullptr){
+        // Distinct mask per entry, see batched_deq_spmm_mma_*
+        int mask_offset = __ldg(batch_offsets + entry_idx);
+        values = values_b + mask_offset * values_stride;
+        column_indices += mask_offset;
+        row_indices += entry_idx * m_vec;
+        row_offsets += entry_idx * m_vec * 2;
+    }
+    if(entry_scales != nullptr){
+        // Per-entry dequantization, e.g. one scale per head
+        scale *= __ldg(entry_scales + entry_idx % num_entry_scales);
+    }
 
     wmmaSpmm_kernel_8b_<LoadType, IndexType, VecType, Tile_K, Tile_N, Warps, VecLength>(
     m_vec, dimN, dimK, scale,
@@ -795,12 +829,27 @@ __global__ void batched_wmmaSpmm_kernel_16b(
     const int* __restrict__ rhs_matrix_b,
     int rhs_stride,
     half* __restrict__ output_matrix_b,
-    int output_stride)
+    int output_stride,
+    const int* __restrict__ batch_offsets,
+    const float* __restrict__ entry_scales,
+    int num_entry_scales)
 {
     int entry_idx = blockIdx.z;
     const VecType* values = values_b + entry_idx * values_stride;
     const int* rhs_matrix = rhs_matrix_b + entry_idx * rhs_stride;
     half* output_matrix = output_matrix_b + entry_idx * output_stride;
+    if(batch_offsets != nullptr){
+        // Distinct mask per entry, see batched_deq_spmm_mma_*
+        int mask_offset = __ldg(batch_offsets + entry_idx);
+        values = values_b + mask_offset * values_stride;
+        column_indices += mask_offset;
+        row_indices += entry_idx * m_vec;
+        row_offsets += entry_idx * m_vec * 2;
+    }
+    if(entry_scales != nullptr){
+        // Per-entry dequantization, e.g. one scale per head
+        scale *= __ldg(entry_scales + entry_idx % num_entry_scales);
+    }
 
     wmmaSpmm_kernel_16b_<LoadType, IndexType, VecType, Tile_K, Tile_N, Warps, VecLength>(
     m_vec, dimN, dimK, scale,
@@ -847,12 +896,27 @@ __global__ void batched_wmmaSpmm_kernel_16b8b(
     const int* __restrict__ rhs_matrix_b,
     int rhs_stride,
     half* __restrict__ output_matrix_b,
-    int output_stride)
+    int output_stride,
+    const int* __restrict__ batch_offsets,
+    const float* __restrict__ entry_scales,
+    int num_entry_scales)
 {
     int entry_idx = blockIdx.z;
     const VecType* values = values_b + entry_idx * values_stride;
     const int* rhs_matrix = rhs_matrix_b + entry_idx * rhs_stride;
     half* output_matrix = output_matrix_b + entry_idx * output_stride;
+    if(batch_offsets != nullptr){
+        // Distinct mask per entry, see batched_deq_spmm_mma_*
+        int mask_offset = __ldg(batch_offsets + entry_idx);
+        values = values_b + mask_offset * values_stride;
+        column_indices += mask_offset;
+        row_indices += entry_idx * m_vec;
+        row_offsets += entry_idx * m_vec * 2;
+    }
+    if(entry_scales != nullptr){
+        // Per-entry dequantization, e.g. one scale per head
+        scale *= __ldg(entry_scales + entry_idx % num_entry_scales);
+    }
 
     wmmaSpmm_kernel_16b8b_<LoadType, IndexType, VecType, Tile_K, Tile_N, Warps, VecLength>(
     m_vec, dimN, dimK, scale,
@@ -898,12 +962,27 @@ __global__ void batched_wmmaSpmm_kernel_16b8b8v(
     const int* __restrict__ rhs_matrix_b,
     int rhs_stride,
     half* __restrict__ output_matrix_b,
-    int output_stride)
+    int output_stride,
+    const int* __restrict__ batch_offsets,
+    const float* __restrict__ entry_scales,
+    int num_entry_scales)
 {
     int entry_idx = blockIdx.z;
     const VecType* values = values_b + entry_idx * values_stride;
     const int* rhs_matrix = rhs_matrix_b + entry_idx * rhs_stride;
     half* output_matrix = output_matrix_b + entry_idx * output_stride;
+    if(batch_offsets != nullptr){
+        // Distinct mask per entry, see batched_deq_spmm_mma_*
+        int mask_offset = __ldg(batch_offsets + entry_idx);
+        values = values_b + mask_offset * values_stride;
+        column_indices += mask_offset;
+        row_indices += entry_idx * m_vec;
+        row_offsets += entry_idx * m_vec * 2;
+    }
+    if(entry_scales != nullptr){
+        // Per-entry dequantization, e.g. one scale per head
+        scale *= __ldg(entry_scales + entry_idx % num_entry_scales);
+    }
 
     wmmaSpmm_kernel_16b8b8v_<LoadType, IndexType, VecType, Tile_K, Tile_N, Warps, VecLength>(
     m_vec, dimN, dimK, scale,
@@ -949,12 +1028,27 @@ __global__ void batched_wmmaSpmm_kernel_8b4b(
     const int* __restrict__ rhs_matrix_b,
     int rhs_stride,
     half* __restrict__ output_matrix_b,
-    int output_stride)
+    int output_stride,
+    const int* __restrict__ batch_offsets,
+    const float* __restrict__ entry_scales,
+    int num_entry_scales)
 {
     int entry_idx = blockIdx.z;
     const VecType* values = values_b + entry_idx * values_stride;
     const int* rhs_matrix = rhs_matrix_b + entry_idx * rhs_stride;
     half* output_matrix = output_matrix_b + entry_idx * output_stride;
+    if(batch_offsets != nullptr){
+        // Distinct mask per entry, see batched_deq_spmm_mma_*
+        int mask_offset = __ldg(batch_offsets + entry_idx);
+        values = values_b + mask_offset * values_stride;
+        column_indices += mask_offset;
+        row_indices += entry_idx * m_vec;
+        row_offsets += entry_idx * m_vec * 2;
+    }
+    if(entry_scales != nullptr){
+        // Per-entry dequantization, e.g. one scale per head
+        scale *= __ldg(entry_scales + entry_idx % num_entry_scales);
+    }
 
     wmmaSpmm_kernel_8b4b_<LoadType, IndexType, VecType, Tile_K, Tile_N, Warps, VecLength>(
     m_vec, dimN, dimK, scale,
@@ -1002,12 +1096,27 @@ __global__ void batched_wmmaSpmm_kernel_8b4b8v(
     const int* __restrict__ rhs_matrix_b,
     int rhs_stride,
     half* __restrict__ output_matrix_b,
-    int output_stride)
+    int output_stride,
+    const int* __restrict__ batch_offsets,
+    const float* __restrict__ entry_scales,
+    int num_entry_scales)
 {
     int entry_idx = blockIdx.z;
     const VecType* values = values_b + entry_idx * values_stride;
     const int* rhs_matrix = rhs_matrix_b + entry_idx * rhs_stride;
     half* output_matrix = output_matrix_b + entry_idx * output_stride;
+    if(batch_offsets != nullptr){
+        // Distinct mask per entry, see batched_deq_spmm_mma_*
+        int mask_offset = __ldg(batch_offsets + entry_idx);
+        values = values_b + mask_offset * values_stride;
+        column_indices += mask_offset;
+        row_indices += entry_idx * m_vec;
+        row_offsets += entry_idx * m_vec * 2;
+    }
+    if(entry_scales != nullptr){
+        // Per-entry dequantization, e.g. one scale per head
+        scale *= __ldg(entry_scales + entry_idx % num_entry_scales);
+    }
 
     wmmaSpmm_kernel_8b4b8v_<LoadType, IndexType, VecType, Tile_K, Tile_N, Warps, VecLength>(
     m_vec, dimN, dimK, scale,
@@ -1033,7 +1142,7 @@ cudaError_t wmmaSpmm_4b_template(
 {
     dim3 grid_dim(ceil(static_cast<float>(m_vec) / Tile_M), ceil(static_cast<float>(n) / Tile_N), 1);
     dim3 block_dim(WarpWidth * Warps, Tile_M, 1);
-    wmmaSpmm_kernel_4b<int, int, VecType, Tile_K, Tile_N, Warps, VecLength><<<grid_dim, block_dim>>>(
+    wmmaSpmm_kernel_4b<int, int, VecType, Tile_K, Tile_N, Warps, VecLength><<<grid_dim, block_dim, 0, c10::cuda::getCurrentCUDAStream()>>>(
         m_vec, n, k, scale, row_indices, row_offsets, column_indices, values, rhs_matrix, output_matrix);
 
     return cudaGetLastError();
@@ -1053,7 +1162,7 @@ cudaError_t wmmaSpmm_8b_template(
     dim3 grid_dim(ceil(static_cast<float>(m_vec) / Tile_M), ceil(static_cast<float>(n) / Tile_N), 1);
     dim3 block_dim(WarpWidth * Warps, Tile_M, 1);
 
-    wmmaSpmm_kernel_8b<int, int, VecType, Tile_K, Tile_N, Warps, VecLength><<<grid_dim, block_dim>>>(
+    wmmaSpmm_kernel_8b<int, int, VecType, Tile_K, Tile_N, Warps, VecLength><<<grid_dim, block_dim, 0, c10::cuda::getCurrentCUDAStream()>>>(
         m_vec, n, k, scale, row_indices, row_offsets, column_indices, values, rhs_matrix, output_matrix);
     return cudaGetLastError();
 }
@@ -1072,10 +1181,10 @@ cudaError_t wmmaSpmm_8b4b_template(
     dim3 grid_dim(ceil(static_cast<float>(m_vec) / Tile_M), ceil(static_cast<float>(n) / Tile_N), 1);
     dim3 block_dim(WarpWidth * Warps, Tile_M, 1);
     if(vec_length == 8)
-        wmmaSpmm_kernel_8b4b8v<int, int, VecType, Tile_K, Tile_N, Warps, VecLength><<<grid_dim, block_dim>>>(
+        wmmaSpmm_kernel_8b4b8v<int, int, VecType, Tile_K, Tile_N, Warps, VecLength><<<grid_dim, block_dim, 0, c10::cuda::getCurrentCUDAStream()>>>(
             m_vec, n, k, scale, row_indices, row_offsets, column_indices, values, rhs_matrix, output_matrix);
     else
-        wmmaSpmm_kernel_8b4b<int, int, VecType, Tile_K, Tile_N, Warps, VecLength><<<grid_dim, block_dim>>>(
+        wmmaSpmm_kernel_8b4b<int, int, VecType, Tile_K, Tile_N, Warps, VecLength><<<grid_dim, block_dim, 0, c10::cuda::getCurrentCUDAStream()>>>(
             m_vec, n, k, scale, row_indices, row_offsets, column_indices, values, rhs_matrix, output_matrix);
     return cudaGetLastError();
 }
@@ -1094,10 +1203,10 @@ cudaError_t wmmaSpmm_16b8b_template(
     dim3 grid_dim(ceil(static_cast<float>(m_vec) / Tile_M), ceil(static_cast<float>(n) / Tile_N), 1);
     dim3 block_dim(WarpWidth * Warps, Tile_M, 1);
     if(vec_length == 8)
-        wmmaSpmm_kernel_16b8b8v<int, int, VecType, Tile_K, Tile_N, Warps, VecLength><<<grid_dim, block_dim>>>(
+        wmmaSpmm_kernel_16b8b8v<int, int, VecType, Tile_K, Tile_N, Warps, VecLength><<<grid_dim, block_dim, 0, c10::cuda::getCurrentCUDAStream()>>>(
             m_vec, n, k, scale, row_indices, row_offsets, column_indices, values, rhs_matrix, output_matrix);
     else
-        wmmaSpmm_kernel_16b8b<int, int, VecType, Tile_K, Tile_N, Warps, VecLength><<<grid_dim, block_dim>>>(
+        wmmaSpmm_kernel_16b8b<int, int, VecType, Tile_K, Tile_N, Warps, VecLength><<<grid_dim, block_dim, 0, c10::cuda::getCurrentCUDAStream()>>>(
             m_vec, n, k, scale, row_indices, row_offsets, column_indices, values, rhs_matrix, output_matrix);
     return cudaGetLastError();
 }
@@ -1114,12 +1223,15 @@ cudaError_t batched_wmmaSpmm_4b_template(
     const int* __restrict__ rhs_matrix_b,
     int rhs_stride,
     half* __restrict__ output_matrix_b,
-    int output_stride)
+    int output_stride,
+    const int* __restrict__ batch_offsets,
+    const float* __restrict__ entry_scales,
+    int num_entry_scales)
 {
     dim3 grid_dim(ceil(static_cast<float>(m_vec) / Tile_M), ceil(static_cast<float>(n) / Tile_N), batch_size);
     dim3 block_dim(WarpWidth * Warps, Tile_M, 1);
-    batched_wmmaSpmm_kernel_4b<int, int, VecType, Tile_K, Tile_N, Warps, VecLength><<<grid_dim, block_dim>>>(
-        m_vec, n, k, scale, row_indices, row_offsets, column_indices, values_b, values_stride, rhs_matrix_b, rhs_stride, output_matrix_b, output_stride);
+    batched_wmmaSpmm_kernel_4b<int, int, VecType, Tile_K, Tile_N, Warps, VecLength><<<grid_dim, block_dim, 0, c10::cuda::getCurrentCUDAStream()>>>(
+        m_vec, n, k, scale, row_indices, row_offsets, column_indices, values_b, values_stride, rhs_matrix_b, rhs_stride, output_matrix_b, output_stride, batch_offsets, entry_scales, num_entry_scales);
 
     return cudaGetLastError();
 }
@@ -1136,13 +1248,16 @@ cudaError_t batched_wmmaSpmm_8b_template(
     const int* __restrict__ rhs_matrix_b,
     int rhs_stride,
     half* __restrict__ output_matrix_b,
-    int output_stride)
+    int output_stride,
+    const int* __restrict__ batch_offsets,
+    const float* __restrict__ entry_scales,
+    int num_entry_scales)
 {
     dim3 grid_dim(ceil(static_cast<float>(m_vec) / Tile_M), ceil(static_cast<float>(n) / Tile_N), batch_size);
     dim3 block_dim(WarpWidth * Warps, Tile_M, 1);
 
-    batched_wmmaSpmm_kernel_8b<int, int, VecType, Tile_K, Tile_N, Warps, VecLength><<<grid_dim, block_dim>>>(
-        m_vec, n, k, scale, row_indices, row_offsets, column_indices, values_b, values_stride, rhs_matrix_b, rhs_stride, output_matrix_b, output_stride);
+    batched_wmmaSpmm_kernel_8b<int, int, VecType, Tile_K, Tile_N, Warps, VecLength><<<grid_dim, block_dim, 0, c10::cuda::getCurrentCUDAStream()>>>(
+        m_vec, n, k, scale, row_indices, row_offsets, column_indices, values_b, values_stride, rhs_matrix_b, rhs_stride, output_matrix_b, output_stride, batch_offsets, entry_scales, num_entry_scales);
     return cudaGetLastError();
 }
 
@@ -1157,13 +1272,16 @@ cudaError_t batched_wmmaSpmm_16b_template(
     const int* __restrict__ rhs_matrix_b,
     int rhs_stride,
     half* __restrict__ output_matrix_b,
-    int output_stride)
+    int output_stride,
+    const int* __restrict__ batch_offsets,
+    const float* __restrict__ entry_scales,
+    int num_entry_scales)
 {
     dim3 grid_dim(ceil(static_cast<float>(m_vec) / Tile_M), ceil(static_cast<float>(n) / Tile_N), batch_size);
     dim3 block_dim(WarpWidth * Warps, Tile_M, 1);
 
-    batched_wmmaSpmm_kernel_16b<int, int, VecType, Tile_K, Tile_N, Warps, VecLength><<<grid_dim, block_dim>>>(
-        m_vec, n, k, scale, row_indices, row_offsets, column_indices, values_b, values_stride, rhs_matrix_b, rhs_stride, output_matrix_b, output_stride);
+    batched_wmmaSpmm_kernel_16b<int, int, VecType, Tile_K, Tile_N, Warps, VecLength><<<grid_dim, block_dim, 0, c10::cuda::getCurrentCUDAStream()>>>(
+        m_vec, n, k, scale, row_indices, row_offsets, column_indices, values_b, values_stride, rhs_matrix_b, rhs_stride, output_matrix_b, output_stride, batch_offsets, entry_scales, num_entry_scales);
     return cudaGetLastError();
 }
 
@@ -1180,16 +1298,19 @@ cudaError_t batched_wmmaSpmm_8b4b_template(
     const int* __restrict__ rhs_matrix_b,
     int rhs_stride,
     half* __restrict__ output_matrix_b,
-    int output_stride)
+    int output_stride,
+    const int* __restrict__ batch_offsets,
+    const float* __restrict__ entry_scales,
+    int num_entry_scales)
 {
     dim3 grid_dim(ceil(static_cast<float>(m_vec) / Tile_M), ceil(static_cast<float>(n) / Tile_N), batch_size);
     dim3 block_dim(WarpWidth * Warps, Tile_M, 1);
     if(vec_length == 8)
-        batched_wmmaSpmm_kernel_8b4b8v<int, int, VecType, Tile_K, Tile_N, Warps, VecLength><<<grid_dim, block_dim>>>(
-            m_vec, n, k, scale, row_indices, row_offsets, column_indices, values_b, values_stride, rhs_matrix_b, rhs_stride, output_matrix_b, output_stride);
+        batched_wmmaSpmm_kernel_8b4b8v<int, int, VecType, Tile_K, Tile_N, Warps, VecLength><<<grid_dim, block_dim, 0, c10::cuda::getCurrentCUDAStream()>>>(
+            m_vec, n, k, scale, row_indices, row_offsets, column_indices, values_b, values_stride, rhs_matrix_b, rhs_stride, output_matrix_b, output_stride, batch_offsets, entry_scales, num_entry_scales);
     else
-        batched_wmmaSpmm_kernel_8b4b<int, int, VecType, Tile_K, Tile_N, Warps, VecLength><<<grid_dim, block_dim>>>(
-            m_vec, n, k, scale, row_indices, row_offsets, column_indices, values_b, values_stride, rhs_matrix_b, rhs_stride, output_matrix_b, output_stride);
+        batched_wmmaSpmm_kernel_8b4b<int, int, VecType, Tile_K, Tile_N, Warps, VecLength><<<grid_dim, block_dim, 0, c10::cuda::getCurrentCUDAStream()>>>(
+            m_vec, n, k, scale, row_indices, row_offsets, column_indices, values_b, values_stride, rhs_matrix_b, rhs_stride, output_matrix_b, output_stride, batch_offsets, entry_scales, num_entry_scales);
     return cudaGetLastError();
 }
 
@@ -1205,16 +1326,19 @@ cudaError_t batched_wmmaSpmm_16b8b_template(
     const int* __restrict__ rhs_matrix_b,
     int rhs_stride,
     half* __restrict__ output_matrix_b,
-    int output_stride)
+    int output_stride,
+    const int* __restrict__ batch_offsets,
+    const float* __restrict__ entry_scales,
+    int num_entry_scales)
 {
     dim3 grid_dim(ceil(static_cast<float>(m_vec) / Tile_M), ceil(static_cast<float>(n) / Tile_N), batch_size);
     dim3 block_dim(WarpWidth * Warps, Tile_M, 1);
     if(vec_length == 8)
-        batched_wmmaSpmm_kernel_16b8b8v<int, int, VecType, Tile_K, Tile_N, Warps, VecLength><<<grid_dim, block_dim>>>(
-            m_vec, n, k, scale, row_indices, row_offsets, column_indices, values_b, values_stride, rhs_matrix_b, rhs_stride, output_matrix_b, output_stride);
+        batched_wmmaSpmm_kernel_16b8b8v<int, int, VecType, Tile_K, Tile_N, Warps, VecLength><<<grid_dim, block_dim, 0, c10::cuda::getCurrentCUDAStream()>>>(
+            m_vec, n, k, scale, row_indices, row_offsets, column_indices, values_b, values_stride, rhs_matrix_b, rhs_stride, output_matrix_b, output_stride, batch_offsets, entry_scales, num_entry_scales);
     else
-        batched_wmmaSpmm_kernel_16b8b<int, int, VecType, Tile_K, Tile_N, Warps, VecLength><<<grid_dim, block_dim>>>(
-            m_vec, n, k, scale, row_indices, row_offsets, column_indices, values_b, values_stride, rhs_matrix_b, rhs_stride, output_matrix_b, output_stride);
+        batched_wmmaSpmm_kernel_16b8b<int, int, VecType, Tile_K, Tile_N, Warps, VecLength><<<grid_dim, block_dim, 0, c10::cuda::getCurrentCUDAStream()>>>(
+            m_vec, n, k, scale, row_indices, row_offsets, column_indices, values_b, values_stride, rhs_matrix_b, rhs_stride, output_matrix_b, output_stride, batch_offsets, entry_scales, num_entry_scales);
     return cudaGetLastError();
 }
 
@@ -1228,7 +1352,10 @@ torch::Tensor batched_deq_spmm_mma_16b8b(
     int vec_length,
     int bits_lhs,
     int bits_rhs,
-    float scale)
+    float scale,
+    torch::Tensor batch_offsets,
+    torch::Tensor entry_scales,
+    torch::Tensor out)
 {
     int rhs_num_items_per_int32 = 32 / bits_rhs;
 
@@ -1246,17 +1373,22 @@ torch::Tensor batched_deq_spmm_mma_16b8b(
 
     int nnz = column_indices.numel();
 
-    int values_stride = 0;
+    int values_stride = batch_offsets.defined() ? 1 : nnz; //stride in vector format
     if(vec_length == 8)
-	values_stride = nnz * 2; //2xlong long for 16b8v
-    else
-	values_stride = nnz;
+	values_stride *= 2; //2xlong long for 16b8v
     int rhs_stride = k * n_int32;
     int output_stride = m * n;
 
+    // With distinct masks per entry, row_indices is {batch, m_vec},
+    // row_offsets {batch, m_vec * 2}, and batch_offsets {batch + 1} holds the
+    // first vector of every mask in the concatenated column_indices and values
+    const int* batch_offsets_ptr = batch_offsets_data(batch_offsets, row_indices, row_offsets, column_indices, rhs_matrix.device(), batch_size, m_vec);
+    int num_entry_scales;
+    const float* entry_scales_ptr = entry_scales_data(entry_scales, rhs_matrix.device(), &num_entry_scales);
+
     auto options = torch::TensorOptions().dtype(torch::kFloat16).device(rhs_matrix.device());
 
-    auto output_matrix = torch::empty({batch_size, m, n}, options);
+    auto output_matrix = output_buffer(out, {batch_size, m, n}, options, "bspmm");
 
 
     switch(vec_length){
@@ -1268,7 +1400,7 @@ torch::Tensor batched_deq_spmm_mma_16b8b(
                 reinterpret_cast<int *>(rhs_matrix.data_ptr<int>()),
                 rhs_stride, 
                 reinterpret_cast<half *>(output_matrix.data_ptr<torch::Half>()),
-	        output_stride);
+	        output_stride, batch_offsets_ptr, entry_scales_ptr, num_entry_scales);
             break;
         case 4:
             batched_wmmaSpmm_16b8b_template<int, long long, 1, 16, 64, 32, 2, 4>(m_vec, vec_length, n, k, batch_size, scale,
@@ -1278,7 +1410,7 @@ torch::Tensor batched_deq_spmm_mma_16b8b(
                 reinterpret_cast<int *>(rhs_matrix.data_ptr<int>()),
                 rhs_stride, 
                 reinterpret_cast<half *>(output_matrix.data_ptr<torch::Half>()),
-	        output_stride);
+	        output_stride, batch_offsets_ptr, entry_scales_ptr, num_entry_scales);
             break;
         case 8:
             batched_wmmaSpmm_16b8b_template<int, long long, 1, 16, 64, 32, 2, 8>(m_vec, vec_length, n, k, batch_size, scale,
@@ -1288,7 +1420,7 @@ torch::Tensor batched_deq_spmm_mma_16b8b(
                 reinterpret_cast<int *>(rhs_matrix.data_ptr<int>()),
                 rhs_stride, 
                 reinterpret_cast<half *>(output_matrix.data_ptr<torch::Half>()),
-	        output_stride);
+	        output_stride, batch_offsets_ptr, entry_scales_ptr, num_entry_scales);
             break;
         default:
             printf("Unsupported Vector Length!\n");
@@ -1307,7 +1439,10 @@ torch::Tensor batched_deq_spmm_mma_4b(
     int vec_length,
     int bits_lhs,
     int bits_rhs,
-    float scale)
+    float scale,
+    torch::Tensor batch_offsets,
+    torch::Tensor entry_scales,
+    torch::Tensor out)
 {
     int rhs_num_items_per_int32 = 32 / bits_rhs;
 
@@ -1326,13 +1461,20 @@ torch::Tensor batched_deq_spmm_mma_4b(
     int nnz = column_indices.numel();
 
 
-    int values_stride = nnz; //stride in vector format
+    int values_stride = batch_offsets.defined() ? 1 : nnz; //stride in vector format
     int rhs_stride = k * n_int32;
     int output_stride = m * n;
 
+    // With distinct masks per entry, row_indices is {batch, m_vec},
+    // row_offsets {batch, m_vec * 2}, and batch_offsets {batch + 1} holds the
+    // first vector of every mask in the concatenated column_indices and values
+    const int* batch_offsets_ptr = batch_offsets_data(batch_offsets, row_indices, row_offsets, column_indices, rhs_matrix.device(), batch_size, m_vec);
+    int num_entry_scales;
+    const float* entry_scales_ptr = entry_scales_data(entry_scales, rhs_matrix.device(), &num_entry_scales);
+
     auto options = torch::TensorOptions().dtype(torch::kFloat16).device(rhs_matrix.device());
 
-    auto output_matrix = torch::empty({batch_size, m, n}, options);
+    auto output_matrix = output_buffer(out, {batch_size, m, n}, options, "bspmm");
 
 
     switch(vec_length){
@@ -1344,7 +1486,7 @@ torch::Tensor batched_deq_spmm_mma_4b(
                 reinterpret_cast<int *>(rhs_matrix.data_ptr<int>()),
                 rhs_stride, 
                 reinterpret_cast<half *>(output_matrix.data_ptr<torch::Half>()),
-	        output_stride);
+	        output_stride, batch_offsets_ptr, entry_scales_ptr, num_entry_scales);
             break;
         case 4:
             batched_wmmaSpmm_4b_template<int, short, 1, 32, 64, 32, 2, 4>(m_vec, vec_length, n, k, batch_size, scale,
@@ -1354,7 +1496,7 @@ torch::Tensor batched_deq_spmm_mma_4b(
                 reinterpret_cast<int *>(rhs_matrix.data_ptr<int>()),
                 rhs_stride, 
                 reinterpret_cast<half *>(output_matrix.data_ptr<torch::Half>()),
-	        output_stride);
+	        output_stride, batch_offsets_ptr, entry_scales_ptr, num_entry_scales);
             break;
         case 8:
             batched_wmmaSpmm_4b_template<int, int, 1, 32, 64, 32, 2, 8>(m_vec, vec_length, n, k, batch_size, scale,
@@ -1364,7 +1506,7 @@ torch::Tensor batched_deq_spmm_mma_4b(
                 reinterpret_cast<int *>(rhs_matrix.data_ptr<int>()),
                 rhs_stride, 
                 reinterpret_cast<half *>(output_matrix.data_ptr<torch::Half>()),
-	        output_stride);
+	        output_stride, batch_offsets_ptr, entry_scales_ptr, num_entry_scales);
             break;
         default:
             printf("Unsupported Vector Length!\n");
@@ -1384,7 +1526,10 @@ torch::Tensor batched_deq_spmm_mma_8b4b(
     int vec_length,
     int bits_lhs,
     int bits_rhs,
-    float scale)
+    float scale,
+    torch::Tensor batch_offsets,
+    torch::Tensor entry_scales,
+    torch::Tensor out)
 {
     int rhs_num_items_per_int32 = 32 / bits_rhs;
 
@@ -1403,13 +1548,20 @@ torch::Tensor batched_deq_spmm_mma_8b4b(
     int nnz = column_indices.numel();
 
 
-    int values_stride = nnz; //stride in vector format
+    int values_stride = batch_offsets.defined() ? 1 : nnz; //stride in vector format
     int rhs_stride = k * n_int32;
     int output_stride = m * n;
 
+    // With distinct masks per entry, row_indices is {batch, m_vec},
+    // row_offsets {batch, m_vec * 2}, and batch_offsets {batch + 1} holds the
+    // first vector of every mask in the concatenated column_indices and values
+    const int* batch_offsets_ptr = batch_offsets_data(batch_offsets, row_indices, row_offsets, column_indices, rhs_matrix.device(), batch_size, m_vec);
+    int num_entry_scales;
+    const float* entry_scales_ptr = entry_scales_data(entry_scales, rhs_matrix.device(), &num_entry_scales);
+
     auto options = torch::TensorOptions().dtype(torch::kFloat16).device(rhs_matrix.device());
 
-    auto output_matrix = torch::empty({batch_size, m, n}, options);
+    auto output_matrix = output_buffer(out, {batch_size, m, n}, options, "bspmm");
 
 
     switch(vec_length){
@@ -1421,7 +1573,7 @@ torch::Tensor batched_deq_spmm_mma_8b4b(
                 reinterpret_cast<int *>(rhs_matrix.data_ptr<int>()),
                 rhs_stride, 
                 reinterpret_cast<half *>(output_matrix.data_ptr<torch::Half>()),
-	        output_stride);
+	        output_stride, batch_offsets_ptr, entry_scales_ptr, num_entry_scales);
             break;
         case 4:
             batched_wmmaSpmm_8b4b_template<int, int, 1, 32, 64, 32, 2, 4>(m_vec, vec_length, n, k, batch_size, scale,
@@ -1431,7 +1583,7 @@ torch::Tensor batched_deq_spmm_mma_8b4b(
                 reinterpret_cast<int *>(rhs_matrix.data_ptr<int>()),
                 rhs_stride, 
                 reinterpret_cast<half *>(output_matrix.data_ptr<torch::Half>()),
-	        output_stride);
+	        output_stride, batch_offsets_ptr, entry_scales_ptr, num_entry_scales);
             break;
         case 8:
             batched_wmmaSpmm_8b4b_template<int, long long, 1, 32, 64, 32, 2, 8>(m_vec, vec_length, n, k, batch_size, scale,
@@ -1441,7 +1593,7 @@ torch::Tensor batched_deq_spmm_mma_8b4b(
                 reinterpret_cast<int *>(rhs_matrix.data_ptr<int>()),
                 rhs_stride, 
                 reinterpret_cast<half *>(output_matrix.data_ptr<torch::Half>()),
-	        output_stride);
+	        output_stride, batch_offsets_ptr, entry_scales_ptr, num_entry_scales);
             break;
         default:
             printf("Unsupported Vector Length!\n");
@@ -1458,7 +1610,10 @@ torch::Tensor batched_deq_spmm_mma_8b(
     int vec_length,
     int bits_lhs,
     int bits_rhs,
-    float scale)
+    float scale,
+    torch::Tensor batch_offsets,
+    torch::Tensor entry_scales,
+    torch::Tensor out)
 {
     //int lhs_num_items_per_int32 = 32 / bits_lhs;
     int rhs_num_items_per_int32 = 32 / bits_rhs;
@@ -1478,13 +1633,20 @@ torch::Tensor batched_deq_spmm_mma_8b(
     int nnz = column_indices.numel();
 
 
-    int values_stride = nnz; //stride in vector format
+    int values_stride = batch_offsets.defined() ? 1 : nnz; //stride in vector format
     int rhs_stride = k * n_int32;
     int output_stride = m * n;
 
+    // With distinct masks per entry, row_indices is {batch, m_vec},
+    // row_offsets {batch, m_vec * 2}, and batch_offsets {batch + 1} holds the
+    // first vector of every mask in the concatenated column_indices and values
+    const int* batch_offsets_ptr = batch_offsets_data(batch_offsets, row_indices, row_offsets, column_indices, rhs_matrix.device(), batch_size, m_vec);
+    int num_entry_scales;
+    const float* entry_scales_ptr = entry_scales_data(entry_scales, rhs_matrix.device(), &num_entry_scales);
+
     auto options = torch::TensorOptions().dtype(torch::kFloat16).device(rhs_matrix.device());
 
-    auto output_matrix = torch::empty({batch_size, m, n}, options);
+    auto output_matrix = output_buffer(out, {batch_size, m, n}, options, "bspmm");
 
 
     switch(vec_length){
@@ -1496,7 +1658,7 @@ torch::Tensor batched_deq_spmm_mma_8b(
                 reinterpret_cast<int *>(rhs_matrix.data_ptr<int>()),
                 rhs_stride, 
                 reinterpret_cast<half *>(output_matrix.data_ptr<torch::Half>()),
-	        output_stride);
+	        output_stride, batch_offsets_ptr, entry_scales_ptr, num_entry_scales);
             break;
         case 4:
             batched_wmmaSpmm_8b_template<int, int, 1, 16, 64, 32, 2, 4>(m_vec, vec_length, n, k, batch_size, scale,
@@ -1506,7 +1668,7 @@ torch::Tensor batched_deq_spmm_mma_8b(
                 reinterpret_cast<int *>(rhs_matrix.data_ptr<int>()),
                 rhs_stride, 
                 reinterpret_cast<half *>(output_matrix.data_ptr<torch::Half>()),
-	        output_stride);
+	        output_stride, batch_offsets_ptr, entry_scales_ptr, num_entry_scales);
             break;
         case 8:
             batched_wmmaSpmm_8b_template<int, long long, 1, 16, 64, 32, 2, 8>(m_vec, vec_length, n, k, batch_size, scale,
@@ -1516,7 +1678,7 @@ torch::Tensor batched_deq_spmm_mma_8b(
                 reinterpret_cast<int *>(rhs_matrix.data_ptr<int>()),
                 rhs_stride, 
                 reinterpret_cast<half *>(output_matrix.data_ptr<torch::Half>()),
-	        output_stride);
+	        output_stride, batch_offsets_ptr, entry_scales_ptr, num_entry_scales);
             break;
         default:
             printf("Unsupported Vector Length!\n");
@@ -1534,7 +1696,10 @@ torch::Tensor batched_deq_spmm_mma_16b(
     int vec_length,
     int bits_lhs,
     int bits_rhs,
-    float scale)
+    float scale,
+    torch::Tensor batch_offsets,
+    torch::Tensor entry_scales,
+    torch::Tensor out)
 {
     //int lhs_num_items_per_int32 = 32 / bits_lhs;
     int rhs_num_items_per_int32 = 32 / bits_rhs;
@@ -1554,13 +1719,20 @@ torch::Tensor batched_deq_spmm_mma_16b(
     int nnz = column_indices.numel();
 
 
-    int values_stride = nnz; //stride in vector format
+    int values_stride = batch_offsets.defined() ? 1 : nnz; //stride in vector format
     int rhs_stride = k * n_int32;
     int output_stride = m * n;
 
+    // With distinct masks per entry, row_indices is {batch, m_vec},
+    // row_offsets {batch, m_vec * 2}, and batch_offsets {batch + 1} holds the
+    // first vector of every mask in the concatenated column_indices and values
+    const int* batch_offsets_ptr = batch_offsets_data(batch_offsets, row_indices, row_offsets, column_indices, rhs_matrix.device(), batch_size, m_vec);
+    int num_entry_scales;
+    const float* entry_scales_ptr = entry_scales_data(entry_scales, rhs_matrix.device(), &num_entry_scales);
+
     auto options = torch::TensorOptions().dtype(torch::kFloat16).device(rhs_matrix.device());
 
-    auto output_matrix = torch::empty({batch_size, m, n}, options);
+    auto output_matrix = output_buffer(out, {batch_size, m, n}, options, "bspmm");
 
 
     switch(vec_length){
@@ -1572,7 +1744,7 @@ torch::Tensor batched_deq_spmm_mma_16b(
                 reinterpret_cast<int *>(rhs_matrix.data_ptr<int>()),
                 rhs_stride, 
                 reinterpret_cast<half *>(output_matrix.data_ptr<torch::Half>()),
-	        output_stride);
+	        output_stride, batch_offsets_ptr, entry_scales_ptr, num_entry_scales);
             break;
         case 4:
             batched_wmmaSpmm_16b_template<int, int, 1, 16, 64, 32, 2, 4>(m_vec, vec_length, n, k, batch_size, scale,
@@ -1582,7 +1754,7 @@ torch::Tensor batched_deq_spmm_mma_16b(
                 reinterpret_cast<int *>(rhs_matrix.data_ptr<int>()),
                 rhs_stride, 
                 reinterpret_cast<half *>(output_matrix.data_ptr<torch::Half>()),
-	        output_stride);
+	        output_stride, batch_offsets_ptr, entry_scales_ptr, num_entry_scales);
             break;
         case 8:
             batched_wmmaSpmm_16b_template<int, long long, 1, 16, 64, 32, 2, 8>(m_vec, vec_length, n, k, batch_size, scale,
@@ -1592,10 +1764,30 @@ torch::Tensor batched_deq_spmm_mma_16b(
                 reinterpret_cast<int *>(rhs_matrix.data_ptr<int>()),
                 rhs_stride, 
                 reinterpret_cast<half *>(output_matrix.data_ptr<torch::Half>()),
-	        output_stride);
+	        output_stride, batch_offsets_ptr, entry_scales_ptr, num_entry_scales);
             break;
         default:
             printf("Unsupported Vector Length!\n");
     }
     return output_matrix;
 }
+
+__global__ void byte_transpose_4x4_kernel(const int *in, int *out, int64_t num_groups){
+    const int64_t group = blockIdx.x * static_cast<int64_t>(blockDim.x) + threadIdx.x;
+    if(group < num_groups) ByteTranspose4x4(in + group * 4, out + group * 4);
+}
+
+// ByteTranspose4x4 of every four consecutive ints of in, so the PRMT
+// selectors of the 8-bit rhs fragments can be checked from Python
+torch::Tensor byte_transpose_4x4(torch::Tensor in){
+    TORCH_CHECK(in.scalar_type() == torch::kInt32 && in.is_cuda() && in.is_contiguous(),
+                "byte_transpose_4x4 takes a contiguous int32 CUDA tensor");
+    TORCH_CHECK(in.numel() % 4 == 0, "byte_transpose_4x4 takes groups of four ints");
+    auto out = torch::empty_like(in);
+    const int64_t num_groups = in.numel() / 4;
+    if(num_groups == 0) return out;
+    const int threads = 128;
+    byte_transpose_4x4_kernel<<<(num_groups + threads - 1) / threads, threads, 0, c10::cuda::getCurrentCUDAStream()>>>(
+        in.data_ptr<int>(), out.data_ptr<int>(), num_groups);
+    return out;
+}
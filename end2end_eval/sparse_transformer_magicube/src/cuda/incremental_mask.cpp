@@ -0,0 +1,315 @@
+#include <torch/extension.h>
+#include <ATen/Parallel.h>
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <tuple>
+#include <vector>
+#include "aligned_mask.h"
+
+// Appendable aligned mask for autoregressive decoding. The aligned layout
+// already addresses every row of vectors through a (begin, end) pair, so rows
+// need not be adjacent: row r owns the row_capacity slots starting at
+// r * row_capacity, a multiple of mma_k_dim, and its unused slots hold -1
+// like the padding of align_mask. Appending a row of vectors (a new block of
+// queries) or columns to an existing row (a new key attended by it) writes
+// only the new indices and one (begin, end) pair.
+//
+// The tensors have the layout of aligned_mask_from_csr, restricted to the
+// rows appended so far:
+//
+//   column_indices          num_rows * row_capacity indices
+//   column_indices_shuffle  the same, interleaved within every 8 indices
+//   row_offsets             num_rows (begin, end) pairs
+//   row_indices             the rows in append order. The kernels take them in
+//                           any order; sorting them by length only balances
+//                           the schedule and would cost O(num_rows) per step
+//
+// device_tensors keeps a copy on the device and uploads only the span of rows
+// changed since the previous call. A row outgrowing row_capacity, or more rows
+// than max_rows, doubles the capacity and lays the mask out again, so appends
+// stay amortized O(new indices).
+//
+// sddmm_row_cpu and spmm_row_cpu are the CPU single-row steps of attention:
+// the scores of the queries of one row against the keys it attends, and
+// their product with the values, both O(nnz(row) * head_dim).
+
+class IncrementalMask{
+public:
+    IncrementalMask(int64_t mma_k_dim, int64_t row_capacity, int64_t max_rows)
+        : mma_k_dim_(mma_k_dim), row_capacity_(0), max_rows_(0), num_rows_(0),
+          dirty_begin_(0), dirty_end_(0){
+        TORCH_CHECK(mma_k_dim == 8 || mma_k_dim == 16 || mma_k_dim == 32, "mma_k_dim must be 8, 16 or 32");
+        TORCH_CHECK(row_capacity > 0 && max_rows > 0, "row_capacity and max_rows must be positive");
+        reserve(max_rows, row_capacity);
+    }
+
+    // Appends a row of vectors with the given column indices (strictly
+    // increasing, possibly empty) and returns its index
+    int64_t append_row(torch::Tensor columns){
+        torch::Tensor c = check_columns(columns);
+        if(num_rows_ == max_rows_) reserve(max_rows_ * 2, row_capacity_);
+        const int64_t row = num_rows_++;
+        int *offsets_ptr = offsets_.data_ptr<int>();
+        offsets_ptr[row*2] = offsets_ptr[row*2+1] = static_cast<int>(row * row_capacity_);
+        write(row, c.data_ptr<int>(), c.numel());
+        return row;
+    }
+
+    // Appends column indices to an existing row, larger than its last one
+    void append(int64_t row, torch::Tensor columns){
+        TORCH_CHECK(row >= 0 && row < num_rows_, "row ", row, " out of range");
+        torch::Tensor c = check_columns(columns);
+        write(row, c.data_ptr<int>(), c.numel());
+    }
+
+    // Appends every row of a CSR mask (row_offsets has m + 1 entries)
+    void extend(torch::Tensor row_offsets, torch::Tensor column_indices){
+        TORCH_CHECK(row_offsets.dim() == 1 && row_offsets.size(0) >= 1, "row_offsets must be a 1-d tensor of m + 1 offsets");
+        torch::Tensor offsets = row_offsets.to(torch::kCPU, torch::kInt64).contiguous();
+        torch::Tensor columns = column_indices.to(torch::kCPU, torch::kInt32).contiguous();
+        const int64_t m = offsets.size(0) - 1;
+        const int64_t *csr_ptr = offsets.data_ptr<int64_t>();
+        TORCH_CHECK(csr_ptr[0] == 0 && csr_ptr[m] == columns.numel(), "row_offsets do not match column_indices");
+
+        int64_t longest = 0;
+        for(int64_t i = 0; i < m; i++) longest = std::max(longest, csr_ptr[i+1] - csr_ptr[i]);
+        reserve(std::max(max_rows_, num_rows_ + m), std::max(row_capacity_, longest));
+
+        const int64_t first = num_rows_;
+        num_rows_ += m;
+        int *offsets_ptr = offsets_.data_ptr<int>();
+        const int *col_ptr = columns.data_ptr<int>();
+        at::parallel_for(0, m, kGrainSize, [&](int64_t begin, int64_t end){
+            for(int64_t i = begin; i < end; i++){
+                const int64_t row = first + i;
+                offsets_ptr[row*2] = offsets_ptr[row*2+1] = static_cast<int>(row * row_capacity_);
+                write_slots(row, col_ptr + csr_ptr[i], csr_ptr[i+1] - csr_ptr[i]);
+            }
+        });
+        mark_dirty(first, num_rows_);
+    }
+
+    int64_t num_rows() const{ return num_rows_; }
+    int64_t row_capacity() const{ return row_capacity_; }
+    int64_t max_rows() const{ return max_rows_; }
+
+    int64_t nnz(int64_t row) const{
+        TORCH_CHECK(row >= 0 && row < num_rows_, "row ", row, " out of range");
+        const int *offsets_ptr = offsets_.data_ptr<int>();
+        return offsets_ptr[row*2+1] - offsets_ptr[row*2];
+    }
+
+    // CPU views of the appended rows; a later reserve leaves them stale
+    std::tuple<torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor> tensors() const{
+        return std::make_tuple(columns_.narrow(0, 0, num_rows_ * row_capacity_),
+                               shuffle_.narrow(0, 0, num_rows_ * row_capacity_),
+                               offsets_.narrow(0, 0, num_rows_ * 2),
+                               row_indices_.narrow(0, 0, num_rows_));
+    }
+
+    // The same tensors on device, uploading the rows changed since the last call
+    std::tuple<torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor> device_tensors(torch::Device device){
+        if(!device_columns_.defined() || device_columns_.device() != device ||
+           device_columns_.numel() != columns_.numel()){
+            device_columns_ = columns_.to(device);
+            device_shuffle_ = shuffle_.to(device);
+            device_offsets_ = offsets_.to(device);
+            device_row_indices_ = row_indices_.to(device);
+        }
+        else if(dirty_begin_ < dirty_end_){
+            const int64_t begin = dirty_begin_ * row_capacity_, count = (dirty_end_ - dirty_begin_) * row_capacity_;
+            device_columns_.narrow(0, begin, count).copy_(columns_.narrow(0, begin, count));
+            device_shuffle_.narrow(0, begin, count).copy_(shuffle_.narrow(0, begin, count));
+            device_offsets_.narrow(0, dirty_begin_ * 2, (dirty_end_ - dirty_begin_) * 2)
+                .copy_(offsets_.narrow(0, dirty_begin_ * 2, (dirty_end_ - dirty_begin_) * 2));
+        }
+        dirty_begin_ = dirty_end_ = 0;
+        return std::make_tuple(device_columns_.narrow(0, 0, num_rows_ * row_capacity_),
+                               device_shuffle_.narrow(0, 0, num_rows_ * row_capacity_),
+                               device_offsets_.narrow(0, 0, num_rows_ * 2),
+                               device_row_indices_.narrow(0, 0, num_rows_));
+    }
+
+    // q is {batch, lanes, k} (lanes <= vec_length queries of the row), keys
+    // {batch, n, k}. Returns the {batch, nnz(row), lanes} float scores, laid
+    // out like the values of one vector per column index.
+    torch::Tensor sddmm_row_cpu(int64_t row, torch::Tensor q, torch::Tensor keys) const{
+        TORCH_CHECK(q.dim() == 3 && keys.dim() == 3 && q.size(0) == keys.size(0) && q.size(2) == keys.size(2),
+                    "q must be {batch, lanes, k} and keys {batch, n, k}");
+        const int64_t count = nnz(row), batch = q.size(0), lanes = q.size(1), n = keys.size(1), k = q.size(2);
+        const int *row_ptr = row_columns(row, n);
+        torch::Tensor a = q.detach().to(torch::kCPU, torch::kFloat32).contiguous();
+        torch::Tensor b = keys.detach().to(torch::kCPU, torch::kFloat32).contiguous();
+        torch::Tensor output = torch::empty({batch, count, lanes}, torch::kFloat32);
+        const float *a_ptr = a.data_ptr<float>(), *b_ptr = b.data_ptr<float>();
+        float *out_ptr = output.data_ptr<float>();
+
+        at::parallel_for(0, batch * count, kGrainSize, [&](int64_t begin, int64_t end){
+            for(int64_t i = begin; i < end; i++){
+                const int64_t e = i / count, j = i % count;
+                const float *y = b_ptr + (e * n + row_ptr[j]) * k;
+                for(int64_t v = 0; v < lanes; v++){
+                    const float *x = a_ptr + (e * lanes + v) * k;
+                    float acc = 0.0f;
+                    for(int64_t c = 0; c < k; c++) acc += x[c] * y[c];
+                    out_ptr[i * lanes + v] = acc;
+                }
+            }
+        });
+        return output;
+    }
+
+    // values is {batch, nnz(row), lanes} (softmaxed scores), rhs {batch, n, k}.
+    // Returns the {batch, lanes, k} float product.
+    torch::Tensor spmm_row_cpu(int64_t row, torch::Tensor values, torch::Tensor rhs) const{
+        TORCH_CHECK(values.dim() == 3 && rhs.dim() == 3 && values.size(0) == rhs.size(0),
+                    "values must be {batch, nnz, lanes} and rhs {batch, n, k}");
+        const int64_t count = nnz(row), batch = values.size(0), lanes = values.size(2), n = rhs.size(1), k = rhs.size(2);
+        TORCH_CHECK(values.size(1) == count, "values has ", values.size(1), " entries, the row ", count);
+        const int *row_ptr = row_columns(row, n);
+        torch::Tensor a = values.detach().to(torch::kCPU, torch::kFloat32).contiguous();
+        torch::Tensor b = rhs.detach().to(torch::kCPU, torch::kFloat32).contiguous();
+        torch::Tensor output = torch::zeros({batch, lanes, k}, torch::kFloat32);
+        const float *a_ptr = a.data_ptr<float>(), *b_ptr = b.data_ptr<float>();
+        float *out_ptr = output.data_ptr<float>();
+
+        at::parallel_for(0, batch * lanes, 1, [&](int64_t begin, int64_t end){
+            for(int64_t i = begin; i < end; i++){
+                const int64_t e = i / lanes, v = i % lanes;
+                float *y = out_ptr + i * k;
+                for(int64_t j = 0; j < count; j++){
+                    const float w = a_ptr[(e * count + j) * lanes + v];
+                    const float *x = b_ptr + (e * n + row_ptr[j]) * k;
+                    for(int64_t c = 0; c < k; c++) y[c] += w * x[c];
+                }
+            }
+        });
+        return output;
+    }
+
+private:
+    torch::Tensor check_columns(torch::Tensor columns) const{
+        TORCH_CHECK(columns.dim() == 1, "columns must be a 1-d tensor");
+        torch::Tensor c = columns.to(torch::kCPU, torch::kInt32).contiguous();
+        const int *c_ptr = c.data_ptr<int>();
+        for(int64_t i = 0; i < c.numel(); i++)
+            TORCH_CHECK(c_ptr[i] >= 0 && (i == 0 || c_ptr[i] > c_ptr[i-1]), "columns must be non-negative and strictly increasing");
+        return c;
+    }
+
+    const int *row_columns(int64_t row, int64_t n) const{
+        const int *row_ptr = columns_.data_ptr<int>() + offsets_.data_ptr<int>()[row*2];
+        const int64_t count = nnz(row);
+        TORCH_CHECK(count == 0 || row_ptr[count-1] < n, "column index ", count ? row_ptr[count-1] : 0, " out of range");
+        return row_ptr;
+    }
+
+    // Appends count indices to a row, growing the capacity if needed
+    void write(int64_t row, const int *columns, int64_t count){
+        const int64_t length = nnz(row);
+        TORCH_CHECK(count == 0 || length == 0 || columns[0] > columns_.data_ptr<int>()[row * row_capacity_ + length - 1],
+                    "appended columns must be larger than the last column of row ", row);
+        if(length + count > row_capacity_){
+            int64_t capacity = row_capacity_;
+            while(capacity < length + count) capacity *= 2;
+            reserve(max_rows_, capacity);
+        }
+        write_slots(row, columns, count);
+        mark_dirty(row, row + 1);
+    }
+
+    void write_slots(int64_t row, const int *columns, int64_t count){
+        int *offsets_ptr = offsets_.data_ptr<int>();
+        int *col_ptr = columns_.data_ptr<int>(), *shuffle_ptr = shuffle_.data_ptr<int>();
+        for(int64_t i = 0; i < count; i++){
+            const int64_t p = offsets_ptr[row*2+1] + i, j = p % 8;
+            col_ptr[p] = columns[i];
+            shuffle_ptr[p - j + (j%2)*4 + j/2] = columns[i];
+        }
+        offsets_ptr[row*2+1] += static_cast<int>(count);
+    }
+
+    // Lays the rows out again with at least max_rows rows of row_capacity slots
+    void reserve(int64_t max_rows, int64_t row_capacity){
+        row_capacity = (row_capacity + mma_k_dim_ - 1) / mma_k_dim_ * mma_k_dim_;
+        if(max_rows <= max_rows_ && row_capacity <= row_capacity_) return;
+        max_rows = std::max(max_rows, max_rows_);
+        row_capacity = std::max(row_capacity, row_capacity_);
+        TORCH_CHECK(max_rows * row_capacity <= std::numeric_limits<int>::max(), "the mask exceeds the int32 index range");
+
+        auto options = torch::TensorOptions().dtype(torch::kInt32);
+        torch::Tensor columns = torch::full({max_rows * row_capacity}, -1, options);
+        torch::Tensor shuffle = torch::full({max_rows * row_capacity}, -1, options);
+        torch::Tensor offsets = torch::zeros({max_rows * 2}, options);
+        torch::Tensor row_indices = torch::empty({max_rows}, options);
+        std::iota(row_indices.data_ptr<int>(), row_indices.data_ptr<int>() + max_rows, 0);
+
+        if(num_rows_ > 0){
+            const int *old_offsets = offsets_.data_ptr<int>(), *old_columns = columns_.data_ptr<int>();
+            int *offsets_ptr = offsets.data_ptr<int>(), *col_ptr = columns.data_ptr<int>(), *shuffle_ptr = shuffle.data_ptr<int>();
+            at::parallel_for(0, num_rows_, kGrainSize, [&](int64_t begin, int64_t end){
+                for(int64_t r = begin; r < end; r++){
+                    const int64_t length = old_offsets[r*2+1] - old_offsets[r*2];
+                    offsets_ptr[r*2] = static_cast<int>(r * row_capacity);
+                    offsets_ptr[r*2+1] = static_cast<int>(r * row_capacity + length);
+                    for(int64_t i = 0; i < length; i++){
+                        const int64_t p = r * row_capacity + i, j = p % 8;
+                        col_ptr[p] = old_columns[old_offsets[r*2] + i];
+                        shuffle_ptr[p - j + (j%2)*4 + j/2] = col_ptr[p];
+                    }
+                }
+            });
+        }
+        columns_ = columns;
+        shuffle_ = shuffle;
+        offsets_ = offsets;
+        row_indices_ = row_indices;
+        max_rows_ = max_rows;
+        row_capacity_ = row_capacity;
+        // device_tensors sees the size change and uploads everything
+        device_columns_ = torch::Tensor();
+        dirty_begin_ = dirty_end_ = 0;
+    }
+
+    void mark_dirty(int64_t begin, int64_t end){
+        if(dirty_begin_ == dirty_end_){
+            dirty_begin_ = begin;
+            dirty_end_ = end;
+            return;
+        }
+        dirty_begin_ = std::min(dirty_begin_, begin);
+        dirty_end_ = std::max(dirty_end_, end);
+    }
+
+    int64_t mma_k_dim_;
+    int64_t row_capacity_;
+    int64_t max_rows_;
+    int64_t num_rows_;
+    int64_t dirty_begin_;
+    int64_t dirty_end_;
+    torch::Tensor columns_;
+    torch::Tensor shuffle_;
+    torch::Tensor offsets_;
+    torch::Tensor row_indices_;
+    torch::Tensor device_columns_;
+    torch::Tensor device_shuffle_;
+    torch::Tensor device_offsets_;
+    torch::Tensor device_row_indices_;
+};
+
+PYBIND11_MODULE(TORCH_EXTENSION_NAME, m){
+    py::class_<IncrementalMask>(m, "IncrementalMask")
+        .def(py::init<int64_t, int64_t, int64_t>(), py::arg("mma_k_dim"), py::arg("row_capacity"), py::arg("max_rows"))
+        .def("append_row", &IncrementalMask::append_row, "Append a row of vectors, returns its index")
+        .def("append", &IncrementalMask::append, "Append column indices to a row")
+        .def("extend", &IncrementalMask::extend, "Append every row of a CSR mask")
+        .def("num_rows", &IncrementalMask::num_rows, "Number of rows appended")
+        .def("row_capacity", &IncrementalMask::row_capacity, "Slots per row")
+        .def("max_rows", &IncrementalMask::max_rows, "Rows before the mask is laid out again")
+        .def("nnz", &IncrementalMask::nnz, "Number of column indices of a row")
+        .def("tensors", &IncrementalMask::tensors, "(column_indices, column_indices_shuffle, row_offsets, row_indices) on the CPU")
+        .def("device_tensors", &IncrementalMask::device_tensors, "The mask tensors on a device, uploading only the changed rows")
+        .def("sddmm_row_cpu", &IncrementalMask::sddmm_row_cpu, "Scores of the queries of one row on the CPU")
+        .def("spmm_row_cpu", &IncrementalMask::spmm_row_cpu, "Product of the scores of one row with the values on the CPU");
+}
@@ -0,0 +1,230 @@
+#include <torch/extension.h>
+#include "aligned_mask.h"
+#include <ATen/Parallel.h>
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <string>
+#include <vector>
+// The mismatch report of the Magicube benchmarks
+#include "../../../../SpMM/SpMM/include/verifier.h"
+
+// Host-side construction of the aligned sparse mask consumed by the deq_spmm
+// and deq_sddmm kernels, replacing the Python loops of
+// verify/static_mask.py::static_random_mask_aligned. Every row of vectors is
+// padded to a multiple of mma_k_dim; the five results are
+//
+//   column_indices          aligned column indices, padding slots hold -1
+//   column_indices_shuffle  the same, interleaved within every 8 indices for
+//                           the mma_k_dim = 32 kernels
+//   row_offsets             m (begin, end) pairs of the padded rows
+//   row_indices             rows sorted by length
+//   aligned_num_item        padded number of vectors
+//
+// The index tensors are int32 on the CPU; the caller moves them to the device.
+//
+// pack_masks concatenates the aligned masks of every batch entry (one per head
+// or per sequence) for the bspmm_*_masks and bsddmm_*_masks kernels, and
+// masked_bspmm_cpu / masked_bsddmm_cpu are the float references of those
+// kernels on the packed layout. verify_half compares an fp16 kernel output
+// with its reference in ulps.
+
+// From a CSR mask: row_offsets has m + 1 entries
+AlignedMask aligned_mask_from_csr(torch::Tensor row_offsets, torch::Tensor column_indices, int64_t mma_k_dim){
+    TORCH_CHECK(row_offsets.dim() == 1 && row_offsets.size(0) >= 1, "row_offsets must be a 1-d tensor of m + 1 offsets");
+    torch::Tensor offsets = row_offsets.to(torch::kCPU, torch::kInt64).contiguous();
+    torch::Tensor columns = column_indices.to(torch::kCPU, torch::kInt32).contiguous();
+    const int64_t m = offsets.size(0) - 1;
+    const int64_t *offsets_ptr = offsets.data_ptr<int64_t>();
+    TORCH_CHECK(offsets_ptr[0] == 0 && offsets_ptr[m] == columns.numel(), "row_offsets do not match column_indices");
+    return align_mask(m, offsets_ptr, columns.data_ptr<int>(), mma_k_dim);
+}
+
+// From an m x n boolean (or 0/1) mask, one entry per vector
+AlignedMask aligned_mask_from_dense(torch::Tensor mask, int64_t mma_k_dim){
+    TORCH_CHECK(mask.dim() == 2, "mask must be a 2-d tensor");
+    torch::Tensor dense = mask.to(torch::kCPU, torch::kBool).contiguous();
+    const int64_t m = dense.size(0), n = dense.size(1);
+    TORCH_CHECK(n <= std::numeric_limits<int>::max(), "the mask has too many columns");
+    const bool *dense_ptr = dense.data_ptr<bool>();
+
+    // Count the nonzeros of every row, then scatter the column indices
+    std::vector<int64_t> row_offsets(m + 1, 0);
+    at::parallel_for(0, m, kGrainSize, [&](int64_t begin, int64_t end){
+        for(int64_t i = begin; i < end; i++)
+            row_offsets[i+1] = std::count(dense_ptr + i * n, dense_ptr + (i + 1) * n, true);
+    });
+    std::partial_sum(row_offsets.begin(), row_offsets.end(), row_offsets.begin());
+    std::vector<int> column_indices(row_offsets[m]);
+    at::parallel_for(0, m, kGrainSize, [&](int64_t begin, int64_t end){
+        for(int64_t i = begin; i < end; i++){
+            int *out = column_indices.data() + row_offsets[i];
+            for(int64_t j = 0; j < n; j++)
+                if(dense_ptr[i * n + j]) *out++ = static_cast<int>(j);
+        }
+    });
+    return align_mask(m, row_offsets.data(), column_indices.data(), mma_k_dim);
+}
+
+// Packs one aligned mask per batch entry. All masks must have the same number
+// of rows. Returns
+//
+//   column_indices          the aligned column indices of every mask, concatenated
+//   column_indices_shuffle  the same for the shuffled indices
+//   row_offsets             {batch, m * 2}, relative to the start of each mask
+//   row_indices             {batch, m}
+//   batch_offsets           {batch + 1}, first vector of every mask
+std::tuple<torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor> pack_masks(
+    std::vector<AlignedMask> masks){
+    TORCH_CHECK(!masks.empty(), "pack_masks needs at least one mask");
+    const int64_t batch = masks.size();
+    const int64_t m = std::get<3>(masks[0]).numel();
+
+    auto options = torch::TensorOptions().dtype(torch::kInt32);
+    torch::Tensor batch_offsets = torch::empty({batch + 1}, options);
+    int *batch_offsets_ptr = batch_offsets.data_ptr<int>();
+    batch_offsets_ptr[0] = 0;
+    std::vector<torch::Tensor> columns, shuffles, row_offsets, row_indices;
+    for(int64_t b = 0; b < batch; b++){
+        const AlignedMask &mask = masks[b];
+        TORCH_CHECK(std::get<3>(mask).numel() == m && std::get<2>(mask).numel() == m * 2,
+                    "mask ", b, " has a different number of rows");
+        const int64_t num_item = std::get<0>(mask).numel();
+        TORCH_CHECK(batch_offsets_ptr[b] + num_item <= std::numeric_limits<int>::max(),
+                    "the packed masks exceed the int32 index range");
+        batch_offsets_ptr[b+1] = static_cast<int>(batch_offsets_ptr[b] + num_item);
+        columns.push_back(std::get<0>(mask).to(torch::kCPU, torch::kInt32));
+        shuffles.push_back(std::get<1>(mask).to(torch::kCPU, torch::kInt32));
+        row_offsets.push_back(std::get<2>(mask).to(torch::kCPU, torch::kInt32));
+        row_indices.push_back(std::get<3>(mask).to(torch::kCPU, torch::kInt32));
+    }
+    return std::make_tuple(torch::cat(columns), torch::cat(shuffles), torch::stack(row_offsets),
+                           torch::stack(row_indices), batch_offsets);
+}
+
+// From a {batch, m, n} boolean mask
+std::tuple<torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor> pack_dense_masks(
+    torch::Tensor mask, int64_t mma_k_dim){
+    TORCH_CHECK(mask.dim() == 3, "mask must be a 3-d tensor");
+    std::vector<AlignedMask> masks;
+    for(int64_t b = 0; b < mask.size(0); b++) masks.push_back(aligned_mask_from_dense(mask[b], mma_k_dim));
+    return pack_masks(masks);
+}
+
+static void check_packed(torch::Tensor row_offsets, torch::Tensor batch_offsets, int64_t batch){
+    TORCH_CHECK(row_offsets.dim() == 2 && row_offsets.size(0) == batch, "row_offsets must be {batch, m * 2}");
+    TORCH_CHECK(batch_offsets.numel() == batch + 1, "batch_offsets must have batch + 1 entries");
+}
+
+// Reference of bspmm_*_masks on dequantized operands: values is
+// {num_item, vec_length} (one row per packed vector), rhs {batch, k, n}.
+// Returns the {batch, m * vec_length, n} float product.
+torch::Tensor masked_bspmm_cpu(torch::Tensor row_offsets, torch::Tensor column_indices, torch::Tensor batch_offsets,
+                               torch::Tensor values, torch::Tensor rhs){
+    TORCH_CHECK(values.dim() == 2 && rhs.dim() == 3, "values must be {num_item, vec_length} and rhs {batch, k, n}");
+    const int64_t batch = rhs.size(0), n = rhs.size(2), vec_length = values.size(1);
+    check_packed(row_offsets, batch_offsets, batch);
+    torch::Tensor offsets = row_offsets.to(torch::kCPU, torch::kInt32).contiguous();
+    torch::Tensor columns = column_indices.to(torch::kCPU, torch::kInt32).contiguous();
+    torch::Tensor starts = batch_offsets.to(torch::kCPU, torch::kInt32).contiguous();
+    torch::Tensor lhs = values.to(torch::kCPU, torch::kFloat32).contiguous();
+    torch::Tensor dense = rhs.to(torch::kCPU, torch::kFloat32).contiguous();
+    const int64_t m = offsets.size(1) / 2, k = dense.size(1);
+
+    torch::Tensor output = torch::zeros({batch, m * vec_length, n}, torch::kFloat32);
+    const int *offsets_ptr = offsets.data_ptr<int>(), *col_ptr = columns.data_ptr<int>(), *start_ptr = starts.data_ptr<int>();
+    const float *lhs_ptr = lhs.data_ptr<float>(), *rhs_ptr = dense.data_ptr<float>();
+    float *out_ptr = output.data_ptr<float>();
+
+    at::parallel_for(0, batch * m, 1, [&](int64_t begin, int64_t end){
+        for(int64_t i = begin; i < end; i++){
+            const int64_t b = i / m, r = i % m;
+            const int *row = offsets_ptr + b * m * 2 + r * 2;
+            for(int64_t j = start_ptr[b] + row[0]; j < start_ptr[b] + row[1]; j++){
+                const int col = col_ptr[j];
+                if(col < 0) continue;
+                TORCH_CHECK(col < k, "column index ", col, " out of range");
+                const float *x = rhs_ptr + (b * k + col) * n;
+                for(int64_t v = 0; v < vec_length; v++){
+                    const float a = lhs_ptr[j * vec_length + v];
+                    float *y = out_ptr + (b * m * vec_length + r * vec_length + v) * n;
+                    for(int64_t c = 0; c < n; c++) y[c] += a * x[c];
+                }
+            }
+        }
+    });
+    return output;
+}
+
+// Reference of bsddmm_*_masks on dequantized operands: lhs is
+// {batch, m * vec_length, k}, rhs {batch, n, k}. Returns the
+// {num_item * vec_length} float values, vec_length per packed vector and 0
+// in the padding slots.
+torch::Tensor masked_bsddmm_cpu(torch::Tensor row_offsets, torch::Tensor column_indices, torch::Tensor batch_offsets,
+                                torch::Tensor lhs, torch::Tensor rhs, int64_t vec_length){
+    TORCH_CHECK(lhs.dim() == 3 && rhs.dim() == 3, "lhs must be {batch, m, k} and rhs {batch, n, k}");
+    const int64_t batch = lhs.size(0), k = lhs.size(2), n = rhs.size(1);
+    check_packed(row_offsets, batch_offsets, batch);
+    torch::Tensor offsets = row_offsets.to(torch::kCPU, torch::kInt32).contiguous();
+    torch::Tensor columns = column_indices.to(torch::kCPU, torch::kInt32).contiguous();
+    torch::Tensor starts = batch_offsets.to(torch::kCPU, torch::kInt32).contiguous();
+    torch::Tensor a = lhs.to(torch::kCPU, torch::kFloat32).contiguous();
+    torch::Tensor bt = rhs.to(torch::kCPU, torch::kFloat32).contiguous();
+    const int64_t m = offsets.size(1) / 2;
+    TORCH_CHECK(a.size(1) == m * vec_length, "lhs rows do not match the mask");
+
+    torch::Tensor output = torch::zeros({columns.numel() * vec_length}, torch::kFloat32);
+    const int *offsets_ptr = offsets.data_ptr<int>(), *col_ptr = columns.data_ptr<int>(), *start_ptr = starts.data_ptr<int>();
+    const float *a_ptr = a.data_ptr<float>(), *b_ptr = bt.data_ptr<float>();
+    float *out_ptr = output.data_ptr<float>();
+
+    at::parallel_for(0, batch * m, 1, [&](int64_t begin, int64_t end){
+        for(int64_t i = begin; i < end; i++){
+            const int64_t b = i / m, r = i % m;
+            const int *row = offsets_ptr + b * m * 2 + r * 2;
+            for(int64_t j = start_ptr[b] + row[0]; j < start_ptr[b] + row[1]; j++){
+                const int col = col_ptr[j];
+                if(col < 0) continue;
+                TORCH_CHECK(col < n, "column index ", col, " out of range");
+                const float *y = b_ptr + (b * n + col) * k;
+                for(int64_t v = 0; v < vec_length; v++){
+                    const float *x = a_ptr + (b * m * vec_length + r * vec_length + v) * k;
+                    float acc = 0.0f;
+                    for(int64_t c = 0; c < k; c++) acc += x[c] * y[c];
+                    out_ptr[j * vec_length + v] = acc;
+                }
+            }
+        }
+    });
+    return output;
+}
+
+// Compares the fp16 output of a deq kernel with its reference, both read as
+// rows x (numel / rows) row-major, and prints the mismatches, their tiles and
+// mma lanes. A value more than max_ulp halfs away is a mismatch; the kernels
+// store __float2half(acc / scale), so a reference dequantized the same way is
+// within an ulp. Returns the number of mismatches.
+int64_t verify_half(torch::Tensor got, torch::Tensor expected, int64_t rows, int64_t tile_rows, int64_t tile_cols,
+                    int64_t max_ulp, std::string name){
+    TORCH_CHECK(got.numel() == expected.numel(), "got has ", got.numel(), " values, expected ", expected.numel());
+    TORCH_CHECK(rows > 0 && got.numel() % rows == 0, "the ", got.numel(), " values do not make ", rows, " rows");
+    torch::Tensor a = got.to(torch::kCPU, torch::kFloat16).contiguous();
+    torch::Tensor b = expected.to(torch::kCPU, torch::kFloat16).contiguous();
+    VerifyOptions options = DefaultVerifyOptions(rows, got.numel() / rows, tile_rows, tile_cols);
+    options.mode = kVerifyUlp;
+    options.max_ulp = static_cast<int>(max_ulp);
+    VerifyReport report = VerifyHalf(reinterpret_cast<const uint16_t *>(a.data_ptr<at::Half>()),
+                                     reinterpret_cast<const uint16_t *>(b.data_ptr<at::Half>()), a.numel(), options);
+    PrintVerifyReport(stdout, name.c_str(), report);
+    return report.errors;
+}
+
+PYBIND11_MODULE(TORCH_EXTENSION_NAME, m){
+    m.def("aligned_mask_from_csr", &aligned_mask_from_csr, "Aligned mask tensors from a CSR mask");
+    m.def("aligned_mask_from_dense", &aligned_mask_from_dense, "Aligned mask tensors from a dense boolean mask");
+    m.def("pack_masks", &pack_masks, "Concatenate one aligned mask per batch entry");
+    m.def("pack_dense_masks", &pack_dense_masks, "Packed aligned masks from a batch of dense boolean masks");
+    m.def("masked_bspmm_cpu", &masked_bspmm_cpu, "CPU reference of the batched SpMM with a mask per entry");
+    m.def("masked_bsddmm_cpu", &masked_bsddmm_cpu, "CPU reference of the batched SDDMM with a mask per entry");
+    m.def("verify_half", &verify_half, "Ulp comparison of an fp16 kernel output with its reference");
+}
@@ -0,0 +1,24 @@
+#ifndef OUTPUT_BUFFER_H
+#define OUTPUT_BUFFER_H
+#include <torch/extension.h>
+
+// Output of an sptrans op. Without an out= tensor a fresh one is allocated;
+// otherwise out must have exactly the shape, dtype and device the op would
+// have allocated and is written in place, so a layer can cycle through
+// preallocated buffers.
+inline torch::Tensor output_buffer(
+    torch::Tensor out,
+    at::IntArrayRef sizes,
+    const torch::TensorOptions &options,
+    const char *op)
+{
+    if(!out.defined())
+        return torch::empty(sizes, options);
+    TORCH_CHECK(out.sizes() == sizes, op, ": out has shape ", out.sizes(), ", expected ", sizes);
+    TORCH_CHECK(out.dtype() == options.dtype(), op, ": out has dtype ", out.dtype(), ", expected ", options.dtype());
+    TORCH_CHECK(out.device() == options.device(), op, ": out is on ", out.device(), ", expected ", options.device());
+    TORCH_CHECK(out.is_contiguous(), op, ": out must be contiguous");
+    return out;
+}
+
+#endif
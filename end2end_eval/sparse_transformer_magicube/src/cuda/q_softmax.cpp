@@ -7,7 +7,8 @@ torch::Tensor csr_softmax_cuda(
     float sqrt_dk,
     float scale,
     int vec_length,
-    int bits);
+    int bits,
+    torch::Tensor out);
 
 
 torch::Tensor q_csr_softmax(
@@ -19,7 +20,22 @@ torch::Tensor q_csr_softmax(
     int vec_length,
     int bits)
 {
-    return csr_softmax_cuda(row_indices, row_offsets, values, sqrt_dk, scale, vec_length, bits);
+    return csr_softmax_cuda(row_indices, row_offsets, values, sqrt_dk, scale, vec_length, bits, torch::Tensor());
+}
+
+// Writes the quantized attention to out, a preallocated int32 tensor of the
+// shape q_csr_softmax returns
+torch::Tensor q_csr_softmax_out(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor values,
+    float sqrt_dk,
+    float scale,
+    int vec_length,
+    int bits,
+    torch::Tensor out)
+{
+    return csr_softmax_cuda(row_indices, row_offsets, values, sqrt_dk, scale, vec_length, bits, out);
 }
 
 
@@ -31,7 +47,8 @@ torch::Tensor batched_csr_softmax_cuda(
     float scale,
     int vec_length,
     int batch_size,
-    int bits);
+    int bits,
+    torch::Tensor out);
 
 
 torch::Tensor q_batched_csr_softmax(
@@ -44,10 +61,26 @@ torch::Tensor q_batched_csr_softmax(
     int batch_size,
     int bits)
 {
-    return batched_csr_softmax_cuda(row_indices, row_offsets, values, sqrt_dk, scale, vec_length, batch_size, bits);
+    return batched_csr_softmax_cuda(row_indices, row_offsets, values, sqrt_dk, scale, vec_length, batch_size, bits, torch::Tensor());
+}
+
+torch::Tensor q_batched_csr_softmax_out(
+    torch::Tensor row_indices,
+    torch::Tensor row_offsets,
+    torch::Tensor values,
+    float sqrt_dk,
+    float scale,
+    int vec_length,
+    int batch_size,
+    int bits,
+    torch::Tensor out)
+{
+    return batched_csr_softmax_cuda(row_indices, row_offsets, values, sqrt_dk, scale, vec_length, batch_size, bits, out);
 }
 
 PYBIND11_MODULE(TORCH_EXTENSION_NAME, m){
     m.def("q_csr_softmax", &q_csr_softmax, "Quantized Softmax kernel");
     m.def("q_bcsr_softmax", &q_batched_csr_softmax, "Quantized Batched Softmax kernel");
+    m.def("q_csr_softmax_out", &q_csr_softmax_out, "Quantized Softmax kernel writing to out");
+    m.def("q_bcsr_softmax_out", &q_batched_csr_softmax_out, "Quantized Batched Softmax kernel writing to out");
 }
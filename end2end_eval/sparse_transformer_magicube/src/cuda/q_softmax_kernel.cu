@@ -1,4 +1,6 @@
 #include <torch/extension.h>
+#include <c10/cuda/CUDAStream.h>
+#include "output_buffer.h"
 #include <cuda_runtime.h>
 #include <cuda.h>
 #include <vector>
@@ -318,7 +320,8 @@ torch::Tensor csr_softmax_cuda(
     float sqrt_dk,
     float scale,
     int vec_length,
-    int bits)
+    int bits,
+    torch::Tensor out)
 {
     int m = row_indices.size(0);
 
@@ -344,11 +347,12 @@ torch::Tensor csr_softmax_cuda(
     int num_attn = num_values / num_items_per_int32;
 
     auto options = torch::TensorOptions().dtype(torch::kInt32).device(values.device());
-    auto attn = torch::zeros({num_attn, }, options);
+    // Padding slots are not written by the kernel
+    auto attn = output_buffer(out, {num_attn, }, options, "q_csr_softmax").zero_();
 
     switch(vec_length){
         case 8:
-            csrSoftmaxKernel<8, float4, 128><<<grid, block>>>(
+            csrSoftmaxKernel<8, float4, 128><<<grid, block, 0, c10::cuda::getCurrentCUDAStream()>>>(
                 row_indices.data_ptr<int>(), row_offsets.data_ptr<int>(),
                 reinterpret_cast<half *>(values.data_ptr<torch::Half>()),
                 reinterpret_cast<int *>(attn.data_ptr<int>()),
@@ -360,7 +364,7 @@ torch::Tensor csr_softmax_cuda(
             break;
 
         case 4:
-            csrSoftmaxKernel<4, float2, 128><<<grid, block>>>(
+            csrSoftmaxKernel<4, float2, 128><<<grid, block, 0, c10::cuda::getCurrentCUDAStream()>>>(
                row_indices.data_ptr<int>(), row_offsets.data_ptr<int>(),
                reinterpret_cast<half *>(values.data_ptr<torch::Half>()),
                reinterpret_cast<int *>(attn.data_ptr<int>()),
@@ -372,7 +376,7 @@ torch::Tensor csr_softmax_cuda(
            break; 
         
         case 2:
-            csrSoftmaxKernel<2, float, 128><<<grid, block>>>(
+            csrSoftmaxKernel<2, float, 128><<<grid, block, 0, c10::cuda::getCurrentCUDAStream()>>>(
                row_indices.data_ptr<int>(), row_offsets.data_ptr<int>(),
                reinterpret_cast<half *>(values.data_ptr<torch::Half>()),
                reinterpret_cast<int *>(attn.data_ptr<int>()),
@@ -399,7 +403,8 @@ torch::Tensor batched_csr_softmax_cuda(
     float scale,
     int vec_length,
     int batch_size,
-    int bits)
+    int bits,
+    torch::Tensor out)
 {
     int m = row_indices.size(0);
     
@@ -425,12 +430,13 @@ torch::Tensor batched_csr_softmax_cuda(
     int attn_stride = values_stride / num_items_per_int32;
 
     auto options = torch::TensorOptions().dtype(torch::kInt32).device(values.device());
-    auto attn = torch::zeros({batch_size, attn_stride}, options);
+    // Padding slots are not written by the kernel
+    auto attn = output_buffer(out, {batch_size, attn_stride}, options, "q_bcsr_softmax").zero_();
 
 
     switch(vec_length){
         case 8:
-            batchedCsrSoftmaxKernel<8, float4, 128><<<grid, block>>>(
+            batchedCsrSoftmaxKernel<8, float4, 128><<<grid, block, 0, c10::cuda::getCurrentCUDAStream()>>>(
                 row_indices.data_ptr<int>(), row_offsets.data_ptr<int>(),
                 reinterpret_cast<half *>(values.data_ptr<torch::Half>()),
                 values_stride,
@@ -444,7 +450,7 @@ torch::Tensor batched_csr_softmax_cuda(
             break;
 
         case 4:
-            batchedCsrSoftmaxKernel<4, float2, 128><<<grid, block>>>(
+            batchedCsrSoftmaxKernel<4, float2, 128><<<grid, block, 0, c10::cuda::getCurrentCUDAStream()>>>(
                row_indices.data_ptr<int>(), row_offsets.data_ptr<int>(),
                reinterpret_cast<half *>(values.data_ptr<torch::Half>()),
                values_stride,
@@ -458,7 +464,7 @@ torch::Tensor batched_csr_softmax_cuda(
            break; 
         
         case 2:
-            batchedCsrSoftmaxKernel<2, float, 128><<<grid, block>>>(
+            batchedCsrSoftmaxKernel<2, float, 128><<<grid, block, 0, c10::cuda::getCurrentCUDAStream()>>>(
                row_indices.data_ptr<int>(), row_offsets.data_ptr<int>(),
                reinterpret_cast<half *>(values.data_ptr<torch::Half>()),
                values_stride,
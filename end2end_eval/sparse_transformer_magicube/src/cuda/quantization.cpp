@@ -1,21 +1,115 @@
 #include <torch/extension.h>
+#include <ATen/Parallel.h>
+#include <algorithm>
 
-torch::Tensor quantization_cuda(torch::Tensor input_matrix, int bits, float scale);
+torch::Tensor quantization_cuda(torch::Tensor input_matrix, int bits, float scale, torch::Tensor scales, torch::Tensor out);
 
 torch::Tensor quantization(torch::Tensor input_matrix, int bits, float scale)
 {
-    return quantization_cuda(input_matrix, bits, scale);
+    return quantization_cuda(input_matrix, bits, scale, torch::Tensor(), torch::Tensor());
 }
 
-torch::Tensor batched_quantization_cuda(torch::Tensor input_matrix, int bits, float scale);
+// Writes the packed values to out, a preallocated int32 tensor of the shape
+// quantization returns
+torch::Tensor quantization_out(torch::Tensor input_matrix, int bits, float scale, torch::Tensor out)
+{
+    return quantization_cuda(input_matrix, bits, scale, torch::Tensor(), out);
+}
+
+// Scale tensor overloads, see sptrans.calibration: scales is a float32
+// {groups, channels} tensor on the device of the input, with channels 1 or
+// the number of columns. quantization takes a single group; batch entry i
+// of bquantization uses group i % groups.
+torch::Tensor quantization_scales(torch::Tensor input_matrix, int bits, torch::Tensor scales)
+{
+    return quantization_cuda(input_matrix, bits, 1.0f, scales, torch::Tensor());
+}
+
+torch::Tensor quantization_scales_out(torch::Tensor input_matrix, int bits, torch::Tensor scales, torch::Tensor out)
+{
+    return quantization_cuda(input_matrix, bits, 1.0f, scales, out);
+}
+
+torch::Tensor batched_quantization_cuda(torch::Tensor input_matrix, int bits, float scale, torch::Tensor scales, torch::Tensor out);
 
 torch::Tensor batched_quantization(torch::Tensor input_matrix, int bits, float scale)
 {
-    return batched_quantization_cuda(input_matrix, bits, scale);
+    return batched_quantization_cuda(input_matrix, bits, scale, torch::Tensor(), torch::Tensor());
+}
+
+torch::Tensor batched_quantization_out(torch::Tensor input_matrix, int bits, float scale, torch::Tensor out)
+{
+    return batched_quantization_cuda(input_matrix, bits, scale, torch::Tensor(), out);
+}
+
+torch::Tensor batched_quantization_scales(torch::Tensor input_matrix, int bits, torch::Tensor scales)
+{
+    return batched_quantization_cuda(input_matrix, bits, 1.0f, scales, torch::Tensor());
+}
+
+torch::Tensor batched_quantization_scales_out(torch::Tensor input_matrix, int bits, torch::Tensor scales, torch::Tensor out)
+{
+    return batched_quantization_cuda(input_matrix, bits, 1.0f, scales, out);
+}
+
+// Host reference of the quantization kernels, for checking them bit for bit:
+// x * scale is clamped to the signed range of bits, truncated toward zero
+// and packed 32 / bits values per int32, column c of a row at bits
+// (c % items) * bits of int c / items. Batch entry i uses group i % groups
+// of the {groups, channels} scales, as bquantization does.
+torch::Tensor quantization_reference(torch::Tensor input_matrix, int bits, torch::Tensor scales)
+{
+    TORCH_CHECK(bits == 4 || bits == 8, "the quantization kernels support 4 and 8 bits");
+    TORCH_CHECK(input_matrix.dim() >= 2, "input must be a matrix or a batch of matrices");
+    const int64_t m = input_matrix.size(-2), n = input_matrix.size(-1);
+    const int items = 32 / bits;
+    TORCH_CHECK(n % items == 0, "the number of columns must be a multiple of ", items);
+    torch::Tensor input = input_matrix.reshape({-1, m, n}).to(torch::kCPU, torch::kFloat32).contiguous();
+    torch::Tensor s = scales.to(torch::kCPU, torch::kFloat32).reshape({scales.dim() == 2 ? scales.size(0) : 1, -1}).contiguous();
+    const int64_t batch = input.size(0), groups = s.size(0), channels = s.size(1);
+    TORCH_CHECK(channels == 1 || channels == n, "scales have ", channels, " channels, expected 1 or ", n);
+
+    auto sizes = input_matrix.sizes().vec();
+    sizes.back() = n / items;
+    torch::Tensor output = torch::empty({batch, m, n / items}, torch::kInt32);
+    const float *in = input.data_ptr<float>(), *scale = s.data_ptr<float>();
+    int *out = output.data_ptr<int>();
+    const float qmin = -(1 << (bits - 1)), qmax = (1 << (bits - 1)) - 1;
+    const unsigned int mask = (1u << bits) - 1;
+
+    at::parallel_for(0, batch * m, 64, [&](int64_t begin, int64_t end){
+        for(int64_t r = begin; r < end; r++){
+            const float *row_scale = scale + ((r / m) % groups) * channels;
+            for(int64_t w = 0; w < n / items; w++){
+                unsigned int packed = 0;
+                for(int i = 0; i < items; i++){
+                    const int64_t c = w * items + i;
+                    float q = in[r * n + c] * row_scale[channels == 1 ? 0 : c];
+                    q = std::min(std::max(q, qmin), qmax);
+                    packed |= (static_cast<unsigned int>(static_cast<int>(q)) & mask) << (i * bits);
+                }
+                out[r * (n / items) + w] = static_cast<int>(packed);
+            }
+        }
+    });
+    return output.reshape(sizes);
+}
+
+torch::Tensor quantization_reference_scalar(torch::Tensor input_matrix, int bits, float scale)
+{
+    return quantization_reference(input_matrix, bits, torch::full({1, 1}, scale, torch::kFloat32));
 }
 
 
 PYBIND11_MODULE(TORCH_EXTENSION_NAME, m){
     m.def("quantization", &quantization, "Custom symmetric quantization kernel");
+    m.def("quantization", &quantization_scales, "Custom symmetric quantization kernel with a scale tensor");
     m.def("bquantization", &batched_quantization, "Custom Batched symmetric quantization kernel");
+    m.def("bquantization", &batched_quantization_scales, "Custom Batched symmetric quantization kernel with a scale tensor");
+    m.def("quantization_out", &quantization_out, "Custom symmetric quantization kernel writing to out");
+    m.def("quantization_out", &quantization_scales_out, "Custom symmetric quantization kernel with a scale tensor writing to out");
+    m.def("bquantization_out", &batched_quantization_out, "Custom Batched symmetric quantization kernel writing to out");
+    m.def("bquantization_out", &batched_quantization_scales_out, "Custom Batched symmetric quantization kernel with a scale tensor writing to out");
+    m.def("quantization_reference", &quantization_reference_scalar, "Host reference of quantization and bquantization");
+    m.def("quantization_reference", &quantization_reference, "Host reference of quantization and bquantization with a scale tensor");
 }
@@ -1,6 +1,9 @@
 #include <cuda.h>
 #include "cuda_fp16.h"
 #include <torch/extension.h>
+#include <c10/cuda/CUDAStream.h>
+#include "output_buffer.h"
+#include "scale_tensor.h"
 #include <cuda_runtime.h>
 #include <cstdint>
 #include <cmath>
@@ -13,6 +16,8 @@ using namespace nvcuda;
 template <int Bits=4>
 __device__ void quantizationKernel_4b_(
     int m, int n, float scale,
+    const float* __restrict__ scales,
+    int channels,
     const half* __restrict__ input_matrix,
     int* __restrict__ output_matrix)
 {
@@ -24,12 +29,19 @@ __device__ void quantizationKernel_4b_(
     int quantized_vec = 0;
     half *inputs = reinterpret_cast<half *>(&input_buffer);
 
+    // Per-channel scales, one per column; n is a multiple of 8
+    float channel_scales[8];
+    int col = offset % n;
+    #pragma unroll
+    for (int i = 0; i < 8; i++)
+        channel_scales[i] = scales == nullptr ? scale : scale * __ldg(scales + (channels == 1 ? 0 : col + i));
+
     float tempf;
     int tempr;
     int mask = 15;
     #pragma unroll
     for (int i = 0; i < 8; i++){
-        tempf = __half2float(inputs[i])*scale;
+        tempf = __half2float(inputs[i])*channel_scales[i];
         if(tempf < -8.0)
             tempf = -8.0;
         if(tempf > 7.0)
@@ -46,6 +58,8 @@ __device__ void quantizationKernel_4b_(
 template <int Bits=8>
 __device__ void quantizationKernel_8b_(
     int m, int n, float scale,
+    const float* __restrict__ scales,
+    int channels,
     const half* __restrict__ input_matrix,
     int* __restrict__ output_matrix)
 {
@@ -57,11 +71,18 @@ __device__ void quantizationKernel_8b_(
     char quantized_vec[8] = {};
     half *inputs = reinterpret_cast<half *>(&input_buffer);
 
+    // Per-channel scales, one per column; n is a multiple of 8
+    float channel_scales[8];
+    int col = offset % n;
+    #pragma unroll
+    for (int i = 0; i < 8; i++)
+        channel_scales[i] = scales == nullptr ? scale : scale * __ldg(scales + (channels == 1 ? 0 : col + i));
+
     float tempf;
 
     #pragma unroll
     for (int i = 0; i < 8; i++){
-        tempf = __half2float(inputs[i])*scale;
+        tempf = __half2float(inputs[i])*channel_scales[i];
         if(tempf < -128.0)
             tempf = -128.0;
         if(tempf > 127.0)
@@ -78,17 +99,22 @@ __device__ void quantizationKernel_8b_(
 template <int Bits=4>
 __global__ void quantizationKernel_4b(
     int m, int n, float scale,
+    const float* __restrict__ scales,
+    int channels,
     const half* __restrict__ input_matrix,
     int* __restrict__ output_matrix)
 {
     quantizationKernel_4b_<Bits>(
-        m, n, scale, input_matrix, output_matrix
+        m, n, scale, scales, channels, input_matrix, output_matrix
     );
 }
 
 template <int Bits=4>
 __global__ void batched_quantizationKernel_4b(
     int m, int n, int input_stride, int output_stride, float scale,
+    const float* __restrict__ scales,
+    int groups,
+    int channels,
     const half* __restrict__ input_matrix_b,
     int* __restrict__ output_matrix_b)
 {
@@ -96,9 +122,11 @@ __global__ void batched_quantizationKernel_4b(
     int entry_idx = blockIdx.y;
     const half* input_matrix = input_matrix_b + entry_idx * input_stride;
     int* output_matrix = output_matrix_b + entry_idx * output_stride;
+    if(scales != nullptr)
+        scales += (entry_idx % groups) * channels;
 
     quantizationKernel_4b_<Bits>(
-        m, n, scale, input_matrix, output_matrix
+        m, n, scale, scales, channels, input_matrix, output_matrix
     );
 }
 
@@ -106,17 +134,22 @@ __global__ void batched_quantizationKernel_4b(
 template <int Bits=8>
 __global__ void quantizationKernel_8b(
     int m, int n, float scale,
+    const float* __restrict__ scales,
+    int channels,
     const half* __restrict__ input_matrix,
     int* __restrict__ output_matrix)
 {
     quantizationKernel_8b_<Bits>(
-        m, n, scale, input_matrix, output_matrix
+        m, n, scale, scales, channels, input_matrix, output_matrix
     );
 }
 
 template <int Bits=8>
 __global__ void batched_quantizationKernel_8b(
     int m, int n, int input_stride, int output_stride, float scale,
+    const float* __restrict__ scales,
+    int groups,
+    int channels,
     const half* __restrict__ input_matrix_b,
     int* __restrict__ output_matrix_b)
 {
@@ -124,9 +157,11 @@ __global__ void batched_quantizationKernel_8b(
     int entry_idx = blockIdx.y;
     const half* input_matrix = input_matrix_b + entry_idx * input_stride;
     int* output_matrix = output_matrix_b + entry_idx * output_stride;
+    if(scales != nullptr)
+        scales += (entry_idx % groups) * channels;
 
     quantizationKernel_8b_<Bits>(
-        m, n, scale, input_matrix, output_matrix
+        m, n, scale, scales, channels, input_matrix, output_matrix
     );
 }
 
@@ -135,14 +170,24 @@ __global__ void batched_quantizationKernel_8b(
 torch::Tensor quantization_cuda(
     torch::Tensor input_matrix,
     int bits,
-    float scale)
+    float scale,
+    torch::Tensor scales,
+    torch::Tensor out)
 {
     int m = input_matrix.size(-2);
     int n = input_matrix.size(-1);
     
     int num_items_per_int32 = 32 / bits;
     auto options = torch::TensorOptions().dtype(torch::kInt32).device(input_matrix.device());
-    auto output_matrix = torch::empty({m, n/num_items_per_int32}, options);
+    auto output_matrix = output_buffer(out, {m, n/num_items_per_int32}, options, "quantization");
+
+    // Optional {1, channels} scales, multiplied into scale
+    const float* scales_ptr = nullptr;
+    int groups = 1, channels = 1;
+    if(scales.defined()){
+        scales_ptr = quantization_scales_data(scales, input_matrix.device(), n, &groups, &channels);
+        TORCH_CHECK(groups == 1, "quantization takes a single group of scales");
+    }
 
     int num_half_per_int4 = 8;
     dim3 block_dim(32, 1, 1);
@@ -151,15 +196,15 @@ torch::Tensor quantization_cuda(
 
     switch(bits){
         case 8:
-            quantizationKernel_8b<8><<<grid_dim, block_dim>>>(
-                m, n, scale,
+            quantizationKernel_8b<8><<<grid_dim, block_dim, 0, c10::cuda::getCurrentCUDAStream()>>>(
+                m, n, scale, scales_ptr, channels,
                 reinterpret_cast<half *>(input_matrix.data_ptr<torch::Half>()),
                 reinterpret_cast<int *>(output_matrix.data_ptr<int>())
             );
             break;
         case 4:
-            quantizationKernel_4b<4><<<grid_dim, block_dim>>>(
-                m, n, scale,
+            quantizationKernel_4b<4><<<grid_dim, block_dim, 0, c10::cuda::getCurrentCUDAStream()>>>(
+                m, n, scale, scales_ptr, channels,
                 reinterpret_cast<half *>(input_matrix.data_ptr<torch::Half>()),
                 reinterpret_cast<int *>(output_matrix.data_ptr<int>())
             );
@@ -173,7 +218,9 @@ torch::Tensor quantization_cuda(
 torch::Tensor batched_quantization_cuda(
     torch::Tensor input_matrix,
     int bits,
-    float scale)
+    float scale,
+    torch::Tensor scales,
+    torch::Tensor out)
 {
 
     int m = input_matrix.size(-2);
@@ -182,7 +229,13 @@ torch::Tensor batched_quantization_cuda(
 
     int num_items_per_int32 = 32 / bits;
     auto options = torch::TensorOptions().dtype(torch::kInt32).device(input_matrix.device());
-    auto output_matrix = torch::empty({batch_size, m, n/num_items_per_int32}, options);
+    auto output_matrix = output_buffer(out, {batch_size, m, n/num_items_per_int32}, options, "bquantization");
+
+    // Optional {groups, channels} scales, multiplied into scale
+    const float* scales_ptr = nullptr;
+    int groups = 1, channels = 1;
+    if(scales.defined())
+        scales_ptr = quantization_scales_data(scales, input_matrix.device(), n, &groups, &channels);
 
     int num_half_per_int4 = 8;
     dim3 block_dim(32, 1, 1);
@@ -194,15 +247,15 @@ torch::Tensor batched_quantization_cuda(
 
     switch(bits){
         case 8:
-            batched_quantizationKernel_8b<8><<<grid_dim, block_dim>>>(
-                m, n, input_stride, output_stride, scale,
+            batched_quantizationKernel_8b<8><<<grid_dim, block_dim, 0, c10::cuda::getCurrentCUDAStream()>>>(
+                m, n, input_stride, output_stride, scale, scales_ptr, groups, channels,
                 reinterpret_cast<half *>(input_matrix.data_ptr<torch::Half>()),
                 reinterpret_cast<int *>(output_matrix.data_ptr<int>())
             );
             break;
         case 4:
-            batched_quantizationKernel_4b<4><<<grid_dim, block_dim>>>(
-                m, n, input_stride, output_stride, scale,
+            batched_quantizationKernel_4b<4><<<grid_dim, block_dim, 0, c10::cuda::getCurrentCUDAStream()>>>(
+                m, n, input_stride, output_stride, scale, scales_ptr, groups, channels,
                 reinterpret_cast<half *>(input_matrix.data_ptr<torch::Half>()),
                 reinterpret_cast<int *>(output_matrix.data_ptr<int>())
             );
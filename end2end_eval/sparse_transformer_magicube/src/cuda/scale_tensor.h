@@ -0,0 +1,38 @@
+#ifndef SCALE_TENSOR_H
+#define SCALE_TENSOR_H
+#include <torch/extension.h>
+
+// Scale tensors produced by sptrans.calibration. Batch entry i of a batched
+// op uses group i % groups, so a {num_heads} tensor gives one scale per head
+// for the {bsz * num_heads} entries of the attention layer.
+
+// Per-entry dequantization scales of the batched SpMM and SDDMM, multiplied
+// into the scalar scale. Returns nullptr when the tensor is undefined.
+inline const float *entry_scales_data(torch::Tensor entry_scales, torch::Device device, int *num_entry_scales)
+{
+    *num_entry_scales = 1;
+    if(!entry_scales.defined())
+        return nullptr;
+    TORCH_CHECK(entry_scales.scalar_type() == torch::kFloat32, "entry scales must be float32");
+    TORCH_CHECK(entry_scales.device() == device, "entry scales must be on ", device);
+    TORCH_CHECK(entry_scales.is_contiguous() && entry_scales.numel() > 0, "entry scales must be a non-empty contiguous tensor");
+    *num_entry_scales = entry_scales.numel();
+    return entry_scales.data_ptr<float>();
+}
+
+// Quantization scales of shape {groups, channels}: groups is indexed as
+// above and channels is 1 (per-tensor or per-head) or the number of columns
+// n (per-channel).
+inline const float *quantization_scales_data(torch::Tensor scales, torch::Device device, int n, int *groups, int *channels)
+{
+    TORCH_CHECK(scales.scalar_type() == torch::kFloat32, "quantization scales must be float32");
+    TORCH_CHECK(scales.device() == device, "quantization scales must be on ", device);
+    TORCH_CHECK(scales.dim() == 2 && scales.is_contiguous(), "quantization scales must be a contiguous {groups, channels} tensor");
+    TORCH_CHECK(scales.size(0) > 0 && (scales.size(1) == 1 || scales.size(1) == n),
+                "quantization scales have ", scales.size(1), " channels, expected 1 or ", n);
+    *groups = scales.size(0);
+    *channels = scales.size(1);
+    return scales.data_ptr<float>();
+}
+
+#endif
@@ -0,0 +1,462 @@
+#include <torch/extension.h>
+#include <ATen/Parallel.h>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <string>
+#include <vector>
+#include "aligned_mask.h"
+
+// Chain of quantized sparse weight layers (the FFN of a transformer block)
+// run from C++: every layer is
+//
+//   y = dequant(W_q x_q) + bias       deq_spmm kernel, W vector-sparse
+//   y = activation(y)                 none, relu or gelu
+//   x_q = quantize(y)                 input of the next layer
+//
+// Activations are kept transposed, {features, tokens}, so that the output of
+// one layer is the dense rhs of the next. The packed inputs alternate
+// between the two slots of an ActivationArena and the fp16 accumulator of
+// the hidden layers is reused, so a forward pass allocates only its result.
+//
+// forward_cpu runs the same plans with the same integer arithmetic on the
+// CPU.
+//
+// The deq_spmm kernels multiply through u8 / u4 mma, so a signed operand is
+// split into its positive and negative parts, both non-negative and
+// quantized symmetrically to [0, qmax]:
+//
+//   W x = (W+ - W-) (x+ - x-)
+//
+// A weight with negative entries is stored as W+ stacked on W- (twice the
+// vector rows, one pattern), an input that can be negative as x+ next to
+// x- (twice the tokens), so all products come out of one launch and are
+// combined in fp16. Every partial product is a sum of non-negative terms, so
+// nothing cancels before the dequantization. The input of a layer is split
+// unless the previous layer ends in a relu; the cost is 2x per split operand.
+
+torch::Tensor batched_deq_spmm_mma_4b(torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor,
+    int, int, int, float, torch::Tensor, torch::Tensor, torch::Tensor);
+torch::Tensor batched_deq_spmm_mma_8b4b(torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor,
+    int, int, int, float, torch::Tensor, torch::Tensor, torch::Tensor);
+torch::Tensor batched_deq_spmm_mma_8b(torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor,
+    int, int, int, float, torch::Tensor, torch::Tensor, torch::Tensor);
+torch::Tensor batched_deq_spmm_mma_16b8b(torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor,
+    int, int, int, float, torch::Tensor, torch::Tensor, torch::Tensor);
+torch::Tensor batched_quantization_cuda(torch::Tensor input_matrix, int bits, float scale, torch::Tensor scales, torch::Tensor out);
+
+// Tile_N of the deq_spmm kernels: the number of tokens must be a multiple
+static const int64_t kTokenTile = 64;
+
+enum Activation{ kActivationNone, kActivationRelu, kActivationGelu };
+
+static int parse_activation(const std::string &activation){
+    if(activation == "none") return kActivationNone;
+    if(activation == "relu") return kActivationRelu;
+    if(activation == "gelu") return kActivationGelu;
+    TORCH_CHECK(false, "activation must be none, relu or gelu, got ", activation);
+    return kActivationNone;
+}
+
+// Quantization of the kernels: x * scale clamped to the signed range of
+// bits and truncated toward zero
+static inline int quantize_value(float x, float scale, int bits){
+    const float qmax = (1 << (bits - 1)) - 1, qmin = -(1 << (bits - 1));
+    return static_cast<int>(std::min(std::max(x * scale, qmin), qmax));
+}
+
+// Value of a split operand: quantized positive minus quantized negative part
+static inline int quantize_split(float x, float scale, int bits){
+    return quantize_value(std::max(x, 0.0f), scale, bits) - quantize_value(std::max(-x, 0.0f), scale, bits);
+}
+
+static inline float gelu(float x){
+    return 0.5f * x * (1.0f + std::erf(x * 0.70710678f));
+}
+
+// One layer: the weight in the aligned vector-sparse layout of deq_spmm
+struct SparseLinear{
+    int64_t in_features;
+    int64_t out_features;
+    int vec_length;
+    int bits_lhs;
+    int bits_rhs;
+    int activation;
+    float weight_scale;
+    float input_scale;
+    // The weight has negative entries: the kernel operand is W+ stacked on W-
+    bool split_lhs;
+    // The input can be negative: the kernel operand is x+ next to x-
+    bool split_rhs;
+
+    // Kernel operands on the device of the weight
+    torch::Tensor row_indices;
+    torch::Tensor row_offsets;
+    torch::Tensor column_indices;
+    torch::Tensor values;
+    torch::Tensor bias;
+
+    // The same plan for forward_cpu, without the stacking: the quantized
+    // vectors (W+ - W-) are {aligned_num_item, vec_length} int32, the bias
+    // float32
+    torch::Tensor cpu_row_offsets;
+    torch::Tensor cpu_column_indices;
+    torch::Tensor cpu_values;
+    torch::Tensor cpu_bias;
+};
+
+// Packs the quantized vectors in the layout q_csr_softmax writes for the
+// deq_spmm kernels. With p the aligned position of a vector and v its lane:
+//
+//   8 bits   byte (p / 16) * V * 16 + v * 16 + p % 16
+//   4 bits   nibble p % 2 of byte (p / 32) * V * 16 + v * 16 + (p % 32) / 2
+//   16 bits  low byte at (p / 16) * V * 32 + v * 32 + p % 16, high byte 16 later
+static torch::Tensor pack_values(const int *q, int64_t aligned_num_item, int vec_length, int bits){
+    const int64_t num_bytes = aligned_num_item * vec_length * bits / 8;
+    torch::Tensor packed = torch::zeros({num_bytes / 4}, torch::kInt32);
+    unsigned char *bytes = reinterpret_cast<unsigned char *>(packed.data_ptr<int>());
+    const int64_t group = bits == 4 ? 32 : 16;
+    at::parallel_for(0, aligned_num_item / group, 16, [&](int64_t begin, int64_t end){
+        for(int64_t g = begin; g < end; g++){
+            for(int64_t p = g * group; p < (g + 1) * group; p++){
+                for(int v = 0; v < vec_length; v++){
+                    const int value = q[p * vec_length + v];
+                    if(bits == 8){
+                        bytes[g * vec_length * 16 + v * 16 + p % 16] = static_cast<unsigned char>(value);
+                    }
+                    else if(bits == 4){
+                        bytes[g * vec_length * 16 + v * 16 + (p % 32) / 2] |= static_cast<unsigned char>((value & 15) << (4 * (p % 2)));
+                    }
+                    else{
+                        bytes[g * vec_length * 32 + v * 32 + p % 16] = static_cast<unsigned char>(value & 0xff);
+                        bytes[g * vec_length * 32 + v * 32 + 16 + p % 16] = static_cast<unsigned char>((value >> 8) & 0xff);
+                    }
+                }
+            }
+        }
+    });
+    return packed;
+}
+
+// Two packed activation slots and the fp16 buffers of a layer (the kernel
+// accumulator, the combined result and the split input), grown on demand and
+// handed out as views of the exact shape the kernels' out= check expects
+class ActivationArena{
+public:
+    enum HalfSlot{ kAccumulator, kResult, kSplit, kHalfSlots };
+
+    torch::Tensor packed(int slot, int64_t rows, int64_t cols, const torch::Device &device){
+        return view(packed_[slot], {1, rows, cols}, torch::TensorOptions().dtype(torch::kInt32).device(device));
+    }
+
+    torch::Tensor half(HalfSlot slot, int64_t rows, int64_t cols, const torch::Device &device){
+        return view(half_[slot], {1, rows, cols}, torch::TensorOptions().dtype(torch::kFloat16).device(device));
+    }
+
+    int64_t bytes() const{
+        int64_t total = 0;
+        for(const torch::Tensor *t : {&packed_[0], &packed_[1], &half_[kAccumulator], &half_[kResult], &half_[kSplit]})
+            if(t->defined()) total += t->numel() * t->element_size();
+        return total;
+    }
+
+    void reset(){
+        packed_[0] = packed_[1] = torch::Tensor();
+        for(int i = 0; i < kHalfSlots; i++) half_[i] = torch::Tensor();
+    }
+
+private:
+    static torch::Tensor view(torch::Tensor &storage, std::vector<int64_t> sizes, const torch::TensorOptions &options){
+        const int64_t numel = sizes[0] * sizes[1] * sizes[2];
+        if(!storage.defined() || storage.numel() < numel || storage.device() != options.device())
+            storage = torch::empty({numel}, options);
+        return storage.narrow(0, 0, numel).view(sizes);
+    }
+
+    torch::Tensor packed_[2];
+    torch::Tensor half_[kHalfSlots];
+};
+
+class SparseMLP{
+public:
+    // weight is the pruned {out_features, in_features} weight: a vector of
+    // vec_length rows is kept when any of its entries is nonzero. bias is
+    // {out_features} or None, input_scale the quantization scale of the
+    // layer input (see sptrans.calibration).
+    void add_layer(torch::Tensor weight, c10::optional<torch::Tensor> bias, int64_t vec_length, int64_t bits_lhs, int64_t bits_rhs,
+                   std::string activation, double input_scale){
+        TORCH_CHECK(weight.dim() == 2, "weight must be {out_features, in_features}");
+        TORCH_CHECK((bits_lhs == 4 && bits_rhs == 4) || (bits_lhs == 8 && bits_rhs == 4) ||
+                    (bits_lhs == 8 && bits_rhs == 8) || (bits_lhs == 16 && bits_rhs == 8),
+                    "unsupported precision pair ", bits_lhs, "b", bits_rhs, "b");
+        TORCH_CHECK(vec_length == 2 || vec_length == 4 || vec_length == 8, "vec_length must be 2, 4 or 8");
+        TORCH_CHECK(input_scale > 0.0, "input_scale must be positive");
+
+        SparseLinear layer;
+        layer.out_features = weight.size(0);
+        layer.in_features = weight.size(1);
+        TORCH_CHECK(layers_.empty() || layers_.back().out_features == layer.in_features,
+                    "layer takes ", layer.in_features, " features, the previous one produces ", layers_.back().out_features);
+        TORCH_CHECK(layer.out_features % vec_length == 0, "out_features must be a multiple of vec_length");
+        TORCH_CHECK(layer.out_features % 8 == 0 && layer.in_features % 8 == 0, "the feature sizes must be multiples of 8");
+        layer.vec_length = vec_length;
+        layer.bits_lhs = bits_lhs;
+        layer.bits_rhs = bits_rhs;
+        layer.activation = parse_activation(activation);
+        layer.input_scale = static_cast<float>(input_scale);
+        layer.split_rhs = layers_.empty() || layers_.back().activation != kActivationRelu;
+
+        torch::Tensor w = weight.detach().to(torch::kCPU, torch::kFloat32).contiguous();
+        const float *w_ptr = w.data_ptr<float>();
+        const int64_t m_vec = layer.out_features / vec_length, k = layer.in_features;
+
+        // Vector sparsity pattern of the weight
+        std::vector<int64_t> row_offsets(m_vec + 1, 0);
+        std::vector<std::vector<int>> row_columns(m_vec);
+        at::parallel_for(0, m_vec, kGrainSize / 16, [&](int64_t begin, int64_t end){
+            for(int64_t r = begin; r < end; r++){
+                for(int64_t c = 0; c < k; c++){
+                    bool nonzero = false;
+                    for(int v = 0; v < vec_length; v++) nonzero |= w_ptr[(r * vec_length + v) * k + c] != 0.0f;
+                    if(nonzero) row_columns[r].push_back(static_cast<int>(c));
+                }
+                row_offsets[r + 1] = row_columns[r].size();
+            }
+        });
+        std::partial_sum(row_offsets.begin(), row_offsets.end(), row_offsets.begin());
+        std::vector<int> column_indices;
+        column_indices.reserve(row_offsets[m_vec]);
+        for(int64_t r = 0; r < m_vec; r++) column_indices.insert(column_indices.end(), row_columns[r].begin(), row_columns[r].end());
+
+        const int64_t mma_k_dim = bits_rhs == 4 ? 32 : 16;
+        AlignedMask mask = align_mask(m_vec, row_offsets.data(), column_indices.data(), mma_k_dim);
+        torch::Tensor aligned_columns = std::get<0>(mask), aligned_offsets = std::get<2>(mask);
+        const int64_t aligned_num_item = std::get<4>(mask);
+
+        // Per-tensor weight scale from the largest magnitude
+        const float absmax = w.abs().max().item<float>();
+        const float qmax = (1 << (bits_lhs - 1)) - 1;
+        layer.weight_scale = absmax > 0.0f ? qmax / absmax : 1.0f;
+        layer.split_lhs = w.lt(0).any().item<bool>();
+
+        // W+ in the first aligned_num_item vectors, W- after them when split
+        const int64_t parts = layer.split_lhs ? 2 : 1;
+        torch::Tensor q = torch::zeros({parts * aligned_num_item, vec_length}, torch::kInt32);
+        int *q_ptr = q.data_ptr<int>();
+        const int *offsets_ptr = aligned_offsets.data_ptr<int>(), *columns_ptr = aligned_columns.data_ptr<int>();
+        at::parallel_for(0, m_vec, kGrainSize / 16, [&](int64_t begin, int64_t end){
+            for(int64_t r = begin; r < end; r++)
+                for(int64_t p = offsets_ptr[r * 2]; p < offsets_ptr[r * 2 + 1]; p++)
+                    for(int v = 0; v < vec_length; v++){
+                        const float value = w_ptr[(r * vec_length + v) * k + columns_ptr[p]];
+                        q_ptr[p * vec_length + v] = quantize_value(std::max(value, 0.0f), layer.weight_scale, bits_lhs);
+                        if(layer.split_lhs)
+                            q_ptr[(aligned_num_item + p) * vec_length + v] = quantize_value(std::max(-value, 0.0f), layer.weight_scale, bits_lhs);
+                    }
+        });
+
+        const torch::Device device = weight.device();
+        TORCH_CHECK(layers_.empty() || layers_[0].values.device() == device, "all layers must be on the same device");
+        layer.values = pack_values(q_ptr, parts * aligned_num_item, vec_length, bits_lhs).to(device);
+        if(layer.split_lhs){
+            // The same pattern twice: rows m_vec.. hold W-
+            std::vector<int64_t> stacked_offsets(row_offsets);
+            for(int64_t r = 1; r <= m_vec; r++) stacked_offsets.push_back(row_offsets[m_vec] + row_offsets[r]);
+            std::vector<int> stacked_columns(column_indices);
+            stacked_columns.insert(stacked_columns.end(), column_indices.begin(), column_indices.end());
+            AlignedMask stacked = align_mask(2 * m_vec, stacked_offsets.data(), stacked_columns.data(), mma_k_dim);
+            layer.row_indices = std::get<3>(stacked).to(device);
+            layer.row_offsets = std::get<2>(stacked).to(device);
+            layer.column_indices = std::get<0>(stacked).to(device);
+            torch::Tensor negative = q.narrow(0, aligned_num_item, aligned_num_item);
+            q = q.narrow(0, 0, aligned_num_item) - negative;
+        }
+        else{
+            layer.row_indices = std::get<3>(mask).to(device);
+            layer.row_offsets = aligned_offsets.to(device);
+            layer.column_indices = aligned_columns.to(device);
+        }
+        layer.cpu_row_offsets = aligned_offsets;
+        layer.cpu_column_indices = aligned_columns;
+        layer.cpu_values = q.contiguous();
+        if(bias.has_value() && bias->defined()){
+            TORCH_CHECK(bias->numel() == layer.out_features, "bias must have out_features entries");
+            layer.bias = bias->detach().to(device, torch::kFloat16).reshape({1, layer.out_features, 1});
+            layer.cpu_bias = bias->detach().to(torch::kCPU, torch::kFloat32).contiguous();
+        }
+        layers_.push_back(layer);
+    }
+
+    void set_input_scale(int64_t layer, double input_scale){
+        TORCH_CHECK(layer >= 0 && layer < static_cast<int64_t>(layers_.size()), "no layer ", layer);
+        TORCH_CHECK(input_scale > 0.0, "input_scale must be positive");
+        layers_[layer].input_scale = static_cast<float>(input_scale);
+    }
+
+    // x is {tokens, in_features} float16 on the device of the layers;
+    // returns {tokens, out_features} float16
+    torch::Tensor forward(torch::Tensor x){
+        check_input(x);
+        TORCH_CHECK(x.is_cuda() && x.scalar_type() == torch::kFloat16, "forward takes a float16 CUDA tensor");
+        TORCH_CHECK(x.device() == layers_[0].values.device(), "input is on ", x.device(), ", the layers on ", layers_[0].values.device());
+        const int64_t tokens = x.size(0);
+        TORCH_CHECK(tokens % kTokenTile == 0, "the number of tokens must be a multiple of ", kTokenTile);
+        const torch::Device device = x.device();
+
+        torch::Tensor h = x.t().contiguous().view({1, layers_[0].in_features, tokens});
+        for(size_t i = 0; i < layers_.size(); i++){
+            const SparseLinear &layer = layers_[i];
+            torch::Tensor q = quantize_input(layer, h, i % 2, tokens, device);
+            const int64_t rows = layer.split_lhs ? 2 * layer.out_features : layer.out_features;
+            const int64_t cols = layer.split_rhs ? 2 * tokens : tokens;
+            torch::Tensor y = combine(layer, spmm(layer, q, arena_.half(ActivationArena::kAccumulator, rows, cols, device)),
+                                      tokens, device);
+            if(layer.bias.defined()) y.add_(layer.bias);
+            if(layer.activation == kActivationRelu) y.relu_();
+            else if(layer.activation == kActivationGelu) at::gelu_out(y, y);
+            if(i + 1 == layers_.size()) return y.view({layer.out_features, tokens}).t().contiguous();
+            h = y;
+        }
+        return torch::Tensor();
+    }
+
+    // The same chain on the CPU: integer products of the quantized operands,
+    // dequantized, biased and activated in float32. x is {tokens, in_features}
+    // on any device; returns {tokens, out_features} float32 on the CPU.
+    torch::Tensor forward_cpu(torch::Tensor x){
+        check_input(x);
+        const int64_t tokens = x.size(0);
+        torch::Tensor h = x.detach().to(torch::kCPU, torch::kFloat32).t().contiguous();
+        for(size_t i = 0; i < layers_.size(); i++){
+            const SparseLinear &layer = layers_[i];
+            const int64_t k = layer.in_features;
+
+            // Equal to quantize_value for the non-negative inputs that forward
+            // does not split
+            torch::Tensor q = torch::empty({k, tokens}, torch::kInt32);
+            const float *h_ptr = h.data_ptr<float>();
+            int *q_ptr = q.data_ptr<int>();
+            at::parallel_for(0, k * tokens, 4096, [&](int64_t begin, int64_t end){
+                for(int64_t j = begin; j < end; j++) q_ptr[j] = quantize_split(h_ptr[j], layer.input_scale, layer.bits_rhs);
+            });
+
+            torch::Tensor y = torch::empty({layer.out_features, tokens}, torch::kFloat32);
+            float *y_ptr = y.data_ptr<float>();
+            const int *offsets_ptr = layer.cpu_row_offsets.data_ptr<int>(), *columns_ptr = layer.cpu_column_indices.data_ptr<int>();
+            const int *w_ptr = layer.cpu_values.data_ptr<int>();
+            const float *bias_ptr = layer.cpu_bias.defined() ? layer.cpu_bias.data_ptr<float>() : nullptr;
+            const float scale = layer.weight_scale * layer.input_scale;
+            const int vec_length = layer.vec_length;
+            at::parallel_for(0, layer.out_features / vec_length, 1, [&](int64_t begin, int64_t end){
+                std::vector<int> acc(vec_length * tokens);
+                for(int64_t r = begin; r < end; r++){
+                    std::fill(acc.begin(), acc.end(), 0);
+                    for(int64_t p = offsets_ptr[r * 2]; p < offsets_ptr[r * 2 + 1]; p++){
+                        const int *x_row = q_ptr + columns_ptr[p] * tokens;
+                        for(int v = 0; v < vec_length; v++){
+                            const int w = w_ptr[p * vec_length + v];
+                            int *acc_row = acc.data() + v * tokens;
+                            for(int64_t t = 0; t < tokens; t++) acc_row[t] += w * x_row[t];
+                        }
+                    }
+                    for(int v = 0; v < vec_length; v++){
+                        const int64_t row = r * vec_length + v;
+                        const float bias = bias_ptr != nullptr ? bias_ptr[row] : 0.0f;
+                        for(int64_t t = 0; t < tokens; t++){
+                            float value = acc[v * tokens + t] / scale + bias;
+                            if(layer.activation == kActivationRelu) value = std::max(value, 0.0f);
+                            else if(layer.activation == kActivationGelu) value = gelu(value);
+                            y_ptr[row * tokens + t] = value;
+                        }
+                    }
+                }
+            });
+            h = y;
+        }
+        return h.t().contiguous();
+    }
+
+    int64_t num_layers() const{ return layers_.size(); }
+
+    // Bytes held by the activation arena
+    int64_t arena_bytes() const{ return arena_.bytes(); }
+
+    void reset_arena(){ arena_.reset(); }
+
+    // (weight_scale, input_scale) of a layer
+    std::tuple<double, double> scales(int64_t layer) const{
+        TORCH_CHECK(layer >= 0 && layer < static_cast<int64_t>(layers_.size()), "no layer ", layer);
+        return std::make_tuple(layers_[layer].weight_scale, layers_[layer].input_scale);
+    }
+
+private:
+    void check_input(const torch::Tensor &x) const{
+        TORCH_CHECK(!layers_.empty(), "the executor has no layers");
+        TORCH_CHECK(x.dim() == 2 && x.size(1) == layers_[0].in_features,
+                    "input must be {tokens, ", layers_[0].in_features, "}");
+    }
+
+    // Packed kernel rhs of a layer: h ({1, in_features, tokens} float16), or
+    // relu(h) next to relu(-h) when the input is split
+    torch::Tensor quantize_input(const SparseLinear &layer, const torch::Tensor &h, int slot, int64_t tokens,
+                                 const torch::Device &device){
+        torch::Tensor input = h;
+        if(layer.split_rhs){
+            input = arena_.half(ActivationArena::kSplit, layer.in_features, 2 * tokens, device);
+            torch::Tensor positive = input.narrow(2, 0, tokens), negative = input.narrow(2, tokens, tokens);
+            at::clamp_min_out(positive, h, 0);
+            at::neg_out(negative, h);
+            negative.clamp_min_(0);
+        }
+        return batched_quantization_cuda(input, layer.bits_rhs, layer.input_scale, torch::Tensor(),
+                                         arena_.packed(slot, layer.in_features, input.size(2) * layer.bits_rhs / 32, device));
+    }
+
+    // {1, out_features, tokens} result from the kernel output of the split
+    // operands: (W+ x+ - W+ x-) - (W- x+ - W- x-)
+    torch::Tensor combine(const SparseLinear &layer, const torch::Tensor &acc, int64_t tokens, const torch::Device &device){
+        if(!layer.split_lhs && !layer.split_rhs) return acc;
+        torch::Tensor y = arena_.half(ActivationArena::kResult, layer.out_features, tokens, device);
+        torch::Tensor positive = acc.narrow(1, 0, layer.out_features);
+        if(!layer.split_rhs) return at::sub_out(y, positive, acc.narrow(1, layer.out_features, layer.out_features));
+        at::sub_out(y, positive.narrow(2, 0, tokens), positive.narrow(2, tokens, tokens));
+        if(layer.split_lhs){
+            torch::Tensor negative = acc.narrow(1, layer.out_features, layer.out_features);
+            y.sub_(negative.narrow(2, 0, tokens)).add_(negative.narrow(2, tokens, tokens));
+        }
+        return y;
+    }
+
+    static torch::Tensor spmm(const SparseLinear &layer, torch::Tensor rhs, torch::Tensor out){
+        const float scale = layer.weight_scale * layer.input_scale;
+        if(layer.bits_lhs == 4)
+            return batched_deq_spmm_mma_4b(layer.row_indices, layer.row_offsets, layer.column_indices, layer.values, rhs,
+                layer.vec_length, layer.bits_lhs, layer.bits_rhs, scale, torch::Tensor(), torch::Tensor(), out);
+        if(layer.bits_lhs == 8 && layer.bits_rhs == 4)
+            return batched_deq_spmm_mma_8b4b(layer.row_indices, layer.row_offsets, layer.column_indices, layer.values, rhs,
+                layer.vec_length, layer.bits_lhs, layer.bits_rhs, scale, torch::Tensor(), torch::Tensor(), out);
+        if(layer.bits_lhs == 8)
+            return batched_deq_spmm_mma_8b(layer.row_indices, layer.row_offsets, layer.column_indices, layer.values, rhs,
+                layer.vec_length, layer.bits_lhs, layer.bits_rhs, scale, torch::Tensor(), torch::Tensor(), out);
+        return batched_deq_spmm_mma_16b8b(layer.row_indices, layer.row_offsets, layer.column_indices, layer.values, rhs,
+            layer.vec_length, layer.bits_lhs, layer.bits_rhs, scale, torch::Tensor(), torch::Tensor(), out);
+    }
+
+    std::vector<SparseLinear> layers_;
+    ActivationArena arena_;
+};
+
+PYBIND11_MODULE(TORCH_EXTENSION_NAME, m){
+    py::class_<SparseMLP>(m, "SparseMLP")
+        .def(py::init<>())
+        .def("add_layer", &SparseMLP::add_layer, "Append a pruned weight layer",
+             py::arg("weight"), py::arg("bias"), py::arg("vec_length"), py::arg("bits_lhs"), py::arg("bits_rhs"),
+             py::arg("activation") = "none", py::arg("input_scale") = 1.0)
+        .def("set_input_scale", &SparseMLP::set_input_scale, "Set the quantization scale of a layer input")
+        .def("forward", &SparseMLP::forward, "Run the layer chain with the deq_spmm kernels")
+        .def("forward_cpu", &SparseMLP::forward_cpu, "Run the layer chain on the CPU")
+        .def("num_layers", &SparseMLP::num_layers, "Number of layers")
+        .def("arena_bytes", &SparseMLP::arena_bytes, "Bytes held by the activation arena")
+        .def("reset_arena", &SparseMLP::reset_arena, "Free the activation arena")
+        .def("scales", &SparseMLP::scales, "(weight_scale, input_scale) of a layer");
+}
@@ -1,6 +1,22 @@
 #ifndef SPMM_COMPUTE_UTILS_H
 #define SPMM_COMPUTE_UTILS_H
 
+    // Transpose of a 4x4 byte matrix held in four registers: byte i of out[j]
+    // is byte j of in[i]. Turns four gathered rows of 8-bit rhs values into
+    // the column-major B fragments of mma.m8n8k16 with eight PRMTs. The rows
+    // are picked by the column indices of the sparse lhs, so this cannot be
+    // done ahead of time when the rhs is quantized.
+    __device__ __forceinline__ void ByteTranspose4x4(const int *in, int *out){
+        const int t0 = __byte_perm(in[0], in[1], 0x5140);
+        const int t1 = __byte_perm(in[0], in[1], 0x7362);
+        const int t2 = __byte_perm(in[2], in[3], 0x5140);
+        const int t3 = __byte_perm(in[2], in[3], 0x7362);
+        out[0] = __byte_perm(t0, t2, 0x5410);
+        out[1] = __byte_perm(t0, t2, 0x7632);
+        out[2] = __byte_perm(t1, t3, 0x5410);
+        out[3] = __byte_perm(t1, t3, 0x7632);
+    }
+
     template <typename VecType, int Tile_K, int Tile_N, int BlockWidth, int VecLength>
     struct ComputeUtils {
 
@@ -907,15 +923,7 @@
 	        rhs_fragment[i] = *(dense_tile_ + base_offset + i*16); 
 	    }
 
-            unsigned char *rhs_fragment_char = reinterpret_cast<unsigned char *>(rhs_fragment); 
-            unsigned char *rhs_fragment_transpose_char = reinterpret_cast<unsigned char *>(rhs_fragment_transpose);
-
-            #pragma unroll
-	    for(int i=0; i<4; i++){
-	        for(int j=0; j<4; j++){
-	            *(rhs_fragment_transpose_char + j*4 + i) = *(rhs_fragment_char + j + i*4);
-	        }
-	    }
+            ByteTranspose4x4(rhs_fragment, rhs_fragment_transpose);
 
             if(lane_id_ % 32 < ValuesBlockWidth)
 	        lhs_fragment[0] = lhs_tile_[lane_id_ % ValuesBlockWidth + (step % 2) * ValuesBlockWidth];
@@ -952,15 +960,7 @@
 	        rhs_fragment[i] = *(dense_tile_ + base_offset + i*16); 
 	    }
 
-            unsigned char *rhs_fragment_char = reinterpret_cast<unsigned char *>(rhs_fragment); 
-            unsigned char *rhs_fragment_transpose_char = reinterpret_cast<unsigned char *>(rhs_fragment_transpose);
-
-            #pragma unroll
-	    for(int i=0; i<4; i++){
-	        for(int j=0; j<4; j++){
-	            *(rhs_fragment_transpose_char + j*4 + i) = *(rhs_fragment_char + j + i*4);
-	        }
-	    }
+            ByteTranspose4x4(rhs_fragment, rhs_fragment_transpose);
 
             if(lane_id_ % 32 < ValuesBlockWidth)
 	        lhs_fragment[0] = lhs_tile_[lane_id_ % ValuesBlockWidth];
@@ -1023,15 +1023,7 @@
 	        rhs_fragment[i] = *(dense_tile_ + base_offset + i*16); 
 	    }
 
-            unsigned char *rhs_fragment_char = reinterpret_cast<unsigned char *>(rhs_fragment); 
-            unsigned char *rhs_fragment_transpose_char = reinterpret_cast<unsigned char *>(rhs_fragment_transpose);
-
-            #pragma unroll
-	    for(int i=0; i<4; i++){
-	        for(int j=0; j<4; j++){
-	            *(rhs_fragment_transpose_char + j*4 + i) = *(rhs_fragment_char + j + i*4);
-	        }
-	    }
+            ByteTranspose4x4(rhs_fragment, rhs_fragment_transpose);
 
 	    lhs_fragment[0] = lhs_tile_[lane_id_ % 32 + (step % 2) * ValuesBlockWidth];
 	    lhs_fragment[1] = lhs_tile_[lane_id_ % 32 + 32 + (step % 2) * ValuesBlockWidth];
@@ -1078,15 +1070,7 @@
 	        rhs_fragment[i] = *(dense_tile_ + base_offset + i*16); 
 	    }
 
-            unsigned char *rhs_fragment_char = reinterpret_cast<unsigned char *>(rhs_fragment); 
-            unsigned char *rhs_fragment_transpose_char = reinterpret_cast<unsigned char *>(rhs_fragment_transpose);
-
-            #pragma unroll
-	    for(int i=0; i<4; i++){
-	        for(int j=0; j<4; j++){
-	            *(rhs_fragment_transpose_char + j*4 + i) = *(rhs_fragment_char + j + i*4);
-	        }
-	    }
+            ByteTranspose4x4(rhs_fragment, rhs_fragment_transpose);
 
 	    lhs_fragment[0] = lhs_tile_[lane_id_ % 32];
 	    lhs_fragment[1] = lhs_tile_[lane_id_ % 32 + 32];
@@ -1158,15 +1142,7 @@
 	        rhs_fragment[i] = *(dense_tile_ + base_offset + i*16); 
 	    }
 
-            unsigned char *rhs_fragment_char = reinterpret_cast<unsigned char *>(rhs_fragment); 
-            unsigned char *rhs_fragment_transpose_char = reinterpret_cast<unsigned char *>(rhs_fragment_transpose);
-
-            #pragma unroll
-	    for(int i=0; i<4; i++){
-	        for(int j=0; j<4; j++){
-	            *(rhs_fragment_transpose_char + j*4 + i) = *(rhs_fragment_char + j + i*4);
-	        }
-	    }
+            ByteTranspose4x4(rhs_fragment, rhs_fragment_transpose);
 
             if(lane_id_ % 32 < ValuesBlockWidth)
 	        lhs_fragment[0] = lhs_tile_[lane_id_ % ValuesBlockWidth + (step % 2) * ValuesBlockWidth];
@@ -1203,15 +1179,7 @@
 	        rhs_fragment[i] = *(dense_tile_ + base_offset + i*16); 
 	    }
 
-            unsigned char *rhs_fragment_char = reinterpret_cast<unsigned char *>(rhs_fragment); 
-            unsigned char *rhs_fragment_transpose_char = reinterpret_cast<unsigned char *>(rhs_fragment_transpose);
-
-            #pragma unroll
-	    for(int i=0; i<4; i++){
-	        for(int j=0; j<4; j++){
-	            *(rhs_fragment_transpose_char + j*4 + i) = *(rhs_fragment_char + j + i*4);
-	        }
-	    }
+            ByteTranspose4x4(rhs_fragment, rhs_fragment_transpose);
 
             if(lane_id_ % 32 < ValuesBlockWidth)
 	        lhs_fragment[0] = lhs_tile_[lane_id_ % ValuesBlockWidth];
@@ -1275,15 +1243,7 @@
 	        rhs_fragment[i] = *(dense_tile_ + base_offset + i*16); 
 	    }
 
-            unsigned char *rhs_fragment_char = reinterpret_cast<unsigned char *>(rhs_fragment); 
-            unsigned char *rhs_fragment_transpose_char = reinterpret_cast<unsigned char *>(rhs_fragment_transpose);
-
-            #pragma unroll
-	    for(int i=0; i<4; i++){
-	        for(int j=0; j<4; j++){
-	            *(rhs_fragment_transpose_char + j*4 + i) = *(rhs_fragment_char + j + i*4);
-	        }
-	    }
+            ByteTranspose4x4(rhs_fragment, rhs_fragment_transpose);
 
 	    lhs_fragment[0] = lhs_tile_[lane_id_ % 32 + (step % 2) * ValuesBlockWidth]; // ValuesBlockWidth = 64
             #pragma unroll
@@ -1330,15 +1290,7 @@
 	        rhs_fragment[i] = *(dense_tile_ + base_offset + i*16); 
 	    }
 
-            unsigned char *rhs_fragment_char = reinterpret_cast<unsigned char *>(rhs_fragment); 
-            unsigned char *rhs_fragment_transpose_char = reinterpret_cast<unsigned char *>(rhs_fragment_transpose);
-
-            #pragma unroll
-	    for(int i=0; i<4; i++){
-	        for(int j=0; j<4; j++){
-	            *(rhs_fragment_transpose_char + j*4 + i) = *(rhs_fragment_char + j + i*4);
-	        }
-	    }
+            ByteTranspose4x4(rhs_fragment, rhs_fragment_transpose);
 
 	    lhs_fragment[0] = lhs_tile_[lane_id_ % 32]; // ValuesBlockWidth = 64
             #pragma unroll
@@ -1410,15 +1362,7 @@
 	        rhs_fragment[i] = *(dense_tile_ + base_offset + i*16); 
 	    }
 
-            unsigned char *rhs_fragment_char = reinterpret_cast<unsigned char *>(rhs_fragment); 
-            unsigned char *rhs_fragment_transpose_char = reinterpret_cast<unsigned char *>(rhs_fragment_transpose);
-
-            #pragma unroll
-	    for(int i=0; i<4; i++){
-	        for(int j=0; j<4; j++){
-	            *(rhs_fragment_transpose_char + j*4 + i) = *(rhs_fragment_char + j + i*4);
-	        }
-	    }
+            ByteTranspose4x4(rhs_fragment, rhs_fragment_transpose);
 
             if(lane_id_ % 32 < ValuesBlockWidth)
 	        lhs_fragment[0] = lhs_tile_[lane_id_ % ValuesBlockWidth + (step % 2) * ValuesBlockWidth];
@@ -1455,15 +1399,7 @@
 	        rhs_fragment[i] = *(dense_tile_ + base_offset + i*16); 
 	    }
 
-            unsigned char *rhs_fragment_char = reinterpret_cast<unsigned char *>(rhs_fragment); 
-            unsigned char *rhs_fragment_transpose_char = reinterpret_cast<unsigned char *>(rhs_fragment_transpose);
-
-            #pragma unroll
-	    for(int i=0; i<4; i++){
-	        for(int j=0; j<4; j++){
-	            *(rhs_fragment_transpose_char + j*4 + i) = *(rhs_fragment_char + j + i*4);
-	        }
-	    }
+            ByteTranspose4x4(rhs_fragment, rhs_fragment_transpose);
 
             if(lane_id_ % 32 < ValuesBlockWidth)
 	        lhs_fragment[0] = lhs_tile_[lane_id_ % ValuesBlockWidth];
@@ -3038,16 +2974,8 @@
 	        rhs_fragment[4+i] = *(dense_tile_ + base_offset + 8 + i*16); 
 	    }
 
-            char *rhs_fragment_char = reinterpret_cast<char *>(rhs_fragment); 
-            char *rhs_fragment_transpose_char = reinterpret_cast<char *>(rhs_fragment_transpose);
-
-            #pragma unroll
-	    for(int i=0; i<4; i++){
-	        for(int j=0; j<4; j++){
-	            *(rhs_fragment_transpose_char + j*4 + i) = *(rhs_fragment_char + j + i*4);
-	            *(rhs_fragment_transpose_char + 16 + j*4 + i) = *(rhs_fragment_char + 16 + j + i*4);
-		}
-	    }
+            ByteTranspose4x4(rhs_fragment, rhs_fragment_transpose);
+            ByteTranspose4x4(rhs_fragment + 4, rhs_fragment_transpose + 4);
             
 	    if(lane_id_ < 16){
 	        lhs_fragment[0] = lhs_tile_[lane_id_+n_group_idx*16];
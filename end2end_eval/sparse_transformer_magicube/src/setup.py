@@ -20,6 +20,22 @@ setup(
         CUDAExtension('sptrans.quantization', 
                       ['cuda/quantization.cpp', 'cuda/quantization_kernel.cu'],
                       extra_compile_args={'cxx':[], 'nvcc':['-arch=sm_80', '-lcusparse', '--ptxas-options=-v', '-lineinfo']}),
+        CppExtension('sptrans.mask_builder',
+                     ['cuda/mask_builder.cpp'],
+                     extra_compile_args=['-O3', '-fopenmp', '-pthread'],
+                     extra_link_args=['-fopenmp', '-pthread']),
+        CUDAExtension('sptrans.sparse_mlp',
+                      ['cuda/sparse_mlp.cpp', 'cuda/deq_spmm_kernel.cu', 'cuda/quantization_kernel.cu'],
+                      extra_compile_args={'cxx':['-O3', '-fopenmp'], 'nvcc':['-arch=sm_80', '-lcusparse', '--ptxas-options=-v', '-lineinfo']},
+                      extra_link_args=['-fopenmp']),
+        CppExtension('sptrans.calibration',
+                     ['cuda/calibration.cpp'],
+                     extra_compile_args=['-O3', '-fopenmp'],
+                     extra_link_args=['-fopenmp']),
+        CppExtension('sptrans.incremental_mask',
+                     ['cuda/incremental_mask.cpp'],
+                     extra_compile_args=['-O3', '-fopenmp'],
+                     extra_link_args=['-fopenmp']),
         ],
     cmdclass={'build_ext': BuildExtension},
     install_requires=['torch']
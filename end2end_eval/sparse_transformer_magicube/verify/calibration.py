@@ -0,0 +1,87 @@
+import argparse
+import torch
+from sptrans.quantization import bquantization, quantization_reference
+from sptrans.calibration import Calibrator
+
+
+parser = argparse.ArgumentParser(description='Per-head calibrated scales against torch')
+
+parser.add_argument('--batch_size', type=int, default=8, help='batch size * number of heads')
+parser.add_argument('--num_heads', type=int, default=4, help='number of heads')
+parser.add_argument('--seq_len', type=int, default=512, help='input sequence length')
+parser.add_argument('--feature', type=int, default=64, help='feature length')
+parser.add_argument('--bits', type=int, default=8, help='4 or 8')
+parser.add_argument('--percentile', type=float, default=99.9, help='percentile of the percentile method')
+
+args = parser.parse_args()
+
+qmax = 2 ** (args.bits - 1) - 1
+
+# Two batches, every head with its own spread; the second batch is wider so
+# the histograms grow their range between the observations
+spread = torch.arange(1, args.num_heads + 1, dtype=torch.float32).repeat(args.batch_size // args.num_heads)
+batches = [torch.randn(args.batch_size, args.seq_len, args.feature) * spread.view(-1, 1, 1) * growth
+           for growth in (1.0, 3.0)]
+batches = [b.half().cuda() for b in batches]
+
+
+def head_magnitudes(h):
+    # Batch entry i is head i % num_heads
+    return torch.cat([b[h::args.num_heads].float().abs().reshape(-1).cpu() for b in batches])
+
+
+def calibrate(method):
+    calibrator = Calibrator(args.bits, method, "head", args.num_heads, args.percentile)
+    for b in batches:
+        calibrator.observe(b)
+    scales = calibrator.scales()
+    assert scales.shape == (args.num_heads, 1), scales.shape
+    return scales.view(-1)
+
+
+def quantization_error(values, threshold):
+    # The kernels' clamp-and-truncate quantization at scale qmax / threshold
+    scale = qmax / threshold
+    q = torch.clamp(torch.trunc(values * scale), -qmax - 1, qmax) / scale
+    return float(((values - q) ** 2).sum())
+
+
+ok = True
+
+absmax = calibrate("absmax")
+percentile = calibrate("percentile")
+mse = calibrate("mse")
+for h in range(args.num_heads):
+    values = head_magnitudes(h)
+    top = float(values.max())
+    # absmax is exact; the percentile comes from a 1024 bin histogram whose
+    # range is at most twice the maximum
+    expected = qmax / top
+    ok_absmax = abs(float(absmax[h]) - expected) <= 1e-5 * expected
+    target = float(torch.quantile(values, args.percentile / 100.0))
+    ok_percentile = abs(qmax / float(percentile[h]) - target) <= 2.0 * top / 1024
+    # mse minimizes the error of the binned magnitudes, so it has to be at
+    # least as good as absmax on the data up to the binning
+    ok_mse = quantization_error(values, qmax / float(mse[h])) <= 1.01 * quantization_error(values, top)
+    print("head %d  absmax %s  percentile %s  mse %s  scales %.4f %.4f %.4f" %
+          (h, ok_absmax, ok_percentile, ok_mse, absmax[h], percentile[h], mse[h]))
+    ok &= ok_absmax and ok_percentile and ok_mse
+
+# The calibrated per-head scales drive bquantization like any scale tensor
+x = batches[0]
+for name, scales in (("absmax", absmax), ("mse", mse)):
+    scales = scales.view(-1, 1)
+    exact = torch.equal(bquantization(x, args.bits, scales.cuda()).cpu(), quantization_reference(x, args.bits, scales))
+    print("%-8s bquantization with calibrated scales == host reference: %s" % (name, exact))
+    ok &= exact
+
+# Only the precisions of the quantization kernels
+for bits in (2, 16):
+    try:
+        Calibrator(bits)
+        print("bits %d accepted: False" % bits)
+        ok = False
+    except RuntimeError as e:
+        print("bits %d rejected: %s" % (bits, str(e).splitlines()[0]))
+
+print("PASSED" if ok else "FAILED")
@@ -0,0 +1,105 @@
+import argparse
+import torch
+import numpy as np
+from sptrans.incremental_mask import IncrementalMask
+from sptrans.mask_builder import aligned_mask_from_csr, masked_bsddmm_cpu, masked_bspmm_cpu
+
+
+parser = argparse.ArgumentParser(description='Incremental mask check')
+
+parser.add_argument('--prompt_len', type=int, default=256, help='tokens of the prompt, a multiple of vec_length')
+parser.add_argument('--new_tokens', type=int, default=128, help='tokens generated one by one')
+parser.add_argument('--vec_length', type=int, default=8, help='vector length')
+parser.add_argument('--window', type=int, default=64, help='local attention window')
+parser.add_argument('--stride', type=int, default=16, help='stride of the global columns')
+parser.add_argument('--mma_k_dim', type=int, default=16, help='8, 16 or 32')
+parser.add_argument('--batch_size', type=int, default=4, help='batch size * number of heads')
+parser.add_argument('--head_dim', type=int, default=64, help='head dimension')
+
+args = parser.parse_args()
+
+
+def row_columns(row, seq_len):
+    # Causal local window of every query of a row of vectors plus strided
+    # global columns
+    first, last = row * args.vec_length, min((row + 1) * args.vec_length, seq_len) - 1
+    return [c for c in range(last + 1) if first - c < args.window or c % args.stride == 0]
+
+
+def csr(num_rows, seq_len):
+    rows = [row_columns(r, seq_len) for r in range(num_rows)]
+    offsets = np.cumsum([0] + [len(r) for r in rows])
+    return torch.tensor(offsets, dtype=torch.int64), torch.tensor(sum(rows, []), dtype=torch.int32)
+
+
+def same_rows(mask, reference):
+    # Row by row, since the incremental layout leaves gaps between rows
+    columns, shuffle, offsets, _ = mask.tensors()
+    ref_columns, ref_shuffle, ref_offsets, _, _ = reference
+    for r in range(mask.num_rows()):
+        b, e = offsets[2 * r].item(), offsets[2 * r + 1].item()
+        rb, re = ref_offsets[2 * r].item(), ref_offsets[2 * r + 1].item()
+        if not torch.equal(columns[b:e], ref_columns[rb:re]):
+            return False
+        padded = (e - b + args.mma_k_dim - 1) // args.mma_k_dim * args.mma_k_dim
+        if not torch.equal(shuffle[b:b + padded], ref_shuffle[rb:rb + padded]):
+            return False
+    return True
+
+
+# Prefill with the prompt, then append one token at a time: the key column
+# goes to the rows that attend it and every vec_length tokens a row starts
+mask = IncrementalMask(args.mma_k_dim, args.window + args.stride, args.prompt_len // args.vec_length)
+mask.extend(*csr(args.prompt_len // args.vec_length, args.prompt_len))
+for t in range(args.prompt_len, args.prompt_len + args.new_tokens):
+    if t % args.vec_length == 0:
+        mask.append_row(torch.tensor(row_columns(t // args.vec_length, t + 1), dtype=torch.int32))
+    else:
+        row = t // args.vec_length
+        have = mask.nnz(row)
+        new = row_columns(row, t + 1)[have:]
+        mask.append(row, torch.tensor(new, dtype=torch.int32))
+    # Rows before the current one never change in a causal mask
+    mask.device_tensors(torch.device('cuda'))
+
+seq_len = args.prompt_len + args.new_tokens
+num_rows = (seq_len + args.vec_length - 1) // args.vec_length
+reference = aligned_mask_from_csr(*csr(num_rows, seq_len), args.mma_k_dim)
+ok = mask.num_rows() == num_rows and same_rows(mask, reference)
+print("incremental mask == rebuilt mask: %s (row capacity %d, max rows %d)" % (ok, mask.row_capacity(), mask.max_rows()))
+
+device = mask.device_tensors(torch.device('cuda'))
+synced = all(torch.equal(d.cpu(), h) for d, h in zip(device, mask.tensors()))
+print("device copy up to date: %s" % synced)
+ok &= synced
+
+# Single-row step of the last row against the full mask references
+row = num_rows - 1
+lanes = seq_len - row * args.vec_length
+q = torch.randn(args.batch_size, num_rows * args.vec_length, args.head_dim)
+k = torch.randn(args.batch_size, seq_len, args.head_dim)
+v = torch.randn(args.batch_size, seq_len, args.head_dim)
+columns, _, offsets, _ = mask.tensors()
+# The references run the first entry alone
+offsets = offsets.view(1, -1)
+batch_offsets = torch.zeros(2, dtype=torch.int32)
+
+b, e = offsets[0, 2 * row].item(), offsets[0, 2 * row + 1].item()
+scores = mask.sddmm_row_cpu(row, q[:, row * args.vec_length:row * args.vec_length + lanes], k)
+reference = masked_bsddmm_cpu(offsets, columns, batch_offsets, q[:1], k[:1], args.vec_length)
+reference = reference.view(-1, args.vec_length)[b:e, :lanes]
+scores_ok = torch.allclose(scores[0], reference, atol=1e-4)
+print("sddmm_row_cpu == masked_bsddmm_cpu: %s" % scores_ok)
+ok &= scores_ok
+
+probs = torch.softmax(scores, dim=1)
+out = mask.spmm_row_cpu(row, probs, v)
+values = torch.zeros(columns.numel(), args.vec_length)
+values[b:e, :lanes] = probs[0]
+reference = masked_bspmm_cpu(offsets, columns, batch_offsets, values, v[:1])
+reference = reference[0, row * args.vec_length:row * args.vec_length + lanes]
+out_ok = torch.allclose(out[0], reference, atol=1e-4)
+print("spmm_row_cpu == masked_bspmm_cpu: %s" % out_ok)
+ok &= out_ok
+
+print("PASSED" if ok else "FAILED")
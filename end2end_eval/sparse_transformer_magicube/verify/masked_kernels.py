@@ -0,0 +1,101 @@
+import argparse
+import torch
+import numpy as np
+from sptrans.quantization import bquantization
+from sptrans.deq_sddmm import bsddmm_4b_masks, bsddmm_8b_masks
+from sptrans.deq_spmm import bspmm_4b_masks, bspmm_8b_masks, bspmm_8b4b_masks
+from sptrans.mask_builder import pack_dense_masks, masked_bsddmm_cpu, masked_bspmm_cpu, verify_half
+
+
+parser = argparse.ArgumentParser(description='Batched SpMM / SDDMM with a mask per entry against the CPU references')
+
+parser.add_argument('--batch_size', type=int, default=4, help='batch size * number of heads')
+parser.add_argument('--seq_len', type=int, default=512, help='input sequence length')
+parser.add_argument('--head_dim', type=int, default=64, help='head dimension')
+parser.add_argument('--vec_length', type=int, default=8, help='vector length')
+parser.add_argument('--lhs_pre', type=int, default=8, help='bits of the SpMM values, 4 or 8')
+parser.add_argument('--rhs_pre', type=int, default=8, help='bits of q, k and v, 4 or 8')
+parser.add_argument('--scale', type=float, default=7.0, help='quantization scale of every operand')
+
+args = parser.parse_args()
+
+m = args.seq_len // args.vec_length
+n = args.seq_len
+mma_k_dim = 32 if args.rhs_pre == 4 else 16
+
+
+def quantize(x, bits):
+    # bquantization of a non-negative tensor: the kernels multiply through
+    # u8 / u4 mma, so the operands are kept in [0, qmax]
+    qmax = 2 ** (bits - 1) - 1
+    return torch.trunc(torch.clamp(x.float() * args.scale, 0, qmax))
+
+
+def pack_values(q, bits):
+    # Layout of q_csr_softmax (and sparse_mlp.cpp pack_values) for the
+    # {num_item, vec_length} quantized values, p the packed vector position:
+    #   8 bits  byte (p / 16) * V * 16 + v * 16 + p % 16
+    #   4 bits  nibble p % 2 of byte (p / 32) * V * 16 + v * 16 + (p % 32) / 2
+    q = q.to(torch.int32).numpy()
+    num_item, V = q.shape
+    group = 32 if bits == 4 else 16
+    q = q.reshape(num_item // group, group, V).transpose(0, 2, 1)
+    if bits == 8:
+        packed = q.astype(np.uint8)
+    else:
+        packed = (q[..., 0::2] | (q[..., 1::2] << 4)).astype(np.uint8)
+    return torch.from_numpy(np.ascontiguousarray(packed).reshape(-1).view(np.int32).copy()).cuda()
+
+
+def dequantize(acc, scale):
+    # What the kernels store: __float2half(acc / scale) of the int32
+    # accumulator, exact in float below 2^24
+    return (acc.float() / torch.tensor(scale, dtype=torch.float32)).half()
+
+
+# A different mask per entry, with a different density each
+density = torch.linspace(0.05, 0.3, args.batch_size).view(-1, 1, 1)
+masks = torch.rand(args.batch_size, m, n) < density
+columns, _, row_offsets, row_indices, batch_offsets = pack_dense_masks(masks, mma_k_dim)
+valid = columns >= 0
+print("%d entries, %s vectors per mask" % (args.batch_size, (batch_offsets[1:] - batch_offsets[:-1]).tolist()))
+device_mask = [t.cuda() for t in (row_indices, row_offsets, columns, batch_offsets)]
+
+ok = True
+
+# SDDMM: q {batch, m * V, head_dim}, k {batch, n, head_dim}
+q = torch.rand(args.batch_size, m * args.vec_length, args.head_dim, dtype=torch.float16, device='cuda')
+k = torch.rand(args.batch_size, n, args.head_dim, dtype=torch.float16, device='cuda')
+bsddmm = bsddmm_4b_masks if args.rhs_pre == 4 else bsddmm_8b_masks
+scores = bsddmm(*device_mask, bquantization(q, args.rhs_pre, args.scale), bquantization(k, args.rhs_pre, args.scale),
+                args.vec_length, args.rhs_pre, args.scale * args.scale)
+reference = dequantize(masked_bsddmm_cpu(row_offsets, columns, batch_offsets, quantize(q.cpu(), args.rhs_pre),
+                                          quantize(k.cpu(), args.rhs_pre), args.vec_length), args.scale * args.scale)
+# Only the slots of real columns, the kernels leave the padding undefined;
+# a thread block computes 64 vectors
+slots = valid.repeat_interleave(args.vec_length)
+ok &= verify_half(scores.cpu()[slots], reference[slots], int(valid.sum()), 64, args.vec_length, 1, "bsddmm") == 0
+
+# SpMM: values {num_item, V} on the packed masks, v {batch, n, head_dim}
+values = quantize(torch.rand(columns.numel(), args.vec_length), args.lhs_pre) * valid.view(-1, 1)
+v = torch.rand(args.batch_size, n, args.head_dim, dtype=torch.float16, device='cuda')
+if args.lhs_pre == 4:
+    bspmm = bspmm_4b_masks
+else:
+    bspmm = bspmm_8b4b_masks if args.rhs_pre == 4 else bspmm_8b_masks
+out = bspmm(*device_mask, pack_values(values, args.lhs_pre), bquantization(v, args.rhs_pre, args.scale),
+            args.vec_length, args.lhs_pre, args.rhs_pre, args.scale * args.scale)
+reference = dequantize(masked_bspmm_cpu(row_offsets, columns, batch_offsets, values, quantize(v.cpu(), args.rhs_pre)),
+                       args.scale * args.scale)
+ok &= verify_half(out, reference, args.batch_size * m * args.vec_length, args.vec_length, args.head_dim, 1, "bspmm") == 0
+
+# The validation of the mask tensors
+try:
+    bspmm(*device_mask[:3], device_mask[3][:-1], pack_values(values, args.lhs_pre), bquantization(v, args.rhs_pre, args.scale),
+          args.vec_length, args.lhs_pre, args.rhs_pre, args.scale * args.scale)
+    print("short batch_offsets accepted: False")
+    ok = False
+except RuntimeError as e:
+    print("short batch_offsets rejected: %s" % str(e).splitlines()[0])
+
+print("PASSED" if ok else "FAILED")
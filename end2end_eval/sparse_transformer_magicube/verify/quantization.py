@@ -0,0 +1,89 @@
+import argparse
+import torch
+import numpy as np
+from sptrans.quantization import bquantization, quantization_reference
+from sptrans.deq_spmm import byte_transpose_4x4
+
+
+parser = argparse.ArgumentParser(description='Quantization kernel and rhs layout check')
+
+parser.add_argument('--batch_size', type=int, default=8, help='batch size')
+parser.add_argument('--num_heads', type=int, default=4, help='number of per-head scale groups')
+parser.add_argument('--seq_len', type=int, default=512, help='input sequence length')
+parser.add_argument('--feature', type=int, default=64, help='feature length')
+parser.add_argument('--bits', type=int, default=8, help='4 or 8')
+parser.add_argument('--scale', type=float, default=36.0, help='scalar quantization scale')
+
+args = parser.parse_args()
+
+items = 32 // args.bits
+qmax = 2 ** (args.bits - 1) - 1
+
+x = torch.randn(size=(args.batch_size, args.seq_len, args.feature), dtype=torch.float16, device='cuda')
+
+
+def unpack(packed, bits):
+    # Column c of a row is at bits (c % items) * bits of int c // items
+    words = packed.cpu().numpy().view(np.uint32)
+    shifts = np.arange(32 // bits, dtype=np.uint32) * bits
+    values = (words[..., None] >> shifts) & ((1 << bits) - 1)
+    values = values.reshape(words.shape[:-1] + (-1,)).astype(np.int32)
+    return np.where(values > (1 << (bits - 1)) - 1, values - (1 << bits), values)
+
+
+def dense_reference(x, scales):
+    # clamp(x * scale) truncated toward zero, scales broadcast as {groups, channels}
+    groups = scales.size(0)
+    s = scales.cpu().repeat(args.batch_size // groups, 1).reshape(args.batch_size, 1, -1)
+    q = torch.clamp(x.float().cpu() * s, -qmax - 1, qmax)
+    return torch.trunc(q).to(torch.int32).numpy()
+
+
+def check(name, packed, reference, scales):
+    exact = torch.equal(packed.cpu(), reference)
+    layout = np.array_equal(unpack(packed, args.bits), dense_reference(x, scales))
+    print("%-12s kernel == host reference: %s, unpacked == dense reference: %s" % (name, exact, layout))
+    return exact and layout
+
+
+ok = True
+
+# Scalar scale
+scales = torch.full((1, 1), args.scale, dtype=torch.float32)
+ok &= check("per-tensor", bquantization(x, args.bits, args.scale), quantization_reference(x, args.bits, args.scale), scales)
+
+# Per-head and per-channel scale tensors
+scales = torch.rand(args.num_heads, 1, dtype=torch.float32) * args.scale + 1.0
+ok &= check("per-head", bquantization(x, args.bits, scales.cuda()), quantization_reference(x, args.bits, scales), scales)
+scales = torch.rand(1, args.feature, dtype=torch.float32) * args.scale + 1.0
+ok &= check("per-channel", bquantization(x, args.bits, scales.cuda()), quantization_reference(x, args.bits, scales), scales)
+
+# The 8-bit SpMM compute stage gathers four packed rhs rows picked by the
+# sparse column indices and transposes their bytes with ByteTranspose4x4
+# (compute_utils.h). Its PRMT selectors against the byte loop they replaced:
+#   out_bytes[j * 4 + i] = in_bytes[j + i * 4]
+def byte_loop_transpose(groups):
+    in_bytes = groups.view(np.uint8).reshape(-1, 16)
+    out_bytes = np.empty_like(in_bytes)
+    for i in range(4):
+        for j in range(4):
+            out_bytes[:, j * 4 + i] = in_bytes[:, j + i * 4]
+    return out_bytes.view(np.int32).reshape(-1)
+
+
+# Every byte position distinct, random words, and gathered rows of the
+# quantized rhs as the kernel loads them
+identity = np.arange(16, dtype=np.uint8).view(np.int32)
+random_words = np.random.randint(-2 ** 31, 2 ** 31, size=4 * 4096, dtype=np.int64).astype(np.int32)
+packed = bquantization(x, 8, args.scale).cpu().numpy()
+rows = np.random.randint(args.seq_len, size=(1024, 4))
+words = np.random.randint(packed.shape[-1], size=(1024, 1))
+gathered = packed[np.random.randint(args.batch_size, size=(1024, 1)), rows, words].reshape(-1)
+for name, groups in (("identity", identity), ("random", random_words), ("gathered", gathered)):
+    groups = np.ascontiguousarray(groups, dtype=np.int32)
+    prmt = byte_transpose_4x4(torch.from_numpy(groups).cuda()).cpu().numpy()
+    same = np.array_equal(prmt, byte_loop_transpose(groups))
+    print("%-12s ByteTranspose4x4 == byte loop (%s): %s" % ("rhs layout", name, same))
+    ok &= same
+
+print("PASSED" if ok else "FAILED")
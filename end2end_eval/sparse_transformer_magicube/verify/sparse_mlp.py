@@ -0,0 +1,56 @@
+import argparse
+import sys
+import os
+import torch
+import torch.nn as nn
+
+sys.path.append(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+from sparse_mlp import SparseMLP, prune_vectors
+
+
+parser = argparse.ArgumentParser(description='Sparse MLP executor check')
+
+parser.add_argument('--tokens', type=int, default=512, help='number of tokens, a multiple of 64')
+parser.add_argument('--embed_dim', type=int, default=256, help='embedding dimension')
+parser.add_argument('--hidden_dim', type=int, default=1024, help='hidden dimension')
+parser.add_argument('--vec_length', type=int, default=8, help='vector length of the sparsity pattern')
+parser.add_argument('--sparsity', type=float, default=0.9, help='vector sparsity of the weights')
+parser.add_argument('--lhs_pre', type=int, default=8, help='weight precision')
+parser.add_argument('--rhs_pre', type=int, default=8, help='activation precision')
+parser.add_argument('--activation', type=str, default='relu,gelu', help='comma separated list of none, relu and gelu')
+
+args = parser.parse_args()
+
+# Signed weights and inputs: the executor splits them into positive and
+# negative parts for the u8 / u4 mma. A relu hidden layer feeds the second
+# layer non-negative inputs, which are not split; gelu and none are.
+dense_tolerance = 0.1 if min(args.lhs_pre, args.rhs_pre) >= 8 else 0.4
+passed = True
+for activation in args.activation.split(','):
+    linear1 = nn.Linear(args.embed_dim, args.hidden_dim)
+    linear2 = nn.Linear(args.hidden_dim, args.embed_dim)
+    for linear in (linear1, linear2):
+        with torch.no_grad():
+            linear.weight.normal_(0, linear.in_features ** -0.5)
+            linear.bias.normal_(0, 0.1)
+        prune_vectors(linear, args.sparsity, args.vec_length)
+
+    mlp = SparseMLP([linear1, linear2], [activation, 'none'], args.vec_length, args.lhs_pre, args.rhs_pre).cuda().half()
+
+    x = torch.randn(size=(args.tokens, args.embed_dim), dtype=torch.float16, device='cuda')
+
+    out = mlp(x)
+    out_cpu = mlp.forward_cpu(x)
+    dense = linear2(getattr(torch.nn.functional, activation, lambda h: h)(linear1(x)))
+
+    print("%s: max |forward - forward_cpu| = %f" % (activation, (out.float().cpu() - out_cpu).abs().max().item()))
+    print("%s: max |forward - dense| / max |dense| = %f" % (activation, ((out - dense).abs().max() / dense.abs().max()).item()))
+    print("%s: arena bytes: %d" % (activation, mlp.executor.arena_bytes()))
+
+    # fp16 rounding of the accumulator between the layers
+    tolerance = 1e-2 * out_cpu.abs().max().item()
+    passed &= torch.allclose(out.float().cpu(), out_cpu, atol=tolerance)
+    # The quantized chain must also follow the signed float chain
+    passed &= ((out - dense).abs().max() / dense.abs().max()).item() < dense_tolerance
+
+print("PASSED" if passed else "FAILED")
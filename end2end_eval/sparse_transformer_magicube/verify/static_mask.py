@@ -27,51 +27,21 @@ def static_random_mask(m, n, sparsity):
 
 
 def static_random_mask_aligned(m, n, sparsity, mma_k_dim):
+    # The padding, the 8-wide shuffle and the row sort are done by the
+    # multithreaded sptrans.mask_builder extension
+    from sptrans.mask_builder import aligned_mask_from_csr
 
     csr_mask = random(m=m, n=n, density = 1. - sparsity, format='csr')
-    column_indices = csr_mask.indices
-    row_offsets = csr_mask.indptr
-
-    aligned_num_item = 0
-    aligned_row_offsets = np.zeros(m*2, dtype='int32')
-    aligned_row_offsets[0] = aligned_num_item
-    for i in range(1, m+1):
-        num_item = row_offsets[i] - row_offsets[i-1]
-        aligned_num_item += int((num_item + mma_k_dim - 1) / mma_k_dim) * mma_k_dim
-        if i != m:
-            aligned_row_offsets[i*2] = aligned_num_item
-        aligned_row_offsets[i*2-1] = aligned_row_offsets[i*2-2] + num_item
-
-    row_length = []
+    column_indices = torch.from_numpy(csr_mask.indices.astype(np.int32))
+    row_offsets = torch.from_numpy(csr_mask.indptr.astype(np.int64))
 
-    for i in range(m):
-        row_length.append(row_offsets[i+1] - row_offsets[i])
+    column_indices, column_indices_shuffle, row_offsets, row_indices, aligned_num_item = \
+        aligned_mask_from_csr(row_offsets, column_indices, mma_k_dim)
 
-    row_indices = np.argsort(row_length)
-
-    aligned_col_indices = np.zeros(aligned_num_item, dtype='int32')
-    aligned_col_indices_shuffle = np.zeros(aligned_num_item, dtype='int32')
-
-    for i in range(aligned_num_item):
-        aligned_col_indices[i] = -1
-        aligned_col_indices_shuffle[i] = -1
-
-    for i in range(1, m+1):
-        offset_begin = row_offsets[i-1]
-        offset_end = row_offsets[i]
-        for j in range(offset_begin, offset_end):
-            aligned_col_indices[aligned_row_offsets[(i-1)*2] + j - offset_begin] = column_indices[j]
-
-    chunks = int(aligned_num_item/8)
-
-    for i in range(chunks):
-        for j in range(8):
-            aligned_col_indices_shuffle[i*8 + (j%2)*4 + int(j/2)] = aligned_col_indices[i*8 + j]
-
-    column_indices = torch.tensor(aligned_col_indices, dtype=torch.int32, device='cuda')
-    column_indices_shuffle = torch.tensor(aligned_col_indices_shuffle, dtype=torch.int32, device='cuda')
-    row_offsets = torch.tensor(aligned_row_offsets, dtype=torch.int32, device='cuda')
-    row_indices = torch.tensor(row_indices, dtype=torch.int32, device='cuda')
+    column_indices = column_indices.cuda()
+    column_indices_shuffle = column_indices_shuffle.cuda()
+    row_offsets = row_offsets.cuda()
+    row_indices = row_indices.cuda()
 
     return column_indices, column_indices_shuffle, row_offsets, row_indices, aligned_num_item
 